@@ -0,0 +1,111 @@
+//
+// Compares the branch condition evaluation against the unordered_map of std::function it replaced.
+//
+
+#include "../system/Flags.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+// The previous implementation, kept verbatim apart from indexing with the condition bits
+bool legacy_branch(instruction_t &opcode, status_register_t &status)
+{
+    using std::function;
+    using std::unordered_map;
+    static unordered_map<int, function<bool(status_register_t)>> branchingInstructions;
+    if (branchingInstructions.empty())
+    {
+        branchingInstructions[0] = [&](status_register_t status) -> bool
+        { return !status.N; };
+        branchingInstructions[1] = [&](status_register_t status) -> bool
+        { return status.N; };
+        branchingInstructions[2] = [&](status_register_t status) -> bool
+        { return !status.V; };
+        branchingInstructions[3] = [&](status_register_t status) -> bool
+        { return status.V; };
+        branchingInstructions[4] = [&](status_register_t status) -> bool
+        { return !status.C; };
+        branchingInstructions[5] = [&](status_register_t status) -> bool
+        { return status.C; };
+        branchingInstructions[6] = [&](status_register_t status) -> bool
+        { return !status.Z; };
+        branchingInstructions[7] = [&](status_register_t status) -> bool
+        { return status.Z; };
+    }
+    return branchingInstructions[opcode._a](status);
+}
+
+const int samples = 1 << 16;
+const int rounds = 500;
+
+struct sample
+{
+    uint8_t opcode;
+    uint8_t p;
+};
+
+template <typename Condition>
+double measure(const std::vector<sample> &input, Condition condition, uint64_t &taken)
+{
+    taken = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (const sample &s : input)
+        {
+            taken += condition(s);
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / (double(samples) * rounds);
+}
+}
+
+int main()
+{
+    // Every condition against every status byte first
+    for (int opcode = 0x10; opcode < 0x100; opcode += 0x20)
+    {
+        for (int p = 0; p < 256; p++)
+        {
+            instruction_t instruction;
+            instruction._instruction = opcode;
+            status_register_t status;
+            status.value = p;
+            if (legacy_branch(instruction, status) != flags::branch_taken(opcode, p))
+            {
+                std::printf("mismatch for opcode %02X with P=%02X\n", opcode, p);
+                return 1;
+            }
+        }
+    }
+
+    std::mt19937 rng(6502);
+    std::vector<sample> input(samples);
+    for (sample &s : input)
+    {
+        s.opcode = 0x10 | ((rng() & 7) << 5);
+        s.p = rng();
+    }
+
+    uint64_t legacyTaken, tableTaken;
+    const double legacy = measure(input, [](const sample &s)
+                                  {
+                                      instruction_t instruction;
+                                      instruction._instruction = s.opcode;
+                                      status_register_t status;
+                                      status.value = s.p;
+                                      return legacy_branch(instruction, status); },
+                                  legacyTaken);
+    const double bits = measure(input, [](const sample &s)
+                                { return flags::branch_taken(s.opcode, s.p); },
+                                tableTaken);
+    std::printf("unordered_map + std::function %6.2f ns/branch\n", legacy);
+    std::printf("opcode bits                   %6.2f ns/branch\n", bits);
+    return legacyTaken == tableTaken ? 0 : 1;
+}
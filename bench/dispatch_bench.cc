@@ -0,0 +1,135 @@
+//
+// Runs the same instruction trace through the table, threaded, block cache and JIT dispatch
+// backends, checks that they all end in the same state and reports their throughput.
+// Without NESACOLA_JIT the JIT row runs the block cache.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Mixed loads, stores, ALU, shifts, a subroutine call and a branch, looping forever from $8000
+const uint8_t program[] = {
+    0xA2, 0x00,       // $8000 LDX #$00
+    0xBD, 0x00, 0x03, // $8002 LDA $0300,X
+    0x69, 0x13,       // $8005 ADC #$13
+    0x9D, 0x00, 0x04, // $8007 STA $0400,X
+    0x45, 0x10,       // $800A EOR $10
+    0x85, 0x10,       // $800C STA $10
+    0x0A,             // $800E ASL A
+    0x26, 0x11,       // $800F ROL $11
+    0x20, 0x1C, 0x80, // $8011 JSR $801C
+    0xE8,             // $8014 INX
+    0xD0, 0xEB,       // $8015 BNE $8002
+    0xE6, 0x12,       // $8017 INC $12
+    0x4C, 0x00, 0x80, // $8019 JMP $8000
+    0xA4, 0x12,       // $801C LDY $12
+    0xC9, 0x80,       // $801E CMP #$80
+    0x60,             // $8020 RTS
+};
+
+const uint32_t instructions = 50000000;
+const uint32_t batch = 10000;
+
+struct result
+{
+    double seconds;
+    uint64_t cycles;
+    registers_t registers;
+    uint8_t memory[0x800];
+};
+
+// The program and the reset vector in a 32KB PRG image at $8000
+std::vector<uint8_t> make_rom()
+{
+    std::vector<uint8_t> rom(0x8000);
+    std::memcpy(rom.data(), program, sizeof(program));
+    rom[0x7FFC] = 0x00;
+    rom[0x7FFD] = 0x80;
+    return rom;
+}
+
+void load(MMU &bus, std::vector<uint8_t> &rom)
+{
+    bus.map_memory(0x8000, rom.size(), rom.data(), false);
+}
+
+void load(TestBus &bus, const std::vector<uint8_t> &rom)
+{
+    bus.load(0x8000, rom.data(), rom.size());
+}
+
+template <class Bus, typename Backend>
+result run(Backend backend)
+{
+    static std::vector<uint8_t> rom = make_rom();
+    Bus bus;
+    load(bus, rom);
+    CPU<Bus> cpu(&bus);
+    cpu.reset();
+    result r{};
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t executed = 0; executed < instructions; executed += batch)
+    {
+        r.cycles += backend(cpu, batch);
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.registers = cpu.getRegisters();
+    for (uint16_t i = 0; i < 0x800; i++)
+    {
+        r.memory[i] = bus.read(i);
+    }
+    return r;
+}
+
+void report(const char *name, const result &r)
+{
+    std::printf("%-16s %8.2f M instructions/s %8.2f M cycles/s\n", name,
+                instructions / r.seconds / 1e6, r.cycles / r.seconds / 1e6);
+}
+
+bool identical(const result &x, const result &y)
+{
+    const registers_t &a = x.registers;
+    const registers_t &b = y.registers;
+    return x.cycles == y.cycles && a.PC.value == b.PC.value && a.SP == b.SP && a.sr == b.sr &&
+           a.AC == b.AC && a.X == b.X && a.Y == b.Y && std::memcmp(x.memory, y.memory, sizeof(x.memory)) == 0;
+}
+
+template <class Bus>
+bool compare(const char *bus)
+{
+    const result table = run<Bus>([](CPU<Bus> &cpu, uint32_t count)
+                                  { return cpu.execute_table(UINT32_MAX, count); });
+    const result threaded = run<Bus>([](CPU<Bus> &cpu, uint32_t count)
+                                     { return cpu.execute_threaded(UINT32_MAX, count); });
+    const result cached = run<Bus>([](CPU<Bus> &cpu, uint32_t count)
+                                   { return cpu.execute_cached(UINT32_MAX, count); });
+    const result jit = run<Bus>([](CPU<Bus> &cpu, uint32_t count)
+                                { return cpu.execute_jit(UINT32_MAX, count); });
+    const std::string name(bus);
+    report((name + " table").c_str(), table);
+    report((name + " threaded").c_str(), threaded);
+    report((name + " cached").c_str(), cached);
+    report((name + " jit").c_str(), jit);
+    if (!identical(table, threaded) || !identical(table, cached) || !identical(table, jit))
+    {
+        std::printf("%s: backends diverged\n", bus);
+        return false;
+    }
+    return true;
+}
+}
+
+int main()
+{
+    const bool mmu = compare<MMU>("MMU");
+    const bool flat = compare<TestBus>("TestBus");
+    return mmu && flat ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+//
+// Runs the dispatch benchmark's program on 16 lanes of the lockstep core and on 16 scalar
+// CPUs one after another, checks that every lane ends in the state of its scalar CPU and
+// reports the aggregate throughput of both and the share of vector steps. The lanes start
+// with different RAM, so the loop's loads differ while its control flow stays the same.
+//
+
+#include "../system/CPU.h"
+#include "../system/Lockstep.h"
+#include "../system/TestBus.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+const int lanes = 16;
+const uint32_t cycles_per_lane = 20000000;
+const uint32_t slice = 100000;
+
+const uint8_t program[] = {
+    0xA2, 0x00,       // $8000 LDX #$00
+    0xBD, 0x00, 0x03, // $8002 LDA $0300,X
+    0x69, 0x13,       // $8005 ADC #$13
+    0x9D, 0x00, 0x04, // $8007 STA $0400,X
+    0x45, 0x10,       // $800A EOR $10
+    0x85, 0x10,       // $800C STA $10
+    0x0A,             // $800E ASL A
+    0x26, 0x11,       // $800F ROL $11
+    0x20, 0x1C, 0x80, // $8011 JSR $801C
+    0xE8,             // $8014 INX
+    0xD0, 0xEB,       // $8015 BNE $8002
+    0xE6, 0x12,       // $8017 INC $12
+    0x4C, 0x00, 0x80, // $8019 JMP $8000
+    0xA4, 0x12,       // $801C LDY $12
+    0xC9, 0x80,       // $801E CMP #$80
+    0x60,             // $8020 RTS
+};
+
+uint8_t seed_byte(int lane, uint16_t address)
+{
+    return uint8_t(address * 37 + lane * 101 + (address >> 3));
+}
+}
+
+int main()
+{
+    std::vector<uint8_t> rom(0x8000);
+    std::memcpy(rom.data(), program, sizeof(program));
+    rom[0x7FFC] = 0x00;
+    rom[0x7FFD] = 0x80;
+
+    std::unique_ptr<Lockstep<lanes>> lockstep(new Lockstep<lanes>(rom.data(), rom.size()));
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        for (uint16_t address = 0; address < 0x800; address++)
+        {
+            lockstep->write(lane, address, seed_byte(lane, address));
+        }
+    }
+    lockstep->reset();
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t spent = 0; spent < cycles_per_lane; spent += slice)
+    {
+        lockstep->run_for(slice);
+    }
+    const double vectorSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t steps = lockstep->getVectorSteps() * lanes + lockstep->getScalarSteps();
+
+    static TestBus bus;
+    bool identical = true;
+    double scalarSeconds = 0;
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        bus.load(0x8000, rom.data(), rom.size());
+        for (uint16_t address = 0; address < 0x800; address++)
+        {
+            const uint8_t byte = seed_byte(lane, address);
+            bus.load(address, &byte, 1);
+        }
+        CPU<TestBus> cpu(&bus);
+        cpu.reset();
+        uint64_t cycles = 0;
+        start = std::chrono::steady_clock::now();
+        while (cycles < lockstep->getCycles(lane))
+        {
+            cycles += cpu.execute_table(uint32_t(lockstep->getCycles(lane) - cycles), UINT32_MAX);
+        }
+        scalarSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const registers_t a = cpu.getRegisters();
+        const registers_t b = lockstep->getRegisters(lane);
+        identical &= cycles == lockstep->getCycles(lane) && a.PC.value == b.PC.value && a.AC == b.AC &&
+                     a.X == b.X && a.Y == b.Y && a.SP == b.SP && a.sr == b.sr;
+        for (uint16_t address = 0; address < 0x800; address++)
+        {
+            identical &= bus.read(address) == lockstep->read(lane, address);
+        }
+    }
+
+    std::printf("lockstep x%d %8.2f M instructions/s, %.1f%% of steps vectorized\n", lanes,
+                steps / vectorSeconds / 1e6,
+                100.0 * lockstep->getVectorSteps() / (lockstep->getVectorSteps() + lockstep->getScalarSteps()));
+    // Both ran the same instructions
+    std::printf("scalar   x%d %8.2f M instructions/s\n", lanes, steps / scalarSeconds / 1e6);
+    if (!identical)
+    {
+        std::printf("lanes diverged from the scalar CPU\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+//
+// Time per instruction for each of the 151 documented opcodes, through the backend the build
+// selects, on a flat TestBus. Each opcode runs from a page of copies of itself ending in a jump
+// back, control flow opcodes loop on themselves: JMP and JSR to their own address, BRK through
+// a vector pointing at it, RTS and RTI returning to it from a stack filled with $80.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include "../system/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace
+{
+const uint32_t instructions = 2000000;
+const uint32_t batch = 100000;
+const uint16_t code = 0x8000;
+const uint16_t code_end = 0x8FF0;
+
+struct result
+{
+    uint8_t opcode;
+    // As it was run
+    char text[24];
+    double ns;
+    double cycles;
+};
+
+// Memory for one opcode, returns where it starts
+uint16_t setup(TestBus &bus, uint8_t opcode)
+{
+    // Zero page pointers all lead to $0303, the stack holds $80s and JMP ($0200) goes to $8000
+    std::vector<uint8_t> page(0x100, 0x03);
+    bus.load(0x0000, page.data(), page.size());
+    std::fill(page.begin(), page.end(), 0x80);
+    bus.load(0x0100, page.data(), page.size());
+    const uint8_t indirect[2] = {0x00, 0x80};
+    bus.load(0x0200, indirect, 2);
+    const uint8_t vectors[6] = {0x00, 0x80, 0x00, 0x80, 0x00, 0x80};
+    bus.load(0xFFFA, vectors, 6);
+
+    switch (opcode)
+    {
+    case 0x00: // BRK, through $FFFE
+    case 0x20: // JSR $8000
+    case 0x4C: // JMP $8000
+    case 0x6C: // JMP ($0200)
+    {
+        const uint8_t self[3] = {opcode, 0x00, uint8_t(opcode == 0x6C ? 0x02 : 0x80)};
+        bus.load(code, self, 3);
+        return code;
+    }
+    case 0x40: // RTI pulls P then $8080
+    {
+        bus.load(0x8080, &opcode, 1);
+        return 0x8080;
+    }
+    case 0x60: // RTS pulls $8080 and adds one
+    {
+        bus.load(0x8081, &opcode, 1);
+        return 0x8081;
+    }
+    }
+    // Branches go to the next instruction taken or not, everything else works on $10 or $0300
+    const bool branch = (opcode & 0x1F) == 0x10;
+    const int length = trace::length(opcode);
+    const uint8_t instruction[3] = {opcode, uint8_t(branch ? 0x00 : length == 2 ? 0x10 : 0x00), 0x03};
+    uint16_t address = code;
+    for (; address + length <= code_end; address += length)
+    {
+        bus.load(address, instruction, length);
+    }
+    const uint8_t back[3] = {0x4C, code & 0xFF, code >> 8};
+    bus.load(address, back, 3);
+    return code;
+}
+
+result measure(uint8_t opcode)
+{
+    std::unique_ptr<TestBus> bus(new TestBus());
+    std::unique_ptr<CPU<TestBus>> cpu(new CPU<TestBus>(bus.get()));
+    registers_t start{};
+    start.PC.value = setup(*bus, opcode);
+    start.SP = 0xFD;
+    start.sr = 0x24;
+    cpu->setRegisters(start);
+    // Warms the caches and lets the block cache and JIT see the code
+    cpu->step_n(batch);
+    uint64_t cycles = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (uint32_t executed = 0; executed < instructions; executed += batch)
+    {
+        cycles += cpu->step_n(batch);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result r;
+    r.opcode = opcode;
+    const uint8_t bytes[3] = {bus->read(start.PC.value), bus->read(start.PC.value + 1),
+                              bus->read(start.PC.value + 2)};
+    trace::disassemble(r.text, sizeof(r.text), start.PC.value, bytes);
+    r.ns = seconds * 1e9 / instructions;
+    r.cycles = double(cycles) / instructions;
+    return r;
+}
+}
+
+int main()
+{
+    std::vector<result> results;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (!trace::documented(uint8_t(opcode)))
+        {
+            continue;
+        }
+        results.push_back(measure(uint8_t(opcode)));
+        const result &r = results.back();
+        std::printf("$%02X %-14s %7.2f ns %6.2f cycles\n", r.opcode, r.text, r.ns, r.cycles);
+    }
+    double total = 0;
+    for (const result &r : results)
+    {
+        total += r.ns;
+    }
+    const result &slowest = *std::max_element(results.begin(), results.end(),
+                                              [](const result &a, const result &b) { return a.ns < b.ns; });
+    std::printf("%zu opcodes, %.2f ns per instruction on average, slowest $%02X at %.2f ns\n", results.size(),
+                total / results.size(), slowest.opcode, slowest.ns);
+    return results.size() == 151 ? 0 : 1;
+}
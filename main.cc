@@ -1,13 +1,49 @@
+#include "system/Cartridge.h"
 #include "system/data_types.h"
-#include "system/CPU.h"
+#include "system/Movie.h"
+#include "system/NES.h"
 #include <iostream>
-#include <unordered_map>
-#include <functional>
-#include <cmath>
 
 int main(int argc, char *argv[])
 {
-
-    CPU cpu(new MMU());
-    cpu.run();
-}
\ No newline at end of file
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " rom.nes [movie]" << std::endl;
+        return 1;
+    }
+    NES nes;
+    switch (nes.load(argv[1]))
+    {
+    case NES::bad_image:
+        std::cerr << argv[1] << ": not an iNES or NES 2.0 image" << std::endl;
+        return 1;
+    case NES::unsupported_mapper:
+    {
+        // A failed load keeps no cartridge, read the header again for its mapper number
+        Cartridge rejected;
+        rejected.load(argv[1]);
+        std::cerr << argv[1] << ": mapper " << rejected.getHeader().mapper << " is not supported" << std::endl;
+        return 1;
+    }
+    case NES::loaded:
+        break;
+    }
+    Movie movie;
+    if (argc > 2 && !movie.load(argv[2]))
+    {
+        std::cerr << argv[2] << ": not a movie" << std::endl;
+        return 1;
+    }
+    nes.reset();
+    // The movie plays at full speed without drawing, its last frame is the first one shown
+    nes.getPPU().set_frame_output(movie.getFrames() < 2);
+    for (uint32_t frame = 0;; frame++)
+    {
+        if (frame + 1 == movie.getFrames())
+        {
+            nes.getPPU().set_frame_output(true);
+        }
+        movie.apply(nes, frame);
+        nes.run_frame();
+    }
+}
@@ -0,0 +1,749 @@
+#include "APU.h"
+#include <algorithm>
+
+namespace
+{
+const uint8_t length_table[32] = {10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+                                  12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+// Bit n is the output of sequencer step n
+const uint8_t duty_table[4] = {0x02, 0x06, 0x1E, 0xF9};
+// NTSC timer periods in CPU cycles
+const uint16_t noise_periods[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+const uint16_t dmc_periods[16] = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+// Frame counter steps in CPU cycles from the start of the sequence, and the sequence length
+const uint32_t four_steps[4] = {7457, 14913, 22371, 29829};
+const uint32_t five_steps[5] = {7457, 14913, 22371, 29829, 37281};
+const uint32_t four_step_period = 29830;
+const uint32_t five_step_period = 37282;
+
+// The 2A03's nonlinear mixer, as buffer levels
+const double full_scale = 30000;
+struct mixer_tables
+{
+    int32_t pulse[31];
+    int32_t tnd[203];
+    mixer_tables()
+    {
+        pulse[0] = tnd[0] = 0;
+        for (int n = 1; n < 31; n++)
+        {
+            pulse[n] = int32_t(full_scale * 95.52 / (8128.0 / n + 100));
+        }
+        for (int n = 1; n < 203; n++)
+        {
+            tnd[n] = int32_t(full_scale * 163.67 / (24329.0 / n + 100));
+        }
+    }
+};
+const mixer_tables mixer;
+}
+
+void APU::envelope_t::clock()
+{
+    if (start)
+    {
+        start = false;
+        decay = 15;
+        divider = period;
+    }
+    else if (divider == 0)
+    {
+        divider = period;
+        if (decay)
+        {
+            decay--;
+        }
+        else if (loop)
+        {
+            decay = 15;
+        }
+    }
+    else
+    {
+        divider--;
+    }
+}
+
+uint16_t APU::pulse_t::sweep_target() const
+{
+    const uint16_t change = period >> sweep_shift;
+    if (!sweep_negate)
+    {
+        return period + change;
+    }
+    const uint16_t subtracted = change + ones_complement;
+    return subtracted > period ? 0 : period - subtracted;
+}
+
+uint8_t APU::pulse_t::output() const
+{
+    return audible() && ((duty_table[duty] >> position) & 1) ? envelope.volume() : 0;
+}
+
+void APU::pulse_t::clock_sweep()
+{
+    if (sweep_divider == 0 && sweep_enabled && sweep_shift && audible())
+    {
+        period = sweep_target();
+    }
+    if (sweep_divider == 0 || sweep_reload)
+    {
+        sweep_divider = sweep_period;
+        sweep_reload = false;
+    }
+    else
+    {
+        sweep_divider--;
+    }
+}
+
+/*
+ * The channel structs are padded, so they are saved a field at a time: padding copied out as raw
+ * bytes would make two saves of one state differ.
+ */
+void APU::envelope_t::save(StateWriter &out) const
+{
+    out.put(start);
+    out.put(loop);
+    out.put(constant);
+    out.put(period);
+    out.put(divider);
+    out.put(decay);
+}
+
+void APU::envelope_t::load(StateReader &in)
+{
+    in.get(start);
+    in.get(loop);
+    in.get(constant);
+    in.get(period);
+    in.get(divider);
+    in.get(decay);
+}
+
+void APU::pulse_t::save(StateWriter &out) const
+{
+    envelope.save(out);
+    out.put(duty);
+    out.put(position);
+    out.put(length);
+    out.put(period);
+    out.put(sweep_enabled);
+    out.put(sweep_negate);
+    out.put(sweep_reload);
+    out.put(sweep_period);
+    out.put(sweep_shift);
+    out.put(sweep_divider);
+    out.put(ones_complement);
+    out.put(next);
+}
+
+void APU::pulse_t::load(StateReader &in)
+{
+    envelope.load(in);
+    in.get(duty);
+    in.get(position);
+    in.get(length);
+    in.get(period);
+    in.get(sweep_enabled);
+    in.get(sweep_negate);
+    in.get(sweep_reload);
+    in.get(sweep_period);
+    in.get(sweep_shift);
+    in.get(sweep_divider);
+    in.get(ones_complement);
+    in.get(next);
+}
+
+void APU::triangle_t::save(StateWriter &out) const
+{
+    out.put(control);
+    out.put(linear_reload);
+    out.put(linear_period);
+    out.put(linear);
+    out.put(position);
+    out.put(length);
+    out.put(period);
+    out.put(next);
+}
+
+void APU::triangle_t::load(StateReader &in)
+{
+    in.get(control);
+    in.get(linear_reload);
+    in.get(linear_period);
+    in.get(linear);
+    in.get(position);
+    in.get(length);
+    in.get(period);
+    in.get(next);
+}
+
+void APU::noise_t::save(StateWriter &out) const
+{
+    envelope.save(out);
+    out.put(mode);
+    out.put(rate);
+    out.put(length);
+    out.put(shift);
+    out.put(next);
+}
+
+void APU::noise_t::load(StateReader &in)
+{
+    envelope.load(in);
+    in.get(mode);
+    in.get(rate);
+    in.get(length);
+    in.get(shift);
+    in.get(next);
+}
+
+void APU::dmc_t::save(StateWriter &out) const
+{
+    out.put(irq_enabled);
+    out.put(loop);
+    out.put(irq);
+    out.put(rate);
+    out.put(level);
+    out.put(sample_address);
+    out.put(sample_length);
+    out.put(address);
+    out.put(remaining);
+    out.put(sample);
+    out.put(sample_full);
+    out.put(bits);
+    out.put(shift);
+    out.put(silence);
+    out.put(next);
+}
+
+void APU::dmc_t::load(StateReader &in)
+{
+    in.get(irq_enabled);
+    in.get(loop);
+    in.get(irq);
+    in.get(rate);
+    in.get(level);
+    in.get(sample_address);
+    in.get(sample_length);
+    in.get(address);
+    in.get(remaining);
+    in.get(sample);
+    in.get(sample_full);
+    in.get(bits);
+    in.get(shift);
+    in.get(silence);
+    in.get(next);
+}
+
+APU::APU(MMU &mmu) : mmu(mmu), buffer(clock_rate, sample_rate, sample_rate / 4)
+{
+    pulse[0].ones_complement = true;
+    reset();
+}
+
+void APU::reset()
+{
+    pulse[0] = pulse_t();
+    pulse[0].ones_complement = true;
+    pulse[1] = pulse_t();
+    triangle = triangle_t();
+    noise = noise_t();
+    dmc = dmc_t();
+    enabled = 0;
+    dmc.next = synced + dmc_periods[0];
+    five_step = irq_inhibit = false;
+    set_frame_flag(false);
+    set_dmc_flag(false);
+    frame_step = 0;
+    frame_start = synced;
+    frame_next = frame_start + four_steps[0];
+    mix(synced);
+    reschedule();
+}
+
+void APU::save(StateWriter &out) const
+{
+    out.put(synced);
+    out.put(frame_origin);
+    buffer.save(out);
+    out.put(level);
+    pulse[0].save(out);
+    pulse[1].save(out);
+    triangle.save(out);
+    noise.save(out);
+    dmc.save(out);
+    out.put(enabled);
+    out.put(five_step);
+    out.put(irq_inhibit);
+    out.put(frame_flag);
+    out.put(frame_step);
+    out.put(frame_start);
+    out.put(frame_next);
+}
+
+bool APU::load(StateReader &in)
+{
+    in.get(synced);
+    in.get(frame_origin);
+    buffer.load(in);
+    in.get(level);
+    pulse[0].load(in);
+    pulse[1].load(in);
+    triangle.load(in);
+    noise.load(in);
+    dmc.load(in);
+    in.get(enabled);
+    in.get(five_step);
+    in.get(irq_inhibit);
+    in.get(frame_flag);
+    in.get(frame_step);
+    in.get(frame_start);
+    in.get(frame_next);
+    // Everything the mixer tables, the duty table and the period tables are indexed with
+    const envelope_t *envelopes[3] = {&pulse[0].envelope, &pulse[1].envelope, &noise.envelope};
+    for (const envelope_t *envelope : envelopes)
+    {
+        if (envelope->period > 15 || envelope->decay > 15)
+        {
+            return false;
+        }
+    }
+    return pulse[0].duty < 4 && pulse[1].duty < 4 && triangle.position < 32 && noise.rate < 16 && dmc.rate < 16 &&
+           dmc.level < 128 && frame_step >= 0 && frame_step < (five_step ? 5 : 4);
+}
+
+void APU::sync(uint64_t cycle)
+{
+    for (;;)
+    {
+        const uint64_t time = std::min({frame_next, pulse[0].next, pulse[1].next, triangle.next, noise.next, dmc.next});
+        if (time >= cycle)
+        {
+            break;
+        }
+        for (pulse_t &channel : pulse)
+        {
+            if (channel.next == time)
+            {
+                channel.position = (channel.position + 1) & 7;
+                channel.next += (channel.period + 1) * 2;
+            }
+        }
+        if (triangle.next == time)
+        {
+            triangle.position = (triangle.position + 1) & 31;
+            triangle.next += triangle.period + 1;
+        }
+        if (noise.next == time)
+        {
+            const int tap = noise.mode ? 6 : 1;
+            const uint16_t feedback = (noise.shift ^ (noise.shift >> tap)) & 1;
+            noise.shift = (noise.shift >> 1) | (feedback << 14);
+            noise.next += noise_periods[noise.rate];
+        }
+        if (dmc.next == time)
+        {
+            step_dmc(time);
+        }
+        if (frame_next == time)
+        {
+            step_frame();
+            update_timers(time);
+        }
+        mix(time);
+    }
+    synced = std::max(synced, cycle);
+    reschedule();
+}
+
+uint64_t APU::next_sync() const
+{
+    uint64_t next = idle;
+    if (!five_step && !irq_inhibit && !frame_flag)
+    {
+        // Every step, the IRQ is raised on the last one
+        next = frame_next;
+    }
+    if (dmc.irq_enabled && !dmc.loop && dmc.remaining)
+    {
+        // The end of the output cycle, when the reader may fetch the last byte
+        next = std::min(next, dmc.next + uint64_t(dmc.bits - 1) * dmc_periods[dmc.rate]);
+    }
+    return next == idle ? idle : std::max(next + 1, synced + 1);
+}
+
+void APU::reschedule()
+{
+    if (!scheduler)
+    {
+        return;
+    }
+    const uint64_t next = next_sync();
+    if (next == idle)
+    {
+        scheduler->cancel(event_id);
+    }
+    else
+    {
+        scheduler->schedule(event_id, next);
+    }
+}
+
+uint8_t APU::read_register(uint16_t address)
+{
+    if (address != 0x4015)
+    {
+        return 0;
+    }
+    const uint8_t status = (pulse[0].length ? 0x01 : 0) | (pulse[1].length ? 0x02 : 0) |
+                           (triangle.length ? 0x04 : 0) | (noise.length ? 0x08 : 0) | (dmc.remaining ? 0x10 : 0) |
+                           (frame_flag ? 0x40 : 0) | (dmc.irq ? 0x80 : 0);
+    set_frame_flag(false);
+    reschedule();
+    return status;
+}
+
+void APU::write_register(uint16_t address, uint8_t value)
+{
+    switch (address)
+    {
+    case 0x4000:
+    case 0x4004:
+    {
+        pulse_t &channel = pulse[(address >> 2) & 1];
+        channel.duty = value >> 6;
+        channel.envelope.loop = value & 0x20;
+        channel.envelope.constant = value & 0x10;
+        channel.envelope.period = value & 0x0F;
+        break;
+    }
+    case 0x4001:
+    case 0x4005:
+    {
+        pulse_t &channel = pulse[(address >> 2) & 1];
+        channel.sweep_enabled = value & 0x80;
+        channel.sweep_period = (value >> 4) & 7;
+        channel.sweep_negate = value & 0x08;
+        channel.sweep_shift = value & 7;
+        channel.sweep_reload = true;
+        break;
+    }
+    case 0x4002:
+    case 0x4006:
+    {
+        pulse_t &channel = pulse[(address >> 2) & 1];
+        channel.period = (channel.period & 0x700) | value;
+        break;
+    }
+    case 0x4003:
+    case 0x4007:
+    {
+        pulse_t &channel = pulse[(address >> 2) & 1];
+        channel.period = (channel.period & 0xFF) | ((value & 7) << 8);
+        if (enabled & (1 << ((address >> 2) & 1)))
+        {
+            channel.length = length_table[value >> 3];
+        }
+        channel.position = 0;
+        channel.envelope.start = true;
+        break;
+    }
+    case 0x4008:
+        triangle.control = value & 0x80;
+        triangle.linear_period = value & 0x7F;
+        break;
+    case 0x400A:
+        triangle.period = (triangle.period & 0x700) | value;
+        break;
+    case 0x400B:
+        triangle.period = (triangle.period & 0xFF) | ((value & 7) << 8);
+        if (enabled & 0x04)
+        {
+            triangle.length = length_table[value >> 3];
+        }
+        triangle.linear_reload = true;
+        break;
+    case 0x400C:
+        noise.envelope.loop = value & 0x20;
+        noise.envelope.constant = value & 0x10;
+        noise.envelope.period = value & 0x0F;
+        break;
+    case 0x400E:
+        noise.mode = value & 0x80;
+        noise.rate = value & 0x0F;
+        break;
+    case 0x400F:
+        if (enabled & 0x08)
+        {
+            noise.length = length_table[value >> 3];
+        }
+        noise.envelope.start = true;
+        break;
+    case 0x4010:
+        dmc.irq_enabled = value & 0x80;
+        dmc.loop = value & 0x40;
+        dmc.rate = value & 0x0F;
+        if (!dmc.irq_enabled)
+        {
+            set_dmc_flag(false);
+        }
+        break;
+    case 0x4011:
+        dmc.level = value & 0x7F;
+        break;
+    case 0x4012:
+        dmc.sample_address = 0xC000 | (value << 6);
+        break;
+    case 0x4013:
+        dmc.sample_length = (value << 4) + 1;
+        break;
+    case 0x4015:
+        enabled = value & 0x1F;
+        if (!(value & 0x01))
+        {
+            pulse[0].length = 0;
+        }
+        if (!(value & 0x02))
+        {
+            pulse[1].length = 0;
+        }
+        if (!(value & 0x04))
+        {
+            triangle.length = 0;
+        }
+        if (!(value & 0x08))
+        {
+            noise.length = 0;
+        }
+        if (!(value & 0x10))
+        {
+            dmc.remaining = 0;
+        }
+        else if (dmc.remaining == 0)
+        {
+            dmc.address = dmc.sample_address;
+            dmc.remaining = dmc.sample_length;
+            fetch_sample();
+        }
+        set_dmc_flag(false);
+        break;
+    case 0x4017:
+        five_step = value & 0x80;
+        irq_inhibit = value & 0x40;
+        if (irq_inhibit)
+        {
+            set_frame_flag(false);
+        }
+        // The sequence restarts, the 3 or 4 cycle delay of the real chip is left out
+        frame_step = 0;
+        frame_start = synced;
+        frame_next = frame_start + four_steps[0];
+        if (five_step)
+        {
+            quarter_frame();
+            half_frame();
+        }
+        break;
+    default:
+        return;
+    }
+    update_timers(synced);
+    mix(synced);
+    reschedule();
+}
+
+void APU::end_frame()
+{
+    buffer.end_frame(uint32_t(synced - frame_origin));
+    frame_origin = synced;
+}
+
+void APU::step_frame()
+{
+    if (five_step)
+    {
+        if (frame_step != 3)
+        {
+            quarter_frame();
+        }
+        if (frame_step == 1 || frame_step == 4)
+        {
+            half_frame();
+        }
+    }
+    else
+    {
+        quarter_frame();
+        if (frame_step & 1)
+        {
+            half_frame();
+        }
+        if (frame_step == 3 && !irq_inhibit)
+        {
+            set_frame_flag(true);
+        }
+    }
+    const int steps = five_step ? 5 : 4;
+    if (++frame_step == steps)
+    {
+        frame_step = 0;
+        frame_start += five_step ? five_step_period : four_step_period;
+    }
+    frame_next = frame_start + (five_step ? five_steps[frame_step] : four_steps[frame_step]);
+}
+
+void APU::quarter_frame()
+{
+    pulse[0].envelope.clock();
+    pulse[1].envelope.clock();
+    noise.envelope.clock();
+    if (triangle.linear_reload)
+    {
+        triangle.linear = triangle.linear_period;
+    }
+    else if (triangle.linear)
+    {
+        triangle.linear--;
+    }
+    if (!triangle.control)
+    {
+        triangle.linear_reload = false;
+    }
+}
+
+void APU::half_frame()
+{
+    for (pulse_t &channel : pulse)
+    {
+        if (channel.length && !channel.envelope.loop)
+        {
+            channel.length--;
+        }
+        channel.clock_sweep();
+    }
+    if (triangle.length && !triangle.control)
+    {
+        triangle.length--;
+    }
+    if (noise.length && !noise.envelope.loop)
+    {
+        noise.length--;
+    }
+}
+
+void APU::step_dmc(uint64_t time)
+{
+    if (!dmc.silence)
+    {
+        if (dmc.shift & 1)
+        {
+            if (dmc.level <= 125)
+            {
+                dmc.level += 2;
+            }
+        }
+        else if (dmc.level >= 2)
+        {
+            dmc.level -= 2;
+        }
+        dmc.shift >>= 1;
+    }
+    if (--dmc.bits == 0)
+    {
+        dmc.bits = 8;
+        dmc.silence = !dmc.sample_full;
+        if (dmc.sample_full)
+        {
+            dmc.shift = dmc.sample;
+            dmc.sample_full = false;
+            fetch_sample();
+        }
+    }
+    dmc.next = time + dmc_periods[dmc.rate];
+}
+
+void APU::fetch_sample()
+{
+    if (dmc.sample_full || dmc.remaining == 0)
+    {
+        return;
+    }
+    // The CPU is not stalled for the fetch
+    dmc.sample = mmu.read(dmc.address);
+    dmc.sample_full = true;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if (--dmc.remaining == 0)
+    {
+        if (dmc.loop)
+        {
+            dmc.address = dmc.sample_address;
+            dmc.remaining = dmc.sample_length;
+        }
+        else if (dmc.irq_enabled)
+        {
+            set_dmc_flag(true);
+        }
+    }
+}
+
+void APU::set_frame_flag(bool raised)
+{
+    frame_flag = raised;
+    if (frame_irq.set)
+    {
+        frame_irq.set(frame_irq.context, raised);
+    }
+}
+
+void APU::set_dmc_flag(bool raised)
+{
+    dmc.irq = raised;
+    if (dmc_irq.set)
+    {
+        dmc_irq.set(dmc_irq.context, raised);
+    }
+}
+
+void APU::update_timers(uint64_t time)
+{
+    for (pulse_t &channel : pulse)
+    {
+        if (!channel.audible())
+        {
+            channel.next = idle;
+        }
+        else if (channel.next == idle)
+        {
+            channel.next = time + (channel.period + 1) * 2;
+        }
+    }
+    if (!triangle.stepping())
+    {
+        triangle.next = idle;
+    }
+    else if (triangle.next == idle)
+    {
+        triangle.next = time + triangle.period + 1;
+    }
+    if (!noise.length)
+    {
+        noise.next = idle;
+    }
+    else if (noise.next == idle)
+    {
+        noise.next = time + noise_periods[noise.rate];
+    }
+}
+
+void APU::mix(uint64_t time)
+{
+    const int32_t next = mixer.pulse[pulse[0].output() + pulse[1].output()] +
+                         mixer.tnd[3 * triangle.output() + 2 * noise.output() + dmc.level];
+    if (next != level)
+    {
+        buffer.add_delta(uint32_t(time - frame_origin), next - level);
+        level = next;
+    }
+}
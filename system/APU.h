@@ -0,0 +1,260 @@
+#ifndef _APU_
+#define _APU_
+#include "BlipBuffer.h"
+#include "MMU.h"
+#include "Mapper.h"
+#include "Scheduler.h"
+#include <cstdint>
+
+/*
+ * 2A03 audio: two pulse channels, triangle, noise and DMC, registers at $4000-$4013, $4015
+ * and $4017 through the owner's io handler.
+ *
+ * Like the PPU the APU trails the CPU and catches up on register accesses and at next_sync().
+ * Catching up does not tick cycles, it jumps from one channel timer step or frame counter
+ * clock to the next and records each change of the mixed output in a band-limited buffer.
+ * end_frame() turns what was recorded into 48 kHz samples.
+ */
+class APU
+{
+public:
+    static constexpr int sample_rate = 48000;
+    // NTSC CPU clock in Hz
+    static constexpr double clock_rate = 1789773.0;
+
+    APU(MMU &mmu);
+    APU(const APU &) = delete;
+    APU &operator=(const APU &) = delete;
+
+    // Wired to CPU::set_irq with irq_frame_counter and irq_dmc
+    void connect_frame_irq(irq_line line)
+    {
+        frame_irq = line;
+    }
+    void connect_dmc_irq(irq_line line)
+    {
+        dmc_irq = line;
+    }
+    void connect_clock(clock_source source)
+    {
+        clock = source;
+    }
+    void connect_scheduler(Scheduler *timeline, int id)
+    {
+        scheduler = timeline;
+        event_id = id;
+    }
+    // Power on state, the channels are silenced and the frame counter starts over
+    void reset();
+
+    /*
+     * Runs up to CPU cycle cycle, a cycle already passed is a no-op.
+     */
+    void sync(uint64_t cycle);
+    // Up to the connected clock, done before every register access
+    void catch_up()
+    {
+        if (clock.now)
+        {
+            sync(clock.now(clock.context));
+        }
+    }
+    /*
+     * The CPU cycle the APU has to be synced at next even if its registers are left alone, for
+     * the frame counter and DMC IRQs.
+     */
+    uint64_t next_sync() const;
+    uint64_t getSyncedCycle() const
+    {
+        return synced;
+    }
+
+    // $4015, the only readable register
+    uint8_t read_register(uint16_t address);
+    void write_register(uint16_t address, uint8_t value);
+
+    /*
+     * Channels, frame counter and the output being recorded. Samples not read yet are dropped
+     * by a load. Loading returns false when a field that indexes a table is out of range, the
+     * APU must then be loaded again before it runs.
+     */
+    void save(StateWriter &out) const;
+    bool load(StateReader &in);
+
+    /*
+     * Makes the samples up to the synced cycle readable.
+     */
+    void end_frame();
+    size_t getSamplesAvailable() const
+    {
+        return buffer.getSamplesAvailable();
+    }
+    /*
+     * Copies up to count mono samples to out, returns how many were copied.
+     */
+    size_t read_samples(int16_t *out, size_t count)
+    {
+        return buffer.read_samples(out, count);
+    }
+
+private:
+    static constexpr uint64_t idle = UINT64_MAX;
+
+    MMU &mmu;
+    irq_line frame_irq;
+    irq_line dmc_irq;
+    clock_source clock;
+    Scheduler *scheduler = nullptr;
+    int event_id = 0;
+    // CPU cycle run up to, and the cycle the samples being recorded start at
+    uint64_t synced = 0;
+    uint64_t frame_origin = 0;
+    BlipBuffer buffer;
+    // Last mixed level added to the buffer
+    int32_t level = 0;
+
+    struct envelope_t
+    {
+        bool start = false;
+        bool loop = false;
+        bool constant = false;
+        uint8_t period = 0;
+        uint8_t divider = 0;
+        uint8_t decay = 0;
+
+        void clock();
+        void save(StateWriter &out) const;
+        void load(StateReader &in);
+        uint8_t volume() const
+        {
+            return constant ? period : decay;
+        }
+    };
+    /*
+     * Each channel keeps the CPU cycle its timer next steps its sequencer at, idle while
+     * stepping cannot change what it outputs.
+     */
+    struct pulse_t
+    {
+        envelope_t envelope;
+        uint8_t duty = 0;
+        uint8_t position = 0;
+        uint8_t length = 0;
+        uint16_t period = 0;
+        bool sweep_enabled = false;
+        bool sweep_negate = false;
+        bool sweep_reload = false;
+        uint8_t sweep_period = 0;
+        uint8_t sweep_shift = 0;
+        uint8_t sweep_divider = 0;
+        // Pulse 1 negates in ones' complement
+        bool ones_complement = false;
+        uint64_t next = idle;
+
+        uint16_t sweep_target() const;
+        bool audible() const
+        {
+            return length && period >= 8 && sweep_target() <= 0x7FF;
+        }
+        uint8_t output() const;
+        void clock_sweep();
+        void save(StateWriter &out) const;
+        void load(StateReader &in);
+    };
+    struct triangle_t
+    {
+        bool control = false;
+        bool linear_reload = false;
+        uint8_t linear_period = 0;
+        uint8_t linear = 0;
+        uint8_t position = 0;
+        uint8_t length = 0;
+        uint16_t period = 0;
+        uint64_t next = idle;
+
+        void save(StateWriter &out) const;
+        void load(StateReader &in);
+        // Halted by either counter, periods under 2 are ultrasonic and left alone
+        bool stepping() const
+        {
+            return length && linear && period >= 2;
+        }
+        uint8_t output() const
+        {
+            return position < 16 ? 15 - position : position - 16;
+        }
+    };
+    struct noise_t
+    {
+        envelope_t envelope;
+        bool mode = false;
+        uint8_t rate = 0;
+        uint8_t length = 0;
+        uint16_t shift = 1;
+        uint64_t next = idle;
+
+        void save(StateWriter &out) const;
+        void load(StateReader &in);
+        uint8_t output() const
+        {
+            return length && !(shift & 1) ? envelope.volume() : 0;
+        }
+    };
+    struct dmc_t
+    {
+        bool irq_enabled = false;
+        bool loop = false;
+        bool irq = false;
+        uint8_t rate = 0;
+        uint8_t level = 0;
+        uint16_t sample_address = 0xC000;
+        uint16_t sample_length = 1;
+        // Sample reader
+        uint16_t address = 0xC000;
+        uint16_t remaining = 0;
+        uint8_t sample = 0;
+        bool sample_full = false;
+        // Output unit
+        uint8_t bits = 8;
+        uint8_t shift = 0;
+        bool silence = true;
+        uint64_t next = idle;
+
+        void save(StateWriter &out) const;
+        void load(StateReader &in);
+    };
+    pulse_t pulse[2];
+    triangle_t triangle;
+    noise_t noise;
+    dmc_t dmc;
+    // $4015 channel enables
+    uint8_t enabled = 0;
+
+    // Frame counter mode, the step it is on and the cycle of that step
+    bool five_step = false;
+    bool irq_inhibit = false;
+    bool frame_flag = false;
+    int frame_step = 0;
+    uint64_t frame_start = 0;
+    uint64_t frame_next = 0;
+
+    // Moves the scheduled event to next_sync()
+    void reschedule();
+    // Clocks the frame counter step due at frame_next and moves on to the next one
+    void step_frame();
+    void quarter_frame();
+    void half_frame();
+    void step_dmc(uint64_t time);
+    // Fills the DMC sample buffer from memory if it is empty and bytes remain
+    void fetch_sample();
+    void set_frame_flag(bool raised);
+    void set_dmc_flag(bool raised);
+    /*
+     * Starts the timers of channels that became audible at time and stops the ones that fell
+     * silent, after anything that could change which is which.
+     */
+    void update_timers(uint64_t time);
+    // Adds the change of the mixed output at time to the buffer
+    void mix(uint64_t time);
+};
+#endif
@@ -0,0 +1,188 @@
+#ifndef _BLIP_BUFFER_
+#define _BLIP_BUFFER_
+#include "Savestate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Band-limited step synthesis. The sound source records when its output level changes, in
+ * source clocks, and each change is added to the sample buffer as a windowed sinc step at
+ * its sub-sample position. Reading integrates the steps back into samples, so the cost
+ * follows the number of level changes instead of the source clock rate.
+ */
+class BlipBuffer
+{
+public:
+    // Kernel width in samples, and sub-sample positions it is tabulated at
+    static constexpr int taps = 16;
+    static constexpr int phase_bits = 6;
+    static constexpr int phases = 1 << phase_bits;
+    // Kernel entries of a phase add up to 1 << kernel_bits
+    static constexpr int kernel_bits = 14;
+
+    /*
+     * capacity is in output samples and must be well over a frame's worth, unread samples past
+     * it are dropped oldest first.
+     */
+    BlipBuffer(double clock_rate, int sample_rate, size_t capacity)
+        : step(uint64_t(sample_rate / clock_rate * 4294967296.0)), samples(capacity + taps), capacity(capacity)
+    {
+        // Passes up to 90% of the output Nyquist frequency
+        const double cutoff = 0.9;
+        for (int phase = 0; phase < phases; phase++)
+        {
+            double weights[taps];
+            double total = 0;
+            for (int tap = 0; tap < taps; tap++)
+            {
+                // Centred between the middle taps, the step lands half the kernel after its time
+                const double distance = tap - (taps / 2 - 1) - double(phase) / phases;
+                const double angle = M_PI * cutoff * distance;
+                const double sinc = distance == 0 ? 1.0 : std::sin(angle) / angle;
+                const double window = 0.42 + 0.5 * std::cos(M_PI * distance / (taps / 2)) +
+                                      0.08 * std::cos(2 * M_PI * distance / (taps / 2));
+                weights[tap] = sinc * std::max(window, 0.0);
+                total += weights[tap];
+            }
+            // Rounded so every step integrates to exactly its size
+            int32_t sum = 0;
+            for (int tap = 0; tap < taps; tap++)
+            {
+                kernel[phase][tap] = int32_t(std::lround(weights[tap] / total * (1 << kernel_bits)));
+                sum += kernel[phase][tap];
+            }
+            kernel[phase][taps / 2 - 1] += (1 << kernel_bits) - sum;
+        }
+    }
+
+    /*
+     * Adds a level change of delta at time source clocks after the last end_frame.
+     * delta must stay within 16 bits.
+     */
+    void add_delta(uint32_t time, int32_t delta)
+    {
+        const uint64_t position = offset + time * step;
+        const size_t index = available + size_t(position >> 32);
+        if (index >= capacity)
+        {
+            return;
+        }
+        const int32_t *weights = kernel[(position >> (32 - phase_bits)) & (phases - 1)];
+        int32_t *out = &samples[index];
+        for (int tap = 0; tap < taps; tap++)
+        {
+            out[tap] += weights[tap] * delta;
+        }
+    }
+    /*
+     * Makes the samples up to time source clocks after the last end_frame readable, later
+     * times are relative to it.
+     */
+    void end_frame(uint32_t time)
+    {
+        const uint64_t position = offset + time * step;
+        offset = position & 0xFFFFFFFFu;
+        available += size_t(position >> 32);
+        if (available > capacity - max_frame)
+        {
+            // Nobody is reading, keep the newest samples
+            remove(available - (capacity - max_frame));
+        }
+    }
+
+    size_t getSamplesAvailable() const
+    {
+        return available;
+    }
+    /*
+     * Copies up to count samples to out and removes them, returns how many were copied.
+     */
+    size_t read_samples(int16_t *out, size_t count)
+    {
+        count = std::min(count, available);
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = next_sample(i);
+        }
+        shift(count);
+        return count;
+    }
+    // Drops the readable samples
+    void clear()
+    {
+        remove(available);
+    }
+
+    /*
+     * The fraction, the integrator and the steps recorded since the last end_frame, which is all
+     * the output still to come depends on. Readable samples are not saved: the integrator is
+     * saved as if they had been read, and loading drops the ones the buffer holds.
+     */
+    void save(StateWriter &out) const
+    {
+        int64_t settled = level;
+        for (size_t i = 0; i < available; i++)
+        {
+            settled = integrate(settled, samples[i]);
+        }
+        out.put(offset);
+        out.put(settled);
+        out.put(&samples[available], pending * sizeof(int32_t));
+    }
+    void load(StateReader &in)
+    {
+        std::fill(samples.begin() + pending, samples.end(), 0);
+        available = 0;
+        in.get(offset);
+        in.get(level);
+        in.get(samples.data(), pending * sizeof(int32_t));
+    }
+
+private:
+    // Output samples per source clock in 32.32 fixed point, and the fraction left from the last frame
+    uint64_t step;
+    uint64_t offset = 0;
+    int32_t kernel[phases][taps];
+    // Steps spread over the readable samples and the kernel width past them
+    std::vector<int32_t> samples;
+    size_t capacity;
+    size_t available = 0;
+    // Integrator, with the level in kernel_bits fixed point
+    int64_t level = 0;
+    // Room kept for the frame being recorded, a few frames' worth at 48 kHz
+    static constexpr size_t max_frame = 4096;
+    // Samples past the readable ones that steps of the frame being recorded can reach
+    static constexpr size_t pending = max_frame + taps;
+
+    static int64_t integrate(int64_t level, int32_t step)
+    {
+        const int32_t sample = int32_t(level >> kernel_bits);
+        // Leaks the level back to 0 so a held level does not stay as DC
+        return level + step - (int64_t(sample) << (kernel_bits - 9));
+    }
+    int16_t next_sample(size_t i)
+    {
+        const int32_t sample = int32_t(level >> kernel_bits);
+        level = integrate(level, samples[i]);
+        return int16_t(std::min(std::max(sample, -32768), 32767));
+    }
+    void remove(size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            next_sample(i);
+        }
+        shift(count);
+    }
+    void shift(size_t count)
+    {
+        const size_t kept = available - count + taps;
+        std::memmove(samples.data(), samples.data() + count, kept * sizeof(int32_t));
+        std::fill(samples.begin() + kept, samples.begin() + kept + count, 0);
+        available -= count;
+    }
+};
+#endif
@@ -0,0 +1,121 @@
+#ifndef _BLOCKCACHE_
+#define _BLOCKCACHE_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Straight-line runs of pre-decoded instructions keyed by the address of their first instruction.
+ * Only $8000-$FFFF is cached, on the NES that is ROM and RAM mirroring never aliases it.
+ * Op is the decoded instruction type of the CPU that owns the cache.
+ */
+template <class Op>
+class BlockCache
+{
+public:
+    static constexpr uint16_t base = 0x8000;
+    // Instructions per block
+    static constexpr size_t max_block = 32;
+    // Decoded instructions kept before everything is flushed
+    static constexpr size_t capacity = 0x10000;
+
+    struct block_t
+    {
+        uint32_t first;
+        uint32_t count;
+        // Entries so far and the translated code, for the JIT tier
+        uint32_t hits = 0;
+        const void *native = nullptr;
+        // Most cycles the block can take before its last instruction starts
+        uint32_t native_span = 0;
+    };
+
+    block_t *find(uint16_t pc)
+    {
+        if (index.empty())
+        {
+            return nullptr;
+        }
+        const int32_t block = index[pc - base];
+        return block < 0 ? nullptr : &blocks[block];
+    }
+    const Op *instructions(const block_t *block) const
+    {
+        return &ops[block->first];
+    }
+    // Whether count more instructions fit, the owner flushes first when they do not
+    bool fits(size_t count) const
+    {
+        return ops.size() + count <= capacity;
+    }
+    /*
+     * Adds the block decoded from start, last is the address of its last byte. The block has to
+     * fit.
+     */
+    block_t *insert(uint16_t start, uint16_t last, const Op *decoded, size_t count)
+    {
+        if (index.empty())
+        {
+            index.assign(0x10000 - base, -1);
+        }
+        index[start - base] = blocks.size();
+        blocks.push_back({uint32_t(ops.size()), uint32_t(count)});
+        ops.insert(ops.end(), decoded, decoded + count);
+        for (int page = start >> 8; page <= last >> 8; page++)
+        {
+            starts[page].push_back(start);
+            code[page] = 1;
+        }
+        return &blocks.back();
+    }
+
+    // True when a write to address may modify a cached block
+    bool covers(uint16_t address) const
+    {
+        return code[address >> 8];
+    }
+    void invalidate(uint16_t address)
+    {
+        const int page = address >> 8;
+        for (uint16_t start : starts[page])
+        {
+            index[start - base] = -1;
+        }
+        starts[page].clear();
+        code[page] = 0;
+    }
+
+    /*
+     * Bank switches remap whole pages, the bus bumps its epoch and the cache starts over.
+     */
+    uint32_t getEpoch() const
+    {
+        return epoch;
+    }
+    void flush(uint32_t newEpoch)
+    {
+        epoch = newEpoch;
+        if (!index.empty())
+        {
+            index.assign(index.size(), -1);
+        }
+        blocks.clear();
+        ops.clear();
+        for (int page = 0; page < 256; page++)
+        {
+            starts[page].clear();
+            code[page] = 0;
+        }
+    }
+
+private:
+    std::vector<Op> ops;
+    std::vector<block_t> blocks;
+    // Block number by start address - base, -1 when not decoded
+    std::vector<int32_t> index;
+    // Start addresses of the blocks overlapping each page
+    std::vector<uint16_t> starts[256];
+    uint8_t code[256]{};
+    uint32_t epoch = 0;
+};
+#endif
@@ -1,885 +1,1518 @@
 #include "CPU.h"
+#include "LaneBus.h"
+#include "TestBus.h"
+#include "Flags.h"
 #include "data_types.h"
-#include <functional>
-#include <unordered_map>
+#include <type_traits>
 // Rotation
 #define RIGHT true
 #define LEFT false
 
-/*
-    x_indexed_indirect = 0,
-    zeropage = 1,
-    immediate = 2,
-    absolute = 3,
-    indirect_y_indexed = 4,
-    zeropage_x_indexed = 5,
-    absolute_y_indexed = 6,
-    absolute_x_indexed = 7
-*/
-
-void ADC(uint8_t &ac, uint8_t val, status_register_t &status)
-{
-    bool carry = (ac + val + status.C) > 0xFF;
-    uint8_t sum = (ac + val + status.C) & 0xff;
-    status.V = (~(ac ^ val) & (ac ^ sum) & 0x80) > 0;
-    ac = sum;
-    status.N = ac >> 7;
-    status.Z = ac == 0;
-    status.C = carry;
+namespace alu
+{
+template <class F>
+void ADC(uint8_t &ac, uint8_t val, F &status)
+{
+    const uint16_t sum = ac + val + status.carry();
+    status.adc(ac, val, sum);
+    ac = sum & 0xff;
 };
 
-void SBC(uint8_t &ac, uint8_t val, status_register_t &status)
+template <class F>
+void SBC(uint8_t &ac, uint8_t val, F &status)
 {
     ADC(ac, ~val, status);
 }
-void AND(uint8_t &ac, uint8_t val, status_register_t &status)
+template <class F>
+void AND(uint8_t &ac, uint8_t val, F &status)
 {
     ac &= val;
-    status.N = ac & 0x80;
-    status.Z = ac == 0;
+    status.nz(ac);
 }
-void EOR(uint8_t &ac, uint8_t val, status_register_t &status)
+template <class F>
+void EOR(uint8_t &ac, uint8_t val, F &status)
 {
     ac ^= val;
-    status.N = ac & 0x80;
-    status.Z = ac == 0;
+    status.nz(ac);
 }
-void ORA(uint8_t &ac, uint8_t val, status_register_t &status)
+template <class F>
+void ORA(uint8_t &ac, uint8_t val, F &status)
 {
     ac |= val;
-    status.N = ac & 0x80;
-    status.Z = ac == 0;
+    status.nz(ac);
 }
 
-void rotate(uint8_t &var, status_register_t &status, bool direction)
+template <class F>
+void rotate(uint8_t &var, F &status, bool direction)
 {
-    bool oldC = status.C;
-    if (direction)
+    const uint8_t oldC = status.carry();
+    uint8_t carry;
+    if (direction == LEFT)
     {
-        status.C = (var & 0x80) > 0;
-        var <<= 1;
-        var = var || oldC;
+        carry = var >> 7;
+        var = (var << 1) | oldC;
     }
     else
     {
-        status.C = (var & 1) > 0;
-        var >>= 1;
-        var = var || (oldC << 7);
+        carry = var & 1;
+        var = (var >> 1) | (oldC << 7);
     }
-
-    status.Z = (var == 0);
-    status.N = (var >> 7);
+    status.nzc(var, carry);
 }
 
-void ASL(uint8_t &var, status_register_t &status)
+template <class F>
+void ASL(uint8_t &var, F &status)
 {
-    status.C = (var & 0x80) != 0;
+    const uint8_t carry = var >> 7;
     var <<= 1;
-    status.N = var >> 7;
-    status.Z = var == 0;
+    status.nzc(var, carry);
 }
 
-void LSR(uint8_t &var, status_register_t &status)
+template <class F>
+void LSR(uint8_t &var, F &status)
 {
-    status.C = var & 1;
-    var >> 1;
-    status.N = 0;
-    status.Z = var == 0;
+    const uint8_t carry = var & 1;
+    var >>= 1;
+    status.nzc(var, carry);
 }
 
-void inline transfer_load(uint8_t &dest, uint8_t &from, status_register_t &status)
+template <class F>
+void inline transfer_load(uint8_t &dest, uint8_t from, F &status)
 {
     dest = from;
-    status.N = (dest >> 7) & 0x1;
-    status.Z = dest == 0;
-}
-
-void LDA(uint8_t &dest, uint8_t from, status_register_t &status)
-{
-    uint8_t value = from;
-    transfer_load(dest, value, status);
-}
-// Special case of transfer which the flags are not set
-void TXS(uint8_t &SP, uint8_t &var, status_register_t &status)
-{
-    SP = var;
+    status.nz(dest);
 }
 
-void BIT(uint8_t &ac, uint8_t &mem, status_register_t &status)
+template <class F>
+void BIT(uint8_t ac, uint8_t mem, F &status)
 {
-    uint8_t bits = (ac & mem);
+    status.bit(ac, mem);
 }
 
-void CMP(uint8_t &reg, uint8_t &mem, status_register_t &status)
+template <class F>
+void CMP(uint8_t reg, uint8_t mem, F &status)
 {
-    uint16_t result = reg - mem;
-    status.N = (result >> 7);
-    status.Z = result == 0;
-    status.C = result > 255;
+    status.nzc(reg - mem, reg >= mem);
 }
 
-void decrement(uint8_t &var, status_register_t &status)
+template <class F>
+void decrement(uint8_t &var, F &status)
 {
     var--;
-    status.N = ((var >> 7) & 0x1);
-    status.Z = var == 0;
+    status.nz(var);
 }
-void increment(uint8_t &var, status_register_t &status)
+template <class F>
+void increment(uint8_t &var, F &status)
 {
     var++;
-    status.N = ((var >> 7) & 0x1);
-    status.Z = var == 0;
+    status.nz(var);
+}
 }
 
-/**
- * @brief Returns whether it shouold branch or not,this should cover all of the branching functions
- *
- * @param opcode
- * @param status
- * @return true
- * @return false
+/*
+ * Every opcode resolves to an addressing mode, an operation and its base cycle count.
+ * Opcodes that are not listed jam the real chip, here they behave as a one byte NOP.
  */
-bool branch(instruction_t &opcode, status_register_t &status)
-{
-    using std::function;
-    using std::unordered_map;
-    static unordered_map<int, function<bool(status_register_t)>> branchingInstructions;
-    if (branchingInstructions.empty())
-    {
-        // BPL
-        branchingInstructions[0] = [&](status_register_t status) -> bool
-        { return !status.N; };
-        // BMI
-        branchingInstructions[1] = [&](status_register_t status) -> bool
-        { return status.N; };
-        // BVC
-        branchingInstructions[2] = [&](status_register_t status) -> bool
-        { return !status.V; };
-        // BVS
-        branchingInstructions[3] = [&](status_register_t status) -> bool
-        { return status.V; };
-        // BCC
-        branchingInstructions[4] = [&](status_register_t status) -> bool
-        { return !status.C; };
-        // BCS
-        branchingInstructions[5] = [&](status_register_t status) -> bool
-        { return status.C; };
-        // BNE
-        branchingInstructions[6] = [&](status_register_t status) -> bool
-        { return !status.Z; };
-        // BEQ
-        branchingInstructions[7] = [&](status_register_t status) -> bool
-        { return status.Z; };
+template <class Bus, class Flags>
+constexpr std::array<typename CPU<Bus, Flags>::opcode_t, 256> CPU<Bus, Flags>::make_opcode_table()
+{
+    std::array<opcode_t, 256> t{};
+    for (auto &entry : t)
+    {
+        entry = {&CPU::implied, &CPU::NOP, 2};
     }
-    return branchingInstructions[opcode._b](status);
-}
+    // ORA
+    t[0x09] = {&CPU::immediate, &CPU::ORA, 2};
+    t[0x05] = {&CPU::zeropage, &CPU::ORA, 3};
+    t[0x15] = {&CPU::zeropage_x_indexed, &CPU::ORA, 4};
+    t[0x0D] = {&CPU::absolute, &CPU::ORA, 4};
+    t[0x1D] = {&CPU::absolute_x_indexed, &CPU::ORA, 4, true};
+    t[0x19] = {&CPU::absolute_y_indexed, &CPU::ORA, 4, true};
+    t[0x01] = {&CPU::x_indexed_indirect, &CPU::ORA, 6};
+    t[0x11] = {&CPU::indirect_y_indexed, &CPU::ORA, 5, true};
+    // AND
+    t[0x29] = {&CPU::immediate, &CPU::AND, 2};
+    t[0x25] = {&CPU::zeropage, &CPU::AND, 3};
+    t[0x35] = {&CPU::zeropage_x_indexed, &CPU::AND, 4};
+    t[0x2D] = {&CPU::absolute, &CPU::AND, 4};
+    t[0x3D] = {&CPU::absolute_x_indexed, &CPU::AND, 4, true};
+    t[0x39] = {&CPU::absolute_y_indexed, &CPU::AND, 4, true};
+    t[0x21] = {&CPU::x_indexed_indirect, &CPU::AND, 6};
+    t[0x31] = {&CPU::indirect_y_indexed, &CPU::AND, 5, true};
+    // EOR
+    t[0x49] = {&CPU::immediate, &CPU::EOR, 2};
+    t[0x45] = {&CPU::zeropage, &CPU::EOR, 3};
+    t[0x55] = {&CPU::zeropage_x_indexed, &CPU::EOR, 4};
+    t[0x4D] = {&CPU::absolute, &CPU::EOR, 4};
+    t[0x5D] = {&CPU::absolute_x_indexed, &CPU::EOR, 4, true};
+    t[0x59] = {&CPU::absolute_y_indexed, &CPU::EOR, 4, true};
+    t[0x41] = {&CPU::x_indexed_indirect, &CPU::EOR, 6};
+    t[0x51] = {&CPU::indirect_y_indexed, &CPU::EOR, 5, true};
+    // ADC
+    t[0x69] = {&CPU::immediate, &CPU::ADC, 2};
+    t[0x65] = {&CPU::zeropage, &CPU::ADC, 3};
+    t[0x75] = {&CPU::zeropage_x_indexed, &CPU::ADC, 4};
+    t[0x6D] = {&CPU::absolute, &CPU::ADC, 4};
+    t[0x7D] = {&CPU::absolute_x_indexed, &CPU::ADC, 4, true};
+    t[0x79] = {&CPU::absolute_y_indexed, &CPU::ADC, 4, true};
+    t[0x61] = {&CPU::x_indexed_indirect, &CPU::ADC, 6};
+    t[0x71] = {&CPU::indirect_y_indexed, &CPU::ADC, 5, true};
+    // STA
+    t[0x85] = {&CPU::zeropage, &CPU::STA, 3};
+    t[0x95] = {&CPU::zeropage_x_indexed, &CPU::STA, 4};
+    t[0x8D] = {&CPU::absolute, &CPU::STA, 4};
+    t[0x9D] = {&CPU::absolute_x_indexed, &CPU::STA, 5};
+    t[0x99] = {&CPU::absolute_y_indexed, &CPU::STA, 5};
+    t[0x81] = {&CPU::x_indexed_indirect, &CPU::STA, 6};
+    t[0x91] = {&CPU::indirect_y_indexed, &CPU::STA, 6};
+    // LDA
+    t[0xA9] = {&CPU::immediate, &CPU::LDA, 2};
+    t[0xA5] = {&CPU::zeropage, &CPU::LDA, 3};
+    t[0xB5] = {&CPU::zeropage_x_indexed, &CPU::LDA, 4};
+    t[0xAD] = {&CPU::absolute, &CPU::LDA, 4};
+    t[0xBD] = {&CPU::absolute_x_indexed, &CPU::LDA, 4, true};
+    t[0xB9] = {&CPU::absolute_y_indexed, &CPU::LDA, 4, true};
+    t[0xA1] = {&CPU::x_indexed_indirect, &CPU::LDA, 6};
+    t[0xB1] = {&CPU::indirect_y_indexed, &CPU::LDA, 5, true};
+    // CMP
+    t[0xC9] = {&CPU::immediate, &CPU::CMP, 2};
+    t[0xC5] = {&CPU::zeropage, &CPU::CMP, 3};
+    t[0xD5] = {&CPU::zeropage_x_indexed, &CPU::CMP, 4};
+    t[0xCD] = {&CPU::absolute, &CPU::CMP, 4};
+    t[0xDD] = {&CPU::absolute_x_indexed, &CPU::CMP, 4, true};
+    t[0xD9] = {&CPU::absolute_y_indexed, &CPU::CMP, 4, true};
+    t[0xC1] = {&CPU::x_indexed_indirect, &CPU::CMP, 6};
+    t[0xD1] = {&CPU::indirect_y_indexed, &CPU::CMP, 5, true};
+    // SBC, 0xEB is the unofficial duplicate
+    t[0xE9] = {&CPU::immediate, &CPU::SBC, 2};
+    t[0xEB] = {&CPU::immediate, &CPU::SBC, 2};
+    t[0xE5] = {&CPU::zeropage, &CPU::SBC, 3};
+    t[0xF5] = {&CPU::zeropage_x_indexed, &CPU::SBC, 4};
+    t[0xED] = {&CPU::absolute, &CPU::SBC, 4};
+    t[0xFD] = {&CPU::absolute_x_indexed, &CPU::SBC, 4, true};
+    t[0xF9] = {&CPU::absolute_y_indexed, &CPU::SBC, 4, true};
+    t[0xE1] = {&CPU::x_indexed_indirect, &CPU::SBC, 6};
+    t[0xF1] = {&CPU::indirect_y_indexed, &CPU::SBC, 5, true};
 
-void CPU::execute(uint8_t &inst, uint32_t &cycles)
-{
-    const instruction_t *instruction = reinterpret_cast<instruction_t *>(&inst);
-    const int operation = instruction->_a;
-    const int addressingMode = instruction->_b;
-    const int grouping = instruction->_c;
-    uint16_t &PC = (registers.PC.value);
-    switch (grouping)
+    // ASL
+    t[0x0A] = {&CPU::implied, &CPU::ASL_A, 2};
+    t[0x06] = {&CPU::zeropage, &CPU::ASL, 5};
+    t[0x16] = {&CPU::zeropage_x_indexed, &CPU::ASL, 6};
+    t[0x0E] = {&CPU::absolute, &CPU::ASL, 6};
+    t[0x1E] = {&CPU::absolute_x_indexed, &CPU::ASL, 7};
+    // ROL
+    t[0x2A] = {&CPU::implied, &CPU::ROL_A, 2};
+    t[0x26] = {&CPU::zeropage, &CPU::ROL, 5};
+    t[0x36] = {&CPU::zeropage_x_indexed, &CPU::ROL, 6};
+    t[0x2E] = {&CPU::absolute, &CPU::ROL, 6};
+    t[0x3E] = {&CPU::absolute_x_indexed, &CPU::ROL, 7};
+    // LSR
+    t[0x4A] = {&CPU::implied, &CPU::LSR_A, 2};
+    t[0x46] = {&CPU::zeropage, &CPU::LSR, 5};
+    t[0x56] = {&CPU::zeropage_x_indexed, &CPU::LSR, 6};
+    t[0x4E] = {&CPU::absolute, &CPU::LSR, 6};
+    t[0x5E] = {&CPU::absolute_x_indexed, &CPU::LSR, 7};
+    // ROR
+    t[0x6A] = {&CPU::implied, &CPU::ROR_A, 2};
+    t[0x66] = {&CPU::zeropage, &CPU::ROR, 5};
+    t[0x76] = {&CPU::zeropage_x_indexed, &CPU::ROR, 6};
+    t[0x6E] = {&CPU::absolute, &CPU::ROR, 6};
+    t[0x7E] = {&CPU::absolute_x_indexed, &CPU::ROR, 7};
+    // STX, LDX
+    t[0x86] = {&CPU::zeropage, &CPU::STX, 3};
+    t[0x96] = {&CPU::zeropage_y_indexed, &CPU::STX, 4};
+    t[0x8E] = {&CPU::absolute, &CPU::STX, 4};
+    t[0xA2] = {&CPU::immediate, &CPU::LDX, 2};
+    t[0xA6] = {&CPU::zeropage, &CPU::LDX, 3};
+    t[0xB6] = {&CPU::zeropage_y_indexed, &CPU::LDX, 4};
+    t[0xAE] = {&CPU::absolute, &CPU::LDX, 4};
+    t[0xBE] = {&CPU::absolute_y_indexed, &CPU::LDX, 4, true};
+    // DEC, INC
+    t[0xC6] = {&CPU::zeropage, &CPU::DEC, 5};
+    t[0xD6] = {&CPU::zeropage_x_indexed, &CPU::DEC, 6};
+    t[0xCE] = {&CPU::absolute, &CPU::DEC, 6};
+    t[0xDE] = {&CPU::absolute_x_indexed, &CPU::DEC, 7};
+    t[0xE6] = {&CPU::zeropage, &CPU::INC, 5};
+    t[0xF6] = {&CPU::zeropage_x_indexed, &CPU::INC, 6};
+    t[0xEE] = {&CPU::absolute, &CPU::INC, 6};
+    t[0xFE] = {&CPU::absolute_x_indexed, &CPU::INC, 7};
+    // Register transfers and register increments
+    t[0x8A] = {&CPU::implied, &CPU::TXA, 2};
+    t[0xAA] = {&CPU::implied, &CPU::TAX, 2};
+    t[0x9A] = {&CPU::implied, &CPU::TXS, 2};
+    t[0xBA] = {&CPU::implied, &CPU::TSX, 2};
+    t[0x98] = {&CPU::implied, &CPU::TYA, 2};
+    t[0xA8] = {&CPU::implied, &CPU::TAY, 2};
+    t[0xCA] = {&CPU::implied, &CPU::DEX, 2};
+    t[0x88] = {&CPU::implied, &CPU::DEY, 2};
+    t[0xE8] = {&CPU::implied, &CPU::INX, 2};
+    t[0xC8] = {&CPU::implied, &CPU::INY, 2};
+    t[0xEA] = {&CPU::implied, &CPU::NOP, 2};
+
+    // BIT
+    t[0x24] = {&CPU::zeropage, &CPU::BIT, 3};
+    t[0x2C] = {&CPU::absolute, &CPU::BIT, 4};
+    // STY, LDY
+    t[0x84] = {&CPU::zeropage, &CPU::STY, 3};
+    t[0x94] = {&CPU::zeropage_x_indexed, &CPU::STY, 4};
+    t[0x8C] = {&CPU::absolute, &CPU::STY, 4};
+    t[0xA0] = {&CPU::immediate, &CPU::LDY, 2};
+    t[0xA4] = {&CPU::zeropage, &CPU::LDY, 3};
+    t[0xB4] = {&CPU::zeropage_x_indexed, &CPU::LDY, 4};
+    t[0xAC] = {&CPU::absolute, &CPU::LDY, 4};
+    t[0xBC] = {&CPU::absolute_x_indexed, &CPU::LDY, 4, true};
+    // CPY, CPX
+    t[0xC0] = {&CPU::immediate, &CPU::CPY, 2};
+    t[0xC4] = {&CPU::zeropage, &CPU::CPY, 3};
+    t[0xCC] = {&CPU::absolute, &CPU::CPY, 4};
+    t[0xE0] = {&CPU::immediate, &CPU::CPX, 2};
+    t[0xE4] = {&CPU::zeropage, &CPU::CPX, 3};
+    t[0xEC] = {&CPU::absolute, &CPU::CPX, 4};
+    // Jumps and subroutines
+    t[0x4C] = {&CPU::absolute, &CPU::JMP, 3};
+    t[0x6C] = {&CPU::indirect, &CPU::JMP, 5};
+    t[0x20] = {&CPU::absolute, &CPU::JSR, 6};
+    t[0x60] = {&CPU::implied, &CPU::RTS, 6};
+    t[0x00] = {&CPU::implied, &CPU::BRK, 7};
+    t[0x40] = {&CPU::implied, &CPU::RTI, 6};
+    // Stack
+    t[0x08] = {&CPU::implied, &CPU::PHP, 3};
+    t[0x28] = {&CPU::implied, &CPU::PLP, 4};
+    t[0x48] = {&CPU::implied, &CPU::PHA, 3};
+    t[0x68] = {&CPU::implied, &CPU::PLA, 4};
+    // Flags
+    t[0x18] = {&CPU::implied, &CPU::CLC, 2};
+    t[0x38] = {&CPU::implied, &CPU::SEC, 2};
+    t[0x58] = {&CPU::implied, &CPU::CLI, 2};
+    t[0x78] = {&CPU::implied, &CPU::SEI, 2};
+    t[0xB8] = {&CPU::implied, &CPU::CLV, 2};
+    t[0xD8] = {&CPU::implied, &CPU::CLD, 2};
+    t[0xF8] = {&CPU::implied, &CPU::SED, 2};
+    // Branches, xxy10000: xx selects the flag and y the value it is compared against
+    for (int op = 0x10; op < 0x100; op += 0x20)
+    {
+        t[op] = {&CPU::relative, &CPU::BRANCH, 2, true};
+    }
+
+    // Unofficial NOPs still consume their operand bytes
+    for (int op : {0x1A, 0x3A, 0x5A, 0x7A, 0xDA, 0xFA})
+    {
+        t[op] = {&CPU::implied, &CPU::NOP, 2};
+    }
+    for (int op : {0x80, 0x82, 0x89, 0xC2, 0xE2})
+    {
+        t[op] = {&CPU::immediate, &CPU::NOP, 2};
+    }
+    for (int op : {0x04, 0x44, 0x64})
     {
-    case 0:
-        break;
-    case 1:
-        switch (operation)
+        t[op] = {&CPU::zeropage, &CPU::NOP, 3};
+    }
+    for (int op : {0x14, 0x34, 0x54, 0x74, 0xD4, 0xF4})
+    {
+        t[op] = {&CPU::zeropage_x_indexed, &CPU::NOP, 4};
+    }
+    t[0x0C] = {&CPU::absolute, &CPU::NOP, 4};
+    for (int op : {0x1C, 0x3C, 0x5C, 0x7C, 0xDC, 0xFC})
+    {
+        t[op] = {&CPU::absolute_x_indexed, &CPU::NOP, 4, true};
+    }
+    // LAX, SAX
+    t[0xA7] = {&CPU::zeropage, &CPU::LAX, 3};
+    t[0xB7] = {&CPU::zeropage_y_indexed, &CPU::LAX, 4};
+    t[0xAF] = {&CPU::absolute, &CPU::LAX, 4};
+    t[0xBF] = {&CPU::absolute_y_indexed, &CPU::LAX, 4, true};
+    t[0xA3] = {&CPU::x_indexed_indirect, &CPU::LAX, 6};
+    t[0xB3] = {&CPU::indirect_y_indexed, &CPU::LAX, 5, true};
+    t[0x87] = {&CPU::zeropage, &CPU::SAX, 3};
+    t[0x97] = {&CPU::zeropage_y_indexed, &CPU::SAX, 4};
+    t[0x8F] = {&CPU::absolute, &CPU::SAX, 4};
+    t[0x83] = {&CPU::x_indexed_indirect, &CPU::SAX, 6};
+    // Read-modify-write combos share the group 1 layout, aaa111cc
+    const operation combos[] = {&CPU::SLO, &CPU::RLA, &CPU::SRE, &CPU::RRA,
+                                nullptr, nullptr, &CPU::DCP, &CPU::ISB};
+    for (int a = 0; a < 8; a++)
+    {
+        if (combos[a] == nullptr)
         {
-        case 0:
-            // ORA
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                ORA(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                ORA(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                ORA(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+            continue;
+        }
+        const int base = (a << 5) | 0x03;
+        t[base | 0x04] = {&CPU::zeropage, combos[a], 5};
+        t[base | 0x14] = {&CPU::zeropage_x_indexed, combos[a], 6};
+        t[base | 0x0C] = {&CPU::absolute, combos[a], 6};
+        t[base | 0x1C] = {&CPU::absolute_x_indexed, combos[a], 7};
+        t[base | 0x18] = {&CPU::absolute_y_indexed, combos[a], 7};
+        t[base | 0x00] = {&CPU::x_indexed_indirect, combos[a], 8};
+        t[base | 0x10] = {&CPU::indirect_y_indexed, combos[a], 8};
+    }
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                ORA(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                ORA(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+    // Instruction lengths and pre-decoded resolvers for the block cache
+    for (auto &entry : t)
+    {
+        if (entry.mode == &CPU::implied)
+        {
+            entry.length = 1;
+            entry.resolve = &CPU::operand_address;
+        }
+        else if (entry.mode == &CPU::immediate || entry.mode == &CPU::zeropage || entry.mode == &CPU::relative)
+        {
+            entry.length = 2;
+            entry.resolve = &CPU::operand_address;
+        }
+        else if (entry.mode == &CPU::zeropage_x_indexed)
+        {
+            entry.length = 2;
+            entry.resolve = &CPU::zeropage_x_operand;
+        }
+        else if (entry.mode == &CPU::zeropage_y_indexed)
+        {
+            entry.length = 2;
+            entry.resolve = &CPU::zeropage_y_operand;
+        }
+        else if (entry.mode == &CPU::x_indexed_indirect)
+        {
+            entry.length = 2;
+            entry.resolve = &CPU::x_indexed_indirect_operand;
+        }
+        else if (entry.mode == &CPU::indirect_y_indexed)
+        {
+            entry.length = 2;
+            entry.resolve = &CPU::indirect_y_indexed_operand;
+        }
+        else if (entry.mode == &CPU::absolute)
+        {
+            entry.length = 3;
+            entry.resolve = &CPU::operand_address;
+        }
+        else if (entry.mode == &CPU::absolute_x_indexed)
+        {
+            entry.length = 3;
+            entry.resolve = &CPU::absolute_x_operand;
+        }
+        else if (entry.mode == &CPU::absolute_y_indexed)
+        {
+            entry.length = 3;
+            entry.resolve = &CPU::absolute_y_operand;
+        }
+        else if (entry.mode == &CPU::indirect)
+        {
+            entry.length = 3;
+            entry.resolve = &CPU::indirect_operand;
+        }
+    }
+    return t;
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                ORA(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                ORA(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+constexpr std::array<typename CPU<Bus, Flags>::opcode_t, 256> CPU<Bus, Flags>::opcode_table = CPU<Bus, Flags>::make_opcode_table();
 
-            break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                ORA(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-            break;
-        case 1:
-            // AND
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                AND(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                AND(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                AND(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::push(uint8_t value)
+{
+    write(0x100 | registers.SP--, value);
+}
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                AND(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                AND(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+template <class Bus, class Flags>
+uint8_t CPU<Bus, Flags>::pull()
+{
+    return read(0x100 | ++registers.SP);
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                AND(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                AND(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::implied()
+{
+    return 0;
+}
 
-            break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                AND(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-            break;
-        case 2:
-            // EOR
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                EOR(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                EOR(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                EOR(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::immediate()
+{
+    return registers.PC.value++;
+}
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                EOR(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                EOR(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::zeropage()
+{
+    return read(registers.PC.value++);
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                EOR(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                EOR(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::zeropage_x_indexed()
+{
+    return zeropage_x_operand(read(registers.PC.value++));
+}
 
-            break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                EOR(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-            break;
-        case 3:
-            // ADC
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                ADC(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                ADC(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                ADC(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::zeropage_y_indexed()
+{
+    return zeropage_y_operand(read(registers.PC.value++));
+}
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                ADC(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                ADC(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::absolute()
+{
+    halfword absolute;
+    absolute.ll = read(registers.PC.value++);
+    absolute.hh = read(registers.PC.value++);
+    return absolute.value;
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                ADC(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                ADC(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::absolute_x_indexed()
+{
+    return absolute_x_operand(absolute());
+}
 
-            break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                ADC(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-            break;
-        case 4:
-            // STA
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-            }
-            break;
-            case 2:
-            { // Immediate
-              // Illegal
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::absolute_y_indexed()
+{
+    return absolute_y_operand(absolute());
+}
 
-            break;
-            case 3:
-            { // Absolute
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::indirect()
+{
+    return indirect_operand(absolute());
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::x_indexed_indirect()
+{
+    return x_indexed_indirect_operand(read(registers.PC.value++));
+}
 
-            break;
-            case 7:
-            {
-                //  Absolute X indexed
-                
-            }
-            break;
-            }
-            break;
-        case 5:
-            // LDA
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                LDA(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                LDA(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                LDA(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::indirect_y_indexed()
+{
+    return indirect_y_indexed_operand(read(registers.PC.value++));
+}
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                LDA(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                LDA(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::relative()
+{
+    nes_byte offset;
+    offset._unsigned = read(registers.PC.value++);
+    return registers.PC.value + offset._signed;
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                LDA(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                LDA(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::operand_address(uint16_t operand)
+{
+    return operand;
+}
 
-            break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                LDA(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-            break;
-        case 6:
-            // CMP
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                uint8_t value = mmu->read(indirect.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
-            {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                uint8_t value = mmu->read(zeropage.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += 3;
-            }
-            break;
-            case 2:
-            { // Immediate
-                uint8_t value = (mmu->read(PC++));
-                CMP(registers.AC, value, registers.sr);
-                cycles += 2;
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::zeropage_x_operand(uint16_t operand)
+{
+    // Wraps around inside the zero page
+    return uint8_t(operand + registers.X);
+}
 
-            break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                uint8_t value = mmu->read(absolute.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                uint8_t value = mmu->read(indirectY.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::zeropage_y_operand(uint16_t operand)
+{
+    return uint8_t(operand + registers.Y);
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                uint8_t value = mmu->read(zeropage.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                uint8_t value = mmu->read(absoluteyIndexedY.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::absolute_x_operand(uint16_t operand)
+{
+    const uint16_t address = operand + registers.X;
+    extra_cycles = (operand ^ address) > 0xFF;
+    return address;
+}
 
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::absolute_y_operand(uint16_t operand)
+{
+    const uint16_t address = operand + registers.Y;
+    extra_cycles = (operand ^ address) > 0xFF;
+    return address;
+}
+
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::indirect_operand(uint16_t operand)
+{
+    halfword pointer;
+    pointer.value = operand;
+    halfword target;
+    target.ll = read(pointer.value);
+    // The high byte is fetched without carrying into the pointer page
+    pointer.ll++;
+    target.hh = read(pointer.value);
+    return target.value;
+}
+
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::x_indexed_indirect_operand(uint16_t operand)
+{
+    const uint8_t pointer = operand + registers.X;
+    halfword indirect;
+    indirect.ll = read(pointer);
+    indirect.hh = read(uint8_t(pointer + 1));
+    return indirect.value;
+}
+
+template <class Bus, class Flags>
+uint16_t CPU<Bus, Flags>::indirect_y_indexed_operand(uint16_t operand)
+{
+    const uint8_t pointer = operand;
+    halfword indirectY;
+    indirectY.ll = read(pointer);
+    indirectY.hh = read(uint8_t(pointer + 1));
+    const uint16_t address = indirectY.value + registers.Y;
+    extra_cycles = (indirectY.value ^ address) > 0xFF;
+    return address;
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LDA(uint16_t address)
+{
+    alu::transfer_load(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LDX(uint16_t address)
+{
+    alu::transfer_load(registers.X, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LDY(uint16_t address)
+{
+    alu::transfer_load(registers.Y, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::STA(uint16_t address)
+{
+    write(address, registers.AC);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::STX(uint16_t address)
+{
+    write(address, registers.X);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::STY(uint16_t address)
+{
+    write(address, registers.Y);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TAX(uint16_t)
+{
+    alu::transfer_load(registers.X, registers.AC, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TAY(uint16_t)
+{
+    alu::transfer_load(registers.Y, registers.AC, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TSX(uint16_t)
+{
+    alu::transfer_load(registers.X, registers.SP, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TXA(uint16_t)
+{
+    alu::transfer_load(registers.AC, registers.X, status);
+}
+// Special case of transfer which the flags are not set
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TXS(uint16_t)
+{
+    registers.SP = registers.X;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::TYA(uint16_t)
+{
+    alu::transfer_load(registers.AC, registers.Y, status);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::PHA(uint16_t)
+{
+    push(registers.AC);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::PHP(uint16_t)
+{
+    // The pushed copy always has the break and the unused bit set
+    push(flags::pack(status.get(), true).value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::PLA(uint16_t)
+{
+    alu::transfer_load(registers.AC, pull(), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::PLP(uint16_t)
+{
+    status_register_t sr;
+    sr.value = pull();
+    status.put(flags::unpack(sr));
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ADC(uint16_t address)
+{
+    alu::ADC(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SBC(uint16_t address)
+{
+    alu::SBC(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::AND(uint16_t address)
+{
+    alu::AND(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::EOR(uint16_t address)
+{
+    alu::EOR(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ORA(uint16_t address)
+{
+    alu::ORA(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::BIT(uint16_t address)
+{
+    alu::BIT(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CMP(uint16_t address)
+{
+    alu::CMP(registers.AC, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CPX(uint16_t address)
+{
+    alu::CMP(registers.X, read(address), status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CPY(uint16_t address)
+{
+    alu::CMP(registers.Y, read(address), status);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::INC(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::increment(value, status);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::INX(uint16_t)
+{
+    alu::increment(registers.X, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::INY(uint16_t)
+{
+    alu::increment(registers.Y, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::DEC(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::decrement(value, status);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::DEX(uint16_t)
+{
+    alu::decrement(registers.X, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::DEY(uint16_t)
+{
+    alu::decrement(registers.Y, status);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ASL(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::ASL(value, status);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ASL_A(uint16_t)
+{
+    alu::ASL(registers.AC, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LSR(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::LSR(value, status);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LSR_A(uint16_t)
+{
+    alu::LSR(registers.AC, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ROL(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::rotate(value, status, LEFT);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ROL_A(uint16_t)
+{
+    alu::rotate(registers.AC, status, LEFT);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ROR(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::rotate(value, status, RIGHT);
+    write(address, value);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ROR_A(uint16_t)
+{
+    alu::rotate(registers.AC, status, RIGHT);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CLC(uint16_t)
+{
+    status.clear(flags::C);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CLD(uint16_t)
+{
+    status.clear(flags::D);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CLI(uint16_t)
+{
+    status.clear(flags::I);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::CLV(uint16_t)
+{
+    status.clear(flags::V);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SEC(uint16_t)
+{
+    status.set(flags::C);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SED(uint16_t)
+{
+    status.set(flags::D);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SEI(uint16_t)
+{
+    status.set(flags::I);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::BRANCH(uint16_t address)
+{
+    const uint8_t taken = flags::branch_taken(opcode, status.get());
+    const uint8_t crossed = (registers.PC.value ^ address) > 0xFF;
+    extra_cycles = taken + (taken & crossed);
+    registers.PC.value = taken ? address : registers.PC.value;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::JMP(uint16_t address)
+{
+    registers.PC.value = address;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::JSR(uint16_t address)
+{
+    // Pushes the address of the last byte of the instruction
+    halfword ret;
+    ret.value = registers.PC.value - 1;
+    push(ret.hh);
+    push(ret.ll);
+    registers.PC.value = address;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::RTS(uint16_t)
+{
+    halfword ret;
+    ret.ll = pull();
+    ret.hh = pull();
+    registers.PC.value = ret.value + 1;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::BRK(uint16_t)
+{
+    // BRK skips a padding byte
+    halfword ret;
+    ret.value = registers.PC.value + 1;
+    push(ret.hh);
+    push(ret.ll);
+    PHP(0);
+    status.set(flags::I);
+    registers.PC.ll = read(0xFFFE);
+    registers.PC.hh = read(0xFFFF);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::RTI(uint16_t)
+{
+    PLP(0);
+    registers.PC.ll = pull();
+    registers.PC.hh = pull();
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::NOP(uint16_t)
+{
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::LAX(uint16_t address)
+{
+    alu::transfer_load(registers.AC, read(address), status);
+    registers.X = registers.AC;
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SAX(uint16_t address)
+{
+    write(address, registers.AC & registers.X);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::DCP(uint16_t address)
+{
+    uint8_t value = read(address) - 1;
+    write(address, value);
+    alu::CMP(registers.AC, value, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::ISB(uint16_t address)
+{
+    uint8_t value = read(address) + 1;
+    write(address, value);
+    alu::SBC(registers.AC, value, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SLO(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::ASL(value, status);
+    write(address, value);
+    alu::ORA(registers.AC, value, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::RLA(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::rotate(value, status, LEFT);
+    write(address, value);
+    alu::AND(registers.AC, value, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::SRE(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::LSR(value, status);
+    write(address, value);
+    alu::EOR(registers.AC, value, status);
+}
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::RRA(uint16_t address)
+{
+    uint8_t value = read(address);
+    alu::rotate(value, status, RIGHT);
+    write(address, value);
+    alu::ADC(registers.AC, value, status);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::execute(uint8_t &inst, uint32_t &cycles)
+{
+    const opcode_t &entry = opcode_table[inst];
+    opcode = inst;
+    const uint16_t address = (this->*entry.mode)();
+    (this->*entry.op)(address);
+    cycles += entry.cycles + (entry.penalty ? extra_cycles : 0);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::interrupt(uint16_t vector)
+{
+    push(registers.PC.hh);
+    push(registers.PC.ll);
+    push(flags::pack(status.get(), false).value);
+    status.set(flags::I);
+    registers.PC.ll = read(vector);
+    registers.PC.hh = read(vector + 1);
+}
+
+template <class Bus, class Flags>
+bool CPU<Bus, Flags>::poll_events(uint32_t &cycles, bool resumed)
+{
+    if (events & (event_stall | event_yield))
+    {
+        events &= ~(event_stall | event_yield);
+        cycles += stalled;
+        stalled = 0;
+        stop = stop_budget;
+        return true;
+    }
+    if (events & event_nmi)
+    {
+        events &= ~event_nmi;
+        interrupt(0xFFFA);
+        cycles += 7;
+        stop = stop_nmi;
+        return true;
+    }
+    // A masked IRQ keeps the line asserted until the handler acknowledges the device
+    if ((events & event_irq) && !status.test(flags::I))
+    {
+        interrupt(0xFFFE);
+        cycles += 7;
+        stop = stop_irq;
+        return true;
+    }
+    events &= ~event_code_write;
+    if ((events & event_breakpoint) && !resumed && breakpoints[registers.PC.value])
+    {
+        stop = stop_breakpoint;
+        return true;
+    }
+    return false;
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::set_breakpoint(uint16_t address)
+{
+    if (!breakpoints[address])
+    {
+        breakpoints[address] = true;
+        breakpoint_count++;
+    }
+    events |= event_breakpoint;
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::clear_breakpoint(uint16_t address)
+{
+    if (breakpoints[address])
+    {
+        breakpoints[address] = false;
+        breakpoint_count--;
+    }
+    if (breakpoint_count == 0)
+    {
+        events &= ~event_breakpoint;
+    }
+}
+
+template <class Bus, class Flags>
+uint32_t CPU<Bus, Flags>::execute_table(uint32_t max_cycles, uint32_t max_instructions)
+{
+    uint32_t cycles = 0;
+    const run_clock running{this, cycles};
+    uint32_t remaining = max_instructions;
+    stop = stop_budget;
+    while (cycles < max_cycles && remaining != 0)
+    {
+        if (events && poll_events(cycles, remaining == max_instructions))
+        {
             break;
-            case 7:
-            {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                uint8_t value = mmu->read(absoluteyIndexedX.value);
-                CMP(registers.AC, value, registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
-            }
-            break;
-            }
-        case 7:
-            // SBC
-            switch (addressingMode)
-            {
-            case 0:
-            {
-                // X indexed indirect
-                halfword indirect;
-                uint8_t value = mmu->read(PC++);
-                indirect.hh = value + registers.X + 1;
-                indirect.ll = value + registers.X;
-                SBC(registers.AC, mmu->read(indirect.value), registers.sr);
-                cycles += 6;
-            }
-            break;
-            case 1:
+        }
+        remaining--;
+        run_started = cycles;
+        uint8_t inst = read(registers.PC.value++);
+        trace(registers.PC.value - 1, inst, cycles);
+        execute(inst, cycles);
+    }
+    return cycles;
+}
+
+template <class Bus, class Flags>
+typename CPU<Bus, Flags>::block_t *CPU<Bus, Flags>::decode_block(uint16_t pc)
+{
+    decoded_t decoded[BlockCache<decoded_t>::max_block];
+    size_t count = 0;
+    const uint16_t start = pc;
+    uint16_t last = pc;
+    while (count < BlockCache<decoded_t>::max_block)
+    {
+        const uint8_t inst = read(pc);
+        const opcode_t &entry = opcode_table[inst];
+        decoded_t &op = decoded[count++];
+        op.op = entry.op;
+        op.resolve = entry.resolve;
+        op.opcode = inst;
+        op.cycles = entry.cycles;
+        op.penalty = entry.penalty;
+        op.next_pc = pc + entry.length;
+        if (entry.length == 2)
+        {
+            op.operand = read(pc + 1);
+        }
+        else if (entry.length == 3)
+        {
+            halfword operand;
+            operand.ll = read(pc + 1);
+            operand.hh = read(pc + 2);
+            op.operand = operand.value;
+        }
+        else
+        {
+            op.operand = 0;
+        }
+        // Immediate operands are their own address and branch targets are resolved now
+        if (entry.mode == &CPU::immediate)
+        {
+            op.operand = pc + 1;
+        }
+        else if (entry.mode == &CPU::relative)
+        {
+            nes_byte offset;
+            offset._unsigned = op.operand;
+            op.operand = op.next_pc + offset._signed;
+        }
+        last = op.next_pc - 1;
+        // Blocks end at control flow and never wrap past $FFFF
+        const bool control = entry.op == &CPU::BRANCH || entry.op == &CPU::JMP || entry.op == &CPU::JSR ||
+                             entry.op == &CPU::RTS || entry.op == &CPU::RTI || entry.op == &CPU::BRK;
+        if (control || op.next_pc < pc || op.next_pc < BlockCache<decoded_t>::base)
+        {
+            if (op.next_pc < pc)
             {
-                // Zeropage
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                SBC(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 3;
+                last = 0xFFFF;
             }
             break;
-            case 2:
-            { // Immediate
-                SBC(registers.AC, (mmu->read(PC++)), registers.sr);
-                cycles += 2;
-            }
+        }
+        pc = op.next_pc;
+    }
+    if (!cache.fits(count))
+    {
+        // Translated code for the dropped blocks goes with them, like on a bank switch
+        cache.flush(cache.getEpoch());
+#if defined(NESACOLA_JIT)
+        jit_code.reset();
+#endif
+    }
+    return cache.insert(start, last, decoded, count);
+}
 
+template <class Bus, class Flags>
+uint32_t CPU<Bus, Flags>::execute_cached(uint32_t max_cycles, uint32_t max_instructions)
+{
+    uint32_t cycles = 0;
+    const run_clock running{this, cycles};
+    uint32_t remaining = max_instructions;
+    stop = stop_budget;
+    while (cycles < max_cycles && remaining != 0)
+    {
+        if (events && poll_events(cycles, remaining == max_instructions))
+        {
             break;
-            case 3:
-            { // Absolute
-                halfword absolute;
-                absolute.ll = mmu->read(PC++);
-                absolute.hh = mmu->read(PC++);
-                SBC(registers.AC, mmu->read(absolute.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 4:
-            {
-                // Indirect Y indexed
-                halfword indirectY;
-                uint8_t value = mmu->read(PC++);
-                indirectY.hh = value;
-                indirectY.ll = value;
-                indirectY.value += registers.Y;
-                SBC(registers.AC, mmu->read(indirectY.value), registers.sr);
-                cycles += 5 + mmu->checkBoundaryCross();
-            }
+        }
+        const uint16_t pc = registers.PC.value;
+        if (pc < BlockCache<decoded_t>::base)
+        {
+            remaining--;
+            run_started = cycles;
+            uint8_t inst = read(registers.PC.value++);
+            trace(registers.PC.value - 1, inst, cycles);
+            execute(inst, cycles);
+            continue;
+        }
+        if (cache.getEpoch() != bus->mapping_epoch())
+        {
+            cache.flush(bus->mapping_epoch());
+        }
+        const block_t *block = cache.find(pc);
+        if (block == nullptr)
+        {
+            block = decode_block(pc);
+        }
+        run_block(block, cycles, remaining, max_cycles);
+    }
+    return cycles;
+}
 
-            break;
-            case 5:
-            {
-                // zeropage x Indexed
-                halfword zeropage;
-                zeropage.hh = 00;
-                zeropage.ll = mmu->read(PC++);
-                zeropage.ll += registers.X;
-                SBC(registers.AC, mmu->read(zeropage.value), registers.sr);
-                cycles += 4;
-            }
-            break;
-            case 6:
-            {
-                // Absolute y indexed
-                halfword absoluteyIndexedY;
-                absoluteyIndexedY.ll = mmu->read(PC++);
-                absoluteyIndexedY.hh = mmu->read(PC++);
-                absoluteyIndexedY.value += registers.Y;
-                SBC(registers.AC, mmu->read(absoluteyIndexedY.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-            }
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::run_block(const block_t *block, uint32_t &cycles, uint32_t &remaining, uint32_t max_cycles)
+{
+    const decoded_t *op = cache.instructions(block);
+    const decoded_t *end = op + block->count;
+    // Events, including writes into cached code, end the block at the next instruction boundary.
+    // So does a bank switch, the rest of the block may not be mapped anymore
+    do
+    {
+        remaining--;
+        run_started = cycles;
+        trace(registers.PC.value, op->opcode, cycles);
+        registers.PC.value = op->next_pc;
+        opcode = op->opcode;
+        const uint16_t address = (this->*op->resolve)(op->operand);
+        (this->*op->op)(address);
+        cycles += op->cycles + (op->penalty ? extra_cycles : 0);
+        ++op;
+    } while (op != end && cycles < max_cycles && remaining != 0 && !events &&
+             cache.getEpoch() == bus->mapping_epoch());
+}
 
+template <class Bus, class Flags>
+uint32_t CPU<Bus, Flags>::execute_jit(uint32_t max_cycles, uint32_t max_instructions)
+{
+#if defined(NESACOLA_JIT)
+    // Translated code keeps P as a byte, like flags::eager
+    if (!std::is_same<Flags, flags::eager>::value)
+    {
+        return execute_cached(max_cycles, max_instructions);
+    }
+#if defined(NESACOLA_TRACE)
+    if (tracer)
+    {
+        return execute_cached(max_cycles, max_instructions);
+    }
+#endif
+    uint32_t cycles = 0;
+    const run_clock running{this, cycles};
+    uint32_t remaining = max_instructions;
+    stop = stop_budget;
+    while (cycles < max_cycles && remaining != 0)
+    {
+        if (events && poll_events(cycles, remaining == max_instructions))
+        {
             break;
-            case 7:
+        }
+        const uint16_t pc = registers.PC.value;
+        if (pc < BlockCache<decoded_t>::base)
+        {
+            remaining--;
+            run_started = cycles;
+            uint8_t inst = read(registers.PC.value++);
+            trace(registers.PC.value - 1, inst, cycles);
+            execute(inst, cycles);
+            continue;
+        }
+        if (cache.getEpoch() != bus->mapping_epoch())
+        {
+            cache.flush(bus->mapping_epoch());
+            jit_code.reset();
+        }
+        block_t *block = cache.find(pc);
+        if (block == nullptr)
+        {
+            block = decode_block(pc);
+        }
+        if (block->native == nullptr && block->hits++ == jit_threshold)
+        {
+            block = compile_block(pc, block);
+        }
+        // Translated code never looks at the budget, it only runs when the whole block fits
+        if (block->native && !events && block->count <= remaining && cycles + block->native_span < max_cycles)
+        {
+            const auto native = reinterpret_cast<uint32_t (*)(CPU *)>(const_cast<void *>(block->native));
+            run_started = cycles;
+            remaining -= native(this);
+            cycles += jit_cycles;
+            jit_cycles = 0;
+            jit_elapsed = 0;
+            continue;
+        }
+        run_block(block, cycles, remaining, max_cycles);
+    }
+    return cycles;
+#else
+    return execute_cached(max_cycles, max_instructions);
+#endif
+}
+
+#if defined(NESACOLA_JIT)
+template <class Bus, class Flags>
+typename CPU<Bus, Flags>::block_t *CPU<Bus, Flags>::compile_block(uint16_t pc, block_t *block)
+{
+    if (jit_code.refused())
+    {
+        return block;
+    }
+    using jit::mode_kind;
+    using jit::op_kind;
+    const std::pair<operation, op_kind> inline_ops[] = {
+        {&CPU::LDA, op_kind::LDA}, {&CPU::LDX, op_kind::LDX}, {&CPU::LDY, op_kind::LDY},
+        {&CPU::LAX, op_kind::LAX}, {&CPU::STA, op_kind::STA}, {&CPU::STX, op_kind::STX},
+        {&CPU::STY, op_kind::STY}, {&CPU::SAX, op_kind::SAX}, {&CPU::TAX, op_kind::TAX},
+        {&CPU::TAY, op_kind::TAY}, {&CPU::TSX, op_kind::TSX}, {&CPU::TXA, op_kind::TXA},
+        {&CPU::TXS, op_kind::TXS}, {&CPU::TYA, op_kind::TYA}, {&CPU::PHA, op_kind::PHA},
+        {&CPU::PHP, op_kind::PHP}, {&CPU::PLA, op_kind::PLA}, {&CPU::PLP, op_kind::PLP},
+        {&CPU::ADC, op_kind::ADC}, {&CPU::SBC, op_kind::SBC}, {&CPU::AND, op_kind::AND},
+        {&CPU::EOR, op_kind::EOR}, {&CPU::ORA, op_kind::ORA}, {&CPU::BIT, op_kind::BIT},
+        {&CPU::CMP, op_kind::CMP}, {&CPU::CPX, op_kind::CPX}, {&CPU::CPY, op_kind::CPY},
+        {&CPU::INC, op_kind::INC}, {&CPU::INX, op_kind::INX}, {&CPU::INY, op_kind::INY},
+        {&CPU::DEC, op_kind::DEC}, {&CPU::DEX, op_kind::DEX}, {&CPU::DEY, op_kind::DEY},
+        {&CPU::ASL, op_kind::ASL}, {&CPU::ASL_A, op_kind::ASL_A}, {&CPU::LSR, op_kind::LSR},
+        {&CPU::LSR_A, op_kind::LSR_A}, {&CPU::ROL, op_kind::ROL}, {&CPU::ROL_A, op_kind::ROL_A},
+        {&CPU::ROR, op_kind::ROR}, {&CPU::ROR_A, op_kind::ROR_A}, {&CPU::CLC, op_kind::CLC},
+        {&CPU::CLD, op_kind::CLD}, {&CPU::CLI, op_kind::CLI}, {&CPU::CLV, op_kind::CLV},
+        {&CPU::SEC, op_kind::SEC}, {&CPU::SED, op_kind::SED}, {&CPU::SEI, op_kind::SEI},
+        {&CPU::BRANCH, op_kind::BRANCH}, {&CPU::JMP, op_kind::JMP}, {&CPU::JSR, op_kind::JSR},
+        {&CPU::RTS, op_kind::RTS}, {&CPU::NOP, op_kind::NOP},
+    };
+    const std::pair<addressing_mode, mode_kind> modes[] = {
+        {&CPU::implied, mode_kind::implied}, {&CPU::immediate, mode_kind::immediate},
+        {&CPU::zeropage, mode_kind::address}, {&CPU::absolute, mode_kind::address},
+        {&CPU::relative, mode_kind::address}, {&CPU::zeropage_x_indexed, mode_kind::zeropage_x},
+        {&CPU::zeropage_y_indexed, mode_kind::zeropage_y}, {&CPU::absolute_x_indexed, mode_kind::absolute_x},
+        {&CPU::absolute_y_indexed, mode_kind::absolute_y}, {&CPU::x_indexed_indirect, mode_kind::x_indexed_indirect},
+        {&CPU::indirect_y_indexed, mode_kind::indirect_y_indexed},
+    };
+
+    jit::instruction decoded[BlockCache<decoded_t>::max_block];
+    const decoded_t *op = cache.instructions(block);
+    uint32_t span = 0;
+    for (uint32_t i = 0; i < block->count; i++, op++)
+    {
+        const opcode_t &entry = opcode_table[op->opcode];
+        jit::instruction &inst = decoded[i];
+        inst.op = op_kind::interpret;
+        for (const auto &candidate : inline_ops)
+        {
+            if (candidate.first == entry.op)
             {
-                halfword absoluteyIndexedX;
-                absoluteyIndexedX.ll = mmu->read(PC++);
-                absoluteyIndexedX.hh = mmu->read(PC++);
-                absoluteyIndexedX.value += registers.Y;
-                SBC(registers.AC, mmu->read(absoluteyIndexedX.value), registers.sr);
-                cycles += (4 + mmu->checkBoundaryCross());
-                //  Absolute X indexed
+                inst.op = candidate.second;
+                break;
             }
-            break;
+        }
+        inst.mode = mode_kind::other;
+        for (const auto &candidate : modes)
+        {
+            if (candidate.first == entry.mode)
+            {
+                inst.mode = candidate.second;
+                break;
             }
-            break;
         }
-        break;
-    case 2:
-        break;
-    case 3:
-        break;
+        if (inst.mode == mode_kind::other)
+        {
+            inst.op = op_kind::interpret;
+        }
+        // Immediates are translated as constants, writes to cached code drop the block first
+        inst.operand = inst.mode == mode_kind::immediate ? read(op->operand) : op->operand;
+        inst.pc = op->next_pc - entry.length;
+        inst.next_pc = op->next_pc;
+        inst.opcode = op->opcode;
+        inst.cycles = op->cycles;
+        inst.penalty = op->penalty;
+        if (i + 1 < block->count)
+        {
+            // A taken branch is the worst penalty
+            span += op->cycles + 2;
+        }
     }
+
+    const std::vector<uint8_t> code = jit::translate(decoded, block->count, jit_layout());
+    const void *native = jit_code.install(code);
+    if (native == nullptr)
+    {
+        // Out of code space, start over with an empty cache. When the system refused to reprotect
+        // the buffer this drops the blocks on pages that no longer execute, the retry fails and
+        // the block is interpreted
+        cache.flush(cache.getEpoch());
+        jit_code.reset();
+        block = decode_block(pc);
+        native = jit_code.install(code);
+    }
+    block->native = native;
+    block->native_span = span;
+    return block;
+}
+
+template <class Bus, class Flags>
+jit::layout CPU<Bus, Flags>::jit_layout()
+{
+    const auto offset = [this](const void *member)
+    {
+        return int32_t(static_cast<const uint8_t *>(member) - reinterpret_cast<const uint8_t *>(this));
+    };
+    jit::layout state{};
+    state.pc = offset(&registers.PC.value);
+    state.sp = offset(&registers.SP);
+    state.ac = offset(&registers.AC);
+    state.x = offset(&registers.X);
+    state.y = offset(&registers.Y);
+    if constexpr (std::is_same<Flags, flags::eager>::value)
+    {
+        state.p = offset(&status.p);
+    }
+    state.events = offset(&events);
+    state.cycles = offset(&jit_cycles);
+    state.elapsed = offset(&jit_elapsed);
+    state.opcode = offset(&opcode);
+    state.read_pages = bus->getReadPages();
+    state.write_pages = bus->getWritePages();
+    state.nz_table = flags::nz_table.data();
+    state.read = reinterpret_cast<const void *>(&CPU::jit_read);
+    state.write = reinterpret_cast<const void *>(&CPU::jit_write);
+    state.interpret = reinterpret_cast<const void *>(&CPU::jit_interpret);
+    return state;
+}
+
+template <class Bus, class Flags>
+uint8_t CPU<Bus, Flags>::jit_read(CPU *cpu, uint16_t address)
+{
+    return cpu->read(address);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::jit_write(CPU *cpu, uint16_t address, uint8_t value)
+{
+    cpu->write(address, value);
+    // A bank switch may have remapped the running block
+    if (cpu->bus->mapping_epoch() != cpu->cache.getEpoch())
+    {
+        cpu->events |= event_code_write;
+    }
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::jit_interpret(CPU *cpu, uint16_t pc)
+{
+    uint32_t cycles = 0;
+    cpu->registers.PC.value = pc + 1;
+    uint8_t inst = cpu->read(pc);
+    cpu->execute(inst, cycles);
+    cpu->jit_cycles += cycles;
+    if (cpu->bus->mapping_epoch() != cpu->cache.getEpoch())
+    {
+        cpu->events |= event_code_write;
+    }
+}
+#endif
+
+#if defined(__GNUC__)
+// One label per opcode, 0x00 to 0xFF
+#define OPCODE_ROW(h)                                                                  \
+    OPCODE(0x##h##0) OPCODE(0x##h##1) OPCODE(0x##h##2) OPCODE(0x##h##3)                \
+    OPCODE(0x##h##4) OPCODE(0x##h##5) OPCODE(0x##h##6) OPCODE(0x##h##7)                \
+    OPCODE(0x##h##8) OPCODE(0x##h##9) OPCODE(0x##h##A) OPCODE(0x##h##B)                \
+    OPCODE(0x##h##C) OPCODE(0x##h##D) OPCODE(0x##h##E) OPCODE(0x##h##F)
+#define OPCODE_LABELS                                                                  \
+    OPCODE_ROW(0) OPCODE_ROW(1) OPCODE_ROW(2) OPCODE_ROW(3)                            \
+    OPCODE_ROW(4) OPCODE_ROW(5) OPCODE_ROW(6) OPCODE_ROW(7)                            \
+    OPCODE_ROW(8) OPCODE_ROW(9) OPCODE_ROW(A) OPCODE_ROW(B)                            \
+    OPCODE_ROW(C) OPCODE_ROW(D) OPCODE_ROW(E) OPCODE_ROW(F)
+
+template <class Bus, class Flags>
+uint32_t CPU<Bus, Flags>::execute_threaded(uint32_t max_cycles, uint32_t max_instructions)
+{
+#define OPCODE(n) &&op_##n,
+    static const void *const labels[256] = {OPCODE_LABELS};
+#undef OPCODE
+    uint32_t cycles = 0;
+    const run_clock running{this, cycles};
+    uint32_t remaining = max_instructions;
+    stop = stop_budget;
+    // Every handler jumps straight to the next one, giving each opcode its own indirect branch
+#define DISPATCH()                                                              \
+    if (cycles >= max_cycles || remaining == 0)                                 \
+    {                                                                           \
+        return cycles;                                                          \
+    }                                                                           \
+    if (events && poll_events(cycles, remaining == max_instructions))           \
+    {                                                                           \
+        return cycles;                                                          \
+    }                                                                           \
+    remaining--;                                                                \
+    run_started = cycles;                                                       \
+    opcode = read(registers.PC.value++);                                        \
+    trace(registers.PC.value - 1, opcode, cycles);                              \
+    goto *labels[opcode];
+    // The handlers expand the same table entries as execute, with the member pointers resolved at compile time
+#define OPCODE(n)                                                                 \
+    op_##n:                                                                       \
+    {                                                                             \
+        constexpr opcode_t entry = opcode_table[n];                               \
+        const uint16_t address = (this->*entry.mode)();                           \
+        (this->*entry.op)(address);                                               \
+        cycles += entry.cycles + (entry.penalty ? extra_cycles : 0);   \
+    }                                                                             \
+    DISPATCH();
+
+    DISPATCH();
+    OPCODE_LABELS
+#undef OPCODE
+#undef DISPATCH
+    return cycles;
 }
-void CPU::run() {}
\ No newline at end of file
+#undef OPCODE_LABELS
+#undef OPCODE_ROW
+#else
+template <class Bus, class Flags>
+uint32_t CPU<Bus, Flags>::execute_threaded(uint32_t max_cycles, uint32_t max_instructions)
+{
+    return execute_table(max_cycles, max_instructions);
+}
+#endif
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::reset()
+{
+    registers.AC = 0;
+    registers.X = 0;
+    registers.Y = 0;
+    registers.SP = 0xFD;
+    status.put(flags::I | flags::U);
+    registers.PC.ll = read(0xFFFC);
+    registers.PC.hh = read(0xFFFD);
+    events &= ~(event_nmi | event_stall);
+    stalled = 0;
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::save(StateWriter &out) const
+{
+    // A field at a time, registers_t has a padding byte
+    const registers_t saved = getRegisters();
+    out.put(saved.PC.value);
+    out.put(saved.SP);
+    out.put(saved.sr);
+    out.put(saved.AC);
+    out.put(saved.X);
+    out.put(saved.Y);
+    out.put(clock);
+    // A yield or a code write only concern the run they happened in
+    out.put(uint8_t(events & (event_nmi | event_irq | event_stall)));
+    out.put(stalled);
+    out.put(irq_lines);
+    out.put(stop);
+}
+
+template <class Bus, class Flags>
+void CPU<Bus, Flags>::load(StateReader &in)
+{
+    registers_t saved;
+    in.get(saved.PC.value);
+    in.get(saved.SP);
+    in.get(saved.sr);
+    in.get(saved.AC);
+    in.get(saved.X);
+    in.get(saved.Y);
+    setRegisters(saved);
+    in.get(clock);
+    uint8_t pending;
+    in.get(pending);
+    events = (events & event_breakpoint) | pending;
+    in.get(stalled);
+    in.get(irq_lines);
+    in.get(stop);
+}
+
+template class CPU<MMU, flags::eager>;
+template class CPU<MMU, flags::lazy>;
+template class CPU<TestBus, flags::eager>;
+template class CPU<TestBus, flags::lazy>;
+template class CPU<LaneBus, flags::eager>;
+template class CPU<LaneBus, flags::lazy>;
@@ -1,31 +1,459 @@
 #ifndef _CPU_H_
 #define _CPU_H_
 #include "MMU.h"
+#include "Flags.h"
+#include "BlockCache.h"
+#include "Savestate.h"
+#if defined(NESACOLA_JIT)
+#include "Jit.h"
+#endif
+#if defined(NESACOLA_TRACE)
+#include "Trace.h"
+#endif
+#include <array>
+#include <bitset>
 
+struct registers_t
+{
+    halfword PC;
+    uint8_t SP;
+    // Status register, see Flags.h for the layout. Inside the CPU the flag policy owns it
+    uint8_t sr;
+    uint8_t AC;
+    uint8_t X;
+    uint8_t Y;
+};
+
+/*
+ * 6502 core, templated on its bus so reads and writes inline into the opcode kernels.
+ * Bus provides read(address), write(address, nes_byte), mapping_epoch(), which changes
+ * whenever memory is remapped, and getWritePages(), whose null pages hold no code that writes
+ * can change. The JIT tier also uses getReadPages().
+ * Flags is the flag evaluation policy, flags::eager or flags::lazy.
+ */
+template <class Bus, class Flags = default_flags>
 class CPU
 {
 private:
-    struct
+    registers_t registers{};
+    Flags status;
+
+    Bus *bus;
+    // Opcode being executed, the branch kernel decodes its condition from it
+    uint8_t opcode;
+    // Set by the indexed addressing modes when adding the index carried into the high byte (1)
+    // and by taken branches (1, 2 when the target is in another page)
+    uint8_t extra_cycles = 0;
+
+    /*
+     * Resolves the effective address of the current instruction, consuming its operand bytes.
+     */
+    using addressing_mode = uint16_t (CPU::*)();
+    /*
+     * Executes an operation over the effective address returned by the addressing mode.
+     */
+    using operation = void (CPU::*)(uint16_t address);
+    /*
+     * Resolves the effective address from operand bytes that were fetched ahead of time.
+     */
+    using decoded_mode = uint16_t (CPU::*)(uint16_t operand);
+
+    struct opcode_t
     {
-        halfword PC;
-        uint8_t SP;
-        status_register_t sr;
-        uint8_t AC;
-        uint8_t X;
-        uint8_t Y;
+        addressing_mode mode;
+        operation op;
+        // Base cycle count
+        uint8_t cycles;
+        // Indexed reads crossing a page and taken branches add extra_cycles
+        bool penalty = false;
+        // Derived from mode, instruction length and the resolver used on pre-decoded operands
+        uint8_t length = 1;
+        decoded_mode resolve = nullptr;
+    };
+    static const std::array<opcode_t, 256> opcode_table;
+    static constexpr std::array<opcode_t, 256> make_opcode_table();
 
-    } registers;
+    uint8_t read(uint16_t address) { return bus->read(address); }
+    void write(uint16_t address, uint8_t value)
+    {
+        nes_byte byte;
+        byte._unsigned = value;
+        bus->write(address, byte);
+        // Writes to ROM pages are mapper registers, they never change code and bank switches
+        // bump the mapping epoch instead
+        if (cache.covers(address) && bus->getWritePages()[address >> 8])
+        {
+            cache.invalidate(address);
+            events |= event_code_write;
+        }
+    }
+    void push(uint8_t value);
+    uint8_t pull();
+
+    // Addressing modes
+    uint16_t implied();
+    uint16_t immediate();
+    uint16_t zeropage();
+    uint16_t zeropage_x_indexed();
+    uint16_t zeropage_y_indexed();
+    uint16_t absolute();
+    uint16_t absolute_x_indexed();
+    uint16_t absolute_y_indexed();
+    uint16_t indirect();
+    uint16_t x_indexed_indirect();
+    uint16_t indirect_y_indexed();
+    uint16_t relative();
+    // The same modes over a pre-decoded operand. Immediate and relative operands are decoded
+    // to their effective address, like zeropage and absolute ones
+    uint16_t operand_address(uint16_t operand);
+    uint16_t zeropage_x_operand(uint16_t operand);
+    uint16_t zeropage_y_operand(uint16_t operand);
+    uint16_t absolute_x_operand(uint16_t operand);
+    uint16_t absolute_y_operand(uint16_t operand);
+    uint16_t indirect_operand(uint16_t operand);
+    uint16_t x_indexed_indirect_operand(uint16_t operand);
+    uint16_t indirect_y_indexed_operand(uint16_t operand);
+
+    // Load, store and transfer
+    void LDA(uint16_t address);
+    void LDX(uint16_t address);
+    void LDY(uint16_t address);
+    void STA(uint16_t address);
+    void STX(uint16_t address);
+    void STY(uint16_t address);
+    void TAX(uint16_t address);
+    void TAY(uint16_t address);
+    void TSX(uint16_t address);
+    void TXA(uint16_t address);
+    void TXS(uint16_t address);
+    void TYA(uint16_t address);
+    // Stack
+    void PHA(uint16_t address);
+    void PHP(uint16_t address);
+    void PLA(uint16_t address);
+    void PLP(uint16_t address);
+    // Arithmetic and logic
+    void ADC(uint16_t address);
+    void SBC(uint16_t address);
+    void AND(uint16_t address);
+    void EOR(uint16_t address);
+    void ORA(uint16_t address);
+    void BIT(uint16_t address);
+    void CMP(uint16_t address);
+    void CPX(uint16_t address);
+    void CPY(uint16_t address);
+    // Increments and decrements
+    void INC(uint16_t address);
+    void INX(uint16_t address);
+    void INY(uint16_t address);
+    void DEC(uint16_t address);
+    void DEX(uint16_t address);
+    void DEY(uint16_t address);
+    // Shifts, the _A variants operate on the accumulator
+    void ASL(uint16_t address);
+    void ASL_A(uint16_t address);
+    void LSR(uint16_t address);
+    void LSR_A(uint16_t address);
+    void ROL(uint16_t address);
+    void ROL_A(uint16_t address);
+    void ROR(uint16_t address);
+    void ROR_A(uint16_t address);
+    // Flags
+    void CLC(uint16_t address);
+    void CLD(uint16_t address);
+    void CLI(uint16_t address);
+    void CLV(uint16_t address);
+    void SEC(uint16_t address);
+    void SED(uint16_t address);
+    void SEI(uint16_t address);
+    // Control flow, BRANCH covers all of the conditional branches
+    void BRANCH(uint16_t address);
+    void JMP(uint16_t address);
+    void JSR(uint16_t address);
+    void RTS(uint16_t address);
+    void BRK(uint16_t address);
+    void RTI(uint16_t address);
+    void NOP(uint16_t address);
+    // Unofficial opcodes exercised by commercial games and nestest
+    void LAX(uint16_t address);
+    void SAX(uint16_t address);
+    void DCP(uint16_t address);
+    void ISB(uint16_t address);
+    void SLO(uint16_t address);
+    void RLA(uint16_t address);
+    void SRE(uint16_t address);
+    void RRA(uint16_t address);
 
-    MMU *mmu;
     void execute(uint8_t &inst, uint32_t &cycles);
 
+    // Pending events, the run loop only leaves its fast path when this is not zero
+    enum event : uint8_t
+    {
+        event_nmi = 1,
+        event_irq = 2,
+        event_breakpoint = 4,
+        // A write changed a page holding cached blocks, the block being run may be stale
+        event_code_write = 8,
+        // A device halted the CPU, stalled cycles are added before the next instruction
+        event_stall = 16,
+        // The scheduler moved the deadline the run was started with
+        event_yield = 32,
+    };
+    uint8_t events = 0;
+    uint32_t stalled = 0;
+    // IRQ is level triggered, one bit per device holding the line
+    uint8_t irq_lines = 0;
+    std::bitset<0x10000> breakpoints;
+    size_t breakpoint_count = 0;
+
+    /*
+     * Pushes PC and P then jumps through the vector.
+     */
+    void interrupt(uint16_t vector);
+    /*
+     * Services pending interrupts and checks breakpoints, returns true when the run loop must return.
+     * resumed skips the breakpoint check so a run can continue from the breakpoint it stopped at.
+     */
+    bool poll_events(uint32_t &cycles, bool resumed);
+
+    struct decoded_t
+    {
+        operation op;
+        decoded_mode resolve;
+        uint16_t operand;
+        uint16_t next_pc;
+        uint8_t opcode;
+        uint8_t cycles;
+        bool penalty;
+    };
+    using block_t = typename BlockCache<decoded_t>::block_t;
+    BlockCache<decoded_t> cache;
+    /*
+     * Decodes instructions from pc up to the first control flow instruction or max_block.
+     */
+    block_t *decode_block(uint16_t pc);
+    // Runs a decoded block until its end, the budget or an event
+    void run_block(const block_t *block, uint32_t &cycles, uint32_t &remaining, uint32_t max_cycles);
+
+    // Cycles of the runs that have returned, and how far into the current run its instruction started
+    uint64_t clock = 0;
+    uint32_t run_started = 0;
+    /*
+     * Adds a backend's cycle counter to the clock when the run returns.
+     */
+    struct run_clock
+    {
+        CPU *cpu;
+        const uint32_t &cycles;
+        ~run_clock()
+        {
+            cpu->clock += cycles;
+            cpu->run_started = 0;
+        }
+    };
+
+#if defined(NESACOLA_TRACE)
+    TraceRing *tracer = nullptr;
+#endif
+    /*
+     * Records the instruction at pc, cycles into the current run, when a trace ring is attached.
+     * Nothing is left of it without NESACOLA_TRACE.
+     */
+    void trace(uint16_t pc, uint8_t inst, uint32_t cycles)
+    {
+#if defined(NESACOLA_TRACE)
+        if (tracer)
+        {
+            tracer->record({pc, inst, registers.AC, registers.X, registers.Y, registers.SP,
+                            flags::pack(status.get(), false).value, uint32_t(clock + cycles)});
+        }
+#else
+        (void)pc;
+        (void)inst;
+        (void)cycles;
+#endif
+    }
+
+#if defined(NESACOLA_JIT)
+    jit::CodeBuffer jit_code;
+    // Blocks are translated on this many entries
+    uint32_t jit_threshold = 16;
+    // Cycles the translated code only knows while running
+    uint32_t jit_cycles = 0;
+    // Base cycles of the block before the instruction calling out of translated code
+    uint32_t jit_elapsed = 0;
+    /*
+     * Translates the block at pc, returns it again since a full code buffer flushes the cache.
+     */
+    block_t *compile_block(uint16_t pc, block_t *block);
+    jit::layout jit_layout();
+    // Called from translated code
+    static uint8_t jit_read(CPU *cpu, uint16_t address);
+    static void jit_write(CPU *cpu, uint16_t address, uint8_t value);
+    static void jit_interpret(CPU *cpu, uint16_t pc);
+#endif
+
 public:
-    CPU(MMU *mmu)
+    enum irq_source : uint8_t
     {
-        this->mmu = mmu;
+        irq_mapper = 1,
+        irq_frame_counter = 2,
+        irq_dmc = 4,
+    };
+    enum stop_reason
+    {
+        stop_budget,
+        stop_nmi,
+        stop_irq,
+        stop_breakpoint,
+    };
+
+    CPU(Bus *bus)
+    {
+        this->bus = bus;
     }
     ~CPU(){};
-    void run();
+    /*
+     * Loads the reset vector and puts the registers in their power up state.
+     */
+    void reset();
+    registers_t getRegisters() const
+    {
+        registers_t snapshot = registers;
+        snapshot.sr = status.get();
+        return snapshot;
+    }
+    // Loads every register, for cores that keep a CPU's state outside of it between steps
+    void setRegisters(const registers_t &value)
+    {
+        registers = value;
+        status.put(value.sr);
+    }
+
+    /*
+     * Registers, clock and pending interrupts. Breakpoints and decoded code are not state: a load
+     * keeps the breakpoints set, and the block cache follows the banks the mapper restores
+     * through the mapping epoch like after any bank switch.
+     */
+    void save(StateWriter &out) const;
+    // Only between runs
+    void load(StateReader &in);
+
+    stop_reason getStopReason() const
+    {
+        return stop;
+    }
+    /*
+     * Cycles since power on. Devices read it from their register handlers, in the middle of a run
+     * it is the cycle the current instruction started on.
+     */
+    uint64_t getCycles() const
+    {
+#if defined(NESACOLA_JIT)
+        return clock + run_started + jit_cycles + jit_elapsed;
+#else
+        return clock + run_started;
+#endif
+    }
+    /*
+     * The cycle a write from the current instruction lands on. Stores and read-modify-write
+     * instructions write on their last cycle, and their cycle counts never take a penalty.
+     */
+    uint64_t getWriteCycle() const
+    {
+        return getCycles() + opcode_table[opcode].cycles - 1;
+    }
+
+    // Edge triggered, serviced before the next instruction
+    void nmi()
+    {
+        events |= event_nmi;
+    }
+    void set_irq(irq_source source, bool asserted)
+    {
+        irq_lines = asserted ? (irq_lines | source) : (irq_lines & ~source);
+        events = irq_lines ? (events | event_irq) : (events & ~event_irq);
+    }
+    void set_breakpoint(uint16_t address);
+    void clear_breakpoint(uint16_t address);
+#if defined(NESACOLA_TRACE)
+    /*
+     * Records every instruction run from now on into ring, nullptr stops. Translated code is
+     * not traced, the JIT backend runs decoded blocks while a ring is attached.
+     */
+    void attach_trace(TraceRing *ring)
+    {
+        tracer = ring;
+    }
+#endif
+    /*
+     * Halts the CPU for cycles after the current instruction, for DMA. The run returns once they
+     * are spent so the caller sees the time pass.
+     */
+    void stall(uint32_t cycles)
+    {
+        stalled += cycles;
+        events |= event_stall;
+    }
+    // Ends the current run before its next instruction
+    void yield()
+    {
+        events |= event_yield;
+    }
+
+    /*
+     * Runs until at least cycles have elapsed or an event stops the loop, returns the cycles spent.
+     */
+    uint32_t run_for(uint32_t cycles)
+    {
+        return dispatch(cycles, UINT32_MAX);
+    }
+    /*
+     * Runs n instructions unless an event stops the loop first, returns the cycles spent.
+     * step_n(1) gives the exact cost of one instruction, page crossing included.
+     */
+    uint32_t step_n(uint32_t n)
+    {
+        return dispatch(UINT32_MAX, n);
+    }
+
+    /*
+     * Dispatch backends, both run until max_cycles have elapsed, max_instructions have executed
+     * or an event fires, returning the cycles spent. Servicing an interrupt ends the run.
+     */
+    uint32_t execute_table(uint32_t max_cycles, uint32_t max_instructions);
+    // Computed goto dispatch, falls back to execute_table on compilers without labels as values
+    uint32_t execute_threaded(uint32_t max_cycles, uint32_t max_instructions);
+    // Runs pre-decoded blocks from the block cache, code below $8000 is interpreted
+    uint32_t execute_cached(uint32_t max_cycles, uint32_t max_instructions);
+    // Block cache plus x86-64 translation of hot blocks, the same as execute_cached without NESACOLA_JIT
+    // or with lazy flags
+    uint32_t execute_jit(uint32_t max_cycles, uint32_t max_instructions);
+#if defined(NESACOLA_JIT)
+    // 0 translates every block the first time it runs, the differential test uses it
+    void set_jit_threshold(uint32_t entries)
+    {
+        jit_threshold = entries;
+    }
+#endif
+
+private:
+    stop_reason stop = stop_budget;
+
+    // Backend selected by NESACOLA_JIT, NESACOLA_BLOCK_CACHE or NESACOLA_THREADED_DISPATCH
+    uint32_t dispatch(uint32_t max_cycles, uint32_t max_instructions)
+    {
+        events &= ~event_yield;
+#if defined(NESACOLA_JIT)
+        return execute_jit(max_cycles, max_instructions);
+#elif defined(NESACOLA_BLOCK_CACHE)
+        return execute_cached(max_cycles, max_instructions);
+#elif defined(NESACOLA_THREADED_DISPATCH)
+        return execute_threaded(max_cycles, max_instructions);
+#else
+        return execute_table(max_cycles, max_instructions);
+#endif
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,3 +3,168 @@
 //
 
 #include "Cartridge.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const size_t header_size = 16;
+const size_t trainer_size = 512;
+
+/*
+ * NES 2.0 ROM sizes, an MSB nibble of $F switches the LSB to 2^E * (MM * 2 + 1) with LSB = EEEEEEMM.
+ */
+size_t rom_size(uint8_t lsb, uint8_t msb, size_t unit)
+{
+    if (msb == 0x0F)
+    {
+        const int exponent = lsb >> 2;
+        if (exponent > 40)
+        {
+            return SIZE_MAX;
+        }
+        return (size_t(1) << exponent) * ((lsb & 3) * 2 + 1);
+    }
+    return ((size_t(msb) << 8) | lsb) * unit;
+}
+
+// NES 2.0 RAM sizes are 64 << shift, 0 meaning none
+size_t ram_size(uint8_t shift)
+{
+    return shift ? size_t(64) << shift : 0;
+}
+}
+
+Cartridge::~Cartridge()
+{
+    unload();
+}
+
+void Cartridge::unload()
+{
+    if (image)
+    {
+        munmap(const_cast<uint8_t *>(image), image_size);
+        image = nullptr;
+        image_size = 0;
+    }
+    prg = {};
+    chr = {};
+    prg_ram.clear();
+    chr_ram.clear();
+}
+
+bool Cartridge::parse_header(const uint8_t *image, size_t size, header_t &header)
+{
+    if (size < header_size || image[0] != 'N' || image[1] != 'E' || image[2] != 'S' || image[3] != 0x1A)
+    {
+        return false;
+    }
+    header = {};
+    const uint8_t flags6 = image[6];
+    const uint8_t flags7 = image[7];
+    header.nes2 = (flags7 & 0x0C) == 0x08;
+    header.mirroring = (flags6 & 0x08) ? four_screen : (flags6 & 0x01) ? vertical
+                                                                        : horizontal;
+    header.battery = flags6 & 0x02;
+    header.trainer = flags6 & 0x04;
+    if (header.nes2)
+    {
+        header.mapper = (flags6 >> 4) | (flags7 & 0xF0) | ((image[8] & 0x0F) << 8);
+        header.submapper = image[8] >> 4;
+        header.prg_size = rom_size(image[4], image[9] & 0x0F, 0x4000);
+        header.chr_size = rom_size(image[5], image[9] >> 4, 0x2000);
+        header.prg_ram_size = ram_size(image[10] & 0x0F);
+        header.prg_nvram_size = ram_size(image[10] >> 4);
+        header.chr_ram_size = ram_size(image[11] & 0x0F);
+    }
+    else
+    {
+        // Old dumps have text in bytes 12-15 and garbage in the upper mapper nibble
+        const bool dirty = image[12] | image[13] | image[14] | image[15];
+        header.mapper = (flags6 >> 4) | (dirty ? 0 : (flags7 & 0xF0));
+        header.prg_size = image[4] * size_t(0x4000);
+        header.chr_size = image[5] * size_t(0x2000);
+        const size_t ram = (image[8] ? image[8] : 1) * size_t(0x2000);
+        (header.battery ? header.prg_nvram_size : header.prg_ram_size) = ram;
+        header.chr_ram_size = header.chr_size ? 0 : 0x2000;
+    }
+    const size_t body = header_size + (header.trainer ? trainer_size : 0);
+    // Less than one 16KB bank does not fill $8000-$FFFF
+    if (header.prg_size < 0x4000 || header.prg_size > size || header.chr_size > size ||
+        body + header.prg_size + header.chr_size > size)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool Cartridge::load(const char *path)
+{
+    unload();
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < off_t(header_size))
+    {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    image = static_cast<const uint8_t *>(mapped);
+    image_size = info.st_size;
+    if (!parse_header(image, image_size, header))
+    {
+        unload();
+        return false;
+    }
+
+    const uint8_t *body = image + header_size + (header.trainer ? trainer_size : 0);
+    prg = {body, header.prg_size};
+    // Work RAM is mapped as whole 8KB, smaller chips are mirrored by the mask of their board
+    const size_t ram = header.prg_ram_size + header.prg_nvram_size;
+    prg_ram.assign(ram ? (ram < 0x2000 ? 0x2000 : ram) : 0, 0);
+    if (header.chr_size)
+    {
+        chr = {body + header.prg_size, header.chr_size};
+    }
+    else
+    {
+        chr_ram.assign(header.chr_ram_size ? header.chr_ram_size : 0x2000, 0);
+        chr = {chr_ram.data(), chr_ram.size()};
+    }
+    if (header.trainer && prg_ram.size() >= 0x2000)
+    {
+        // Trainers are loaded at $7000
+        std::copy(image + header_size, image + header_size + trainer_size, prg_ram.begin() + 0x1000);
+    }
+    return true;
+}
+
+void Cartridge::map(MMU &mmu)
+{
+    if (!prg_ram.empty())
+    {
+        mmu.map_memory(0x6000, 0x2000, prg_ram.data(), true);
+    }
+    else
+    {
+        // Open, not the work RAM of a cartridge loaded before
+        mmu.map_io(0x6000, 0x2000, io_handler());
+    }
+    // The power on layout of most boards, first bank at $8000 and the last one fixed at $C000
+    mmu.map_rom(0x8000, 0x4000, prg.bank(0, 0x4000));
+    mmu.map_rom(0xC000, 0x4000, prg.bank(prg.size / 0x4000 - 1, 0x4000));
+}
@@ -4,11 +4,139 @@
 
 #ifndef NESACOLA_CARTRIDGE_H
 #define NESACOLA_CARTRIDGE_H
+#include "MMU.h"
+#include "Savestate.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
+/*
+ * A view into ROM or RAM owned by the cartridge, nothing is ever copied out of it.
+ */
+struct rom_span
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
 
-class Cartridge {
-
+    // Bank index of size bankSize, wrapping like the address lines of a smaller chip would
+    const uint8_t *bank(size_t index, size_t bankSize) const
+    {
+        const size_t banks = size / bankSize;
+        return data + (index % (banks ? banks : 1)) * bankSize;
+    }
 };
 
+/*
+ * iNES and NES 2.0 images. The file is mapped read only and PRG/CHR point straight into it,
+ * so instances running the same ROM share its pages.
+ */
+class Cartridge
+{
+public:
+    enum mirroring_t
+    {
+        horizontal,
+        vertical,
+        four_screen,
+        // Set by MMC1 at run time
+        single_lower,
+        single_upper,
+    };
+
+    struct header_t
+    {
+        bool nes2 = false;
+        uint16_t mapper = 0;
+        uint8_t submapper = 0;
+        size_t prg_size = 0;
+        size_t chr_size = 0;
+        // Volatile and battery backed work RAM, $6000-$7FFF
+        size_t prg_ram_size = 0;
+        size_t prg_nvram_size = 0;
+        // Boards without CHR ROM have RAM instead
+        size_t chr_ram_size = 0;
+        mirroring_t mirroring = horizontal;
+        bool battery = false;
+        bool trainer = false;
+    };
+
+    Cartridge() = default;
+    Cartridge(const Cartridge &) = delete;
+    Cartridge &operator=(const Cartridge &) = delete;
+    ~Cartridge();
+
+    /*
+     * Maps the file at path, false when it cannot be read or is not an iNES/NES 2.0 image.
+     */
+    bool load(const char *path);
+    /**
+     * Parses the 16 byte header.
+     * @param size
+     *      size of the whole image, the header is rejected when PRG and CHR do not fit in it.
+     */
+    static bool parse_header(const uint8_t *image, size_t size, header_t &header);
+
+    /*
+     * Maps work RAM at $6000 and the first 32KB of PRG at $8000, a 16KB PRG is mirrored.
+     */
+    void map(MMU &mmu);
+
+    const header_t &getHeader() const
+    {
+        return header;
+    }
+    rom_span getPRG() const
+    {
+        return prg;
+    }
+    // CHR ROM, or the cartridge's CHR RAM
+    rom_span getCHR() const
+    {
+        return chr;
+    }
+    uint8_t *getCHRRam()
+    {
+        return chr_ram.empty() ? nullptr : chr_ram.data();
+    }
+    uint8_t *getPRGRam()
+    {
+        return prg_ram.data();
+    }
+
+    // Work RAM and CHR RAM, their sizes come from the header so they are the same for every state
+    void save(StateWriter &out) const
+    {
+        if (!prg_ram.empty())
+        {
+            out.put(prg_ram.data(), prg_ram.size());
+        }
+        if (!chr_ram.empty())
+        {
+            out.put(chr_ram.data(), chr_ram.size());
+        }
+    }
+    void load(StateReader &in)
+    {
+        if (!prg_ram.empty())
+        {
+            in.get(prg_ram.data(), prg_ram.size());
+        }
+        if (!chr_ram.empty())
+        {
+            in.get(chr_ram.data(), chr_ram.size());
+        }
+    }
+
+private:
+    void unload();
+
+    header_t header;
+    const uint8_t *image = nullptr;
+    size_t image_size = 0;
+    rom_span prg;
+    rom_span chr;
+    std::vector<uint8_t> prg_ram;
+    std::vector<uint8_t> chr_ram;
+};
 
-#endif //NESACOLA_CARTRIDGE_H
+#endif // NESACOLA_CARTRIDGE_H
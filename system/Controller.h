@@ -0,0 +1,85 @@
+#ifndef _CONTROLLER_
+#define _CONTROLLER_
+#include "Savestate.h"
+#include <cstdint>
+
+/*
+ * Standard controller on $4016 or $4017. While the strobe bit written to $4016 is set the shift
+ * register keeps reloading from the buttons, once it is cleared each read shifts out one button,
+ * A first, then 1s after the eighth.
+ */
+class Controller
+{
+public:
+    // Button bits, in the order they are read out
+    enum button
+    {
+        button_a = 0x01,
+        button_b = 0x02,
+        button_select = 0x04,
+        button_start = 0x08,
+        button_up = 0x10,
+        button_down = 0x20,
+        button_left = 0x40,
+        button_right = 0x80,
+    };
+
+    // The buttons held from now on, seen by the game at its next strobe
+    void set_buttons(uint8_t held)
+    {
+        buttons = held;
+        if (strobe)
+        {
+            shift = buttons;
+        }
+    }
+    uint8_t getButtons() const
+    {
+        return buttons;
+    }
+
+    void write_strobe(uint8_t value)
+    {
+        strobe = value & 1;
+        if (strobe)
+        {
+            shift = buttons;
+        }
+    }
+    // Bit 0 of a $4016/$4017 read
+    uint8_t read()
+    {
+        if (strobe)
+        {
+            return buttons & 1;
+        }
+        const uint8_t bit = shift & 1;
+        shift = (shift >> 1) | 0x80;
+        return bit;
+    }
+
+    void reset()
+    {
+        strobe = false;
+        shift = 0;
+    }
+
+    void save(StateWriter &out) const
+    {
+        out.put(buttons);
+        out.put(shift);
+        out.put(strobe);
+    }
+    void load(StateReader &in)
+    {
+        in.get(buttons);
+        in.get(shift);
+        in.get(strobe);
+    }
+
+private:
+    uint8_t buttons = 0;
+    uint8_t shift = 0;
+    bool strobe = false;
+};
+#endif
@@ -0,0 +1,243 @@
+#ifndef _FLAGS_
+#define _FLAGS_
+#include "data_types.h"
+#include <array>
+
+/*
+ * The status register is kept as a plain byte in the 6502 bit layout, so updating several
+ * flags is a single and/or instead of one read-modify-write per bitfield.
+ * It is converted to status_register_t only where the byte leaves the core (PHP, BRK, interrupts).
+ */
+namespace flags
+{
+enum : uint8_t
+{
+    C = 0x01,
+    Z = 0x02,
+    I = 0x04,
+    D = 0x08,
+    B = 0x10,
+    // Reads as set, there is no latch for it
+    U = 0x20,
+    V = 0x40,
+    N = 0x80,
+};
+
+constexpr std::array<uint8_t, 256> make_nz_table()
+{
+    std::array<uint8_t, 256> table{};
+    for (int value = 0; value < 256; value++)
+    {
+        table[value] = (value & N) | (value == 0 ? Z : 0);
+    }
+    return table;
+}
+// N and Z for every result byte
+inline constexpr std::array<uint8_t, 256> nz_table = make_nz_table();
+
+inline void set_nz(uint8_t &p, uint8_t value)
+{
+    p = (p & ~(N | Z)) | nz_table[value];
+}
+// N, Z and C in one update, carry is 0 or 1
+inline void set_nzc(uint8_t &p, uint8_t value, uint8_t carry)
+{
+    p = (p & ~(N | Z | C)) | nz_table[value] | carry;
+}
+
+/*
+ * Packs the register into the byte pushed on the stack, brk tells PHP/BRK apart from IRQ/NMI.
+ */
+inline status_register_t pack(uint8_t p, bool brk)
+{
+    status_register_t status;
+    status.value = p;
+    status.B = brk;
+    status.ignored = 1;
+    return status;
+}
+// B only exists on the stack
+inline uint8_t unpack(status_register_t status)
+{
+    return (status.value & ~B) | U;
+}
+
+/*
+ * Conditional branches are xxy10000, xx selects N, V, C or Z and y is the value that takes the branch.
+ */
+inline bool branch_taken(uint8_t opcode, uint8_t p)
+{
+    constexpr uint8_t shift[4] = {7, 6, 0, 1};
+    return ((p >> shift[opcode >> 6]) & 1) == ((opcode >> 5) & 1);
+}
+
+/*
+ * Flag policies for the CPU, both expose the same operations:
+ * nz/nzc/adc/bit record the outcome of an ALU operation, set/clear/test handle single flags,
+ * get/put convert from and to the status byte.
+ */
+
+// Every operation writes its flags into the status byte right away
+struct eager
+{
+    uint8_t p = I | U;
+
+    void nz(uint8_t value)
+    {
+        set_nz(p, value);
+    }
+    void nzc(uint8_t value, uint8_t carry)
+    {
+        set_nzc(p, value, carry);
+    }
+    // sum is a + b + carry before truncation
+    void adc(uint8_t a, uint8_t b, uint16_t sum)
+    {
+        const uint8_t result = sum & 0xff;
+        const uint8_t overflow = ((~(a ^ b) & (a ^ result)) >> 1) & V;
+        p = (p & ~(N | Z | C | V)) | nz_table[result] | (sum >> 8) | overflow;
+    }
+    void bit(uint8_t ac, uint8_t mem)
+    {
+        p = (p & ~(N | V | Z)) | (mem & (N | V)) | ((ac & mem) == 0 ? Z : 0);
+    }
+    void set(uint8_t mask)
+    {
+        p |= mask;
+    }
+    void clear(uint8_t mask)
+    {
+        p &= ~mask;
+    }
+    uint8_t carry() const
+    {
+        return p & C;
+    }
+    bool test(uint8_t mask) const
+    {
+        return p & mask;
+    }
+    uint8_t get() const
+    {
+        return p;
+    }
+    void put(uint8_t value)
+    {
+        p = value;
+    }
+};
+
+/*
+ * Keeps the last result and operands and only derives N, Z and V when something reads them,
+ * most of the flags an ALU operation produces are overwritten before a branch or PHP sees them.
+ */
+struct lazy
+{
+    // N is bit 7 of n_result and Z is set when z_result is 0, they only differ after BIT and PLP
+    uint8_t n_result = 0;
+    uint8_t z_result = 1;
+    uint8_t carry_flag = 0;
+    // V is bit 7 of (~(a ^ b) & (a ^ result)), a = b = 0 makes it bit 7 of result
+    uint8_t v_a = 0;
+    uint8_t v_b = 0;
+    uint8_t v_result = 0;
+    // I, D and U
+    uint8_t other = I | U;
+
+    void nz(uint8_t value)
+    {
+        n_result = z_result = value;
+    }
+    void nzc(uint8_t value, uint8_t carry)
+    {
+        n_result = z_result = value;
+        carry_flag = carry;
+    }
+    void adc(uint8_t a, uint8_t b, uint16_t sum)
+    {
+        n_result = z_result = sum & 0xff;
+        carry_flag = sum >> 8;
+        v_a = a;
+        v_b = b;
+        v_result = sum & 0xff;
+    }
+    void bit(uint8_t ac, uint8_t mem)
+    {
+        n_result = mem;
+        z_result = ac & mem;
+        v_a = v_b = 0;
+        v_result = mem << 1;
+    }
+    void set(uint8_t mask)
+    {
+        write(mask, true);
+    }
+    void clear(uint8_t mask)
+    {
+        write(mask, false);
+    }
+    uint8_t carry() const
+    {
+        return carry_flag;
+    }
+    bool test(uint8_t mask) const
+    {
+        switch (mask)
+        {
+        case C:
+            return carry_flag;
+        case Z:
+            return z_result == 0;
+        case N:
+            return n_result & N;
+        case V:
+            return overflow();
+        default:
+            return other & mask;
+        }
+    }
+    uint8_t get() const
+    {
+        return other | carry_flag | (z_result == 0 ? Z : 0) | (n_result & N) | (overflow() ? V : 0);
+    }
+    void put(uint8_t value)
+    {
+        n_result = value;
+        z_result = (value & Z) ? 0 : 1;
+        carry_flag = value & C;
+        v_a = v_b = 0;
+        v_result = value << 1;
+        other = (value & (I | D)) | U;
+    }
+
+private:
+    bool overflow() const
+    {
+        return (~(v_a ^ v_b) & (v_a ^ v_result)) & 0x80;
+    }
+    void write(uint8_t mask, bool on)
+    {
+        switch (mask)
+        {
+        case C:
+            carry_flag = on;
+            break;
+        case V:
+            v_a = v_b = 0;
+            v_result = on ? 0x80 : 0;
+            break;
+        default:
+            other = on ? (other | mask) : (other & ~mask);
+            break;
+        }
+    }
+};
+}
+
+// Selected at build time with NESACOLA_LAZY_FLAGS
+#ifdef NESACOLA_LAZY_FLAGS
+using default_flags = flags::lazy;
+#else
+using default_flags = flags::eager;
+#endif
+#endif
@@ -0,0 +1,21 @@
+#ifndef _HASH_
+#define _HASH_
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * FNV-1a over bytes, for telling runs apart: the batch runner prints it for frames and audio and
+ * the tests compare it. Passing the last result as seed continues a hash over several buffers.
+ */
+constexpr uint64_t fnv_basis = 0xCBF29CE484222325ull;
+
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t seed = fnv_basis)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        seed = (seed ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return seed;
+}
+#endif
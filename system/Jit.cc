@@ -0,0 +1,1074 @@
+#include "Jit.h"
+#include "Flags.h"
+#include <cstring>
+#include <functional>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace jit
+{
+namespace x64
+{
+Emitter::label Emitter::new_label()
+{
+    labels.push_back(SIZE_MAX);
+    return labels.size() - 1;
+}
+
+void Emitter::bind(label target)
+{
+    labels[target] = bytes.size();
+}
+
+const std::vector<uint8_t> &Emitter::finish()
+{
+    for (const auto &fixup : fixups)
+    {
+        const int32_t offset = int32_t(labels[fixup.second] - (fixup.first + 4));
+        std::memcpy(&bytes[fixup.first], &offset, sizeof(offset));
+    }
+    fixups.clear();
+    return bytes;
+}
+
+void Emitter::byte(uint8_t value)
+{
+    bytes.push_back(value);
+}
+
+void Emitter::dword(uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        byte(value >> shift);
+    }
+}
+
+/*
+ * byteRegs forces the prefix so register 4 to 7 as a byte operand means spl/bpl/sil/dil and not ah/ch/dh/bh.
+ */
+void Emitter::rex(bool wide, int r, int x, int b, bool byteRegs)
+{
+    const uint8_t prefix = 0x40 | (wide << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+    if (prefix != 0x40 || byteRegs)
+    {
+        byte(prefix);
+    }
+}
+
+void Emitter::encode(std::initializer_list<uint8_t> opcode, int r, int rm, bool wide, bool byteRegs)
+{
+    rex(wide, r, 0, rm, byteRegs);
+    for (uint8_t b : opcode)
+    {
+        byte(b);
+    }
+    byte(0xC0 | ((r & 7) << 3) | (rm & 7));
+}
+
+void Emitter::encode(std::initializer_list<uint8_t> opcode, int r, const mem &m, bool wide, bool byteRegs)
+{
+    rex(wide, r, m.indexed ? m.index : 0, m.base, byteRegs);
+    for (uint8_t b : opcode)
+    {
+        byte(b);
+    }
+    // Always with a displacement, which also covers rbp and r13 as the base
+    const bool shortDisp = m.disp >= -128 && m.disp <= 127;
+    const uint8_t mod = shortDisp ? 0x40 : 0x80;
+    if (m.indexed)
+    {
+        byte(mod | ((r & 7) << 3) | 4);
+        byte((m.scale << 6) | ((m.index & 7) << 3) | (m.base & 7));
+    }
+    else if ((m.base & 7) == rsp)
+    {
+        byte(mod | ((r & 7) << 3) | 4);
+        byte(0x24);
+    }
+    else
+    {
+        byte(mod | ((r & 7) << 3) | (m.base & 7));
+    }
+    if (shortDisp)
+    {
+        byte(m.disp);
+    }
+    else
+    {
+        dword(m.disp);
+    }
+}
+
+void Emitter::rel32(label target)
+{
+    fixups.push_back({bytes.size(), target});
+    dword(0);
+}
+
+namespace
+{
+bool byte_reg(int r)
+{
+    return r >= rsp && r <= rdi;
+}
+}
+
+void Emitter::mov(reg dst, reg src)
+{
+    encode({0x8B}, dst, src);
+}
+void Emitter::mov(reg dst, uint32_t imm)
+{
+    rex(false, 0, 0, dst, false);
+    byte(0xB8 | (dst & 7));
+    dword(imm);
+}
+void Emitter::mov64(reg dst, reg src)
+{
+    encode({0x8B}, dst, src, true);
+}
+void Emitter::mov64(reg dst, uint64_t imm)
+{
+    rex(true, 0, 0, dst, false);
+    byte(0xB8 | (dst & 7));
+    dword(imm);
+    dword(imm >> 32);
+}
+void Emitter::load(reg dst, mem src)
+{
+    encode({0x8B}, dst, src);
+}
+void Emitter::load64(reg dst, mem src)
+{
+    encode({0x8B}, dst, src, true);
+}
+void Emitter::load8(reg dst, mem src)
+{
+    encode({0x0F, 0xB6}, dst, src);
+}
+void Emitter::zx8(reg dst, reg src)
+{
+    encode({0x0F, 0xB6}, dst, src, false, byte_reg(src));
+}
+void Emitter::zx16(reg dst, reg src)
+{
+    encode({0x0F, 0xB7}, dst, src);
+}
+void Emitter::store8(mem dst, reg src)
+{
+    encode({0x88}, src, dst, false, byte_reg(src));
+}
+void Emitter::store16(mem dst, reg src)
+{
+    byte(0x66);
+    encode({0x89}, src, dst);
+}
+void Emitter::store16(mem dst, uint16_t imm)
+{
+    byte(0x66);
+    encode({0xC7}, 0, dst);
+    byte(imm);
+    byte(imm >> 8);
+}
+void Emitter::store32(mem dst, uint32_t imm)
+{
+    encode({0xC7}, 0, dst);
+    for (int i = 0; i < 4; i++)
+    {
+        byte(imm >> (i * 8));
+    }
+}
+void Emitter::lea(reg dst, mem src)
+{
+    encode({0x8D}, dst, src);
+}
+
+void Emitter::alu(alu_op op, reg dst, reg src)
+{
+    encode({uint8_t((op << 3) | 0x01)}, src, dst);
+}
+void Emitter::alu(alu_op op, reg dst, int32_t imm)
+{
+    if (imm >= -128 && imm <= 127)
+    {
+        encode({0x83}, op, dst);
+        byte(imm);
+    }
+    else
+    {
+        encode({0x81}, op, dst);
+        dword(imm);
+    }
+}
+void Emitter::alu(alu_op op, reg dst, mem src)
+{
+    encode({uint8_t((op << 3) | 0x03)}, dst, src);
+}
+void Emitter::alu(alu_op op, mem dst, int32_t imm)
+{
+    if (imm >= -128 && imm <= 127)
+    {
+        encode({0x83}, op, dst);
+        byte(imm);
+    }
+    else
+    {
+        encode({0x81}, op, dst);
+        dword(imm);
+    }
+}
+void Emitter::alu(alu_op op, mem dst, reg src)
+{
+    encode({uint8_t((op << 3) | 0x01)}, src, dst);
+}
+void Emitter::alu64(alu_op op, reg dst, int32_t imm)
+{
+    encode({0x81}, op, dst, true);
+    dword(imm);
+}
+void Emitter::test(reg a, reg b)
+{
+    encode({0x85}, b, a);
+}
+void Emitter::test64(reg a, reg b)
+{
+    encode({0x85}, b, a, true);
+}
+void Emitter::test8(mem a, uint8_t imm)
+{
+    encode({0xF6}, 0, a);
+    byte(imm);
+}
+void Emitter::shl(reg dst, uint8_t count)
+{
+    encode({0xC1}, 4, dst);
+    byte(count);
+}
+void Emitter::shr(reg dst, uint8_t count)
+{
+    encode({0xC1}, 5, dst);
+    byte(count);
+}
+void Emitter::not_(reg dst)
+{
+    encode({0xF7}, 2, dst);
+}
+void Emitter::inc8(mem dst)
+{
+    encode({0xFE}, 0, dst);
+}
+void Emitter::dec8(mem dst)
+{
+    encode({0xFE}, 1, dst);
+}
+void Emitter::setcc(cond condition, reg dst)
+{
+    encode({0x0F, uint8_t(0x90 | condition)}, 0, dst, false, byte_reg(dst));
+}
+
+void Emitter::jcc(cond condition, label target)
+{
+    byte(0x0F);
+    byte(0x80 | condition);
+    rel32(target);
+}
+void Emitter::jmp(label target)
+{
+    byte(0xE9);
+    rel32(target);
+}
+void Emitter::call(const void *function)
+{
+    mov64(rax, uint64_t(reinterpret_cast<uintptr_t>(function)));
+    encode({0xFF}, 2, rax);
+}
+void Emitter::push(reg src)
+{
+    rex(false, 0, 0, src, false);
+    byte(0x50 | (src & 7));
+}
+void Emitter::pop(reg dst)
+{
+    rex(false, 0, 0, dst, false);
+    byte(0x58 | (dst & 7));
+}
+void Emitter::ret()
+{
+    byte(0xC3);
+}
+}
+
+CodeBuffer::~CodeBuffer()
+{
+    if (memory)
+    {
+        munmap(memory, size);
+    }
+}
+
+const void *CodeBuffer::install(const std::vector<uint8_t> &code)
+{
+    if (denied)
+    {
+        return nullptr;
+    }
+    if (memory == nullptr)
+    {
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+            denied = true;
+            return nullptr;
+        }
+        memory = static_cast<uint8_t *>(mapped);
+    }
+    // Blocks start on a 16 byte boundary
+    const size_t start = (used + 15) & ~size_t(15);
+    if (start + code.size() > size)
+    {
+        return nullptr;
+    }
+    // Never writable and executable at the same time, only the pages the block lands on flip
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    const size_t first = start & ~(page - 1);
+    const size_t last = (start + code.size() + page - 1) & ~(page - 1);
+    if (mprotect(memory + first, last - first, PROT_READ | PROT_WRITE) != 0)
+    {
+        denied = true;
+        return nullptr;
+    }
+    std::memcpy(memory + start, code.data(), code.size());
+    if (mprotect(memory + first, last - first, PROT_READ | PROT_EXEC) != 0)
+    {
+        // Blocks already on these pages cannot run either, the caller drops them
+        denied = true;
+        return nullptr;
+    }
+    used = start + code.size();
+    return memory + start;
+}
+
+namespace
+{
+using namespace x64;
+
+// The 6502 registers live in callee saved registers, so they survive calls into the helpers
+const reg A = rbx;
+const reg X = rbp;
+const reg Y = r14;
+const reg P = r15;
+const reg cpu = r12;
+const reg nz = r13;
+// Stack slots below the saved registers, the address across a slow read, a scratch byte and
+// the page crossing of the current instruction
+const int32_t saved_address = 0;
+const int32_t scratch = 8;
+const int32_t crossing = 16;
+
+/*
+ * Effective address of the instruction being translated, known at translation time
+ * or computed into esi.
+ */
+struct target
+{
+    bool constant;
+    uint16_t address;
+};
+
+class translator
+{
+public:
+    translator(const layout &state) : state(state) {}
+
+    std::vector<uint8_t> run(const instruction *block, size_t count)
+    {
+        epilogue = e.new_label();
+        prologue();
+        for (size_t i = 0; i < count; i++)
+        {
+            executed = i + 1;
+            if (!emit(block[i]))
+            {
+                // Control flow, the block ends here
+                break;
+            }
+            if (executed == count)
+            {
+                leave(block[i].next_pc, true);
+            }
+        }
+        for (auto &code : cold)
+        {
+            code();
+        }
+        e.bind(epilogue);
+        e.store8(at(cpu, state.ac), A);
+        e.store8(at(cpu, state.x), X);
+        e.store8(at(cpu, state.y), Y);
+        e.store8(at(cpu, state.p), P);
+        e.alu64(add, rsp, 24);
+        for (reg r : {r15, r14, r13, r12, rbp, rbx})
+        {
+            e.pop(r);
+        }
+        e.ret();
+        return e.finish();
+    }
+
+private:
+    const layout &state;
+    Emitter e;
+    Emitter::label epilogue;
+    // Slow paths and exits go after the block so the common path falls through
+    std::vector<std::function<void()>> cold;
+    // Instructions run, including the one being translated
+    size_t executed = 0;
+    // Base cycles of the inline instructions so far, interpreted ones add their own
+    uint32_t cycles = 0;
+    // The current instruction may have called into the bus or the interpreter
+    bool called = false;
+    // The current instruction left a page crossing in its stack slot
+    bool penalty = false;
+    // Opcode of the current instruction
+    uint8_t opcode = 0;
+
+    void prologue()
+    {
+        for (reg r : {rbx, rbp, r12, r13, r14, r15})
+        {
+            e.push(r);
+        }
+        // Six pushes and the return address, 24 more keeps calls 16 byte aligned
+        e.alu64(sub, rsp, 24);
+        e.mov64(cpu, rdi);
+        e.mov64(nz, uint64_t(reinterpret_cast<uintptr_t>(state.nz_table)));
+        e.load8(A, at(cpu, state.ac));
+        e.load8(X, at(cpu, state.x));
+        e.load8(Y, at(cpu, state.y));
+        e.load8(P, at(cpu, state.p));
+    }
+
+    /*
+     * Returns to the run loop with pc as the next instruction, known is false when PC was already stored.
+     */
+    void exit_code(uint16_t pc, bool known, size_t count, uint32_t extra)
+    {
+        if (known)
+        {
+            e.store16(at(cpu, state.pc), pc);
+        }
+        if (extra)
+        {
+            e.alu(add, at(cpu, state.cycles), int32_t(extra));
+        }
+        e.mov(rax, uint32_t(count));
+        e.jmp(epilogue);
+    }
+    void leave(uint16_t pc, bool known, uint32_t extra = 0)
+    {
+        exit_code(pc, known, executed, cycles + extra);
+    }
+    // A jump taken to an exit placed in the cold section
+    Emitter::label exit_label(uint16_t pc, bool known, uint32_t extra = 0)
+    {
+        const Emitter::label label = e.new_label();
+        const size_t count = executed;
+        const uint32_t total = cycles + extra;
+        cold.push_back([=]
+                       {
+                           e.bind(label);
+                           exit_code(pc, known, count, total); });
+        return label;
+    }
+
+    void call_read()
+    {
+        e.store16(at(rsp, saved_address), rsi);
+        e.mov64(rdi, cpu);
+        e.call(state.read);
+        e.zx8(rax, rax);
+        e.load(rsi, at(rsp, saved_address));
+        e.zx16(rsi, rsi);
+    }
+    // Reads into eax, a runtime address stays in esi
+    void read(target t)
+    {
+        called = true;
+        const Emitter::label slow = e.new_label();
+        const Emitter::label done = e.new_label();
+        if (t.constant)
+        {
+            e.mov64(rdx, uint64_t(reinterpret_cast<uintptr_t>(state.read_pages + (t.address >> 8))));
+            e.load64(rdx, at(rdx));
+            e.test64(rdx, rdx);
+            e.jcc(equal, slow);
+            e.load8(rax, at(rdx, t.address & 0xFF));
+        }
+        else
+        {
+            e.mov(rax, rsi);
+            e.shr(rax, 8);
+            e.mov64(rdx, uint64_t(reinterpret_cast<uintptr_t>(state.read_pages)));
+            e.load64(rdx, at(rdx, rax, 3));
+            e.test64(rdx, rdx);
+            e.jcc(equal, slow);
+            e.zx8(rcx, rsi);
+            e.load8(rax, at(rdx, rcx, 0));
+        }
+        e.bind(done);
+        const uint32_t elapsed = cycles;
+        cold.push_back([=]
+                       {
+                           e.bind(slow);
+                           if (t.constant)
+                           {
+                               e.mov(rsi, t.address);
+                           }
+                           e.store32(at(cpu, state.elapsed), elapsed);
+                           call_read();
+                           e.jmp(done); });
+    }
+    /*
+     * Writes ecx. Code is only cached from $8000 up, so writes there always go through the helper
+     * and it can invalidate the blocks they hit.
+     */
+    void write(target t)
+    {
+        called = true;
+        const Emitter::label slow = e.new_label();
+        const Emitter::label done = e.new_label();
+        if (t.constant)
+        {
+            if (t.address >= 0x8000)
+            {
+                e.jmp(slow);
+            }
+            else
+            {
+                e.mov64(rdx, uint64_t(reinterpret_cast<uintptr_t>(state.write_pages + (t.address >> 8))));
+                e.load64(rdx, at(rdx));
+                e.test64(rdx, rdx);
+                e.jcc(equal, slow);
+                e.store8(at(rdx, t.address & 0xFF), rcx);
+            }
+        }
+        else
+        {
+            e.mov(rax, rsi);
+            e.shr(rax, 8);
+            e.alu(cmp, rax, 0x80);
+            e.jcc(above_equal, slow);
+            e.mov64(rdx, uint64_t(reinterpret_cast<uintptr_t>(state.write_pages)));
+            e.load64(rdx, at(rdx, rax, 3));
+            e.test64(rdx, rdx);
+            e.jcc(equal, slow);
+            e.zx8(rax, rsi);
+            e.store8(at(rdx, rax, 0), rcx);
+        }
+        e.bind(done);
+        const uint32_t elapsed = cycles;
+        const uint8_t current = opcode;
+        cold.push_back([=]
+                       {
+                           e.bind(slow);
+                           if (t.constant)
+                           {
+                               e.mov(rsi, t.address);
+                           }
+                           e.store32(at(cpu, state.elapsed), elapsed);
+                           e.mov(rdx, current);
+                           e.store8(at(cpu, state.opcode), rdx);
+                           e.mov(rdx, rcx);
+                           e.mov64(rdi, cpu);
+                           e.call(state.write);
+                           e.jmp(done); });
+    }
+
+    // ecx on the stack page
+    void push()
+    {
+        e.load8(rsi, at(cpu, state.sp));
+        e.alu(or_, rsi, 0x100);
+        write({false, 0});
+        e.dec8(at(cpu, state.sp));
+    }
+    // eax from the stack page
+    void pull()
+    {
+        e.inc8(at(cpu, state.sp));
+        e.load8(rsi, at(cpu, state.sp));
+        e.alu(or_, rsi, 0x100);
+        read({false, 0});
+    }
+
+    void set_nz(reg value)
+    {
+        e.alu(and_, P, uint8_t(~(flags::N | flags::Z)));
+        e.load8(rdx, at(nz, value, 0));
+        e.alu(or_, P, rdx);
+    }
+    // carry is 0 or 1
+    void set_nzc(reg value, reg carry)
+    {
+        e.alu(and_, P, uint8_t(~(flags::N | flags::Z | flags::C)));
+        e.load8(rdx, at(nz, value, 0));
+        e.alu(or_, P, rdx);
+        e.alu(or_, P, carry);
+    }
+
+    /*
+     * Computes the effective address into esi, or returns it when it is known now.
+     */
+    target address(const instruction &inst)
+    {
+        switch (inst.mode)
+        {
+        case mode_kind::address:
+            return {true, inst.operand};
+        case mode_kind::zeropage_x:
+        case mode_kind::zeropage_y:
+            e.lea(rsi, at(inst.mode == mode_kind::zeropage_x ? X : Y, int32_t(inst.operand)));
+            e.zx8(rsi, rsi);
+            return {false, 0};
+        case mode_kind::absolute_x:
+        case mode_kind::absolute_y:
+            e.lea(rsi, at(inst.mode == mode_kind::absolute_x ? X : Y, int32_t(inst.operand)));
+            if (inst.penalty)
+            {
+                e.mov(rcx, rsi);
+                e.shr(rcx, 8);
+                e.alu(cmp, rcx, int32_t(inst.operand >> 8));
+                e.setcc(not_equal, rcx);
+                crossed();
+            }
+            e.zx16(rsi, rsi);
+            return {false, 0};
+        case mode_kind::x_indexed_indirect:
+            e.lea(rsi, at(X, int32_t(inst.operand)));
+            e.zx8(rsi, rsi);
+            read({false, 0});
+            e.store8(at(rsp, scratch), rax);
+            e.alu(add, rsi, 1);
+            e.zx8(rsi, rsi);
+            read({false, 0});
+            e.shl(rax, 8);
+            e.load8(rcx, at(rsp, scratch));
+            e.alu(or_, rax, rcx);
+            e.mov(rsi, rax);
+            return {false, 0};
+        case mode_kind::indirect_y_indexed:
+            read({true, uint16_t(inst.operand & 0xFF)});
+            e.store8(at(rsp, scratch), rax);
+            read({true, uint16_t((inst.operand + 1) & 0xFF)});
+            e.shl(rax, 8);
+            e.load8(rcx, at(rsp, scratch));
+            e.alu(or_, rax, rcx);
+            e.lea(rsi, at(rax, Y, 0));
+            if (inst.penalty)
+            {
+                e.mov(rcx, rsi);
+                e.alu(xor_, rcx, rax);
+                e.alu(cmp, rcx, 0xFF);
+                e.setcc(above, rcx);
+                crossed();
+            }
+            e.zx16(rsi, rsi);
+            return {false, 0};
+        default:
+            return {true, 0};
+        }
+    }
+    // The byte in cl is 0 or 1, added to the run time cycles once the instruction is done so
+    // its own bus accesses see the cycle it started on
+    void crossed()
+    {
+        e.zx8(rcx, rcx);
+        e.store8(at(rsp, crossing), rcx);
+        penalty = true;
+    }
+
+    // The operand value into eax
+    void fetch(const instruction &inst)
+    {
+        if (inst.mode == mode_kind::immediate)
+        {
+            e.mov(rax, uint32_t(inst.operand));
+            return;
+        }
+        read(address(inst));
+    }
+
+    void compare(reg r)
+    {
+        e.mov(rcx, r);
+        e.alu(sub, rcx, rax);
+        e.zx8(rcx, rcx);
+        e.alu(cmp, r, rax);
+        e.setcc(above_equal, r8);
+        e.zx8(r8, r8);
+        set_nzc(rcx, r8);
+    }
+    // ADC of eax into A
+    void add_with_carry()
+    {
+        e.mov(rdx, P);
+        e.alu(and_, rdx, flags::C);
+        e.alu(add, rdx, A);
+        e.alu(add, rdx, rax);
+        // V is bit 7 of ~(a ^ b) & (a ^ result), moved to bit 6
+        e.mov(rcx, A);
+        e.alu(xor_, rcx, rax);
+        e.not_(rcx);
+        e.mov(r8, A);
+        e.alu(xor_, r8, rdx);
+        e.alu(and_, rcx, r8);
+        e.shr(rcx, 1);
+        e.alu(and_, rcx, flags::V);
+        e.mov(r8, rdx);
+        e.shr(r8, 8);
+        e.zx8(A, rdx);
+        e.alu(and_, P, uint8_t(~(flags::N | flags::Z | flags::C | flags::V)));
+        e.load8(rdx, at(nz, A, 0));
+        e.alu(or_, P, rdx);
+        e.alu(or_, P, r8);
+        e.alu(or_, P, rcx);
+    }
+    // Shifts and rotates of the byte in value
+    void shift(op_kind op, reg value)
+    {
+        switch (op)
+        {
+        case op_kind::ASL:
+        case op_kind::ASL_A:
+        case op_kind::ROL:
+        case op_kind::ROL_A:
+            e.mov(rcx, value);
+            e.shr(rcx, 7);
+            e.shl(value, 1);
+            if (op == op_kind::ROL || op == op_kind::ROL_A)
+            {
+                e.mov(r8, P);
+                e.alu(and_, r8, flags::C);
+                e.alu(or_, value, r8);
+            }
+            e.zx8(value, value);
+            break;
+        default:
+            e.mov(rcx, value);
+            e.alu(and_, rcx, 1);
+            e.shr(value, 1);
+            if (op == op_kind::ROR || op == op_kind::ROR_A)
+            {
+                e.mov(r8, P);
+                e.alu(and_, r8, flags::C);
+                e.shl(r8, 7);
+                e.alu(or_, value, r8);
+            }
+            break;
+        }
+        set_nzc(value, rcx);
+    }
+    // Read, modify in eax, write back
+    void modify(const instruction &inst, const std::function<void()> &operation)
+    {
+        const target t = address(inst);
+        read(t);
+        operation();
+        e.mov(rcx, rax);
+        write(t);
+    }
+
+    void interpret(const instruction &inst)
+    {
+        called = true;
+        e.store8(at(cpu, state.ac), A);
+        e.store8(at(cpu, state.x), X);
+        e.store8(at(cpu, state.y), Y);
+        e.store8(at(cpu, state.p), P);
+        e.store32(at(cpu, state.elapsed), cycles);
+        e.mov64(rdi, cpu);
+        e.mov(rsi, uint32_t(inst.pc));
+        e.call(state.interpret);
+        e.load8(A, at(cpu, state.ac));
+        e.load8(X, at(cpu, state.x));
+        e.load8(Y, at(cpu, state.y));
+        e.load8(P, at(cpu, state.p));
+    }
+
+    void flag(uint8_t mask, bool on)
+    {
+        if (on)
+        {
+            e.alu(or_, P, mask);
+        }
+        else
+        {
+            e.alu(and_, P, uint8_t(~mask));
+        }
+    }
+
+    void transfer(reg dst, reg src)
+    {
+        e.mov(dst, src);
+        set_nz(dst);
+    }
+
+    /*
+     * Emits one instruction, returns false when it ended the block.
+     */
+    bool emit(const instruction &inst)
+    {
+        called = false;
+        penalty = false;
+        opcode = inst.opcode;
+        switch (inst.op)
+        {
+        case op_kind::LDA:
+            fetch(inst);
+            transfer(A, rax);
+            break;
+        case op_kind::LDX:
+            fetch(inst);
+            transfer(X, rax);
+            break;
+        case op_kind::LDY:
+            fetch(inst);
+            transfer(Y, rax);
+            break;
+        case op_kind::LAX:
+            fetch(inst);
+            transfer(A, rax);
+            e.mov(X, A);
+            break;
+        case op_kind::STA:
+        case op_kind::STX:
+        case op_kind::STY:
+        case op_kind::SAX:
+        {
+            const target t = address(inst);
+            e.mov(rcx, inst.op == op_kind::STX ? X : inst.op == op_kind::STY ? Y
+                                                                            : A);
+            if (inst.op == op_kind::SAX)
+            {
+                e.alu(and_, rcx, X);
+            }
+            write(t);
+            break;
+        }
+        case op_kind::TAX:
+            transfer(X, A);
+            break;
+        case op_kind::TAY:
+            transfer(Y, A);
+            break;
+        case op_kind::TXA:
+            transfer(A, X);
+            break;
+        case op_kind::TYA:
+            transfer(A, Y);
+            break;
+        case op_kind::TSX:
+            e.load8(X, at(cpu, state.sp));
+            set_nz(X);
+            break;
+        case op_kind::TXS:
+            e.store8(at(cpu, state.sp), X);
+            break;
+        case op_kind::PHA:
+            e.mov(rcx, A);
+            push();
+            break;
+        case op_kind::PHP:
+            e.mov(rcx, P);
+            e.alu(or_, rcx, flags::B | flags::U);
+            push();
+            break;
+        case op_kind::PLA:
+            pull();
+            transfer(A, rax);
+            break;
+        case op_kind::PLP:
+            pull();
+            e.alu(and_, rax, uint8_t(~flags::B));
+            e.alu(or_, rax, flags::U);
+            e.mov(P, rax);
+            break;
+        case op_kind::ADC:
+            fetch(inst);
+            add_with_carry();
+            break;
+        case op_kind::SBC:
+            fetch(inst);
+            e.alu(xor_, rax, 0xFF);
+            add_with_carry();
+            break;
+        case op_kind::AND:
+        case op_kind::EOR:
+        case op_kind::ORA:
+            fetch(inst);
+            e.alu(inst.op == op_kind::AND ? and_ : inst.op == op_kind::EOR ? xor_
+                                                                             : or_,
+                  A, rax);
+            set_nz(A);
+            break;
+        case op_kind::BIT:
+            fetch(inst);
+            e.mov(rcx, rax);
+            e.alu(and_, rcx, flags::N | flags::V);
+            e.test(rax, A);
+            e.setcc(equal, rdx);
+            e.zx8(rdx, rdx);
+            e.alu(add, rdx, rdx);
+            e.alu(and_, P, uint8_t(~(flags::N | flags::V | flags::Z)));
+            e.alu(or_, P, rcx);
+            e.alu(or_, P, rdx);
+            break;
+        case op_kind::CMP:
+            fetch(inst);
+            compare(A);
+            break;
+        case op_kind::CPX:
+            fetch(inst);
+            compare(X);
+            break;
+        case op_kind::CPY:
+            fetch(inst);
+            compare(Y);
+            break;
+        case op_kind::INC:
+        case op_kind::DEC:
+            modify(inst, [&]
+                   {
+                       e.alu(inst.op == op_kind::INC ? add : sub, rax, 1);
+                       e.zx8(rax, rax);
+                       set_nz(rax); });
+            break;
+        case op_kind::INX:
+        case op_kind::INY:
+        case op_kind::DEX:
+        case op_kind::DEY:
+        {
+            const reg r = (inst.op == op_kind::INX || inst.op == op_kind::DEX) ? X : Y;
+            e.alu((inst.op == op_kind::INX || inst.op == op_kind::INY) ? add : sub, r, 1);
+            e.zx8(r, r);
+            set_nz(r);
+            break;
+        }
+        case op_kind::ASL_A:
+        case op_kind::LSR_A:
+        case op_kind::ROL_A:
+        case op_kind::ROR_A:
+            shift(inst.op, A);
+            break;
+        case op_kind::ASL:
+        case op_kind::LSR:
+        case op_kind::ROL:
+        case op_kind::ROR:
+            modify(inst, [&]
+                   { shift(inst.op, rax); });
+            break;
+        case op_kind::CLC:
+            flag(flags::C, false);
+            break;
+        case op_kind::CLD:
+            flag(flags::D, false);
+            break;
+        case op_kind::CLI:
+            flag(flags::I, false);
+            break;
+        case op_kind::CLV:
+            flag(flags::V, false);
+            break;
+        case op_kind::SEC:
+            flag(flags::C, true);
+            break;
+        case op_kind::SED:
+            flag(flags::D, true);
+            break;
+        case op_kind::SEI:
+            flag(flags::I, true);
+            break;
+        case op_kind::NOP:
+            // Only the page crossing of the indexed forms is observable
+            address(inst);
+            break;
+        case op_kind::BRANCH:
+        {
+            // xxy10000, see flags::branch_taken
+            constexpr uint8_t shift[4] = {7, 6, 0, 1};
+            const uint8_t mask = 1 << shift[inst.opcode >> 6];
+            const bool crossed = (inst.next_pc ^ inst.operand) > 0xFF;
+            cycles += inst.cycles;
+            e.mov(rcx, P);
+            e.alu(and_, rcx, mask);
+            e.jcc((inst.opcode & 0x20) ? not_equal : equal, exit_label(inst.operand, true, 1 + crossed));
+            leave(inst.next_pc, true);
+            return false;
+        }
+        case op_kind::JMP:
+            cycles += inst.cycles;
+            leave(inst.operand, true);
+            return false;
+        case op_kind::JSR:
+        {
+            const uint16_t ret = inst.next_pc - 1;
+            e.mov(rcx, uint32_t(ret >> 8));
+            push();
+            e.mov(rcx, uint32_t(ret & 0xFF));
+            push();
+            cycles += inst.cycles;
+            leave(inst.operand, true);
+            return false;
+        }
+        case op_kind::RTS:
+            pull();
+            e.store8(at(rsp, scratch), rax);
+            pull();
+            e.shl(rax, 8);
+            e.load8(rcx, at(rsp, scratch));
+            e.alu(or_, rax, rcx);
+            e.alu(add, rax, 1);
+            e.store16(at(cpu, state.pc), rax);
+            cycles += inst.cycles;
+            leave(0, false);
+            return false;
+        case op_kind::interpret:
+            interpret(inst);
+            if (inst.mode == mode_kind::other || is_control(inst.opcode))
+            {
+                leave(0, false);
+                return false;
+            }
+            e.test8(at(cpu, state.events), 0xFF);
+            e.jcc(not_equal, exit_label(inst.next_pc, true));
+            return true;
+        }
+        if (penalty)
+        {
+            e.load8(rcx, at(rsp, crossing));
+            e.alu(add, at(cpu, state.cycles), rcx);
+        }
+        cycles += inst.cycles;
+        if (called)
+        {
+            // A device may have raised an interrupt or the write may have hit cached code
+            e.test8(at(cpu, state.events), 0xFF);
+            e.jcc(not_equal, exit_label(inst.next_pc, true));
+        }
+        return true;
+    }
+
+    // BRK and RTI, the other control flow is translated inline
+    static bool is_control(uint8_t opcode)
+    {
+        return opcode == 0x00 || opcode == 0x40;
+    }
+};
+}
+
+std::vector<uint8_t> translate(const instruction *block, size_t count, const layout &state)
+{
+    return translator(state).run(block, count);
+}
+}
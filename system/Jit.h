@@ -0,0 +1,300 @@
+#ifndef _JIT_
+#define _JIT_
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+/*
+ * Optional x86-64 tier built with NESACOLA_JIT. Hot blocks from the block cache are translated
+ * into native code that keeps A, X, Y and P in host registers for the whole block.
+ * The translator knows nothing about the CPU template, the CPU describes where its state lives
+ * with a layout and hands over its blocks as jit::instruction.
+ */
+namespace jit
+{
+namespace x64
+{
+enum reg : uint8_t
+{
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15,
+};
+
+enum cond : uint8_t
+{
+    below = 0x2,
+    above_equal = 0x3,
+    equal = 0x4,
+    not_equal = 0x5,
+    above = 0x7,
+};
+
+enum alu_op : uint8_t
+{
+    add = 0,
+    or_ = 1,
+    and_ = 4,
+    sub = 5,
+    xor_ = 6,
+    cmp = 7,
+};
+
+// base + (index << scale) + disp
+struct mem
+{
+    reg base;
+    int32_t disp;
+    bool indexed;
+    reg index;
+    uint8_t scale;
+};
+inline mem at(reg base, int32_t disp = 0)
+{
+    return {base, disp, false, rax, 0};
+}
+inline mem at(reg base, reg index, uint8_t scale, int32_t disp = 0)
+{
+    return {base, disp, true, index, scale};
+}
+
+/*
+ * Just the instruction forms the translator emits. Register operands are 32 bits wide unless
+ * the name says otherwise, which zero extends into the full register.
+ */
+class Emitter
+{
+public:
+    using label = size_t;
+
+    label new_label();
+    void bind(label target);
+    // Patches the jumps, the code is position independent from then on
+    const std::vector<uint8_t> &finish();
+
+    void mov(reg dst, reg src);
+    void mov(reg dst, uint32_t imm);
+    void mov64(reg dst, reg src);
+    void mov64(reg dst, uint64_t imm);
+    void load(reg dst, mem src);
+    void load64(reg dst, mem src);
+    // movzx from a byte
+    void load8(reg dst, mem src);
+    void zx8(reg dst, reg src);
+    void zx16(reg dst, reg src);
+    void store8(mem dst, reg src);
+    void store16(mem dst, reg src);
+    void store16(mem dst, uint16_t imm);
+    void store32(mem dst, uint32_t imm);
+    void lea(reg dst, mem src);
+
+    void alu(alu_op op, reg dst, reg src);
+    void alu(alu_op op, reg dst, int32_t imm);
+    void alu(alu_op op, reg dst, mem src);
+    void alu(alu_op op, mem dst, int32_t imm);
+    void alu(alu_op op, mem dst, reg src);
+    void alu64(alu_op op, reg dst, int32_t imm);
+    void test(reg a, reg b);
+    void test64(reg a, reg b);
+    void test8(mem a, uint8_t imm);
+    void shl(reg dst, uint8_t count);
+    void shr(reg dst, uint8_t count);
+    void not_(reg dst);
+    void inc8(mem dst);
+    void dec8(mem dst);
+    void setcc(cond condition, reg dst);
+
+    void jcc(cond condition, label target);
+    void jmp(label target);
+    // Through rax, the function may be anywhere in the address space
+    void call(const void *function);
+    void push(reg src);
+    void pop(reg dst);
+    void ret();
+
+private:
+    std::vector<uint8_t> bytes;
+    std::vector<size_t> labels;
+    // Position of each rel32 and the label it points to
+    std::vector<std::pair<size_t, label>> fixups;
+
+    void byte(uint8_t value);
+    void dword(uint32_t value);
+    void rex(bool wide, int r, int x, int b, bool byteRegs);
+    void encode(std::initializer_list<uint8_t> opcode, int r, int rm, bool wide = false, bool byteRegs = false);
+    void encode(std::initializer_list<uint8_t> opcode, int r, const mem &m, bool wide = false, bool byteRegs = false);
+    void rel32(label target);
+};
+}
+
+/*
+ * Executable memory for translated blocks, mapped on the first install.
+ * Full buffers are reset as a whole together with the blocks pointing into them.
+ */
+class CodeBuffer
+{
+public:
+    explicit CodeBuffer(size_t size = 4 << 20) : size(size) {}
+    CodeBuffer(const CodeBuffer &) = delete;
+    CodeBuffer &operator=(const CodeBuffer &) = delete;
+    ~CodeBuffer();
+
+    // Copies code into the buffer, returns nullptr when it does not fit or refused() is true
+    const void *install(const std::vector<uint8_t> &code);
+    void reset()
+    {
+        used = 0;
+    }
+    // The system will not map or reprotect code (PaX, SELinux execmem), every block is interpreted
+    bool refused() const
+    {
+        return denied;
+    }
+
+private:
+    uint8_t *memory = nullptr;
+    size_t size;
+    size_t used = 0;
+    bool denied = false;
+};
+
+/*
+ * Where the translated code finds the CPU state, offsets are from the CPU object.
+ */
+struct layout
+{
+    int32_t pc;
+    int32_t sp;
+    int32_t ac;
+    int32_t x;
+    int32_t y;
+    int32_t p;
+    int32_t events;
+    // Cycles that are only known at run time (page crossings, taken branches, interpreted instructions)
+    int32_t cycles;
+    // Set to the base cycles run so far before calling out, so devices see the time of the access
+    int32_t elapsed;
+    // Set to the opcode before calling out to write, so devices can tell which cycle it lands on
+    int32_t opcode;
+    // Bus page tables, a null page goes through read or write
+    const uint8_t *const *read_pages;
+    uint8_t *const *write_pages;
+    const uint8_t *nz_table;
+    // uint8_t (CPU *, uint16_t address)
+    const void *read;
+    // void (CPU *, uint16_t address, uint8_t value), sets an event when the write hit cached code
+    const void *write;
+    // void (CPU *, uint16_t pc), runs one instruction through the interpreter and adds its cycles
+    const void *interpret;
+};
+
+// Operations the translator emits inline, everything else goes through layout::interpret
+enum class op_kind : uint8_t
+{
+    interpret,
+    LDA,
+    LDX,
+    LDY,
+    LAX,
+    STA,
+    STX,
+    STY,
+    SAX,
+    TAX,
+    TAY,
+    TSX,
+    TXA,
+    TXS,
+    TYA,
+    PHA,
+    PHP,
+    PLA,
+    PLP,
+    ADC,
+    SBC,
+    AND,
+    EOR,
+    ORA,
+    BIT,
+    CMP,
+    CPX,
+    CPY,
+    INC,
+    INX,
+    INY,
+    DEC,
+    DEX,
+    DEY,
+    ASL,
+    ASL_A,
+    LSR,
+    LSR_A,
+    ROL,
+    ROL_A,
+    ROR,
+    ROR_A,
+    CLC,
+    CLD,
+    CLI,
+    CLV,
+    SEC,
+    SED,
+    SEI,
+    BRANCH,
+    JMP,
+    JSR,
+    RTS,
+    NOP,
+};
+
+enum class mode_kind : uint8_t
+{
+    implied,
+    immediate,
+    // zeropage, absolute and relative, the address is known when translating
+    address,
+    zeropage_x,
+    zeropage_y,
+    absolute_x,
+    absolute_y,
+    x_indexed_indirect,
+    indirect_y_indexed,
+    // JMP (indirect), always interpreted
+    other,
+};
+
+struct instruction
+{
+    op_kind op;
+    mode_kind mode;
+    // The immediate value, the address or branch target, or the operand bytes of the indexed modes
+    uint16_t operand;
+    uint16_t pc;
+    uint16_t next_pc;
+    uint8_t opcode;
+    uint8_t cycles;
+    bool penalty;
+};
+
+/*
+ * Translates a block, the code is called as uint32_t (*)(CPU *) and returns the number of
+ * instructions it ran. It leaves early, at an instruction boundary, when an event is raised.
+ */
+std::vector<uint8_t> translate(const instruction *block, size_t count, const layout &state);
+}
+#endif
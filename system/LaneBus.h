@@ -0,0 +1,76 @@
+#ifndef _LANEBUS_
+#define _LANEBUS_
+#include "data_types.h"
+#include <cstddef>
+
+/*
+ * One console's view of the lockstep core's memory: its 2KB of RAM, stored interleaved with
+ * the other lanes' so one address across all lanes is contiguous, mirrored through $1FFF, and
+ * the PRG ROM every lane shares at $8000. The rest of the map has no devices, reads are 0 and
+ * writes are dropped, like an MMU with only the ROM mapped.
+ */
+class LaneBus
+{
+    uint8_t *ram = nullptr;
+    size_t stride = 1;
+    const uint8_t *rom = nullptr;
+    size_t rom_mask = 0;
+    const uint8_t *pages[256]{};
+    uint8_t *const no_pages[256]{};
+
+public:
+    LaneBus() = default;
+    LaneBus(const LaneBus &) = delete;
+    LaneBus &operator=(const LaneBus &) = delete;
+
+    /*
+     * lane_ram is the lane's byte at $0000, the byte at an address is stride * address past it.
+     * prg is 16KB, mirrored, or 32KB.
+     */
+    void attach(uint8_t *lane_ram, size_t lanes, const uint8_t *prg, size_t size)
+    {
+        ram = lane_ram;
+        stride = lanes;
+        rom = prg;
+        rom_mask = size - 1;
+        for (int page = 0x80; page < 0x100; page++)
+        {
+            pages[page] = rom + (((page - 0x80) << 8) & rom_mask);
+        }
+    }
+
+    uint8_t read(uint16_t address) const
+    {
+        if (address < 0x2000)
+        {
+            return ram[(address & 0x7FF) * stride];
+        }
+        if (address >= 0x8000)
+        {
+            return rom[address & rom_mask];
+        }
+        return 0;
+    }
+    void write(uint16_t address, nes_byte value)
+    {
+        if (address < 0x2000)
+        {
+            ram[(address & 0x7FF) * stride] = value._unsigned;
+        }
+    }
+    // Nothing is ever remapped
+    uint32_t mapping_epoch() const
+    {
+        return 0;
+    }
+    // Only the ROM is plain memory, strided RAM always goes through read() and write()
+    const uint8_t *const *getReadPages() const
+    {
+        return pages;
+    }
+    uint8_t *const *getWritePages() const
+    {
+        return no_pages;
+    }
+};
+#endif
@@ -0,0 +1,785 @@
+#include "Lockstep.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace
+{
+// Operations and addressing modes the vector path covers, everything else is scalar
+enum class op : uint8_t
+{
+    scalar,
+    LDA,
+    LDX,
+    LDY,
+    STA,
+    STX,
+    STY,
+    ADC,
+    SBC,
+    AND,
+    ORA,
+    EOR,
+    CMP,
+    CPX,
+    CPY,
+    BIT,
+    INC,
+    DEC,
+    ASL,
+    LSR,
+    ROL,
+    ROR,
+    INX,
+    INY,
+    DEX,
+    DEY,
+    TAX,
+    TAY,
+    TXA,
+    TYA,
+    TSX,
+    TXS,
+    CLC,
+    SEC,
+    CLI,
+    SEI,
+    CLD,
+    SED,
+    CLV,
+    NOP,
+    BRANCH,
+    JMP,
+    JSR,
+    RTS,
+    PHA,
+    PLA,
+};
+
+enum class mode : uint8_t
+{
+    implied,
+    accumulator,
+    immediate,
+    zeropage,
+    zeropage_x,
+    zeropage_y,
+    absolute,
+    absolute_x,
+    absolute_y,
+    indirect_x,
+    indirect_y,
+    relative,
+};
+
+struct entry
+{
+    op operation = op::scalar;
+    mode addressing = mode::implied;
+    uint8_t cycles = 0;
+    // Indexed reads crossing a page take a cycle more
+    bool penalty = false;
+};
+
+constexpr std::array<entry, 256> make_table()
+{
+    std::array<entry, 256> t{};
+    // The aaabbb01 group, bbb picks the mode
+    const op group1[8] = {op::ORA, op::AND, op::EOR, op::ADC, op::STA, op::LDA, op::CMP, op::SBC};
+    const mode modes1[8] = {mode::indirect_x, mode::zeropage,   mode::immediate,  mode::absolute,
+                            mode::indirect_y, mode::zeropage_x, mode::absolute_y, mode::absolute_x};
+    const uint8_t cycles1[8] = {6, 3, 2, 4, 5, 4, 4, 4};
+    for (int a = 0; a < 8; a++)
+    {
+        for (int b = 0; b < 8; b++)
+        {
+            if (group1[a] == op::STA && modes1[b] == mode::immediate)
+            {
+                continue;
+            }
+            entry &e = t[(a << 5) | (b << 2) | 1];
+            e = {group1[a], modes1[b], cycles1[b], false};
+            if (group1[a] == op::STA)
+            {
+                // Stores always take the cycle an indexed read may skip
+                e.cycles += modes1[b] == mode::absolute_x || modes1[b] == mode::absolute_y || modes1[b] == mode::indirect_y;
+            }
+            else
+            {
+                e.penalty = modes1[b] == mode::absolute_x || modes1[b] == mode::absolute_y || modes1[b] == mode::indirect_y;
+            }
+        }
+    }
+    // Read-modify-write shifts, increments and decrements
+    const op rmw[6] = {op::ASL, op::ROL, op::LSR, op::ROR, op::DEC, op::INC};
+    const uint8_t rmw_base[6] = {0x00, 0x20, 0x40, 0x60, 0xC0, 0xE0};
+    for (int i = 0; i < 6; i++)
+    {
+        t[rmw_base[i] | 0x06] = {rmw[i], mode::zeropage, 5};
+        t[rmw_base[i] | 0x16] = {rmw[i], mode::zeropage_x, 6};
+        t[rmw_base[i] | 0x0E] = {rmw[i], mode::absolute, 6};
+        t[rmw_base[i] | 0x1E] = {rmw[i], mode::absolute_x, 7};
+        if (i < 4)
+        {
+            t[rmw_base[i] | 0x0A] = {rmw[i], mode::accumulator, 2};
+        }
+    }
+    t[0xA2] = {op::LDX, mode::immediate, 2};
+    t[0xA6] = {op::LDX, mode::zeropage, 3};
+    t[0xB6] = {op::LDX, mode::zeropage_y, 4};
+    t[0xAE] = {op::LDX, mode::absolute, 4};
+    t[0xBE] = {op::LDX, mode::absolute_y, 4, true};
+    t[0xA0] = {op::LDY, mode::immediate, 2};
+    t[0xA4] = {op::LDY, mode::zeropage, 3};
+    t[0xB4] = {op::LDY, mode::zeropage_x, 4};
+    t[0xAC] = {op::LDY, mode::absolute, 4};
+    t[0xBC] = {op::LDY, mode::absolute_x, 4, true};
+    t[0x86] = {op::STX, mode::zeropage, 3};
+    t[0x96] = {op::STX, mode::zeropage_y, 4};
+    t[0x8E] = {op::STX, mode::absolute, 4};
+    t[0x84] = {op::STY, mode::zeropage, 3};
+    t[0x94] = {op::STY, mode::zeropage_x, 4};
+    t[0x8C] = {op::STY, mode::absolute, 4};
+    t[0xE0] = {op::CPX, mode::immediate, 2};
+    t[0xE4] = {op::CPX, mode::zeropage, 3};
+    t[0xEC] = {op::CPX, mode::absolute, 4};
+    t[0xC0] = {op::CPY, mode::immediate, 2};
+    t[0xC4] = {op::CPY, mode::zeropage, 3};
+    t[0xCC] = {op::CPY, mode::absolute, 4};
+    t[0x24] = {op::BIT, mode::zeropage, 3};
+    t[0x2C] = {op::BIT, mode::absolute, 4};
+    t[0xE8] = {op::INX, mode::implied, 2};
+    t[0xC8] = {op::INY, mode::implied, 2};
+    t[0xCA] = {op::DEX, mode::implied, 2};
+    t[0x88] = {op::DEY, mode::implied, 2};
+    t[0xAA] = {op::TAX, mode::implied, 2};
+    t[0xA8] = {op::TAY, mode::implied, 2};
+    t[0x8A] = {op::TXA, mode::implied, 2};
+    t[0x98] = {op::TYA, mode::implied, 2};
+    t[0xBA] = {op::TSX, mode::implied, 2};
+    t[0x9A] = {op::TXS, mode::implied, 2};
+    t[0x18] = {op::CLC, mode::implied, 2};
+    t[0x38] = {op::SEC, mode::implied, 2};
+    t[0x58] = {op::CLI, mode::implied, 2};
+    t[0x78] = {op::SEI, mode::implied, 2};
+    t[0xD8] = {op::CLD, mode::implied, 2};
+    t[0xF8] = {op::SED, mode::implied, 2};
+    t[0xB8] = {op::CLV, mode::implied, 2};
+    t[0xEA] = {op::NOP, mode::implied, 2};
+    for (int condition = 0; condition < 8; condition++)
+    {
+        t[(condition << 5) | 0x10] = {op::BRANCH, mode::relative, 2};
+    }
+    t[0x4C] = {op::JMP, mode::absolute, 3};
+    t[0x20] = {op::JSR, mode::absolute, 6};
+    t[0x60] = {op::RTS, mode::implied, 6};
+    t[0x48] = {op::PHA, mode::implied, 3};
+    t[0x68] = {op::PLA, mode::implied, 4};
+    return t;
+}
+constexpr std::array<entry, 256> table = make_table();
+
+// N and Z of a result byte, written so the lane loops vectorize
+inline uint8_t nz(uint8_t value)
+{
+    return (value & flags::N) | (value == 0 ? flags::Z : 0);
+}
+inline void set_nz(uint8_t &status, uint8_t value)
+{
+    status = (status & ~(flags::N | flags::Z)) | nz(value);
+}
+inline void set_nzc(uint8_t &status, uint8_t value, uint8_t carry)
+{
+    status = (status & ~(flags::N | flags::Z | flags::C)) | nz(value) | carry;
+}
+inline void add(uint8_t &ac, uint8_t value, uint8_t &status)
+{
+    const uint16_t sum = ac + value + (status & flags::C);
+    const uint8_t result = sum & 0xFF;
+    const uint8_t overflow = ((~(ac ^ value) & (ac ^ result)) >> 1) & flags::V;
+    status = (status & ~(flags::N | flags::Z | flags::C | flags::V)) | nz(result) | (sum >> 8) | overflow;
+    ac = result;
+}
+inline void compare(uint8_t reg, uint8_t value, uint8_t &status)
+{
+    set_nzc(status, reg - value, reg >= value);
+}
+}
+
+template <int lanes>
+Lockstep<lanes>::Lockstep(const uint8_t *prg, size_t size) : rom(prg), rom_mask(size - 1)
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        buses[lane].attach(ram + lane, lanes, prg, size);
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::reset()
+{
+    const uint16_t vector = fetch(0xFFFC) | (fetch(0xFFFD) << 8);
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        a[lane] = x[lane] = y[lane] = 0;
+        sp[lane] = 0xFD;
+        p[lane] = flags::I | flags::U;
+        pc[lane] = vector;
+    }
+}
+
+template <int lanes>
+registers_t Lockstep<lanes>::getRegisters(int lane) const
+{
+    registers_t registers{};
+    registers.PC.value = pc[lane];
+    registers.SP = sp[lane];
+    registers.sr = p[lane];
+    registers.AC = a[lane];
+    registers.X = x[lane];
+    registers.Y = y[lane];
+    return registers;
+}
+
+template <int lanes>
+void Lockstep<lanes>::run_for(uint32_t budget)
+{
+    uint64_t start = cycles[0];
+    for (int lane = 1; lane < lanes; lane++)
+    {
+        start = std::min(start, cycles[lane]);
+    }
+    const uint64_t end = start + budget;
+    for (;;)
+    {
+        // Lanes never share state, so the order they run in is free. Running the lanes at the
+        // lowest PC first lets those behind on a forward path catch up where the paths join.
+        uint32_t address = UINT32_MAX;
+        bool together = true;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            if (cycles[lane] < end)
+            {
+                together &= address == UINT32_MAX || pc[lane] == address;
+                address = std::min<uint32_t>(address, pc[lane]);
+            }
+            else
+            {
+                together = false;
+            }
+        }
+        if (address == UINT32_MAX)
+        {
+            return;
+        }
+        if (together && address >= 0x8000 && step_vector(address))
+        {
+            vector_steps++;
+            continue;
+        }
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            if (pc[lane] == address && cycles[lane] < end)
+            {
+                step_scalar(lane);
+            }
+        }
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::step_scalar(int lane)
+{
+    if (!scalar[lane])
+    {
+        scalar[lane].reset(new CPU<LaneBus>(&buses[lane]));
+    }
+    CPU<LaneBus> &cpu = *scalar[lane];
+    cpu.setRegisters(getRegisters(lane));
+    cycles[lane] += cpu.execute_table(UINT32_MAX, 1);
+    const registers_t registers = cpu.getRegisters();
+    pc[lane] = registers.PC.value;
+    sp[lane] = registers.SP;
+    p[lane] = registers.sr;
+    a[lane] = registers.AC;
+    x[lane] = registers.X;
+    y[lane] = registers.Y;
+    scalar_steps++;
+}
+
+template <int lanes>
+void Lockstep<lanes>::index(uint16_t base, const uint8_t *by, uint16_t *address, uint8_t *crossed) const
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        address[lane] = base + by[lane];
+        crossed[lane] = (base ^ address[lane]) > 0xFF;
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::load(const uint16_t *address, uint8_t *value) const
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        value[lane] = buses[lane].read(address[lane]);
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::store(const uint16_t *address, const uint8_t *value)
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        if (address[lane] < 0x2000)
+        {
+            ram[(address[lane] & 0x7FF) * lanes + lane] = value[lane];
+        }
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::load(uint16_t address, uint8_t *value) const
+{
+    if (address < 0x2000)
+    {
+        std::memcpy(value, &ram[(address & 0x7FF) * lanes], lanes);
+    }
+    else
+    {
+        std::memset(value, address >= 0x8000 ? fetch(address) : 0, lanes);
+    }
+}
+
+template <int lanes>
+void Lockstep<lanes>::store(uint16_t address, const uint8_t *value)
+{
+    if (address < 0x2000)
+    {
+        std::memcpy(&ram[(address & 0x7FF) * lanes], value, lanes);
+    }
+}
+
+template <int lanes>
+bool Lockstep<lanes>::step_vector(uint16_t address)
+{
+    const uint8_t opcode = fetch(address);
+    const entry e = table[opcode];
+    if (e.operation == op::scalar)
+    {
+        return false;
+    }
+    const uint8_t low = fetch(address + 1);
+    const uint16_t absolute = low | (fetch(address + 2) << 8);
+    uint16_t next = address + 1;
+
+    // Effective addresses, shared by every lane unless the mode is indexed
+    bool uniform = true;
+    uint16_t target = 0;
+    alignas(64) uint16_t targets[lanes];
+    alignas(64) uint8_t crossed[lanes]{};
+    alignas(64) uint8_t value[lanes];
+    alignas(64) uint8_t pointer[lanes];
+    switch (e.addressing)
+    {
+    case mode::implied:
+    case mode::accumulator:
+        break;
+    case mode::immediate:
+    case mode::relative:
+        next = address + 2;
+        break;
+    case mode::zeropage:
+        target = low;
+        next = address + 2;
+        break;
+    case mode::zeropage_x:
+    case mode::zeropage_y:
+    {
+        const uint8_t *by = e.addressing == mode::zeropage_x ? x : y;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            targets[lane] = uint8_t(low + by[lane]);
+        }
+        uniform = false;
+        next = address + 2;
+        break;
+    }
+    case mode::absolute:
+        target = absolute;
+        next = address + 3;
+        break;
+    case mode::absolute_x:
+        index(absolute, x, targets, crossed);
+        uniform = false;
+        next = address + 3;
+        break;
+    case mode::absolute_y:
+        index(absolute, y, targets, crossed);
+        uniform = false;
+        next = address + 3;
+        break;
+    case mode::indirect_x:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            pointer[lane] = low + x[lane];
+            targets[lane] = ram[pointer[lane] * lanes + lane] | (ram[uint8_t(pointer[lane] + 1) * lanes + lane] << 8);
+        }
+        uniform = false;
+        next = address + 2;
+        break;
+    case mode::indirect_y:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint16_t base = ram[low * lanes + lane] | (ram[uint8_t(low + 1) * lanes + lane] << 8);
+            targets[lane] = base + y[lane];
+            crossed[lane] = (base ^ targets[lane]) > 0xFF;
+        }
+        uniform = false;
+        next = address + 2;
+        break;
+    }
+
+    auto read_operand = [&]()
+    {
+        if (e.addressing == mode::immediate)
+        {
+            std::memset(value, low, lanes);
+        }
+        else if (e.addressing == mode::accumulator)
+        {
+            std::memcpy(value, a, lanes);
+        }
+        else if (uniform)
+        {
+            load(target, value);
+        }
+        else
+        {
+            load(targets, value);
+        }
+    };
+    auto write_result = [&](const uint8_t *result)
+    {
+        if (e.addressing == mode::accumulator)
+        {
+            std::memcpy(a, result, lanes);
+        }
+        else if (uniform)
+        {
+            store(target, result);
+        }
+        else
+        {
+            store(targets, result);
+        }
+    };
+
+    uint8_t taken[lanes];
+    uint8_t extra[lanes]{};
+    switch (e.operation)
+    {
+    case op::scalar:
+        return false;
+    case op::LDA:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] = value[lane];
+            set_nz(p[lane], value[lane]);
+        }
+        break;
+    case op::LDX:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            x[lane] = value[lane];
+            set_nz(p[lane], value[lane]);
+        }
+        break;
+    case op::LDY:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            y[lane] = value[lane];
+            set_nz(p[lane], value[lane]);
+        }
+        break;
+    case op::STA:
+        write_result(a);
+        break;
+    case op::STX:
+        write_result(x);
+        break;
+    case op::STY:
+        write_result(y);
+        break;
+    case op::ADC:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            add(a[lane], value[lane], p[lane]);
+        }
+        break;
+    case op::SBC:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            add(a[lane], ~value[lane], p[lane]);
+        }
+        break;
+    case op::AND:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] &= value[lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    case op::ORA:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] |= value[lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    case op::EOR:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] ^= value[lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    case op::CMP:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            compare(a[lane], value[lane], p[lane]);
+        }
+        break;
+    case op::CPX:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            compare(x[lane], value[lane], p[lane]);
+        }
+        break;
+    case op::CPY:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            compare(y[lane], value[lane], p[lane]);
+        }
+        break;
+    case op::BIT:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            p[lane] = (p[lane] & ~(flags::N | flags::V | flags::Z)) | (value[lane] & (flags::N | flags::V)) |
+                      ((a[lane] & value[lane]) == 0 ? flags::Z : 0);
+        }
+        break;
+    case op::INC:
+    case op::DEC:
+    {
+        read_operand();
+        const uint8_t step = e.operation == op::INC ? 1 : 0xFF;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            value[lane] += step;
+            set_nz(p[lane], value[lane]);
+        }
+        write_result(value);
+        break;
+    }
+    case op::ASL:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint8_t carry = value[lane] >> 7;
+            value[lane] <<= 1;
+            set_nzc(p[lane], value[lane], carry);
+        }
+        write_result(value);
+        break;
+    case op::LSR:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint8_t carry = value[lane] & 1;
+            value[lane] >>= 1;
+            set_nzc(p[lane], value[lane], carry);
+        }
+        write_result(value);
+        break;
+    case op::ROL:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint8_t carry = value[lane] >> 7;
+            value[lane] = (value[lane] << 1) | (p[lane] & flags::C);
+            set_nzc(p[lane], value[lane], carry);
+        }
+        write_result(value);
+        break;
+    case op::ROR:
+        read_operand();
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint8_t carry = value[lane] & 1;
+            value[lane] = (value[lane] >> 1) | ((p[lane] & flags::C) << 7);
+            set_nzc(p[lane], value[lane], carry);
+        }
+        write_result(value);
+        break;
+    case op::INX:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            set_nz(p[lane], ++x[lane]);
+        }
+        break;
+    case op::INY:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            set_nz(p[lane], ++y[lane]);
+        }
+        break;
+    case op::DEX:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            set_nz(p[lane], --x[lane]);
+        }
+        break;
+    case op::DEY:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            set_nz(p[lane], --y[lane]);
+        }
+        break;
+    case op::TAX:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            x[lane] = a[lane];
+            set_nz(p[lane], x[lane]);
+        }
+        break;
+    case op::TAY:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            y[lane] = a[lane];
+            set_nz(p[lane], y[lane]);
+        }
+        break;
+    case op::TXA:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] = x[lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    case op::TYA:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] = y[lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    case op::TSX:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            x[lane] = sp[lane];
+            set_nz(p[lane], x[lane]);
+        }
+        break;
+    case op::TXS:
+        std::memcpy(sp, x, lanes);
+        break;
+    case op::CLC:
+    case op::SEC:
+    case op::CLI:
+    case op::SEI:
+    case op::CLD:
+    case op::SED:
+    case op::CLV:
+    {
+        // The top three bits pick the flag, the lowest of them sets or clears it, there is no SEV
+        const uint8_t masks[8] = {flags::C, flags::C, flags::I, flags::I, flags::V, flags::V, flags::D, flags::D};
+        const uint8_t mask = masks[opcode >> 5];
+        const uint8_t set = e.operation == op::CLV ? 0 : ((opcode >> 5) & 1) * mask;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            p[lane] = (p[lane] & ~mask) | set;
+        }
+        break;
+    }
+    case op::NOP:
+        break;
+    case op::BRANCH:
+    {
+        const uint16_t destination = next + int8_t(low);
+        const uint8_t page = (next ^ destination) > 0xFF;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            taken[lane] = flags::branch_taken(opcode, p[lane]);
+            extra[lane] = taken[lane] + (taken[lane] & page);
+        }
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            pc[lane] = taken[lane] ? destination : next;
+            cycles[lane] += e.cycles + extra[lane];
+        }
+        return true;
+    }
+    case op::JMP:
+        next = absolute;
+        break;
+    case op::JSR:
+    {
+        // Pushes the address of the last byte of the instruction
+        const uint16_t back = address + 2;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            ram[(0x100 | sp[lane]) * lanes + lane] = back >> 8;
+            ram[(0x100 | uint8_t(sp[lane] - 1)) * lanes + lane] = back & 0xFF;
+            sp[lane] -= 2;
+        }
+        next = absolute;
+        break;
+    }
+    case op::RTS:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            const uint16_t back = ram[(0x100 | uint8_t(sp[lane] + 1)) * lanes + lane] |
+                                  (ram[(0x100 | uint8_t(sp[lane] + 2)) * lanes + lane] << 8);
+            pc[lane] = back + 1;
+            sp[lane] += 2;
+            cycles[lane] += e.cycles;
+        }
+        return true;
+    case op::PHA:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            ram[(0x100 | sp[lane]--) * lanes + lane] = a[lane];
+        }
+        break;
+    case op::PLA:
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            a[lane] = ram[(0x100 | ++sp[lane]) * lanes + lane];
+            set_nz(p[lane], a[lane]);
+        }
+        break;
+    }
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        pc[lane] = next;
+        cycles[lane] += e.cycles + (e.penalty & crossed[lane]);
+    }
+    return true;
+}
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
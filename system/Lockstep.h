@@ -0,0 +1,108 @@
+#ifndef _LOCKSTEP_
+#define _LOCKSTEP_
+#include "CPU.h"
+#include "LaneBus.h"
+#include <memory>
+
+/*
+ * Runs lanes copies of the CPU and its RAM over the same PRG ROM, for workloads that run one
+ * program under many inputs. Registers and RAM are kept as structures of arrays, one byte per
+ * lane, so while every lane is at the same PC an instruction is executed for all of them by
+ * loops over lanes that the compiler turns into SSE/AVX2/AVX-512 code, whatever width it
+ * targets. Memory operands at the same address across lanes are single vector loads and stores.
+ *
+ * When control flow diverges, or on an instruction the vector path does not cover, the lanes
+ * at the lowest PC are stepped one at a time by a scalar CPU over their LaneBus, and vector
+ * execution resumes once every lane is at the same PC again.
+ *
+ * Only the CPU and RAM are covered, there are no devices and no interrupts.
+ */
+template <int lanes>
+class Lockstep
+{
+public:
+    static_assert(lanes > 0 && lanes % 8 == 0, "lanes fill whole 8 byte vectors");
+
+    /*
+     * prg is 16KB, mirrored, or 32KB and has to outlive the core.
+     */
+    Lockstep(const uint8_t *prg, size_t size);
+    Lockstep(const Lockstep &) = delete;
+    Lockstep &operator=(const Lockstep &) = delete;
+
+    /*
+     * Puts every lane in the power up state of CPU::reset, RAM is left as it is.
+     */
+    void reset();
+    /*
+     * Runs every lane until its cycle count reaches that of the lane furthest behind when called
+     * plus cycles, each stopping on its first instruction boundary at or past that.
+     */
+    void run_for(uint32_t cycles);
+
+    registers_t getRegisters(int lane) const;
+    uint64_t getCycles(int lane) const
+    {
+        return cycles[lane];
+    }
+    uint8_t read(int lane, uint16_t address) const
+    {
+        return buses[lane].read(address);
+    }
+    void write(int lane, uint16_t address, uint8_t value)
+    {
+        nes_byte byte;
+        byte._unsigned = value;
+        buses[lane].write(address, byte);
+    }
+
+    // Instructions executed for all lanes at once, and lane instructions executed one at a time
+    uint64_t getVectorSteps() const
+    {
+        return vector_steps;
+    }
+    uint64_t getScalarSteps() const
+    {
+        return scalar_steps;
+    }
+
+private:
+    // One byte per lane, the byte for an address across all lanes is contiguous
+    alignas(64) uint8_t ram[0x800 * lanes]{};
+    alignas(64) uint8_t a[lanes]{};
+    alignas(64) uint8_t x[lanes]{};
+    alignas(64) uint8_t y[lanes]{};
+    alignas(64) uint8_t sp[lanes]{};
+    alignas(64) uint8_t p[lanes]{};
+    uint16_t pc[lanes]{};
+    uint64_t cycles[lanes]{};
+
+    const uint8_t *rom;
+    size_t rom_mask;
+    LaneBus buses[lanes];
+    // Built on the first divergence
+    std::unique_ptr<CPU<LaneBus>> scalar[lanes];
+
+    uint64_t vector_steps = 0;
+    uint64_t scalar_steps = 0;
+
+    uint8_t fetch(uint16_t address) const
+    {
+        return rom[address & rom_mask];
+    }
+    /*
+     * Executes the instruction at pc for every lane, all of which are at pc. False when the
+     * vector path does not cover it and nothing was done.
+     */
+    bool step_vector(uint16_t address);
+    // The instruction at the lane's PC on its own
+    void step_scalar(int lane);
+    // Per lane effective address and page crossing of an indexed mode
+    void index(uint16_t base, const uint8_t *by, uint16_t *address, uint8_t *crossed) const;
+    void load(const uint16_t *address, uint8_t *value) const;
+    void store(const uint16_t *address, const uint8_t *value);
+    // The same when the address is the same for every lane
+    void load(uint16_t address, uint8_t *value) const;
+    void store(uint16_t address, const uint8_t *value);
+};
+#endif
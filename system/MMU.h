@@ -1,36 +1,155 @@
 #ifndef _MMU_
 #define _MMU_
 #include "data_types.h"
-#include "Utils.h"
+#include "Savestate.h"
+
+/*
+ * Device callbacks for pages that are not backed by plain memory.
+ */
+struct io_handler
+{
+    uint8_t (*read)(void *context, uint16_t address) = nullptr;
+    void (*write)(void *context, uint16_t address, uint8_t value) = nullptr;
+    void *context = nullptr;
+};
+
+/*
+ * A device's view of the CPU clock, so it can catch up to the cycle its registers are accessed on.
+ */
+struct clock_source
+{
+    uint64_t (*now)(void *context) = nullptr;
+    void *context = nullptr;
+};
+
 class MMU
 {
-    uint8_t Memory[2048];
+    uint8_t Memory[2048]{};
+
+    // 256 byte pages, a null pointer sends the access to the page handler
+    const uint8_t *readPages[256]{};
+    uint8_t *writePages[256]{};
+    io_handler handlers[256];
+    // Bumped on every remap so caches of decoded code know to start over
+    uint32_t epoch = 0;
+
+    uint8_t read_io(uint16_t address)
+    {
+        const io_handler &handler = handlers[address >> 8];
+        // Unmapped pages read as 0
+        return handler.read ? handler.read(handler.context, address) : 0;
+    }
+    void write_io(uint16_t address, uint8_t value)
+    {
+        const io_handler &handler = handlers[address >> 8];
+        if (handler.write)
+        {
+            handler.write(handler.context, address, value);
+        }
+    }
 
 public:
+    MMU()
+    {
+        // $0000-$1FFF, the 2KB of internal RAM mirrored four times
+        for (int page = 0x00; page < 0x20; page++)
+        {
+            readPages[page] = writePages[page] = &Memory[(page & 0x07) << 8];
+        }
+    }
+
     // Reads a value from memory.
-    const uint8_t read(uint16_t address)
+    uint8_t read(uint16_t address)
     {
-        using utils::isBetween;
-        if (isBetween(0x0000, 0x1FFF, address))
+        const uint8_t *page = readPages[address >> 8];
+        if (page)
         {
-            return Memory[address % 0x800];
+            return page[address & 0xFF];
         }
-        return 00;
+        return read_io(address);
     }
     void write(uint16_t address, nes_byte value)
     {
-        using utils::isBetween;
-        if (isBetween(0x0000, 0x1FFF, address))
+        uint8_t *page = writePages[address >> 8];
+        if (page)
+        {
+            page[address & 0xFF] = value._unsigned;
+            return;
+        }
+        write_io(address, value._unsigned);
+    }
+
+    // Internal RAM, the page tables belong to whoever mapped them
+    void save(StateWriter &out) const
+    {
+        out.put(Memory);
+    }
+    void load(StateReader &in)
+    {
+        in.get(Memory);
+    }
+
+    uint32_t mapping_epoch() const
+    {
+        return epoch;
+    }
+    // For code that does the page lookup itself, entries change with the epoch
+    const uint8_t *const *getReadPages() const
+    {
+        return readPages;
+    }
+    uint8_t *const *getWritePages() const
+    {
+        return writePages;
+    }
+
+    /**
+     * Maps size bytes of data starting at address, both must be multiples of the 256 byte page.
+     * @param writable
+     *      read only memory keeps sending its writes to the page handler, this is how mappers see bank switches.
+     */
+    void map_memory(uint16_t address, uint32_t size, uint8_t *data, bool writable)
+    {
+        epoch++;
+        for (uint32_t offset = 0; offset < size; offset += 0x100)
+        {
+            const int page = (address + offset) >> 8;
+            readPages[page] = data + offset;
+            writePages[page] = writable ? data + offset : nullptr;
+        }
+    }
+    /*
+     * Maps read only memory such as a ROM image mapped from disk, writes go to the page handler.
+     */
+    void map_rom(uint16_t address, uint32_t size, const uint8_t *data)
+    {
+        // Mappers rewrite their bank registers all the time, an unchanged bank keeps decoded code
+        if (readPages[address >> 8] == data && writePages[address >> 8] == nullptr &&
+            readPages[(address + size - 1) >> 8] == data + ((size - 1) & ~0xFFu))
+        {
+            return;
+        }
+        epoch++;
+        for (uint32_t offset = 0; offset < size; offset += 0x100)
         {
-            Memory[address % 0x800] = value._unsigned;
+            const int page = (address + offset) >> 8;
+            readPages[page] = data + offset;
+            writePages[page] = nullptr;
         }
     }
     /*
-     * checks if the last reading caused a boundary cross
+     * Sends every access in the pages covering address to address + size - 1 to the handler.
      */
-    bool checkBoundaryCross()
+    void map_io(uint16_t address, uint32_t size, io_handler handler)
     {
-        return false;
+        epoch++;
+        for (uint32_t offset = 0; offset < size; offset += 0x100)
+        {
+            const int page = (address + offset) >> 8;
+            readPages[page] = nullptr;
+            writePages[page] = nullptr;
+            handlers[page] = handler;
+        }
     }
 };
-#endif
\ No newline at end of file
+#endif
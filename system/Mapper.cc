@@ -0,0 +1,399 @@
+#include "Mapper.h"
+#include <algorithm>
+
+Mapper::Mapper(Cartridge &cartridge, MMU &mmu) : cartridge(cartridge), mmu(mmu)
+{
+    mirroring = cartridge.getHeader().mirroring;
+}
+
+void Mapper::map_prg(uint16_t address, uint32_t size, size_t bank)
+{
+    mmu.map_rom(address, size, cartridge.getPRG().bank(bank, size));
+}
+
+void Mapper::map_chr(int page, int count, size_t bank)
+{
+    const rom_span chr = cartridge.getCHR();
+    const uint8_t *data = chr.bank(bank, count * 0x400);
+    uint8_t *ram = cartridge.getCHRRam();
+    for (int i = 0; i < count; i++)
+    {
+        chr_read[page + i] = data + i * 0x400;
+        chr_write[page + i] = ram ? ram + (data - chr.data) + i * 0x400 : nullptr;
+    }
+}
+
+namespace
+{
+/*
+ * Mapper 0, 16 or 32KB of PRG and 8KB of CHR with no registers.
+ */
+class NROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+
+    void reset() override
+    {
+        map_prg(0x8000, 0x4000, 0);
+        map_prg(0xC000, 0x4000, 1);
+        map_chr(0, 8, 0);
+    }
+    void write(uint16_t, uint8_t) override {}
+};
+
+/*
+ * Mapper 1, registers are loaded one bit at a time through a 5 bit shift register.
+ * The 512KB SUROM variant and the PRG RAM disable bit are not emulated.
+ */
+class MMC1 : public Mapper
+{
+public:
+    using Mapper::Mapper;
+
+    void reset() override
+    {
+        shift = 0x10;
+        // PRG mode 3, the last bank fixed at $C000
+        control = 0x0C;
+        chr0 = chr1 = prg = 0;
+        apply();
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+        if (value & 0x80)
+        {
+            shift = 0x10;
+            control |= 0x0C;
+            apply();
+            return;
+        }
+        // The marker bit reaches bit 0 on the fifth write
+        const bool full = shift & 1;
+        shift = (shift >> 1) | ((value & 1) << 4);
+        if (!full)
+        {
+            return;
+        }
+        switch ((address >> 13) & 3)
+        {
+        case 0:
+            control = shift;
+            break;
+        case 1:
+            chr0 = shift;
+            break;
+        case 2:
+            chr1 = shift;
+            break;
+        case 3:
+            prg = shift & 0x0F;
+            break;
+        }
+        shift = 0x10;
+        apply();
+    }
+
+    void save(StateWriter &out) const override
+    {
+        Mapper::save(out);
+        out.put(shift);
+        out.put(control);
+        out.put(chr0);
+        out.put(chr1);
+        out.put(prg);
+    }
+    void load(StateReader &in) override
+    {
+        Mapper::load(in);
+        in.get(shift);
+        in.get(control);
+        in.get(chr0);
+        in.get(chr1);
+        in.get(prg);
+        apply();
+    }
+
+private:
+    uint8_t shift = 0x10;
+    uint8_t control = 0x0C;
+    uint8_t chr0 = 0;
+    uint8_t chr1 = 0;
+    uint8_t prg = 0;
+
+    void apply()
+    {
+        const Cartridge::mirroring_t modes[4] = {Cartridge::single_lower, Cartridge::single_upper,
+                                                 Cartridge::vertical, Cartridge::horizontal};
+        set_mirroring(modes[control & 3]);
+        switch ((control >> 2) & 3)
+        {
+        case 0:
+        case 1:
+            map_prg(0x8000, 0x8000, prg >> 1);
+            break;
+        case 2:
+            map_prg(0x8000, 0x4000, 0);
+            map_prg(0xC000, 0x4000, prg);
+            break;
+        case 3:
+            map_prg(0x8000, 0x4000, prg);
+            map_prg(0xC000, 0x4000, cartridge.getPRG().size / 0x4000 - 1);
+            break;
+        }
+        if (control & 0x10)
+        {
+            map_chr(0, 4, chr0);
+            map_chr(4, 4, chr1);
+        }
+        else
+        {
+            map_chr(0, 8, chr0 >> 1);
+        }
+    }
+};
+
+/*
+ * Mapper 2, a 16KB bank at $8000 and the last one fixed at $C000.
+ */
+class UxROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+
+    void reset() override
+    {
+        bank = 0;
+        map_prg(0x8000, 0x4000, 0);
+        map_prg(0xC000, 0x4000, cartridge.getPRG().size / 0x4000 - 1);
+        map_chr(0, 8, 0);
+    }
+    void write(uint16_t, uint8_t value) override
+    {
+        bank = value;
+        map_prg(0x8000, 0x4000, bank);
+    }
+
+    void save(StateWriter &out) const override
+    {
+        Mapper::save(out);
+        out.put(bank);
+    }
+    void load(StateReader &in) override
+    {
+        Mapper::load(in);
+        in.get(bank);
+        map_prg(0x8000, 0x4000, bank);
+    }
+
+private:
+    uint8_t bank = 0;
+};
+
+/*
+ * Mapper 3, fixed PRG and one switchable 8KB CHR bank.
+ */
+class CNROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+
+    void reset() override
+    {
+        bank = 0;
+        map_prg(0x8000, 0x4000, 0);
+        map_prg(0xC000, 0x4000, 1);
+        map_chr(0, 8, 0);
+    }
+    void write(uint16_t, uint8_t value) override
+    {
+        bank = value;
+        map_chr(0, 8, bank);
+    }
+
+    void save(StateWriter &out) const override
+    {
+        Mapper::save(out);
+        out.put(bank);
+    }
+    void load(StateReader &in) override
+    {
+        Mapper::load(in);
+        in.get(bank);
+        map_chr(0, 8, bank);
+    }
+
+private:
+    uint8_t bank = 0;
+};
+
+/*
+ * Mapper 4, 8KB PRG and 1/2KB CHR banks plus a scanline counter driving the IRQ line.
+ */
+class MMC3 : public Mapper
+{
+public:
+    using Mapper::Mapper;
+
+    void reset() override
+    {
+        select = 0;
+        const uint8_t banks[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+        std::copy(banks, banks + 8, registers);
+        irq_latch = irq_counter = 0;
+        irq_reload = irq_enabled = false;
+        set_irq(false);
+        apply();
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+        const bool odd = address & 1;
+        switch ((address >> 13) & 3)
+        {
+        case 0:
+            if (odd)
+            {
+                registers[select & 7] = value;
+            }
+            else
+            {
+                select = value;
+            }
+            apply();
+            break;
+        case 1:
+            // The odd register protects PRG RAM, which is left enabled
+            if (!odd)
+            {
+                set_mirroring((value & 1) ? Cartridge::horizontal : Cartridge::vertical);
+            }
+            break;
+        case 2:
+            if (odd)
+            {
+                irq_reload = true;
+            }
+            else
+            {
+                irq_latch = value;
+            }
+            break;
+        case 3:
+            irq_enabled = odd;
+            if (!odd)
+            {
+                // Disabling also acknowledges
+                set_irq(false);
+            }
+            break;
+        }
+    }
+
+    void scanline() override
+    {
+        if (irq_counter == 0 || irq_reload)
+        {
+            irq_counter = irq_latch;
+            irq_reload = false;
+        }
+        else
+        {
+            irq_counter--;
+        }
+        if (irq_counter == 0 && irq_enabled)
+        {
+            set_irq(true);
+        }
+    }
+    // Even while disabled, $E001 arms the IRQ without the PPU seeing the write
+    bool scanline_irq() const override
+    {
+        return true;
+    }
+
+    void save(StateWriter &out) const override
+    {
+        Mapper::save(out);
+        out.put(select);
+        out.put(registers);
+        out.put(irq_latch);
+        out.put(irq_counter);
+        out.put(irq_reload);
+        out.put(irq_enabled);
+    }
+    void load(StateReader &in) override
+    {
+        Mapper::load(in);
+        in.get(select);
+        in.get(registers);
+        in.get(irq_latch);
+        in.get(irq_counter);
+        in.get(irq_reload);
+        in.get(irq_enabled);
+        apply();
+    }
+
+private:
+    uint8_t select = 0;
+    uint8_t registers[8]{};
+    uint8_t irq_latch = 0;
+    uint8_t irq_counter = 0;
+    bool irq_reload = false;
+    bool irq_enabled = false;
+
+    void apply()
+    {
+        const size_t last = cartridge.getPRG().size / 0x2000 - 1;
+        // Bit 6 swaps $8000 and $C000, one of them holds the second to last bank
+        const uint16_t swappable = (select & 0x40) ? 0xC000 : 0x8000;
+        map_prg(swappable, 0x2000, registers[6]);
+        map_prg(swappable ^ 0x4000, 0x2000, last - 1);
+        map_prg(0xA000, 0x2000, registers[7]);
+        map_prg(0xE000, 0x2000, last);
+        // Bit 7 swaps the 2KB and the 1KB halves of the pattern tables
+        const int inverted = (select & 0x80) ? 4 : 0;
+        map_chr(0 ^ inverted, 2, registers[0] >> 1);
+        map_chr(2 ^ inverted, 2, registers[1] >> 1);
+        for (int i = 0; i < 4; i++)
+        {
+            map_chr((4 + i) ^ inverted, 1, registers[2 + i]);
+        }
+    }
+};
+}
+
+std::unique_ptr<Mapper> Mapper::create(Cartridge &cartridge, MMU &mmu)
+{
+    std::unique_ptr<Mapper> mapper;
+    switch (cartridge.getHeader().mapper)
+    {
+    case 0:
+        mapper.reset(new NROM(cartridge, mmu));
+        break;
+    case 1:
+        mapper.reset(new MMC1(cartridge, mmu));
+        break;
+    case 2:
+        mapper.reset(new UxROM(cartridge, mmu));
+        break;
+    case 3:
+        mapper.reset(new CNROM(cartridge, mmu));
+        break;
+    case 4:
+        mapper.reset(new MMC3(cartridge, mmu));
+        break;
+    default:
+        return nullptr;
+    }
+    // Register writes land in the page handler, ROM banks are mapped over it for reads
+    io_handler handler;
+    handler.write = [](void *context, uint16_t address, uint8_t value)
+    { static_cast<Mapper *>(context)->write(address, value); };
+    handler.context = mapper.get();
+    mmu.map_io(0x8000, 0x8000, handler);
+    cartridge.map(mmu);
+    mapper->reset();
+    return mapper;
+}
@@ -0,0 +1,99 @@
+#ifndef _MAPPER_
+#define _MAPPER_
+#include "Cartridge.h"
+#include "MMU.h"
+#include <memory>
+
+/*
+ * The board's IRQ output, wired to CPU::set_irq with irq_mapper.
+ */
+struct irq_line
+{
+    void (*set)(void *context, bool asserted) = nullptr;
+    void *context = nullptr;
+};
+
+/*
+ * Cartridge boards. Writes to $8000-$FFFF reach write() through the MMU page handler and bank
+ * switches only repoint page table entries at the mapped ROM, PRG in the MMU and CHR in chr_read.
+ */
+class Mapper
+{
+public:
+    /*
+     * The board for the cartridge's mapper number with its power on banks mapped,
+     * nullptr when the board is not supported.
+     */
+    static std::unique_ptr<Mapper> create(Cartridge &cartridge, MMU &mmu);
+
+    Mapper(Cartridge &cartridge, MMU &mmu);
+    virtual ~Mapper() = default;
+    Mapper(const Mapper &) = delete;
+    Mapper &operator=(const Mapper &) = delete;
+
+    // Power on banks and registers
+    virtual void reset() = 0;
+    // A write to $8000-$FFFF
+    virtual void write(uint16_t address, uint8_t value) = 0;
+    // Clocked by the PPU once per rendered scanline, MMC3 counts them for its IRQ
+    virtual void scanline() {}
+    // True when scanline() may raise the IRQ, the PPU is then kept in step with every rendered scanline
+    virtual bool scanline_irq() const
+    {
+        return false;
+    }
+
+    /*
+     * Registers and mirroring. Loading maps the banks the registers select, the IRQ line is
+     * restored by the CPU's own state. Any loaded bank number is safe, rom_span::bank wraps it.
+     */
+    virtual void save(StateWriter &out) const
+    {
+        out.put(mirroring);
+    }
+    virtual void load(StateReader &in)
+    {
+        in.get(mirroring);
+    }
+
+    void connect_irq(irq_line line)
+    {
+        irq = line;
+    }
+
+    // The pattern tables as eight 1KB pages, write pages are null for CHR ROM
+    const uint8_t *chr_read[8]{};
+    uint8_t *chr_write[8]{};
+
+    Cartridge::mirroring_t getMirroring() const
+    {
+        return mirroring;
+    }
+
+protected:
+    Cartridge &cartridge;
+    MMU &mmu;
+    irq_line irq;
+    Cartridge::mirroring_t mirroring;
+
+    // Points size bytes at address to PRG bank number bank of that size
+    void map_prg(uint16_t address, uint32_t size, size_t bank);
+    // Points count 1KB pattern table pages from page to CHR bank number bank of count KB
+    void map_chr(int page, int count, size_t bank);
+    void set_irq(bool asserted)
+    {
+        if (irq.set)
+        {
+            irq.set(irq.context, asserted);
+        }
+    }
+    // Four screen boards have their own VRAM and ignore mirroring control
+    void set_mirroring(Cartridge::mirroring_t value)
+    {
+        if (cartridge.getHeader().mirroring != Cartridge::four_screen)
+        {
+            mirroring = value;
+        }
+    }
+};
+#endif
@@ -0,0 +1,53 @@
+#include "Movie.h"
+#include <cstdio>
+
+bool Movie::load(const char *path)
+{
+    input.clear();
+    FILE *file = std::fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    header_t header;
+    bool read = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == magic &&
+                header.version == version && (header.ports == 1 || header.ports == 2);
+    // The frame count is only believed when the file holds exactly that many frames
+    long length = -1;
+    if (read && std::fseek(file, 0, SEEK_END) == 0)
+    {
+        length = std::ftell(file);
+    }
+    const uint64_t expected = uint64_t(header.frames) * header.ports;
+    read = read && length >= long(sizeof(header)) && uint64_t(length) - sizeof(header) == expected &&
+           std::fseek(file, sizeof(header), SEEK_SET) == 0;
+    if (read)
+    {
+        ports = header.ports;
+        input.resize(expected);
+        read = std::fread(input.data(), 1, input.size(), file) == input.size();
+    }
+    std::fclose(file);
+    if (!read)
+    {
+        input.clear();
+    }
+    return read;
+}
+
+bool Movie::save(const char *path) const
+{
+    FILE *file = std::fopen(path, "wb");
+    if (!file)
+    {
+        return false;
+    }
+    header_t header{};
+    header.magic = magic;
+    header.version = version;
+    header.ports = uint8_t(ports);
+    header.frames = getFrames();
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                         std::fwrite(input.data(), 1, input.size(), file) == input.size();
+    return std::fclose(file) == 0 && written;
+}
@@ -0,0 +1,75 @@
+#ifndef _MOVIE_
+#define _MOVIE_
+#include "NES.h"
+#include <cstdint>
+#include <vector>
+
+/*
+ * Input recorded from power on, one byte of Controller::button bits per port per frame. Played
+ * back by setting the buttons before each run_frame after a reset, the run is the same every
+ * time since nothing else reaches the console from outside.
+ *
+ * On disk: a 16 byte header_t, then the frames, each the bytes of its ports in port order.
+ */
+class Movie
+{
+public:
+    static constexpr uint32_t magic = 0x4D53454E; // "NESM"
+    static constexpr uint16_t version = 1;
+
+    struct header_t
+    {
+        uint32_t magic;
+        uint16_t version;
+        // 1 or 2, a one port movie leaves port 1 empty
+        uint8_t ports;
+        uint8_t reserved;
+        uint32_t frames;
+        uint32_t reserved2;
+    };
+
+    explicit Movie(int ports = 1) : ports(ports == 2 ? 2 : 1) {}
+
+    // False if the file cannot be read, is not a movie or does not hold the frames its header
+    // claims, the movie is left empty then
+    bool load(const char *path);
+    bool save(const char *path) const;
+
+    // Appends a frame
+    void record(uint8_t port0, uint8_t port1 = 0)
+    {
+        input.push_back(port0);
+        if (ports == 2)
+        {
+            input.push_back(port1);
+        }
+    }
+    uint32_t getFrames() const
+    {
+        return uint32_t(input.size() / ports);
+    }
+    int getPorts() const
+    {
+        return ports;
+    }
+    // Nothing held past the end
+    uint8_t getButtons(uint32_t frame, int port) const
+    {
+        if (port >= ports || frame >= getFrames())
+        {
+            return 0;
+        }
+        return input[size_t(frame) * ports + port];
+    }
+    // Sets both ports for frame, before its run_frame
+    void apply(NES &nes, uint32_t frame) const
+    {
+        nes.set_buttons(0, getButtons(frame, 0));
+        nes.set_buttons(1, getButtons(frame, 1));
+    }
+
+private:
+    int ports;
+    std::vector<uint8_t> input;
+};
+#endif
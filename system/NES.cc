@@ -0,0 +1,264 @@
+#include "NES.h"
+#include <algorithm>
+#include <cstring>
+
+NES::NES() : cartridge(new Cartridge()), cpu(&mmu), apu(mmu)
+{
+    preempt_line preempt;
+    preempt.raise = [](void *context)
+    { static_cast<CPU<MMU> *>(context)->yield(); };
+    preempt.context = &cpu;
+    scheduler.connect_preempt(preempt);
+
+    irq_line frame_irq;
+    frame_irq.set = [](void *context, bool asserted)
+    { static_cast<CPU<MMU> *>(context)->set_irq(CPU<MMU>::irq_frame_counter, asserted); };
+    frame_irq.context = &cpu;
+    apu.connect_frame_irq(frame_irq);
+    irq_line dmc_irq;
+    dmc_irq.set = [](void *context, bool asserted)
+    { static_cast<CPU<MMU> *>(context)->set_irq(CPU<MMU>::irq_dmc, asserted); };
+    dmc_irq.context = &cpu;
+    apu.connect_dmc_irq(dmc_irq);
+    clock_source clock;
+    clock.now = [](void *context)
+    { return static_cast<CPU<MMU> *>(context)->getCycles(); };
+    clock.context = &cpu;
+    apu.connect_clock(clock);
+    apu.connect_scheduler(&scheduler, event_apu);
+}
+
+NES::load_result NES::load(const char *path)
+{
+    // Built on the side, the console keeps running the loaded cartridge until this one is wired in
+    std::unique_ptr<Cartridge> image(new Cartridge());
+    if (!image->load(path))
+    {
+        return bad_image;
+    }
+    std::unique_ptr<Mapper> board = Mapper::create(*image, mmu);
+    if (!board)
+    {
+        return unsupported_mapper;
+    }
+    irq_line irq;
+    irq.set = [](void *context, bool asserted)
+    { static_cast<CPU<MMU> *>(context)->set_irq(CPU<MMU>::irq_mapper, asserted); };
+    irq.context = &cpu;
+    board->connect_irq(irq);
+
+    // The old PPU refers to the old mapper and that one to the old cartridge, released in that order
+    ppu.reset(new PPU(*board));
+    mapper = std::move(board);
+    cartridge = std::move(image);
+    ppu->map(mmu);
+    nmi_line nmi;
+    nmi.raise = [](void *context)
+    { static_cast<CPU<MMU> *>(context)->nmi(); };
+    nmi.context = &cpu;
+    ppu->connect_nmi(nmi);
+    clock_source clock;
+    clock.now = [](void *context)
+    { return static_cast<CPU<MMU> *>(context)->getCycles(); };
+    clock.context = &cpu;
+    ppu->connect_clock(clock);
+    ppu->connect_scheduler(&scheduler, event_ppu);
+    ppu->sync(cpu.getCycles());
+
+    io_handler io;
+    io.read = &NES::read_io;
+    io.write = &NES::write_io;
+    io.context = this;
+    mmu.map_io(0x4000, 0x100, io);
+
+    StateWriter counter(nullptr);
+    save(counter);
+    state_size = counter.getSize();
+    undo.resize(state_size);
+    return loaded;
+}
+
+void NES::reset()
+{
+    if (!mapper)
+    {
+        return;
+    }
+    mapper->reset();
+    ppu->reset();
+    apu.reset();
+    controllers[0].reset();
+    controllers[1].reset();
+    cpu.reset();
+}
+
+savestate::header_t NES::state_header() const
+{
+    const Cartridge::header_t &rom = cartridge->getHeader();
+    savestate::header_t header{};
+    header.magic = savestate::magic;
+    header.version = savestate::version;
+    header.size = uint32_t(state_size);
+    header.mapper = rom.mapper;
+    header.prg_size = uint32_t(rom.prg_size);
+    header.chr_size = uint32_t(rom.chr_size);
+    return header;
+}
+
+void NES::save(StateWriter &out) const
+{
+    out.put(state_header());
+    cpu.save(out);
+    mmu.save(out);
+    cartridge->save(out);
+    mapper->save(out);
+    ppu->save(out);
+    apu.save(out);
+    controllers[0].save(out);
+    controllers[1].save(out);
+    scheduler.save(out);
+}
+
+void NES::save_state(uint8_t *out) const
+{
+    if (!mapper)
+    {
+        return;
+    }
+    StateWriter writer(out);
+    save(writer);
+}
+
+NES::state_result NES::load_state(const uint8_t *in, size_t size)
+{
+    savestate::header_t header;
+    if (size < sizeof(header))
+    {
+        return state_bad_version;
+    }
+    std::memcpy(&header, in, sizeof(header));
+    if (header.magic != savestate::magic || header.version != savestate::version)
+    {
+        return state_bad_version;
+    }
+    const savestate::header_t expected = state_header();
+    if (header.mapper != expected.mapper || header.prg_size != expected.prg_size ||
+        header.chr_size != expected.chr_size || header.size != expected.size || size < state_size)
+    {
+        return state_wrong_cartridge;
+    }
+    // Put back when a field turns out to be out of range halfway through
+    save_state(undo.data());
+    StateReader reader(in + sizeof(header));
+    if (!load(reader))
+    {
+        StateReader previous(undo.data() + sizeof(header));
+        load(previous);
+        return state_corrupt;
+    }
+    return state_loaded;
+}
+
+bool NES::load(StateReader &in)
+{
+    cpu.load(in);
+    mmu.load(in);
+    cartridge->load(in);
+    mapper->load(in);
+    if (!ppu->load(in) || !apu.load(in))
+    {
+        return false;
+    }
+    controllers[0].load(in);
+    controllers[1].load(in);
+    return scheduler.load(in);
+}
+
+uint32_t NES::run_frame()
+{
+    if (!ppu)
+    {
+        return 0;
+    }
+    const uint64_t start = cpu.getCycles();
+    const uint64_t frame = ppu->getFrameCount();
+    for (;;)
+    {
+        const uint64_t now = cpu.getCycles();
+        for (int id = scheduler.pop(now); id >= 0; id = scheduler.pop(now))
+        {
+            dispatch(id, now);
+        }
+        if (ppu->getFrameCount() != frame)
+        {
+            break;
+        }
+        const uint64_t deadline = scheduler.next();
+        if (deadline > now)
+        {
+            // Events scheduled before the deadline from inside the run end it early
+            scheduler.set_horizon(deadline);
+            cpu.run_for(uint32_t(std::min<uint64_t>(deadline - now, UINT32_MAX)));
+            scheduler.set_horizon(0);
+        }
+    }
+    apu.sync(cpu.getCycles());
+    apu.end_frame();
+    return uint32_t(cpu.getCycles() - start);
+}
+
+void NES::dispatch(int id, uint64_t cycle)
+{
+    switch (id)
+    {
+    case event_ppu:
+        ppu->sync(cycle);
+        break;
+    case event_apu:
+        apu.sync(cycle);
+        break;
+    }
+}
+
+uint8_t NES::read_io(void *context, uint16_t address)
+{
+    NES *nes = static_cast<NES *>(context);
+    if (address == 0x4015)
+    {
+        nes->apu.catch_up();
+        return nes->apu.read_register(address);
+    }
+    if (address == 0x4016 || address == 0x4017)
+    {
+        // The upper bits are left on the bus by the address' high byte
+        return 0x40 | nes->controllers[address & 1].read();
+    }
+    return 0;
+}
+
+void NES::write_io(void *context, uint16_t address, uint8_t value)
+{
+    NES *nes = static_cast<NES *>(context);
+    if (address <= 0x4013 || address == 0x4015 || address == 0x4017)
+    {
+        nes->apu.catch_up();
+        nes->apu.write_register(address, value);
+    }
+    else if (address == 0x4014)
+    {
+        // OAM DMA, the CPU halts for 513 cycles plus one to align to a read cycle when the
+        // write lands on an odd one
+        nes->ppu->catch_up();
+        for (int i = 0; i < 256; i++)
+        {
+            nes->ppu->write_oam(nes->mmu.read((value << 8) | i));
+        }
+        nes->cpu.stall(513 + (nes->cpu.getWriteCycle() & 1));
+    }
+    else if (address == 0x4016)
+    {
+        // One strobe line runs to both ports
+        nes->controllers[0].write_strobe(value);
+        nes->controllers[1].write_strobe(value);
+    }
+}
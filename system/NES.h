@@ -1,17 +1,141 @@
+#ifndef _NES_
+#define _NES_
+#include "APU.h"
+#include "CPU.h"
+#include "Cartridge.h"
+#include "Controller.h"
+#include "Mapper.h"
+#include "MMU.h"
+#include "PPU.h"
+#include "Scheduler.h"
+#include <memory>
+#include <vector>
 
+/*
+ * The console. The CPU drives the timeline and the devices trail it: register accesses catch them
+ * up to the CPU's cycle count, and each keeps the cycle of its next unprompted event (vblank NMI,
+ * a mapper scanline IRQ, the APU's frame counter and DMC IRQs) in the scheduler. The run loop
+ * runs the CPU up to the earliest one.
+ */
 class NES
 {
-private:
-    
 public:
-    NES(/* args */);
-    ~NES();
-};
+    enum load_result
+    {
+        loaded,
+        bad_image,
+        unsupported_mapper,
+    };
+    enum state_result
+    {
+        state_loaded,
+        // Not a savestate, or one from a build with another layout
+        state_bad_version,
+        state_wrong_cartridge,
+        // Right size and cartridge, but a field that indexes a table or the heap is out of range
+        state_corrupt,
+    };
 
-NES::NES(/* args */)
-{
-}
+    NES();
+    NES(const NES &) = delete;
+    NES &operator=(const NES &) = delete;
 
-NES::~NES()
-{
-}
+    /*
+     * Loads an iNES or NES 2.0 image and wires its board into the bus. On failure the cartridge
+     * loaded before, if any, stays in place.
+     */
+    load_result load(const char *path);
+    // Power on state, does nothing until load() has succeeded
+    void reset();
+    /*
+     * Runs until the PPU enters vblank, returns the CPU cycles spent. The frame's audio is then
+     * readable from the APU. Returns 0 until load() has succeeded.
+     */
+    uint32_t run_frame();
+
+    /*
+     * Bytes in a savestate of the loaded cartridge, every one of its states has this size.
+     */
+    size_t getStateSize() const
+    {
+        return state_size;
+    }
+    /*
+     * Writes every component's state to out, getStateSize() bytes. Between runs only, like
+     * after run_frame.
+     */
+    void save_state(uint8_t *out) const;
+    /*
+     * Restores a state written by save_state for the same cartridge. Nothing is changed unless
+     * it is one: the header is checked first, and a state whose fields turn out out of range
+     * while loading is undone.
+     */
+    state_result load_state(const uint8_t *in, size_t size);
+
+    /*
+     * The buttons held on controller port 0 ($4016) or 1 ($4017), a mask of Controller::button.
+     * Set between frames, a movie sets both before every run_frame.
+     */
+    void set_buttons(int port, uint8_t buttons)
+    {
+        controllers[port & 1].set_buttons(buttons);
+    }
+
+    CPU<MMU> &getCPU()
+    {
+        return cpu;
+    }
+    PPU &getPPU()
+    {
+        return *ppu;
+    }
+    APU &getAPU()
+    {
+        return apu;
+    }
+    MMU &getMMU()
+    {
+        return mmu;
+    }
+    Cartridge &getCartridge()
+    {
+        return *cartridge;
+    }
+    Scheduler &getScheduler()
+    {
+        return scheduler;
+    }
+
+private:
+    // Scheduler slots
+    enum event_id
+    {
+        event_ppu,
+        event_apu,
+    };
+
+    std::unique_ptr<Cartridge> cartridge;
+    MMU mmu;
+    CPU<MMU> cpu;
+    Scheduler scheduler;
+    APU apu;
+    std::unique_ptr<Mapper> mapper;
+    std::unique_ptr<PPU> ppu;
+    Controller controllers[2];
+    size_t state_size = 0;
+    // The state before the last load_state, sized with state_size
+    std::vector<uint8_t> undo;
+
+    savestate::header_t state_header() const;
+    void save(StateWriter &out) const;
+    // False when a component refused a field, the console is then partly loaded
+    bool load(StateReader &in);
+
+    // Brings the device behind id up to cycle, it schedules its next event itself
+    void dispatch(int id, uint64_t cycle);
+
+    // $4000-$40FF
+    static uint8_t read_io(void *context, uint16_t address);
+    static void write_io(void *context, uint16_t address, uint8_t value);
+};
+#endif
@@ -0,0 +1,840 @@
+#include "PPU.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// Status bits
+const uint8_t vblank = 0x80;
+const uint8_t sprite0_hit = 0x40;
+const uint8_t sprite_overflow = 0x20;
+
+// Sprite line entries
+const uint8_t behind = 0x20;
+const uint8_t sprite0 = 0x40;
+
+/*
+ * Interleaves the low and high bitplanes of two pattern rows into 16 pixels, leftmost first,
+ * each with its palette number in bits 2-3. flip mirrors both rows, for sprites.
+ */
+void decode_rows(uint8_t lo0, uint8_t hi0, uint8_t lo1, uint8_t hi1, uint8_t palette0, uint8_t palette1,
+                 bool flip, uint8_t *out)
+{
+#if defined(__SSE2__)
+    const uint64_t spread = 0x0101010101010101ull;
+    // Bit 7 is the leftmost pixel unless the row is flipped
+    const __m128i bits = flip ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128)
+                              : _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i lo = _mm_set_epi64x(lo1 * spread, lo0 * spread);
+    const __m128i hi = _mm_set_epi64x(hi1 * spread, hi0 * spread);
+    const __m128i attributes = _mm_set_epi64x((palette1 << 2) * spread, (palette0 << 2) * spread);
+    const __m128i plane0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+    const __m128i plane1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_or_si128(_mm_or_si128(plane0, plane1), attributes));
+#else
+    const uint8_t lo[2] = {lo0, lo1};
+    const uint8_t hi[2] = {hi0, hi1};
+    const uint8_t attributes[2] = {uint8_t(palette0 << 2), uint8_t(palette1 << 2)};
+    for (int i = 0; i < 16; i++)
+    {
+        const int bit = flip ? (i & 7) : 7 - (i & 7);
+        out[i] = ((lo[i >> 3] >> bit) & 1) | (((hi[i >> 3] >> bit) & 1) << 1) | attributes[i >> 3];
+    }
+#endif
+}
+
+/*
+ * Writes the opaque pixels of an 8 pixel sprite row where no earlier sprite has one.
+ */
+void merge_sprite(const uint8_t *row, uint8_t *line)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i source = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row));
+    const __m128i destination = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(line));
+    const __m128i transparent = _mm_cmpeq_epi8(_mm_and_si128(source, three), zero);
+    const __m128i taken = _mm_xor_si128(_mm_cmpeq_epi8(destination, zero), _mm_set1_epi8(-1));
+    const __m128i keep = _mm_or_si128(transparent, taken);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(line),
+                     _mm_or_si128(_mm_and_si128(keep, destination), _mm_andnot_si128(keep, source)));
+#else
+    for (int i = 0; i < 8; i++)
+    {
+        if (!line[i] && (row[i] & 3))
+        {
+            line[i] = row[i];
+        }
+    }
+#endif
+}
+
+/*
+ * Picks the background or the sprite pixel for a whole line and returns the first pixel where
+ * sprite 0 overlaps an opaque background pixel, -1 for none.
+ */
+int composite(const uint8_t *background, const uint8_t *sprites, uint8_t *out)
+{
+    int hit = -1;
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i < PPU::width; i += 32)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i bg = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(background + i));
+        const __m256i sprite = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sprites + i));
+        const __m256i bg_clear = _mm256_cmpeq_epi8(_mm256_and_si256(bg, _mm256_set1_epi8(3)), zero);
+        const __m256i sprite_clear = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, _mm256_set1_epi8(3)), zero);
+        const __m256i in_front = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, _mm256_set1_epi8(behind)), zero);
+        const __m256i use_sprite = _mm256_andnot_si256(sprite_clear, _mm256_or_si256(in_front, bg_clear));
+        const __m256i visible_bg = _mm256_andnot_si256(bg_clear, bg);
+        const __m256i pixel = _mm256_blendv_epi8(visible_bg, _mm256_and_si256(sprite, _mm256_set1_epi8(0x1F)), use_sprite);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), pixel);
+        const __m256i overlap = _mm256_andnot_si256(
+            bg_clear, _mm256_cmpeq_epi8(_mm256_and_si256(sprite, _mm256_set1_epi8(sprite0)), _mm256_set1_epi8(sprite0)));
+        const uint32_t hits = _mm256_movemask_epi8(overlap);
+        if (hits && hit < 0)
+        {
+            hit = i + __builtin_ctz(hits);
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i < PPU::width; i += 16)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(background + i));
+        const __m128i sprite = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sprites + i));
+        const __m128i bg_clear = _mm_cmpeq_epi8(_mm_and_si128(bg, _mm_set1_epi8(3)), zero);
+        const __m128i sprite_clear = _mm_cmpeq_epi8(_mm_and_si128(sprite, _mm_set1_epi8(3)), zero);
+        const __m128i in_front = _mm_cmpeq_epi8(_mm_and_si128(sprite, _mm_set1_epi8(behind)), zero);
+        const __m128i use_sprite = _mm_andnot_si128(sprite_clear, _mm_or_si128(in_front, bg_clear));
+        const __m128i visible_bg = _mm_andnot_si128(bg_clear, bg);
+        const __m128i pixel = _mm_or_si128(_mm_and_si128(use_sprite, _mm_and_si128(sprite, _mm_set1_epi8(0x1F))),
+                                           _mm_andnot_si128(use_sprite, visible_bg));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), pixel);
+        const __m128i overlap = _mm_andnot_si128(
+            bg_clear, _mm_cmpeq_epi8(_mm_and_si128(sprite, _mm_set1_epi8(sprite0)), _mm_set1_epi8(sprite0)));
+        const int hits = _mm_movemask_epi8(overlap);
+        if (hits && hit < 0)
+        {
+            hit = i + __builtin_ctz(hits);
+        }
+    }
+#endif
+    for (; i < PPU::width; i++)
+    {
+        const bool bg_clear = !(background[i] & 3);
+        const bool use_sprite = (sprites[i] & 3) && (!(sprites[i] & behind) || bg_clear);
+        out[i] = use_sprite ? sprites[i] & 0x1F : bg_clear ? 0 : background[i];
+        if (hit < 0 && (sprites[i] & sprite0) && !bg_clear)
+        {
+            hit = i;
+        }
+    }
+    return hit;
+}
+}
+
+PPU::PPU(Mapper &mapper) : mapper(mapper)
+{
+}
+
+void PPU::map(MMU &mmu)
+{
+    io_handler handler;
+    handler.read = [](void *context, uint16_t address)
+    {
+        PPU *ppu = static_cast<PPU *>(context);
+        ppu->catch_up();
+        return ppu->read_register(address);
+    };
+    handler.write = [](void *context, uint16_t address, uint8_t value)
+    {
+        PPU *ppu = static_cast<PPU *>(context);
+        ppu->catch_up();
+        ppu->write_register(address, value);
+        // $2000 and $2001 can move vblank NMI and the scanline clocks
+        ppu->reschedule();
+    };
+    handler.context = this;
+    mmu.map_io(0x2000, 0x2000, handler);
+}
+
+void PPU::reset()
+{
+    ctrl = mask = status = oam_address = 0;
+    v = t = 0;
+    x = 0;
+    w = false;
+    buffer = latch = 0;
+    scanline = lines_per_frame - 1;
+    dot = 0;
+    odd = false;
+    dot_mode = false;
+    sprite0_dot = 0;
+    reschedule();
+}
+
+void PPU::save(StateWriter &out) const
+{
+    out.put(synced);
+    out.put(ctrl);
+    out.put(mask);
+    out.put(status);
+    out.put(oam_address);
+    out.put(v);
+    out.put(t);
+    out.put(x);
+    out.put(w);
+    out.put(buffer);
+    out.put(latch);
+    out.put(vram);
+    out.put(palette);
+    out.put(oam);
+    out.put(scanline);
+    out.put(dot);
+    out.put(odd);
+    out.put(frames);
+    out.put(sprite_line);
+    out.put(sprite0_dot);
+    out.put(dot_mode);
+    out.put(pixel);
+    out.put(fine);
+}
+
+bool PPU::load(StateReader &in)
+{
+    in.get(synced);
+    in.get(ctrl);
+    in.get(mask);
+    in.get(status);
+    in.get(oam_address);
+    in.get(v);
+    in.get(t);
+    uint8_t loaded_x;
+    in.get(loaded_x);
+    in.get(w);
+    in.get(buffer);
+    in.get(latch);
+    in.get(vram);
+    in.get(palette);
+    in.get(oam);
+    // Positions index the frame, the line buffers and tile bits, they are checked before use
+    int loaded_scanline, loaded_dot, loaded_pixel, loaded_fine;
+    in.get(loaded_scanline);
+    in.get(loaded_dot);
+    in.get(odd);
+    in.get(frames);
+    in.get(sprite_line);
+    in.get(sprite0_dot);
+    in.get(dot_mode);
+    in.get(loaded_pixel);
+    in.get(loaded_fine);
+    if (loaded_x > 7 || loaded_scanline < 0 || loaded_scanline >= lines_per_frame || loaded_dot < 0 ||
+        loaded_dot >= dots_per_line || loaded_pixel < 0 || loaded_pixel > width || loaded_fine < 0 || loaded_fine > 7)
+    {
+        return false;
+    }
+    x = loaded_x;
+    scanline = loaded_scanline;
+    dot = loaded_dot;
+    pixel = loaded_pixel;
+    fine = loaded_fine;
+    return true;
+}
+
+void PPU::reschedule()
+{
+    if (scheduler)
+    {
+        scheduler->schedule(event_id, next_sync());
+    }
+}
+
+uint8_t *PPU::nametable(uint16_t address)
+{
+    const int table = (address >> 10) & 3;
+    int page = table;
+    switch (mapper.getMirroring())
+    {
+    case Cartridge::horizontal:
+        page = table >> 1;
+        break;
+    case Cartridge::vertical:
+        page = table & 1;
+        break;
+    case Cartridge::single_lower:
+        page = 0;
+        break;
+    case Cartridge::single_upper:
+        page = 1;
+        break;
+    case Cartridge::four_screen:
+        break;
+    }
+    return &vram[(page << 10) | (address & 0x3FF)];
+}
+
+uint8_t *PPU::palette_entry(uint16_t address)
+{
+    // The backdrop entries of the sprite palettes mirror the background ones
+    uint8_t index = address & 0x1F;
+    if ((index & 0x13) == 0x10)
+    {
+        index &= 0x0F;
+    }
+    return &palette[index];
+}
+
+uint8_t PPU::read_vram(uint16_t address)
+{
+    address &= 0x3FFF;
+    if (address < 0x2000)
+    {
+        return read_chr(address);
+    }
+    if (address < 0x3F00)
+    {
+        return *nametable(address);
+    }
+    return *palette_entry(address);
+}
+
+void PPU::write_vram(uint16_t address, uint8_t value)
+{
+    address &= 0x3FFF;
+    if (address < 0x2000)
+    {
+        // CHR ROM has no write pages
+        uint8_t *page = mapper.chr_write[address >> 10];
+        if (page)
+        {
+            page[address & 0x3FF] = value;
+        }
+    }
+    else if (address < 0x3F00)
+    {
+        *nametable(address) = value;
+    }
+    else
+    {
+        *palette_entry(address) = value & 0x3F;
+    }
+}
+
+uint8_t PPU::read_register(uint16_t address)
+{
+    uint8_t value = latch;
+    switch (address & 7)
+    {
+    case 2:
+        // The low bits are whatever was last on the bus
+        value = (status & 0xE0) | (latch & 0x1F);
+        status &= ~vblank;
+        w = false;
+        break;
+    case 4:
+        value = oam[oam_address];
+        break;
+    case 7:
+    {
+        split_line();
+        const uint16_t target = v & 0x3FFF;
+        if (target >= 0x3F00)
+        {
+            // Palette reads are not buffered, the buffer gets the nametable byte underneath
+            value = (*palette_entry(target) & 0x3F) | (latch & 0xC0);
+            buffer = read_vram(target & 0x2FFF);
+        }
+        else
+        {
+            value = buffer;
+            buffer = read_vram(target);
+        }
+        v += (ctrl & 0x04) ? 32 : 1;
+        break;
+    }
+    }
+    latch = value;
+    return value;
+}
+
+void PPU::write_register(uint16_t address, uint8_t value)
+{
+    latch = value;
+    switch (address & 7)
+    {
+    case 0:
+        if (value != ctrl)
+        {
+            split_line();
+        }
+        // Enabling NMI during vblank raises one straight away
+        if (!(ctrl & 0x80) && (value & 0x80) && (status & vblank) && nmi.raise)
+        {
+            nmi.raise(nmi.context);
+        }
+        ctrl = value;
+        t = (t & ~0x0C00) | ((value & 0x03) << 10);
+        break;
+    case 1:
+        if (value != mask)
+        {
+            split_line();
+        }
+        mask = value;
+        break;
+    case 3:
+        oam_address = value;
+        break;
+    case 4:
+        oam[oam_address++] = value;
+        break;
+    case 5:
+        // Only t and fine X change, neither is used again before the line ends
+        if (!w)
+        {
+            t = (t & ~0x001F) | (value >> 3);
+            x = value & 0x07;
+        }
+        else
+        {
+            t = (t & ~0x73E0) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+        }
+        w = !w;
+        break;
+    case 6:
+        if (!w)
+        {
+            t = (t & 0x00FF) | ((value & 0x3F) << 8);
+        }
+        else
+        {
+            split_line();
+            t = (t & 0xFF00) | value;
+            v = t;
+        }
+        w = !w;
+        break;
+    case 7:
+        split_line();
+        write_vram(v, value);
+        v += (ctrl & 0x04) ? 32 : 1;
+        break;
+    }
+}
+
+void PPU::increment_x()
+{
+    if ((v & 0x001F) == 31)
+    {
+        v &= ~0x001F;
+        v ^= 0x0400;
+    }
+    else
+    {
+        v++;
+    }
+}
+
+void PPU::increment_y()
+{
+    if ((v & 0x7000) != 0x7000)
+    {
+        v += 0x1000;
+        return;
+    }
+    v &= ~0x7000;
+    int y = (v & 0x03E0) >> 5;
+    if (y == 29)
+    {
+        // The last row of tiles, attribute rows are skipped
+        y = 0;
+        v ^= 0x0800;
+    }
+    else if (y == 31)
+    {
+        y = 0;
+    }
+    else
+    {
+        y++;
+    }
+    v = (v & ~0x03E0) | (y << 5);
+}
+
+void PPU::run(uint32_t dots)
+{
+    while (dots)
+    {
+        const int next = next_event();
+        const uint32_t step = std::min<uint32_t>(next - dot, dots);
+        dot += step;
+        dots -= step;
+        if (dot_mode)
+        {
+            render_dots();
+        }
+        if (dot == next)
+        {
+            event();
+        }
+    }
+}
+
+int PPU::next_event() const
+{
+    static const int visible_events[] = {256, 257, 260, dots_per_line};
+    static const int vblank_events[] = {1, dots_per_line};
+    static const int prerender_events[] = {1, 256, 257, 260, 280, 340, dots_per_line};
+    static const int idle_events[] = {dots_per_line};
+    const int *events = idle_events;
+    if (scanline < height)
+    {
+        events = visible_events;
+    }
+    else if (scanline == height + 1)
+    {
+        events = vblank_events;
+    }
+    else if (scanline == lines_per_frame - 1)
+    {
+        events = prerender_events;
+    }
+    while (*events <= dot)
+    {
+        events++;
+    }
+    int next = *events;
+    if (scanline < height && sprite0_dot > dot && sprite0_dot < next)
+    {
+        next = sprite0_dot;
+    }
+    return next;
+}
+
+uint32_t PPU::dots_until(int line, int target) const
+{
+    int32_t dots = ((line - scanline + lines_per_frame) % lines_per_frame) * dots_per_line + target - dot;
+    if (dots <= 0)
+    {
+        dots += lines_per_frame * dots_per_line;
+    }
+    // Passing the end of an odd pre-render line skips a dot
+    const int32_t skip = ((lines_per_frame - 1 - scanline + lines_per_frame) % lines_per_frame) * dots_per_line + 340 - dot;
+    if (odd && rendering() && skip > 0 && skip < dots)
+    {
+        dots--;
+    }
+    return dots;
+}
+
+uint64_t PPU::next_sync() const
+{
+    uint32_t dots = dots_until(height + 1, 1);
+    if (rendering() && mapper.scanline_irq())
+    {
+        // Dot 260 of the visible and pre-render lines, see event()
+        int line = scanline;
+        if (dot >= 260)
+        {
+            line = (line + 1) % lines_per_frame;
+        }
+        if (line >= height && line < lines_per_frame - 1)
+        {
+            line = lines_per_frame - 1;
+        }
+        dots = std::min(dots, dots_until(line, 260));
+    }
+    // Rounded up so the event is behind the PPU once it is synced
+    return synced + (dots + 2) / 3;
+}
+
+void PPU::event()
+{
+    if (dot == dots_per_line || (dot == 340 && scanline == lines_per_frame - 1 && odd && rendering()))
+    {
+        // Odd frames skip the last dot of the pre-render line while rendering
+        dot = 0;
+        if (++scanline == lines_per_frame)
+        {
+            scanline = 0;
+            odd = !odd;
+        }
+        start_line();
+        return;
+    }
+    if (scanline < height && dot == sprite0_dot)
+    {
+        status |= sprite0_hit;
+        sprite0_dot = 0;
+    }
+    switch (dot)
+    {
+    case 1:
+        if (scanline == height + 1)
+        {
+            status |= vblank;
+            frames++;
+            if ((ctrl & 0x80) && nmi.raise)
+            {
+                nmi.raise(nmi.context);
+            }
+        }
+        else if (scanline == lines_per_frame - 1)
+        {
+            status &= ~(vblank | sprite0_hit | sprite_overflow);
+        }
+        break;
+    case 256:
+        if (rendering())
+        {
+            increment_y();
+        }
+        break;
+    case 257:
+        dot_mode = false;
+        if (rendering())
+        {
+            v = (v & ~0x041F) | (t & 0x041F);
+        }
+        break;
+    case 260:
+        // Where MMC3 sees A12 rise with backgrounds at $0000 and sprites at $1000
+        if (rendering())
+        {
+            mapper.scanline();
+        }
+        break;
+    case 280:
+        if (rendering())
+        {
+            v = (v & ~0x7BE0) | (t & 0x7BE0);
+        }
+        break;
+    }
+}
+
+void PPU::start_line()
+{
+    dot_mode = false;
+    sprite0_dot = 0;
+    if (scanline >= height)
+    {
+        return;
+    }
+    if (mask & 0x10)
+    {
+        evaluate_sprites();
+    }
+    else
+    {
+        std::memset(sprite_line, 0, sizeof(sprite_line));
+        sprite0_line = false;
+    }
+    // Fine X is latched for the whole line, split_line starts from it too
+    pixel = 0;
+    fine = x;
+    if (batching)
+    {
+        render_line();
+    }
+    else
+    {
+        dot_mode = true;
+    }
+}
+
+void PPU::evaluate_sprites()
+{
+    std::memset(sprite_line, 0, sizeof(sprite_line));
+    sprite0_line = false;
+    const int size = (ctrl & 0x20) ? 16 : 8;
+    int found = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        const uint8_t *sprite = &oam[i * 4];
+        // Y is the line before the sprite's first one
+        int row = scanline - 1 - sprite[0];
+        if (row < 0 || row >= size)
+        {
+            continue;
+        }
+        if (found == 8)
+        {
+            status |= sprite_overflow;
+            break;
+        }
+        found++;
+        sprite0_line |= i == 0;
+        const uint8_t attributes = sprite[2];
+        if (attributes & 0x80)
+        {
+            row = size - 1 - row;
+        }
+        uint16_t address;
+        if (size == 16)
+        {
+            // Bit 0 of the tile picks the pattern table of tall sprites
+            address = ((sprite[1] & 1) << 12) | ((sprite[1] & 0xFE) << 4) | ((row & 8) << 1) | (row & 7);
+        }
+        else
+        {
+            address = ((ctrl & 0x08) << 9) | (sprite[1] << 4) | row;
+        }
+        uint8_t decoded[16];
+        decode_rows(read_chr(address), read_chr(address + 8), 0, 0, 4 | (attributes & 3), 0, attributes & 0x40,
+                    decoded);
+        const uint8_t flags = 0x10 | ((attributes & 0x20) ? behind : 0) | (i == 0 ? sprite0 : 0);
+        for (int p = 0; p < 8; p++)
+        {
+            // Transparent pixels stay 0
+            decoded[p] = (decoded[p] & 3) ? decoded[p] | flags : 0;
+        }
+        merge_sprite(decoded, &sprite_line[sprite[3]]);
+    }
+}
+
+void PPU::render_line()
+{
+    uint8_t *row = &frame[scanline * width];
+    const uint8_t grayscale = (mask & 0x01) ? 0x30 : 0x3F;
+    if (!output && (!sprite0_line || (mask & 0x18) != 0x18 || (status & sprite0_hit)))
+    {
+        // Nothing on the line can be seen from the CPU
+        return;
+    }
+    if (!rendering())
+    {
+        std::memset(row, palette[0] & grayscale, width);
+        return;
+    }
+    // 34 tiles cover any fine X, decoded two at a time
+    uint8_t background[34 * 8];
+    if (mask & 0x08)
+    {
+        const uint16_t start = v;
+        const uint16_t patterns = ((ctrl & 0x10) << 8) | (v >> 12);
+        for (int tile = 0; tile < 34; tile += 2)
+        {
+            uint8_t lo[2];
+            uint8_t hi[2];
+            uint8_t palettes[2];
+            for (int i = 0; i < 2; i++)
+            {
+                const uint16_t address = patterns | (*nametable(0x2000 | (v & 0x0FFF)) << 4);
+                const uint8_t attribute = *nametable(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+                palettes[i] = (attribute >> (((v >> 4) & 4) | (v & 2))) & 3;
+                lo[i] = read_chr(address);
+                hi[i] = read_chr(address + 8);
+                increment_x();
+            }
+            decode_rows(lo[0], hi[0], lo[1], hi[1], palettes[0], palettes[1], false, &background[tile * 8]);
+        }
+        // The walk is redone by split_line when the line goes dot by dot
+        v = start;
+        if (!(mask & 0x02))
+        {
+            std::memset(&background[x], 0, 8);
+        }
+    }
+    else
+    {
+        std::memset(background, 0, sizeof(background));
+    }
+    uint8_t sprites[width];
+    std::memcpy(sprites, sprite_line, width);
+    if (!(mask & 0x04))
+    {
+        std::memset(sprites, 0, 8);
+    }
+    uint8_t pixels[width];
+    const int hit = composite(&background[x], sprites, pixels);
+    if (hit >= 0 && hit != width - 1 && (mask & 0x18) == 0x18 && !(status & sprite0_hit))
+    {
+        sprite0_dot = hit + 1;
+    }
+    if (!output)
+    {
+        return;
+    }
+    for (int i = 0; i < width; i++)
+    {
+        row[i] = palette[pixels[i]] & grayscale;
+    }
+}
+
+void PPU::render_dots()
+{
+    const int end = std::min(dot, width);
+    uint8_t *row = &frame[scanline * width];
+    for (; pixel < end; pixel++)
+    {
+        uint8_t bg = 0;
+        if ((mask & 0x08) && (pixel >= 8 || (mask & 0x02)))
+        {
+            const uint16_t address = ((ctrl & 0x10) << 8) | (*nametable(0x2000 | (v & 0x0FFF)) << 4) | (v >> 12);
+            const uint8_t attribute = *nametable(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+            const int bit = 7 - fine;
+            bg = ((read_chr(address) >> bit) & 1) | (((read_chr(address + 8) >> bit) & 1) << 1);
+            if (bg)
+            {
+                bg |= ((attribute >> (((v >> 4) & 4) | (v & 2))) & 3) << 2;
+            }
+        }
+        const uint8_t sprite = ((mask & 0x10) && (pixel >= 8 || (mask & 0x04))) ? sprite_line[pixel] : 0;
+        uint8_t index = bg;
+        if (sprite && (!(sprite & behind) || !bg))
+        {
+            index = sprite & 0x1F;
+        }
+        if ((sprite & sprite0) && bg && pixel != width - 1 && (mask & 0x18) == 0x18)
+        {
+            status |= sprite0_hit;
+        }
+        if (output)
+        {
+            row[pixel] = palette[index] & ((mask & 0x01) ? 0x30 : 0x3F);
+        }
+        if (rendering() && ++fine == 8)
+        {
+            fine = 0;
+            increment_x();
+        }
+    }
+}
+
+void PPU::split_line()
+{
+    if (scanline >= height || dot > width)
+    {
+        return;
+    }
+    if (dot_mode)
+    {
+        render_dots();
+        return;
+    }
+    // The pixels from the current dot on are redone with whatever the write changes
+    dot_mode = true;
+    pixel = dot;
+    if (rendering())
+    {
+        const int offset = fine + dot;
+        for (int i = 0; i < (offset >> 3); i++)
+        {
+            increment_x();
+        }
+        fine = offset & 7;
+    }
+    if (sprite0_dot > dot)
+    {
+        sprite0_dot = 0;
+    }
+}
@@ -0,0 +1,229 @@
+#ifndef _PPU_
+#define _PPU_
+#include "MMU.h"
+#include "Mapper.h"
+#include "Scheduler.h"
+#include <cstdint>
+
+/*
+ * The PPU's NMI output, wired to CPU::nmi.
+ */
+struct nmi_line
+{
+    void (*raise)(void *context) = nullptr;
+    void *context = nullptr;
+};
+
+/*
+ * 2C02 picture processing unit, registers at $2000-$2007 mirrored through $3FFF.
+ * Visible scanlines are rendered whole when they start. A register write in the middle of a
+ * rendered line sends the rest of that line through the dot by dot path, so raster splits land
+ * on the dot they were written at. Pattern tables come from the mapper's CHR pages.
+ *
+ * The PPU is not ticked along with the CPU. It remembers the CPU cycle it has run up to and
+ * catches up when its registers are accessed through the MMU, or when the owner syncs it at
+ * next_sync() for events the CPU would otherwise miss. With a scheduler connected the PPU keeps
+ * its event there at next_sync() itself.
+ */
+class PPU
+{
+public:
+    static constexpr int width = 256;
+    static constexpr int height = 240;
+    static constexpr int dots_per_line = 341;
+    static constexpr int lines_per_frame = 262;
+
+    PPU(Mapper &mapper);
+    PPU(const PPU &) = delete;
+    PPU &operator=(const PPU &) = delete;
+
+    /*
+     * Sends $2000-$3FFF to the registers.
+     */
+    void map(MMU &mmu);
+    void connect_nmi(nmi_line line)
+    {
+        nmi = line;
+    }
+    void connect_clock(clock_source source)
+    {
+        clock = source;
+    }
+    void connect_scheduler(Scheduler *timeline, int id)
+    {
+        scheduler = timeline;
+        event_id = id;
+    }
+    // Power on state, the frame starts over at the pre-render line
+    void reset();
+
+    /*
+     * Advances dots PPU cycles, three per CPU cycle on NTSC.
+     */
+    void run(uint32_t dots);
+    /*
+     * Runs up to CPU cycle cycle, a cycle already passed is a no-op.
+     */
+    void sync(uint64_t cycle)
+    {
+        if (cycle > synced)
+        {
+            run(uint32_t(cycle - synced) * 3);
+            synced = cycle;
+        }
+        reschedule();
+    }
+    // Up to the connected clock, done before every register access through the MMU
+    void catch_up()
+    {
+        if (clock.now)
+        {
+            sync(clock.now(clock.context));
+        }
+    }
+    /*
+     * The CPU cycle the PPU has to be synced at next even if its registers are left alone:
+     * the start of vblank, which raises NMI and ends the frame, or the next scanline clock
+     * on boards with a scanline IRQ.
+     */
+    uint64_t next_sync() const;
+    uint64_t getSyncedCycle() const
+    {
+        return synced;
+    }
+
+    uint8_t read_register(uint16_t address);
+    void write_register(uint16_t address, uint8_t value);
+    // One byte of OAM DMA, the same as a write to $2004
+    void write_oam(uint8_t value)
+    {
+        oam[oam_address++] = value;
+    }
+
+    /*
+     * Registers, memories and where the frame is at. The picture is not saved, it is redrawn by
+     * the next frame, so a state loaded mid-frame shows the old picture down to the line it was
+     * saved on until then. Loading returns false when the position in the frame or fine X is out
+     * of range, those are then left as they were.
+     */
+    void save(StateWriter &out) const;
+    bool load(StateReader &in);
+
+    // 6 bit NES colour indices, width * height of them
+    const uint8_t *getFrame() const
+    {
+        return frame;
+    }
+    // Completed frames, bumped when vblank starts
+    uint64_t getFrameCount() const
+    {
+        return frames;
+    }
+    int getScanline() const
+    {
+        return scanline;
+    }
+    int getDot() const
+    {
+        return dot;
+    }
+    // False renders every line dot by dot, the differential test compares both paths
+    void set_scanline_batching(bool enabled)
+    {
+        batching = enabled;
+    }
+    /*
+     * False stops writing pixels to the frame, for frames nobody looks at. Lines are still
+     * fetched where sprite 0 could hit, so the hit flag, sprite overflow, scrolling and the
+     * mapper's scanline clocks land where they would have. The frame keeps whatever it had.
+     */
+    void set_frame_output(bool enabled)
+    {
+        output = enabled;
+    }
+
+private:
+    Mapper &mapper;
+    nmi_line nmi;
+    clock_source clock;
+    Scheduler *scheduler = nullptr;
+    int event_id = 0;
+    // CPU cycle run and rendered up to
+    uint64_t synced = 0;
+
+    // $2000, $2001, $2002 and $2003
+    uint8_t ctrl = 0;
+    uint8_t mask = 0;
+    uint8_t status = 0;
+    uint8_t oam_address = 0;
+    // Loopy's scroll registers: current and temporary VRAM address, fine X and the write toggle
+    uint16_t v = 0;
+    uint16_t t = 0;
+    uint8_t x = 0;
+    bool w = false;
+    // $2007 read buffer and the last value driven on the data bus
+    uint8_t buffer = 0;
+    uint8_t latch = 0;
+
+    // Four nametables, boards without their own VRAM only use the first two
+    uint8_t vram[0x1000]{};
+    uint8_t palette[32]{};
+    uint8_t oam[256]{};
+
+    int scanline = 261;
+    int dot = 0;
+    bool odd = false;
+    uint64_t frames = 0;
+    bool batching = true;
+    bool output = true;
+
+    /*
+     * Per line rendering state. Sprites are evaluated into sprite_line when a visible line starts:
+     * palette address in bits 0-4, 0 when transparent, behind the background in bit 5 and
+     * sprite 0 in bit 6. Sprites at X 249-255 spill into the padding.
+     */
+    uint8_t sprite_line[width + 8]{};
+    // Whether sprite 0 is in sprite_line, without it a line that is not output needs no fetches
+    bool sprite0_line = false;
+    // Dot the batched line predicts a sprite 0 hit at, 0 for none
+    int sprite0_dot = 0;
+    // Dot by dot state, the next pixel and the fine X offset into the tile v points at
+    bool dot_mode = false;
+    int pixel = 0;
+    int fine = 0;
+    uint8_t frame[width * height]{};
+
+    bool rendering() const
+    {
+        return mask & 0x18;
+    }
+    uint8_t *nametable(uint16_t address);
+    uint8_t *palette_entry(uint16_t address);
+    uint8_t read_vram(uint16_t address);
+    void write_vram(uint16_t address, uint8_t value);
+    uint8_t read_chr(uint16_t address) const
+    {
+        return mapper.chr_read[(address >> 10) & 7][address & 0x3FF];
+    }
+
+    // Next dot on the current line with something to do, dots_per_line at the end of the line
+    int next_event() const;
+    // Dots from now until line and dot, a whole frame when that is now
+    uint32_t dots_until(int line, int target) const;
+    // Moves the scheduled event to next_sync()
+    void reschedule();
+    void event();
+    void start_line();
+    void evaluate_sprites();
+    // The whole visible line at once
+    void render_line();
+    // Pixels up to the current dot, one at a time
+    void render_dots();
+    /*
+     * A register write is about to change what the rest of the line looks like.
+     */
+    void split_line();
+    void increment_x();
+    void increment_y();
+};
+#endif
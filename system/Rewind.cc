@@ -0,0 +1,228 @@
+#include "Rewind.h"
+#include <cstring>
+
+namespace
+{
+// Differing bytes keep a literal run going until this many equal ones in a row end it
+const size_t min_equal = 4;
+
+uint8_t *put_varint(uint8_t *out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+const uint8_t *get_varint(const uint8_t *in, size_t &value)
+{
+    value = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        const uint8_t byte = *in++;
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return in;
+        }
+    }
+}
+
+// Length of the run of bytes equal to base from i on
+size_t equal_run(const uint8_t *state, const uint8_t *base, size_t i, size_t size)
+{
+    const size_t start = i;
+    // Eight at a time while whole words match
+    while (i + 8 <= size)
+    {
+        uint64_t a, b;
+        std::memcpy(&a, state + i, 8);
+        std::memcpy(&b, base + i, 8);
+        if (a != b)
+        {
+            break;
+        }
+        i += 8;
+    }
+    while (i < size && state[i] == base[i])
+    {
+        i++;
+    }
+    return i - start;
+}
+}
+
+Rewind::Rewind(size_t state_size, size_t capacity, size_t states, uint32_t interval)
+    : state_size(state_size), interval(interval ? interval : 1), ring(capacity), entries(states ? states : 1),
+      key(state_size), zeros(state_size), scratch(state_size + state_size / 2 + state_size / 16 + 16)
+{
+}
+
+void Rewind::clear()
+{
+    first = count = 0;
+}
+
+size_t Rewind::getUsed() const
+{
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        used += entry(i).size;
+    }
+    return used;
+}
+
+size_t Rewind::encode(const uint8_t *state, const uint8_t *base)
+{
+    uint8_t *out = scratch.data();
+    size_t i = 0;
+    while (i < state_size)
+    {
+        const size_t equal = equal_run(state, base, i, state_size);
+        i += equal;
+        const size_t literal = i;
+        while (i < state_size)
+        {
+            const size_t run = equal_run(state, base, i, state_size);
+            if (run >= min_equal || i + run == state_size)
+            {
+                break;
+            }
+            i += run + 1;
+        }
+        out = put_varint(out, equal);
+        out = put_varint(out, i - literal);
+        for (size_t j = literal; j < i; j++)
+        {
+            *out++ = state[j] ^ base[j];
+        }
+    }
+    return out - scratch.data();
+}
+
+void Rewind::decode(const uint8_t *coded, const uint8_t *base, uint8_t *out, size_t size)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t equal, literal;
+        coded = get_varint(coded, equal);
+        coded = get_varint(coded, literal);
+        std::memcpy(out + i, base + i, equal);
+        i += equal;
+        for (size_t j = 0; j < literal; j++, i++)
+        {
+            out[i] = base[i] ^ *coded++;
+        }
+    }
+}
+
+void Rewind::drop_oldest()
+{
+    do
+    {
+        first = (first + 1) % entries.size();
+        count--;
+    } while (count && entry(0).index != 0);
+}
+
+bool Rewind::reserve(size_t size, size_t &offset)
+{
+    if (size > ring.size())
+    {
+        return false;
+    }
+    for (;;)
+    {
+        if (count == 0)
+        {
+            offset = 0;
+            return true;
+        }
+        const entry_t &oldest = entry(0);
+        const entry_t &newest = entry(count - 1);
+        const size_t head = newest.offset + newest.size;
+        if (count < entries.size())
+        {
+            if (newest.offset >= oldest.offset)
+            {
+                // Unwrapped, free space after head and before the oldest entry
+                if (ring.size() - head >= size)
+                {
+                    offset = head;
+                    return true;
+                }
+                if (oldest.offset >= size)
+                {
+                    offset = 0;
+                    return true;
+                }
+            }
+            else if (oldest.offset - head >= size)
+            {
+                offset = head;
+                return true;
+            }
+        }
+        drop_oldest();
+    }
+}
+
+void Rewind::push(const uint8_t *state)
+{
+    const bool keyframe = count == 0 || entry(count - 1).index + 1 >= interval;
+    size_t size = encode(state, keyframe ? zeros.data() : key.data());
+    const uint32_t index = keyframe ? 0 : entry(count - 1).index + 1;
+    size_t offset;
+    if (!reserve(size, offset))
+    {
+        return;
+    }
+    if (!keyframe && count == 0)
+    {
+        // Making room dropped the keyframe this was coded against
+        size = encode(state, zeros.data());
+        if (!reserve(size, offset))
+        {
+            return;
+        }
+        entries[first] = {offset, size, 0};
+    }
+    else
+    {
+        entries[(first + count) % entries.size()] = {offset, size, index};
+    }
+    std::memcpy(&ring[offset], scratch.data(), size);
+    count++;
+    if (entry(count - 1).index == 0)
+    {
+        std::memcpy(key.data(), state, state_size);
+    }
+}
+
+bool Rewind::pop(uint8_t *out)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+    const entry_t newest = entry(count - 1);
+    count--;
+    if (newest.index != 0)
+    {
+        decode(&ring[newest.offset], key.data(), out, state_size);
+        return true;
+    }
+    decode(&ring[newest.offset], zeros.data(), out, state_size);
+    if (count)
+    {
+        // The group before becomes the one being added to
+        const entry_t &previous = entry(count - 1 - entry(count - 1).index);
+        decode(&ring[previous.offset], zeros.data(), key.data(), state_size);
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef _REWIND_
+#define _REWIND_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * History of savestates for stepping back one frame at a time. Every interval states a keyframe
+ * is stored, and the states after it are stored as their XOR with it, which is mostly zeros from
+ * one frame to the next. Both are run-length coded: a varint count of bytes equal to the
+ * keyframe, a varint count of bytes that differ and their XOR, repeated. Keyframes are coded
+ * against zeros the same way.
+ *
+ * Everything lives in buffers allocated up front: a ring of coded bytes and a ring of entries
+ * pointing into it. When either is full the oldest keyframe goes, with every state that needs
+ * it, so the ring always starts on a keyframe.
+ */
+class Rewind
+{
+public:
+    /*
+     * state_size is NES::getStateSize(), capacity the bytes of coded history kept and states
+     * the most states kept, whichever runs out first.
+     */
+    Rewind(size_t state_size, size_t capacity, size_t states, uint32_t interval = 60);
+    Rewind(const Rewind &) = delete;
+    Rewind &operator=(const Rewind &) = delete;
+
+    // Adds the newest state, dropping the oldest ones when there is no room for it
+    void push(const uint8_t *state);
+    /*
+     * Copies the newest state to out and removes it, false when the history is empty.
+     * Pushing after popping carries on from the state popped last.
+     */
+    bool pop(uint8_t *out);
+    void clear();
+
+    size_t getCount() const
+    {
+        return count;
+    }
+    // Coded bytes held, the ring's capacity is the most it gets to
+    size_t getUsed() const;
+
+private:
+    struct entry_t
+    {
+        size_t offset;
+        size_t size;
+        // Position in its keyframe's group, 0 for the keyframe
+        uint32_t index;
+    };
+
+    size_t state_size;
+    uint32_t interval;
+    // Coded states, entries in push order from first
+    std::vector<uint8_t> ring;
+    std::vector<entry_t> entries;
+    size_t first = 0;
+    size_t count = 0;
+    // The newest keyframe, zeros to code keyframes against and room to code a state into
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> zeros;
+    std::vector<uint8_t> scratch;
+
+    const entry_t &entry(size_t i) const
+    {
+        return entries[(first + i) % entries.size()];
+    }
+    // Codes state against base into scratch, returns the size
+    size_t encode(const uint8_t *state, const uint8_t *base);
+    // Rebuilds a state from its coding and base
+    static void decode(const uint8_t *coded, const uint8_t *base, uint8_t *out, size_t size);
+    // Drops the oldest keyframe and the states after it
+    void drop_oldest();
+    // Where size bytes can go, making room if needed, false when the ring cannot hold them at all
+    bool reserve(size_t size, size_t &offset);
+};
+#endif
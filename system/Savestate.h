@@ -0,0 +1,95 @@
+#ifndef _SAVESTATE_
+#define _SAVESTATE_
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * Savestates are one flat blob: a header, then each component's fields in a fixed order, copied
+ * as they are laid out in memory. Only types without padding are copied whole, so equal states
+ * give equal blobs. Saving and loading are a run of fixed size memcpys into and out
+ * of a buffer the caller owns, with nothing allocated. The blob is only meant to be loaded by the
+ * build that wrote it, version is bumped whenever a component changes what it writes.
+ */
+namespace savestate
+{
+constexpr uint32_t magic = 0x5453454E; // "NEST"
+constexpr uint32_t version = 3;
+
+struct header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    // Size of the whole blob, header included
+    uint32_t size;
+    // The cartridge the state belongs to
+    uint16_t mapper;
+    uint16_t reserved;
+    uint32_t prg_size;
+    uint32_t chr_size;
+};
+}
+
+/*
+ * Appends fields to a savestate. Without a buffer it only counts, which is how the size of a
+ * state is found.
+ */
+class StateWriter
+{
+public:
+    explicit StateWriter(uint8_t *out) : out(out) {}
+
+    template <class T>
+    void put(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "saved as raw bytes");
+        // Padding would be copied out uninitialized and make equal states differ
+        static_assert(std::has_unique_object_representations<T>::value, "saved types have no padding");
+        put(&value, sizeof(T));
+    }
+    void put(const void *data, size_t size)
+    {
+        if (out)
+        {
+            std::memcpy(out + written, data, size);
+        }
+        written += size;
+    }
+    size_t getSize() const
+    {
+        return written;
+    }
+
+private:
+    uint8_t *out;
+    size_t written = 0;
+};
+
+/*
+ * Reads fields back in the order they were written. The caller checks the blob's size against
+ * the header before reading anything.
+ */
+class StateReader
+{
+public:
+    explicit StateReader(const uint8_t *in) : in(in) {}
+
+    template <class T>
+    void get(T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "saved as raw bytes");
+        static_assert(std::has_unique_object_representations<T>::value, "saved types have no padding");
+        get(&value, sizeof(T));
+    }
+    void get(void *data, size_t size)
+    {
+        std::memcpy(data, in + read, size);
+        read += size;
+    }
+
+private:
+    const uint8_t *in;
+    size_t read = 0;
+};
+#endif
@@ -0,0 +1,212 @@
+#ifndef _SCHEDULER_
+#define _SCHEDULER_
+#include "Savestate.h"
+#include <algorithm>
+#include <cstdint>
+
+/*
+ * Called when an event lands before the deadline the CPU is running to, wired to CPU::yield.
+ */
+struct preempt_line
+{
+    void (*raise)(void *context) = nullptr;
+    void *context = nullptr;
+};
+
+/*
+ * Timeline of device events in CPU cycles. Every event id has one slot that is either pending
+ * or not, so the binary min-heap over them has a fixed capacity and rescheduling an event moves
+ * it in place. The run loop only looks at next(): the CPU runs up to it without polling devices,
+ * and a device that moves its event in front of the running deadline preempts the run.
+ */
+class Scheduler
+{
+public:
+    static constexpr int capacity = 8;
+    static constexpr uint64_t never = UINT64_MAX;
+
+    Scheduler()
+    {
+        for (int i = 0; i < capacity; i++)
+        {
+            position[i] = -1;
+        }
+    }
+
+    void connect_preempt(preempt_line line)
+    {
+        preempt = line;
+    }
+
+    /*
+     * Sets event id to fire at cycle, replacing its pending time if there is one.
+     */
+    void schedule(int id, uint64_t cycle)
+    {
+        if (position[id] < 0)
+        {
+            position[id] = size;
+            heap[size++] = id;
+        }
+        const uint64_t previous = due[id];
+        due[id] = cycle;
+        if (cycle < previous)
+        {
+            up(position[id]);
+        }
+        else
+        {
+            down(position[id]);
+        }
+        if (cycle < horizon)
+        {
+            horizon = cycle;
+            if (preempt.raise)
+            {
+                preempt.raise(preempt.context);
+            }
+        }
+    }
+    void cancel(int id)
+    {
+        const int at = position[id];
+        if (at < 0)
+        {
+            return;
+        }
+        position[id] = -1;
+        due[id] = never;
+        if (at != --size)
+        {
+            place(at, heap[size]);
+            up(at);
+            down(position[heap[at]]);
+        }
+    }
+    bool pending(int id) const
+    {
+        return position[id] >= 0;
+    }
+
+    // Cycle of the earliest pending event, never when there is none
+    uint64_t next() const
+    {
+        return size ? due[heap[0]] : never;
+    }
+    /*
+     * Removes and returns the earliest event if it is due by cycle, -1 otherwise.
+     */
+    int pop(uint64_t cycle)
+    {
+        if (size == 0 || due[heap[0]] > cycle)
+        {
+            return -1;
+        }
+        const int id = heap[0];
+        cancel(id);
+        return id;
+    }
+
+    // Pending events, between runs
+    void save(StateWriter &out) const
+    {
+        out.put(heap);
+        out.put(position);
+        out.put(due);
+        out.put(size);
+    }
+    // False, with nothing changed, when the heap and the positions do not index each other
+    bool load(StateReader &in)
+    {
+        int loaded_heap[capacity];
+        int loaded_position[capacity];
+        uint64_t loaded_due[capacity];
+        int loaded_size;
+        in.get(loaded_heap);
+        in.get(loaded_position);
+        in.get(loaded_due);
+        in.get(loaded_size);
+        if (loaded_size < 0 || loaded_size > capacity)
+        {
+            return false;
+        }
+        int queued = 0;
+        for (int id = 0; id < capacity; id++)
+        {
+            const int at = loaded_position[id];
+            if (at < -1 || at >= loaded_size || (at >= 0 && loaded_heap[at] != id))
+            {
+                return false;
+            }
+            queued += at >= 0;
+        }
+        if (queued != loaded_size)
+        {
+            return false;
+        }
+        std::copy(loaded_heap, loaded_heap + capacity, heap);
+        std::copy(loaded_position, loaded_position + capacity, position);
+        std::copy(loaded_due, loaded_due + capacity, due);
+        size = loaded_size;
+        horizon = 0;
+        return true;
+    }
+
+    /*
+     * The deadline the CPU is about to run to, events scheduled before it preempt the run.
+     * 0 while the CPU is not running.
+     */
+    void set_horizon(uint64_t cycle)
+    {
+        horizon = cycle;
+    }
+
+private:
+    // Event ids ordered by due, and where each id sits in the heap
+    int heap[capacity]{};
+    int position[capacity];
+    uint64_t due[capacity] = {never, never, never, never, never, never, never, never};
+    int size = 0;
+    uint64_t horizon = 0;
+    preempt_line preempt;
+
+    void place(int at, int id)
+    {
+        heap[at] = id;
+        position[id] = at;
+    }
+    void up(int at)
+    {
+        const int id = heap[at];
+        while (at > 0 && due[heap[(at - 1) / 2]] > due[id])
+        {
+            place(at, heap[(at - 1) / 2]);
+            at = (at - 1) / 2;
+        }
+        place(at, id);
+    }
+    void down(int at)
+    {
+        const int id = heap[at];
+        for (;;)
+        {
+            int child = 2 * at + 1;
+            if (child >= size)
+            {
+                break;
+            }
+            if (child + 1 < size && due[heap[child + 1]] < due[heap[child]])
+            {
+                child++;
+            }
+            if (due[heap[child]] >= due[id])
+            {
+                break;
+            }
+            place(at, heap[child]);
+            at = child;
+        }
+        place(at, id);
+    }
+};
+#endif
@@ -0,0 +1,52 @@
+#ifndef _TESTBUS_
+#define _TESTBUS_
+#include "data_types.h"
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Flat 64KB of RAM with no devices, for headless conformance runs and benchmarks.
+ */
+class TestBus
+{
+    uint8_t Memory[0x10000]{};
+    uint8_t *pages[256];
+
+public:
+    TestBus()
+    {
+        for (int page = 0; page < 256; page++)
+        {
+            pages[page] = &Memory[page << 8];
+        }
+    }
+
+    uint8_t read(uint16_t address)
+    {
+        return Memory[address];
+    }
+    void write(uint16_t address, nes_byte value)
+    {
+        Memory[address] = value._unsigned;
+    }
+    // Nothing is ever remapped
+    uint32_t mapping_epoch() const
+    {
+        return 0;
+    }
+    // Every page is plain memory
+    const uint8_t *const *getReadPages() const
+    {
+        return pages;
+    }
+    uint8_t *const *getWritePages() const
+    {
+        return pages;
+    }
+    // Copies an image into memory, wrapping past $FFFF is the caller's problem
+    void load(uint16_t address, const uint8_t *data, size_t size)
+    {
+        std::memcpy(&Memory[address], data, size);
+    }
+};
+#endif
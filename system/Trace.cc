@@ -0,0 +1,256 @@
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+enum mode_t : uint8_t
+{
+    imp,
+    acc,
+    imm,
+    zp,
+    zpx,
+    zpy,
+    izx,
+    izy,
+    rel,
+    abs_,
+    abx,
+    aby,
+    ind,
+};
+
+const char names[256][4] = {
+    "BRK", "ORA", "KIL", "SLO", "NOP", "ORA", "ASL", "SLO", "PHP", "ORA", "ASL", "ANC", "NOP", "ORA", "ASL", "SLO",
+    "BPL", "ORA", "KIL", "SLO", "NOP", "ORA", "ASL", "SLO", "CLC", "ORA", "NOP", "SLO", "NOP", "ORA", "ASL", "SLO",
+    "JSR", "AND", "KIL", "RLA", "BIT", "AND", "ROL", "RLA", "PLP", "AND", "ROL", "ANC", "BIT", "AND", "ROL", "RLA",
+    "BMI", "AND", "KIL", "RLA", "NOP", "AND", "ROL", "RLA", "SEC", "AND", "NOP", "RLA", "NOP", "AND", "ROL", "RLA",
+    "RTI", "EOR", "KIL", "SRE", "NOP", "EOR", "LSR", "SRE", "PHA", "EOR", "LSR", "ALR", "JMP", "EOR", "LSR", "SRE",
+    "BVC", "EOR", "KIL", "SRE", "NOP", "EOR", "LSR", "SRE", "CLI", "EOR", "NOP", "SRE", "NOP", "EOR", "LSR", "SRE",
+    "RTS", "ADC", "KIL", "RRA", "NOP", "ADC", "ROR", "RRA", "PLA", "ADC", "ROR", "ARR", "JMP", "ADC", "ROR", "RRA",
+    "BVS", "ADC", "KIL", "RRA", "NOP", "ADC", "ROR", "RRA", "SEI", "ADC", "NOP", "RRA", "NOP", "ADC", "ROR", "RRA",
+    "NOP", "STA", "NOP", "SAX", "STY", "STA", "STX", "SAX", "DEY", "NOP", "TXA", "XAA", "STY", "STA", "STX", "SAX",
+    "BCC", "STA", "KIL", "AHX", "STY", "STA", "STX", "SAX", "TYA", "STA", "TXS", "TAS", "SHY", "STA", "SHX", "AHX",
+    "LDY", "LDA", "LDX", "LAX", "LDY", "LDA", "LDX", "LAX", "TAY", "LDA", "TAX", "LAX", "LDY", "LDA", "LDX", "LAX",
+    "BCS", "LDA", "KIL", "LAX", "LDY", "LDA", "LDX", "LAX", "CLV", "LDA", "TSX", "LAS", "LDY", "LDA", "LDX", "LAX",
+    "CPY", "CMP", "NOP", "DCP", "CPY", "CMP", "DEC", "DCP", "INY", "CMP", "DEX", "AXS", "CPY", "CMP", "DEC", "DCP",
+    "BNE", "CMP", "KIL", "DCP", "NOP", "CMP", "DEC", "DCP", "CLD", "CMP", "NOP", "DCP", "NOP", "CMP", "DEC", "DCP",
+    "CPX", "SBC", "NOP", "ISB", "CPX", "SBC", "INC", "ISB", "INX", "SBC", "NOP", "SBC", "CPX", "SBC", "INC", "ISB",
+    "BEQ", "SBC", "KIL", "ISB", "NOP", "SBC", "INC", "ISB", "SED", "SBC", "NOP", "ISB", "NOP", "SBC", "INC", "ISB",
+};
+
+// Rows of the opcode matrix alternate between two layouts, with a few exceptions patched in below
+const mode_t even_row[16] = {imm, izx, imm, izx, zp, zp, zp, zp, imp, imm, imp, imm, abs_, abs_, abs_, abs_};
+const mode_t odd_row[16] = {rel, izy, imp, izy, zpx, zpx, zpx, zpx, imp, aby, imp, aby, abx, abx, abx, abx};
+
+mode_t mode(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case 0x00:
+    case 0x40:
+    case 0x60:
+        return imp;
+    case 0x20:
+        return abs_;
+    case 0x6C:
+        return ind;
+    case 0x0A:
+    case 0x2A:
+    case 0x4A:
+    case 0x6A:
+        return acc;
+    case 0x96:
+    case 0x97:
+    case 0xB6:
+    case 0xB7:
+        return zpy;
+    case 0x9E:
+    case 0x9F:
+    case 0xBE:
+    case 0xBF:
+        return aby;
+    }
+    // KIL in the even rows
+    if ((opcode & 0x9F) == 0x02)
+    {
+        return imp;
+    }
+    return (opcode & 0x10) ? odd_row[opcode & 15] : even_row[opcode & 15];
+}
+}
+
+namespace trace
+{
+const char *mnemonic(uint8_t opcode)
+{
+    return names[opcode];
+}
+
+bool documented(uint8_t opcode)
+{
+    static const char *const official[] = {"ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL",
+                                           "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY",
+                                           "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA",
+                                           "LDX", "LDY", "LSR", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR",
+                                           "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX",
+                                           "TAY", "TSX", "TXA", "TXS", "TYA"};
+    // Column 3, 7, B and F is all unofficial, $EB included, and only $EA of the NOPs is documented
+    if ((opcode & 3) == 3)
+    {
+        return false;
+    }
+    if (opcode == 0xEA)
+    {
+        return true;
+    }
+    for (const char *name : official)
+    {
+        if (std::strcmp(name, names[opcode]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int length(uint8_t opcode)
+{
+    switch (mode(opcode))
+    {
+    case imp:
+    case acc:
+        return 1;
+    case abs_:
+    case abx:
+    case aby:
+    case ind:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+int disassemble(char *text, size_t size, uint16_t pc, const uint8_t *bytes)
+{
+    const uint16_t word = bytes[1] | (length(bytes[0]) == 3 ? bytes[2] << 8 : 0);
+    const char *name = names[bytes[0]];
+    switch (mode(bytes[0]))
+    {
+    case imp:
+        return std::snprintf(text, size, "%s", name);
+    case acc:
+        return std::snprintf(text, size, "%s A", name);
+    case imm:
+        return std::snprintf(text, size, "%s #$%02X", name, word);
+    case zp:
+        return std::snprintf(text, size, "%s $%02X", name, word);
+    case zpx:
+        return std::snprintf(text, size, "%s $%02X,X", name, word);
+    case zpy:
+        return std::snprintf(text, size, "%s $%02X,Y", name, word);
+    case izx:
+        return std::snprintf(text, size, "%s ($%02X,X)", name, word);
+    case izy:
+        return std::snprintf(text, size, "%s ($%02X),Y", name, word);
+    case rel:
+        return std::snprintf(text, size, "%s $%04X", name, uint16_t(pc + 2 + int8_t(word)));
+    case abs_:
+        return std::snprintf(text, size, "%s $%04X", name, word);
+    case abx:
+        return std::snprintf(text, size, "%s $%04X,X", name, word);
+    case aby:
+        return std::snprintf(text, size, "%s $%04X,Y", name, word);
+    case ind:
+        return std::snprintf(text, size, "%s ($%04X)", name, word);
+    }
+    return 0;
+}
+
+int format(char *line, size_t size, const entry_t &entry, const uint8_t *bytes, uint64_t cycle)
+{
+    char hex[10];
+    int at = 0;
+    for (int i = 0; i < length(entry.opcode); i++)
+    {
+        at += std::snprintf(hex + at, sizeof(hex) - at, "%02X ", bytes[i]);
+    }
+    char text[24];
+    disassemble(text, sizeof(text), entry.pc, bytes);
+    return std::snprintf(line, size, "%04X  %-9s%c%-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu", entry.pc, hex,
+                         documented(entry.opcode) ? ' ' : '*', text, entry.a, entry.x, entry.y, entry.p, entry.sp,
+                         (unsigned long long)cycle);
+}
+
+bool write(const char *path, const std::vector<entry_t> &entries)
+{
+    FILE *file = std::fopen(path, "wb");
+    if (!file)
+    {
+        return false;
+    }
+    const file_header_t header{magic, version, entries.size()};
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                         std::fwrite(entries.data(), sizeof(entry_t), entries.size(), file) == entries.size();
+    return std::fclose(file) == 0 && written;
+}
+
+bool read(const char *path, std::vector<entry_t> &entries)
+{
+    entries.clear();
+    FILE *file = std::fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    file_header_t header;
+    bool read = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == magic &&
+                header.version == version;
+    if (read)
+    {
+        entries.resize(header.count);
+        read = std::fread(entries.data(), sizeof(entry_t), entries.size(), file) == entries.size();
+    }
+    std::fclose(file);
+    if (!read)
+    {
+        entries.clear();
+    }
+    return read;
+}
+}
+
+TraceRing::TraceRing(size_t capacity)
+{
+    size_t size = 2;
+    while (size - 1 < capacity)
+    {
+        size <<= 1;
+    }
+    entries.resize(size);
+    mask = size - 1;
+}
+
+std::vector<trace::entry_t> TraceRing::snapshot() const
+{
+    const uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t start = end - std::min<uint64_t>(end, mask);
+    std::vector<trace::entry_t> copy;
+    copy.reserve(end - start);
+    for (uint64_t i = start; i < end; i++)
+    {
+        copy.push_back(entries[i & mask]);
+    }
+    // The recorder may have lapped the copy. Every slot it had claimed by now may have been
+    // overwritten while it was copied, entries before now - size are gone
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t now = claimed.load(std::memory_order_relaxed);
+    if (now > start + entries.size())
+    {
+        const uint64_t lost = std::min<uint64_t>(now - entries.size() - start, copy.size());
+        copy.erase(copy.begin(), copy.begin() + lost);
+    }
+    return copy;
+}
@@ -0,0 +1,110 @@
+#ifndef _TRACE_
+#define _TRACE_
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace trace
+{
+/*
+ * One executed instruction, as it was about to run. The operand bytes are not kept, they are
+ * read back from the ROM when the trace is printed.
+ */
+struct entry_t
+{
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t p;
+    // Low 32 bits of the CPU cycle, a reader unwraps them from one entry to the next
+    uint32_t cycle;
+};
+static_assert(sizeof(entry_t) == 12, "trace entries are 12 bytes");
+
+constexpr uint32_t magic = 0x4352544E; // "NTRC"
+constexpr uint32_t version = 1;
+
+// Dump files: this, then count entries oldest first
+struct file_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+// Bytes an instruction takes, opcode included
+int length(uint8_t opcode);
+// Three letter name, unofficial opcodes by their common names
+const char *mnemonic(uint8_t opcode);
+// One of the 151 opcodes in the MOS documentation
+bool documented(uint8_t opcode);
+// "LDA $0300,X" for the instruction in bytes at pc, returns the characters written
+int disassemble(char *text, size_t size, uint16_t pc, const uint8_t *bytes);
+/*
+ * One line in the layout of nestest.log, without the PPU column and the memory values nestest
+ * shows after operands: "C000  4C F5 C5  JMP $C5F5   ...   A:00 X:00 Y:00 P:24 SP:FD CYC:7".
+ * bytes holds the instruction, length(opcode) of them. Returns the characters written.
+ */
+int format(char *line, size_t size, const entry_t &entry, const uint8_t *bytes, uint64_t cycle);
+
+bool write(const char *path, const std::vector<entry_t> &entries);
+bool read(const char *path, std::vector<entry_t> &entries);
+}
+
+/*
+ * The last capacity instructions a CPU ran, for finding where two runs went apart. The CPU records
+ * into it from its own thread without locking; another thread can copy the entries out while it
+ * runs, entries overwritten while they were being copied are left out.
+ */
+class TraceRing
+{
+public:
+    // Capacity is rounded up to a power of two less one, the slot left over is the one being written
+    explicit TraceRing(size_t capacity);
+    TraceRing(const TraceRing &) = delete;
+    TraceRing &operator=(const TraceRing &) = delete;
+
+    /*
+     * A seqlock: the slot is claimed before it is overwritten and published after, a reader that
+     * sees the claim after copying a slot drops what it copied.
+     */
+    void record(const trace::entry_t &entry)
+    {
+        const uint64_t at = head.load(std::memory_order_relaxed);
+        claimed.store(at + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entries[at & mask] = entry;
+        head.store(at + 1, std::memory_order_release);
+    }
+    void clear()
+    {
+        claimed.store(0, std::memory_order_relaxed);
+        head.store(0, std::memory_order_release);
+    }
+
+    size_t getCapacity() const
+    {
+        return mask;
+    }
+    // Instructions recorded since the ring was made or cleared, the ring holds the last of them
+    uint64_t getRecorded() const
+    {
+        return head.load(std::memory_order_acquire);
+    }
+    /*
+     * The entries held, oldest first.
+     */
+    std::vector<trace::entry_t> snapshot() const;
+
+private:
+    std::vector<trace::entry_t> entries;
+    size_t mask;
+    // Entries published, and entries whose slot has been taken, one more while a record is underway
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> claimed{0};
+};
+#endif
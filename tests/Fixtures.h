@@ -0,0 +1,171 @@
+#ifndef _FIXTURES_
+#define _FIXTURES_
+#include "../system/CPU.h"
+#include "../system/Hash.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * What the differential tests share: comparing registers, building the iNES images they load
+ * and remove again, and the program several of them run on a busy console.
+ */
+namespace fixtures
+{
+inline bool same(const registers_t &a, const registers_t &b)
+{
+    return a.PC.value == b.PC.value && a.SP == b.SP && a.sr == b.sr && a.AC == b.AC && a.X == b.X && a.Y == b.Y;
+}
+
+/*
+ * An iNES image with 8KB of CHR ROM, every byte a NOP until something is placed. Code goes in
+ * by CPU address, 16KB of PRG is mirrored at $8000 and $C000 like NROM-128 maps it.
+ */
+class RomImage
+{
+public:
+    // flags6 holds the nametable layout bits of header byte 6, vertical mirroring by default
+    explicit RomImage(uint8_t mapper = 0, int prg_banks = 2, uint8_t flags6 = 1)
+        : prg_size(prg_banks * 0x4000), image(16 + prg_banks * 0x4000 + 0x2000, 0xEA)
+    {
+        const uint8_t header[16] = {'N', 'E', 'S', 0x1A, uint8_t(prg_banks), 1,
+                                    uint8_t((mapper << 4) | (flags6 & 0x0F))};
+        std::copy(header, header + 16, image.begin());
+    }
+
+    void place(uint16_t address, const uint8_t *code, size_t size)
+    {
+        std::copy(code, code + size, image.begin() + 16 + ((address - 0x8000) & (prg_size - 1)));
+    }
+    template <size_t N>
+    void place(uint16_t address, const uint8_t (&code)[N])
+    {
+        place(address, code, N);
+    }
+    void set_vectors(uint16_t nmi, uint16_t reset, uint16_t irq)
+    {
+        const uint8_t vectors[6] = {uint8_t(nmi), uint8_t(nmi >> 8), uint8_t(reset),
+                                    uint8_t(reset >> 8), uint8_t(irq), uint8_t(irq >> 8)};
+        place(0xFFFA, vectors);
+    }
+
+    uint8_t *getChr()
+    {
+        return &image[16 + prg_size];
+    }
+    static constexpr size_t chr_size = 0x2000;
+
+    bool write(const char *path) const
+    {
+        FILE *file = std::fopen(path, "wb");
+        if (!file)
+        {
+            return false;
+        }
+        const bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+        std::fclose(file);
+        return written;
+    }
+
+private:
+    size_t prg_size;
+    std::vector<uint8_t> image;
+};
+
+/*
+ * Keeps everything that runs beside the CPU busy: polls $2002, splits the scroll mid-frame,
+ * plays all four APU channels, updates VRAM and OAM by DMA from its NMI handler and takes the
+ * MMC3 scanline and APU frame counter IRQs. It uses page 2 for the sprites and logs where each
+ * IRQ landed to $0300.
+ */
+const uint8_t busy_reset[] = {
+    0x78,             // $8000 SEI
+    0xA9, 0x14,       // $8001 LDA #$14
+    0x8D, 0x00, 0xC0, // $8003 STA $C000
+    0x8D, 0x01, 0xC0, // $8006 STA $C001
+    0x8D, 0x01, 0xE0, // $8009 STA $E001
+    0xA9, 0x0F,       // $800C LDA #$0F
+    0x8D, 0x15, 0x40, // $800E STA $4015
+    0xA9, 0xBF,       // $8011 LDA #$BF
+    0x8D, 0x00, 0x40, // $8013 STA $4000
+    0x8D, 0x03, 0x40, // $8016 STA $4003
+    0xA9, 0xC1,       // $8019 LDA #$C1
+    0x8D, 0x08, 0x40, // $801B STA $4008
+    0x8D, 0x0A, 0x40, // $801E STA $400A
+    0x8D, 0x0B, 0x40, // $8021 STA $400B
+    0xA9, 0x34,       // $8024 LDA #$34
+    0x8D, 0x0C, 0x40, // $8026 STA $400C
+    0x8D, 0x0E, 0x40, // $8029 STA $400E
+    0x8D, 0x0F, 0x40, // $802C STA $400F
+    0xA9, 0x80,       // $802F LDA #$80
+    0x8D, 0x00, 0x20, // $8031 STA $2000
+    0xA9, 0x1E,       // $8034 LDA #$1E
+    0x8D, 0x01, 0x20, // $8036 STA $2001
+    0x58,             // $8039 CLI
+    0xE6, 0x10,       // $803A INC $10
+    0xA5, 0x10,       // $803C LDA $10
+    0x8D, 0x05, 0x20, // $803E STA $2005
+    0x8D, 0x05, 0x20, // $8041 STA $2005
+    0x8D, 0x02, 0x40, // $8044 STA $4002
+    0xAE, 0x02, 0x20, // $8047 LDX $2002
+    0x88,             // $804A DEY
+    0xD0, 0xED,       // $804B BNE $803A
+    0x2C, 0x02, 0x20, // $804D BIT $2002
+    0x10, 0xFB,       // $8050 BPL $804D
+    0x4C, 0x3A, 0x80, // $8052 JMP $803A
+};
+const uint8_t busy_nmi[] = {
+    0xA5, 0x11,       // $8100 LDA $11
+    0x18,             // $8102 CLC
+    0x69, 0x01,       // $8103 ADC #$01
+    0x85, 0x11,       // $8105 STA $11
+    0xA9, 0x3F,       // $8107 LDA #$3F
+    0x8D, 0x06, 0x20, // $8109 STA $2006
+    0xA9, 0x00,       // $810C LDA #$00
+    0x8D, 0x06, 0x20, // $810E STA $2006
+    0xA5, 0x11,       // $8111 LDA $11
+    0x8D, 0x07, 0x20, // $8113 STA $2007
+    0xA9, 0x02,       // $8116 LDA #$02
+    0x8D, 0x14, 0x40, // $8118 STA $4014
+    0x40,             // $811B RTI
+};
+const uint8_t busy_irq[] = {
+    0x48,             // $8200 PHA
+    0x8A,             // $8201 TXA
+    0x48,             // $8202 PHA
+    0x8D, 0x00, 0xE0, // $8203 STA $E000
+    0x8D, 0x01, 0xE0, // $8206 STA $E001
+    0xAD, 0x15, 0x40, // $8209 LDA $4015
+    0xBA,             // $820C TSX
+    0xBD, 0x04, 0x01, // $820D LDA $0104,X
+    0xA6, 0x12,       // $8210 LDX $12
+    0x9D, 0x00, 0x03, // $8212 STA $0300,X
+    0xE6, 0x12,       // $8215 INC $12
+    0xA5, 0x10,       // $8217 LDA $10
+    0x49, 0xFF,       // $8219 EOR #$FF
+    0x8D, 0x05, 0x20, // $821B STA $2005
+    0x8D, 0x05, 0x20, // $821E STA $2005
+    0x68,             // $8221 PLA
+    0xAA,             // $8222 TAX
+    0x68,             // $8223 PLA
+    0x40,             // $8224 RTI
+};
+
+/*
+ * The busy program in 32KB of PRG with random CHR, on NROM-256 or on MMC3, which maps it the
+ * same way after reset.
+ */
+inline RomImage busy_image(uint8_t mapper)
+{
+    RomImage image(mapper);
+    image.place(0x8000, busy_reset);
+    image.place(0x8100, busy_nmi);
+    image.place(0x8200, busy_irq);
+    image.set_vectors(0x8100, 0x8000, 0x8200);
+    std::mt19937 rng(1);
+    std::generate(image.getChr(), image.getChr() + RomImage::chr_size, [&] { return uint8_t(rng()); });
+    return image;
+}
+}
+#endif
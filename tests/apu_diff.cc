@@ -0,0 +1,182 @@
+//
+// Runs the APU caught up only at register accesses and at next_sync() next to one synced every
+// CPU cycle, on random register writes and DMC samples. Fails on the first $4015 read, IRQ or
+// block of samples that differs. Then checks a pulse tone comes out at its pitch.
+//
+
+#include "../system/APU.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int seeds = 40;
+const int frames = 20;
+const uint32_t frame_cycles = 29781;
+
+struct console
+{
+    MMU mmu;
+    uint8_t samples[0x4000];
+    APU apu;
+    int irq_changes = 0;
+    bool irq = false;
+
+    console(std::mt19937 &rng) : apu(mmu)
+    {
+        // DMC samples at $C000-$FFFF
+        for (uint8_t &byte : samples)
+        {
+            byte = rng();
+        }
+        mmu.map_memory(0xC000, sizeof(samples), samples, false);
+        irq_line line;
+        line.set = [](void *context, bool asserted)
+        {
+            console *self = static_cast<console *>(context);
+            self->irq_changes += self->irq != asserted;
+            self->irq = asserted;
+        };
+        line.context = this;
+        apu.connect_frame_irq(line);
+        apu.connect_dmc_irq(line);
+        apu.reset();
+    }
+};
+
+bool compare(int seed, std::mt19937 &rng)
+{
+    std::mt19937 fill(seed);
+    console lazy(fill);
+    fill.seed(seed);
+    console eager(fill);
+
+    const uint16_t registers[] = {0x4000, 0x4001, 0x4002, 0x4003, 0x4004, 0x4005, 0x4006, 0x4007, 0x4008,
+                                  0x400A, 0x400B, 0x400C, 0x400E, 0x400F, 0x4010, 0x4011, 0x4012, 0x4013,
+                                  0x4015, 0x4017};
+    uint64_t cycle = 0;
+    std::vector<int16_t> a(APU::sample_rate), b(APU::sample_rate);
+    for (int frame = 0; frame < frames; frame++)
+    {
+        const uint64_t end = cycle + frame_cycles;
+        while (cycle < end)
+        {
+            const uint64_t next = std::min<uint64_t>(end, cycle + 1 + rng() % 2000);
+            while (cycle < next)
+            {
+                cycle++;
+                eager.apu.sync(cycle);
+                if (cycle >= lazy.apu.next_sync())
+                {
+                    lazy.apu.sync(cycle);
+                }
+                if (lazy.irq_changes != eager.irq_changes || lazy.irq != eager.irq)
+                {
+                    std::printf("seed %d: IRQ at cycle %llu, lazy %d eager %d\n", seed, (unsigned long long)cycle,
+                                lazy.irq, eager.irq);
+                    return false;
+                }
+            }
+            lazy.apu.sync(cycle);
+            if (rng() % 4 == 0)
+            {
+                const uint8_t x = lazy.apu.read_register(0x4015);
+                const uint8_t y = eager.apu.read_register(0x4015);
+                if (x != y)
+                {
+                    std::printf("seed %d: $4015 at cycle %llu, lazy %02X eager %02X\n", seed,
+                                (unsigned long long)cycle, x, y);
+                    return false;
+                }
+            }
+            else
+            {
+                const uint16_t address = registers[rng() % 20];
+                uint8_t value = rng();
+                if (address == 0x4015)
+                {
+                    // Mostly enabled
+                    value |= rng() % 4 ? 0x1F : 0;
+                }
+                lazy.apu.write_register(address, value);
+                eager.apu.write_register(address, value);
+            }
+        }
+        lazy.apu.sync(cycle);
+        lazy.apu.end_frame();
+        eager.apu.end_frame();
+        const size_t count = lazy.apu.read_samples(a.data(), a.size());
+        if (eager.apu.read_samples(b.data(), b.size()) != count || count == 0)
+        {
+            std::printf("seed %d: frame %d has %zu samples\n", seed, frame, count);
+            return false;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (a[i] != b[i])
+            {
+                std::printf("seed %d: frame %d sample %zu, lazy %d eager %d\n", seed, frame, i, a[i], b[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A second of 440 Hz on pulse 1 should cross zero upwards 440 times, give or take the edges
+bool pitch()
+{
+    std::mt19937 fill(0);
+    console tone(fill);
+    tone.apu.write_register(0x4015, 0x01);
+    // 50% duty, constant volume 15 and the length counter halted
+    tone.apu.write_register(0x4000, 0xBF);
+    const int period = int(APU::clock_rate / (16 * 440.0) - 1 + 0.5);
+    tone.apu.write_register(0x4002, period & 0xFF);
+    tone.apu.write_register(0x4003, 0x08 | (period >> 8));
+    std::vector<int16_t> samples;
+    std::vector<int16_t> block(APU::sample_rate);
+    uint64_t cycle = 0;
+    while (samples.size() < size_t(APU::sample_rate))
+    {
+        cycle += frame_cycles;
+        tone.apu.sync(cycle);
+        tone.apu.end_frame();
+        const size_t count = tone.apu.read_samples(block.data(), block.size());
+        samples.insert(samples.end(), block.begin(), block.begin() + count);
+    }
+    int crossings = 0;
+    int peak = 0;
+    for (int i = 1; i < APU::sample_rate; i++)
+    {
+        crossings += samples[i - 1] < 0 && samples[i] >= 0;
+        peak = std::max(peak, std::abs(int(samples[i])));
+    }
+    if (std::abs(crossings - 440) > 20 || peak < 1000)
+    {
+        std::printf("440 Hz tone crossed zero %d times with peak %d\n", crossings, peak);
+        return false;
+    }
+    return true;
+}
+}
+
+int main()
+{
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        std::mt19937 rng(seed);
+        if (!compare(seed, rng))
+        {
+            return 1;
+        }
+    }
+    if (!pitch())
+    {
+        return 1;
+    }
+    std::printf("Lazy and per cycle APU agree over %d runs of %d frames\n", seeds, frames);
+    return 0;
+}
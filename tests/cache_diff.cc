@@ -0,0 +1,133 @@
+//
+// Runs two programs through the block cache and the table interpreter. One rewrites an operand
+// inside the block it is running, which has to invalidate the block. The other sits in a loop
+// on a ROM page writing mapper registers on that same page, which must not: the cache decodes
+// through the page handler there, so every decode shows up as handler reads. Fails when
+// registers, RAM, cycles or the mapper writes differ, or when the ROM loop is decoded again.
+//
+
+#include "../system/CPU.h"
+#include "../system/MMU.h"
+#include "../system/TestBus.h"
+#include "Fixtures.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+const uint32_t budget = 200000;
+
+// Rewrites the LDA immediate at $8007 with the loop count every time around
+const uint8_t self_modifying[] = {
+    0xA2, 0x00,       // $8000 LDX #$00
+    0xE8,             // $8002 INX
+    0x8E, 0x08, 0x80, // $8003 STX $8008
+    0xEA,             // $8006 NOP
+    0xA9, 0x00,       // $8007 LDA #$00
+    0x85, 0x20,       // $8009 STA $20
+    0x18,             // $800B CLC
+    0x65, 0x21,       // $800C ADC $21
+    0x85, 0x21,       // $800E STA $21
+    0x4C, 0x02, 0x80, // $8010 JMP $8002
+};
+
+// MMC3 IRQ acknowledge and enable from the fixed bank, like an IRQ handler does
+const uint8_t register_loop[] = {
+    0x8D, 0x00, 0xE0, // $E000 STA $E000
+    0x8D, 0x01, 0xE0, // $E003 STA $E001
+    0xE6, 0x10,       // $E006 INC $10
+    0x4C, 0x00, 0xE0, // $E008 JMP $E000
+};
+
+// $8000-$FFFF behind a handler that counts its reads and writes
+struct board
+{
+    uint8_t rom[0x8000]{};
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+
+    static uint8_t read(void *context, uint16_t address)
+    {
+        board *self = static_cast<board *>(context);
+        self->reads++;
+        return self->rom[address - 0x8000];
+    }
+    static void write(void *context, uint16_t, uint8_t)
+    {
+        static_cast<board *>(context)->writes++;
+    }
+};
+
+bool check_self_modifying()
+{
+    static TestBus tableBus, cachedBus;
+    tableBus.load(0x8000, self_modifying, sizeof(self_modifying));
+    cachedBus.load(0x8000, self_modifying, sizeof(self_modifying));
+    const uint8_t vector[2] = {0x00, 0x80};
+    tableBus.load(0xFFFC, vector, 2);
+    cachedBus.load(0xFFFC, vector, 2);
+    CPU<TestBus> table(&tableBus), cached(&cachedBus);
+    table.reset();
+    cached.reset();
+    const uint32_t tableCycles = table.execute_table(budget, UINT32_MAX);
+    const uint32_t cachedCycles = cached.execute_cached(budget, UINT32_MAX);
+    if (!fixtures::same(table.getRegisters(), cached.getRegisters()) || tableCycles != cachedCycles ||
+        tableBus.read(0x20) != cachedBus.read(0x20) || tableBus.read(0x21) != cachedBus.read(0x21))
+    {
+        std::printf("self-modifying code: the cache ran a stale block, $21 is %02X against %02X\n",
+                    cachedBus.read(0x21), tableBus.read(0x21));
+        return false;
+    }
+    return true;
+}
+
+bool check_register_writes()
+{
+    static board tableBoard, cachedBoard;
+    static MMU tableBus, cachedBus;
+    board *boards[2] = {&tableBoard, &cachedBoard};
+    MMU *buses[2] = {&tableBus, &cachedBus};
+    for (int i = 0; i < 2; i++)
+    {
+        std::copy(register_loop, register_loop + sizeof(register_loop), boards[i]->rom + 0x6000);
+        boards[i]->rom[0x7FFC] = 0x00;
+        boards[i]->rom[0x7FFD] = 0xE0;
+        io_handler handler;
+        handler.read = &board::read;
+        handler.write = &board::write;
+        handler.context = boards[i];
+        buses[i]->map_io(0x8000, 0x8000, handler);
+    }
+    CPU<MMU> table(&tableBus), cached(&cachedBus);
+    table.reset();
+    cached.reset();
+    const uint32_t before = cachedBoard.reads;
+    const uint32_t tableCycles = table.execute_table(budget, UINT32_MAX);
+    const uint32_t cachedCycles = cached.execute_cached(budget, UINT32_MAX);
+    if (!fixtures::same(table.getRegisters(), cached.getRegisters()) || tableCycles != cachedCycles ||
+        tableBus.read(0x10) != cachedBus.read(0x10) || tableBoard.writes != cachedBoard.writes)
+    {
+        std::printf("mapper register writes: the cache and the interpreter disagree\n");
+        return false;
+    }
+    // One decode of the 11 byte loop, not one every time around
+    const uint32_t decoded = cachedBoard.reads - before;
+    if (decoded > sizeof(register_loop))
+    {
+        std::printf("mapper register writes: %u ROM reads to decode an %zu byte loop run %u times\n", decoded,
+                    sizeof(register_loop), cachedBoard.writes / 2);
+        return false;
+    }
+    return true;
+}
+}
+
+int main()
+{
+    if (!check_self_modifying() || !check_register_writes())
+    {
+        return 1;
+    }
+    std::printf("The block cache follows code writes and keeps its blocks across mapper writes\n");
+    return 0;
+}
@@ -0,0 +1,203 @@
+//
+// Instruction conformance against the two standard CPU test programs, on a flat TestBus so
+// nothing but the CPU is involved. Neither ROM ships with the tree, CMake adds a test for each
+// one it is given a path to.
+//
+//   conformance nestest nestest.nes nestest.log
+//     Runs nestest's automated mode from $C000 and compares PC, A, X, Y, P, SP and the cycle
+//     count with every line of the log before each instruction, then checks the result codes
+//     nestest leaves at $02 and $03. The log is the one with CPU cycles in its CYC column.
+//   conformance klaus 6502_functional_test.bin 3469
+//     Runs Klaus Dormann's functional test from $0400 until it traps in a branch or jump to
+//     itself, which must happen at the success address (hex). The NES CPU has no decimal mode,
+//     the test has to be assembled with disable_decimal = 1.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include "../system/Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+// Stops runaway tests, the functional test takes about 30 million instructions
+const uint64_t max_instructions = 500000000;
+
+bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *file = std::fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + count);
+    }
+    std::fclose(file);
+    return true;
+}
+
+// The registers and cycle column of a nestest.log line
+struct log_line
+{
+    uint16_t pc;
+    uint8_t a, x, y, p, sp;
+    uint64_t cycle;
+};
+
+bool parse(const char *text, log_line &line)
+{
+    // The register columns start at 48, the disassembly before them can hold "A:" too
+    const char *registers = std::strlen(text) > 48 ? std::strstr(text + 48, "A:") : nullptr;
+    const char *cycle = std::strstr(text, "CYC:");
+    unsigned pc, a, x, y, p, sp;
+    unsigned long long cycles;
+    if (!registers || !cycle || std::sscanf(text, "%4x", &pc) != 1 ||
+        std::sscanf(registers, "A:%2x X:%2x Y:%2x P:%2x SP:%2x", &a, &x, &y, &p, &sp) != 5 ||
+        std::sscanf(cycle, "CYC:%llu", &cycles) != 1)
+    {
+        return false;
+    }
+    line = {uint16_t(pc), uint8_t(a), uint8_t(x), uint8_t(y), uint8_t(p), uint8_t(sp), cycles};
+    return true;
+}
+
+int nestest(const char *rom_path, const char *log_path)
+{
+    std::vector<uint8_t> rom;
+    if (!read_file(rom_path, rom) || rom.size() < 16 + 0x4000)
+    {
+        std::printf("%s: cannot read nestest\n", rom_path);
+        return 1;
+    }
+    FILE *log = std::fopen(log_path, "r");
+    if (!log)
+    {
+        std::printf("%s: cannot read the log\n", log_path);
+        return 1;
+    }
+    std::unique_ptr<TestBus> bus(new TestBus());
+    // 16KB of PRG mirrored at $8000 and $C000, like NROM-128
+    bus->load(0x8000, &rom[16], 0x4000);
+    bus->load(0xC000, &rom[16], 0x4000);
+    CPU<TestBus> cpu(bus.get());
+    registers_t start{};
+    start.PC.value = 0xC000;
+    start.SP = 0xFD;
+    start.sr = 0x24;
+    cpu.setRegisters(start);
+    // The log counts the 7 cycles of the reset sequence
+    const uint64_t reset_cycles = 7;
+
+    char text[256];
+    int number = 0;
+    while (std::fgets(text, sizeof(text), log))
+    {
+        number++;
+        log_line want;
+        if (!parse(text, want))
+        {
+            std::printf("%s:%d: not a nestest log line\n", log_path, number);
+            std::fclose(log);
+            return 1;
+        }
+        const registers_t got = cpu.getRegisters();
+        const uint64_t cycle = cpu.getCycles() + reset_cycles;
+        const uint8_t p = flags::pack(got.sr, false).value;
+        if (got.PC.value != want.pc || got.AC != want.a || got.X != want.x || got.Y != want.y || p != want.p ||
+            got.SP != want.sp || cycle != want.cycle)
+        {
+            trace::entry_t entry{got.PC.value, bus->read(got.PC.value), got.AC, got.X, got.Y, got.SP, p, 0};
+            const uint8_t bytes[3] = {entry.opcode, bus->read(got.PC.value + 1), bus->read(got.PC.value + 2)};
+            char line[128];
+            trace::format(line, sizeof(line), entry, bytes, cycle);
+            text[std::strcspn(text, "\r\n")] = 0;
+            std::printf("%s:%d differs\n  log: %s\n  got: %s\n", log_path, number, text, line);
+            std::fclose(log);
+            return 1;
+        }
+        cpu.step_n(1);
+    }
+    std::fclose(log);
+    // Official opcodes report to $02, unofficial ones to $03, 0 is a pass
+    if (bus->read(0x02) || bus->read(0x03))
+    {
+        std::printf("nestest reports failure codes $%02X $%02X\n", bus->read(0x02), bus->read(0x03));
+        return 1;
+    }
+    std::printf("nestest: all %d lines match\n", number);
+    return 0;
+}
+
+int klaus(const char *bin_path, const char *success_hex)
+{
+    std::vector<uint8_t> image;
+    if (!read_file(bin_path, image) || image.empty() || image.size() > 0x10000)
+    {
+        std::printf("%s: cannot read the functional test\n", bin_path);
+        return 1;
+    }
+    const uint16_t success = uint16_t(std::strtoul(success_hex, nullptr, 16));
+    std::unique_ptr<TestBus> bus(new TestBus());
+    bus->load(0x0000, image.data(), image.size());
+    CPU<TestBus> cpu(bus.get());
+    registers_t start{};
+    start.PC.value = 0x0400;
+    start.SP = 0xFD;
+    start.sr = 0x24;
+    cpu.setRegisters(start);
+
+    const auto begin = std::chrono::steady_clock::now();
+    uint64_t instructions = 0;
+    for (;;)
+    {
+        // Whole batches through the configured backend, then one step to look for a trap
+        cpu.step_n(10000);
+        const uint16_t pc = cpu.getRegisters().PC.value;
+        cpu.step_n(1);
+        instructions += 10001;
+        if (cpu.getRegisters().PC.value == pc)
+        {
+            break;
+        }
+        if (instructions > max_instructions)
+        {
+            std::printf("the functional test did not finish in %llu instructions\n",
+                        (unsigned long long)max_instructions);
+            return 1;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const uint16_t trap = cpu.getRegisters().PC.value;
+    if (trap != success)
+    {
+        std::printf("the functional test trapped at $%04X, success is $%04X\n", trap, success);
+        return 1;
+    }
+    std::printf("functional test passed, %llu cycles in %.2f s\n", (unsigned long long)cpu.getCycles(), seconds);
+    return 0;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 4 && std::strcmp(argv[1], "nestest") == 0)
+    {
+        return nestest(argv[2], argv[3]);
+    }
+    if (argc == 4 && std::strcmp(argv[1], "klaus") == 0)
+    {
+        return klaus(argv[2], argv[3]);
+    }
+    std::fprintf(stderr, "usage: %s nestest nestest.nes nestest.log\n       %s klaus test.bin success_hex\n", argv[0],
+                 argv[0]);
+    return 1;
+}
@@ -0,0 +1,233 @@
+//
+// Runs one instruction from a fuzzed machine state through every CPU backend, under both flag
+// policies, and compares each against the eager table interpreter: registers, P, the cycles
+// spent, the stop reason and all 64KB of memory. Built with NESACOLA_FUZZ it is a libFuzzer
+// target. Otherwise it is a test that runs a fixed number of random inputs, or replays the input
+// files given as arguments, and fails on the first disagreement.
+//
+// Input: PC, SP, P, A, X, Y, an interrupt byte (bit 0 NMI, bit 1 IRQ), a 32 bit seed the rest
+// of memory is filled from, then the bytes placed at PC.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include "../system/Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+const size_t header_size = 12;
+const int inputs = 100000;
+
+struct result_t
+{
+    const char *name;
+    registers_t registers;
+    uint32_t cycles;
+    uint64_t elapsed;
+    int stop;
+};
+
+struct machine_t
+{
+    registers_t registers;
+    uint8_t interrupts;
+    std::vector<uint8_t> memory;
+};
+
+machine_t decode(const uint8_t *data, size_t size)
+{
+    uint8_t header[header_size]{};
+    std::memcpy(header, data, size < header_size ? size : header_size);
+    machine_t machine;
+    machine.registers.PC.value = header[0] | header[1] << 8;
+    machine.registers.SP = header[2];
+    // B and U are not flip-flops in the chip, a real P always has U set and B clear
+    machine.registers.sr = (header[3] | flags::U) & ~flags::B;
+    machine.registers.AC = header[4];
+    machine.registers.X = header[5];
+    machine.registers.Y = header[6];
+    machine.interrupts = header[7];
+    machine.memory.resize(0x10000);
+    uint64_t state = (header[8] | header[9] << 8 | header[10] << 16 | uint64_t(header[11]) << 24) * 2 + 1;
+    for (size_t i = 0; i < machine.memory.size(); i += 8)
+    {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        const uint64_t word = state * 0x2545F4914F6CDD1DULL;
+        std::memcpy(&machine.memory[i], &word, 8);
+    }
+    for (size_t i = header_size; i < size && i - header_size < machine.memory.size(); i++)
+    {
+        machine.memory[uint16_t(machine.registers.PC.value + i - header_size)] = data[i];
+    }
+    return machine;
+}
+
+template <class Flags>
+using backend = uint32_t (CPU<TestBus, Flags>::*)(uint32_t, uint32_t);
+
+template <class Flags>
+result_t run(const char *name, backend<Flags> execute, const machine_t &machine, TestBus &bus)
+{
+    bus.load(0, machine.memory.data(), machine.memory.size());
+    // Made per input, decoded blocks of the last one would be stale
+    std::unique_ptr<CPU<TestBus, Flags>> cpu(new CPU<TestBus, Flags>(&bus));
+#if defined(NESACOLA_JIT)
+    cpu->set_jit_threshold(0);
+#endif
+    cpu->setRegisters(machine.registers);
+    if (machine.interrupts & 1)
+    {
+        cpu->nmi();
+    }
+    if (machine.interrupts & 2)
+    {
+        cpu->set_irq(CPU<TestBus, Flags>::irq_mapper, true);
+    }
+    const uint64_t start = cpu->getCycles();
+    result_t result;
+    result.name = name;
+    result.cycles = (cpu.get()->*execute)(UINT32_MAX, 1);
+    result.elapsed = cpu->getCycles() - start;
+    result.registers = cpu->getRegisters();
+    result.stop = cpu->getStopReason();
+    return result;
+}
+
+void print(const result_t &result)
+{
+    const registers_t &r = result.registers;
+    std::printf("%-16s A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%u/%llu stop %d\n", result.name, r.AC, r.X,
+                r.Y, r.sr, r.SP, r.PC.value, result.cycles, (unsigned long long)result.elapsed, result.stop);
+}
+
+bool same(const result_t &a, const result_t &b)
+{
+    const registers_t &x = a.registers;
+    const registers_t &y = b.registers;
+    return x.PC.value == y.PC.value && x.SP == y.SP && x.sr == y.sr && x.AC == y.AC && x.X == y.X && x.Y == y.Y &&
+           a.cycles == b.cycles && a.elapsed == b.elapsed && a.stop == b.stop;
+}
+
+/*
+ * Runs the input through every backend, prints what differs and returns false on a mismatch.
+ */
+bool check(const uint8_t *data, size_t size)
+{
+    static TestBus buses[8];
+    const machine_t machine = decode(data, size);
+    using eager = flags::eager;
+    using lazy = flags::lazy;
+    const result_t results[8] = {
+        run<eager>("eager table", &CPU<TestBus, eager>::execute_table, machine, buses[0]),
+        run<eager>("eager threaded", &CPU<TestBus, eager>::execute_threaded, machine, buses[1]),
+        run<eager>("eager cached", &CPU<TestBus, eager>::execute_cached, machine, buses[2]),
+        run<eager>("eager jit", &CPU<TestBus, eager>::execute_jit, machine, buses[3]),
+        run<lazy>("lazy table", &CPU<TestBus, lazy>::execute_table, machine, buses[4]),
+        run<lazy>("lazy threaded", &CPU<TestBus, lazy>::execute_threaded, machine, buses[5]),
+        run<lazy>("lazy cached", &CPU<TestBus, lazy>::execute_cached, machine, buses[6]),
+        run<lazy>("lazy jit", &CPU<TestBus, lazy>::execute_jit, machine, buses[7]),
+    };
+    for (int i = 1; i < 8; i++)
+    {
+        // TestBus memory is one block, page 0 starts it
+        const uint8_t *memory = buses[i].getReadPages()[0];
+        const uint8_t *expected = buses[0].getReadPages()[0];
+        int differing = -1;
+        if (std::memcmp(memory, expected, 0x10000) != 0)
+        {
+            differing = std::mismatch(memory, memory + 0x10000, expected).first - memory;
+        }
+        if (same(results[i], results[0]) && differing < 0)
+        {
+            continue;
+        }
+        const registers_t &r = machine.registers;
+        uint8_t bytes[3];
+        for (int j = 0; j < 3; j++)
+        {
+            bytes[j] = machine.memory[uint16_t(r.PC.value + j)];
+        }
+        char text[32];
+        trace::disassemble(text, sizeof(text), r.PC.value, bytes);
+        std::printf("%04X  %s  with A:%02X X:%02X Y:%02X P:%02X SP:%02X, NMI %d IRQ %d\n", r.PC.value, text, r.AC,
+                    r.X, r.Y, r.sr, r.SP, machine.interrupts & 1, (machine.interrupts >> 1) & 1);
+        print(results[0]);
+        print(results[i]);
+        if (differing >= 0)
+        {
+            std::printf("memory differs at %04X: %02X against %02X\n", differing, memory[differing],
+                        expected[differing]);
+        }
+        return false;
+    }
+    return true;
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!check(data, size))
+    {
+        __builtin_trap();
+    }
+    return 0;
+}
+
+#if !defined(NESACOLA_LIBFUZZER)
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            FILE *file = std::fopen(argv[i], "rb");
+            if (!file)
+            {
+                std::printf("cannot open %s\n", argv[i]);
+                return 1;
+            }
+            std::vector<uint8_t> data;
+            int byte;
+            while ((byte = std::fgetc(file)) != EOF)
+            {
+                data.push_back(uint8_t(byte));
+            }
+            std::fclose(file);
+            if (!check(data.data(), data.size()))
+            {
+                std::printf("%s: backends disagree\n", argv[i]);
+                return 1;
+            }
+        }
+        std::printf("backends agree on %d inputs\n", argc - 1);
+        return 0;
+    }
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(header_size + 3);
+    for (int input = 0; input < inputs; input++)
+    {
+        for (auto &byte : data)
+        {
+            byte = rng();
+        }
+        // Interrupts on one input in eight
+        data[7] = (data[7] & 7) == 0 ? data[7] >> 3 : 0;
+        if (!check(data.data(), data.size()))
+        {
+            std::printf("input %d: backends disagree\n", input);
+            return 1;
+        }
+    }
+    std::printf("every backend agrees with the eager table interpreter over %d instructions\n", inputs);
+    return 0;
+}
+#endif
@@ -0,0 +1,66 @@
+//
+// Runs random memory images through the eager and the lazy flag cores in lockstep,
+// failing on the first instruction where registers, P or the cycle count differ.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include "Fixtures.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int seeds = 200;
+const int steps = 20000;
+}
+
+int main()
+{
+    std::vector<uint8_t> image(0x10000);
+    static TestBus eagerBus, lazyBus;
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        std::mt19937 rng(seed);
+        for (auto &byte : image)
+        {
+            byte = rng();
+        }
+        eagerBus.load(0, image.data(), image.size());
+        lazyBus.load(0, image.data(), image.size());
+        CPU<TestBus, flags::eager> eager(&eagerBus);
+        CPU<TestBus, flags::lazy> lazy(&lazyBus);
+        eager.reset();
+        lazy.reset();
+        for (int step = 0; step < steps; step++)
+        {
+            const registers_t before = eager.getRegisters();
+            const uint32_t eagerCycles = eager.step_n(1);
+            const uint32_t lazyCycles = lazy.step_n(1);
+            const registers_t a = eager.getRegisters();
+            const registers_t b = lazy.getRegisters();
+            if (!fixtures::same(a, b) || eagerCycles != lazyCycles)
+            {
+                std::printf("seed %d step %d, opcode %02X at %04X\n", seed, step,
+                            eagerBus.read(before.PC.value), before.PC.value);
+                std::printf("eager A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%u\n",
+                            a.AC, a.X, a.Y, a.sr, a.SP, a.PC.value, eagerCycles);
+                std::printf("lazy  A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%u\n",
+                            b.AC, b.X, b.Y, b.sr, b.SP, b.PC.value, lazyCycles);
+                return 1;
+            }
+        }
+        for (uint32_t address = 0; address < 0x10000; address++)
+        {
+            if (eagerBus.read(address) != lazyBus.read(address))
+            {
+                std::printf("seed %d: memory differs at %04X\n", seed, address);
+                return 1;
+            }
+        }
+    }
+    std::printf("eager and lazy flags agree over %d programs\n", seeds);
+    return 0;
+}
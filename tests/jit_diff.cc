@@ -0,0 +1,173 @@
+//
+// Runs random programs through the JIT tier and the table interpreter in lockstep. Every block is
+// translated the first time it runs. Budgets vary from call to call so translated blocks are
+// entered and skipped at every boundary. Fails on the first call where registers, P, the cycle
+// count or memory differ.
+//
+
+#include "../system/CPU.h"
+#include "../system/TestBus.h"
+#include "Fixtures.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int seeds = 100;
+const int calls = 4000;
+
+/*
+ * A device on $4000-$40FF. Reads return a running counter and writes of $80 or more raise an NMI,
+ * so translated code sees I/O in its slow path and leaves its block early. Every access folds
+ * the CPU's cycle count into timeline, which catch-up synchronization depends on.
+ */
+template <class Core>
+struct device
+{
+    Core *cpu = nullptr;
+    uint8_t counter = 0;
+    uint64_t timeline = 0;
+
+    static uint8_t read(void *context, uint16_t address)
+    {
+        device *self = static_cast<device *>(context);
+        self->timeline = self->timeline * 31 + self->cpu->getCycles();
+        return self->counter++ ^ (address & 0xFF);
+    }
+    static void write(void *context, uint16_t, uint8_t value)
+    {
+        device *self = static_cast<device *>(context);
+        self->timeline = self->timeline * 31 + self->cpu->getCycles();
+        if (value & 0x80)
+        {
+            self->cpu->nmi();
+        }
+    }
+};
+
+// Flat memory, self modifying code included
+void load(TestBus &bus, const std::vector<uint8_t> &image)
+{
+    bus.load(0, image.data(), image.size());
+}
+
+struct cartridge
+{
+    std::vector<uint8_t> prg;
+    std::vector<uint8_t> ram;
+};
+
+// Mirrored RAM, I/O, 8KB of writable RAM at $6000 and 32KB of ROM
+void load(MMU &bus, cartridge &cart, const std::vector<uint8_t> &image)
+{
+    nes_byte byte;
+    for (uint16_t address = 0; address < 0x800; address++)
+    {
+        byte._unsigned = image[address];
+        bus.write(address, byte);
+    }
+    cart.ram.assign(image.begin() + 0x6000, image.begin() + 0x8000);
+    cart.prg.assign(image.begin() + 0x8000, image.end());
+    bus.map_memory(0x6000, 0x2000, cart.ram.data(), true);
+    bus.map_memory(0x8000, 0x8000, cart.prg.data(), false);
+}
+
+template <class Bus>
+bool lockstep(Bus &jitBus, Bus &tableBus, device<CPU<Bus, flags::eager>> *devices, int seed, std::mt19937 &rng)
+{
+    using Core = CPU<Bus, flags::eager>;
+    Core jitted(&jitBus);
+    Core table(&tableBus);
+    if (devices)
+    {
+        devices[0].cpu = &jitted;
+        devices[1].cpu = &table;
+    }
+    jitted.set_jit_threshold(0);
+    jitted.reset();
+    table.reset();
+    for (int call = 0; call < calls; call++)
+    {
+        const uint32_t maxCycles = 1 + rng() % 300;
+        const uint32_t maxInstructions = 1 + rng() % 100;
+        if (rng() % 64 == 0)
+        {
+            jitted.nmi();
+            table.nmi();
+        }
+        const bool irq = rng() % 16 == 0;
+        jitted.set_irq(Core::irq_mapper, irq);
+        table.set_irq(Core::irq_mapper, irq);
+        const registers_t before = table.getRegisters();
+        const uint32_t jitCycles = jitted.execute_jit(maxCycles, maxInstructions);
+        const uint32_t tableCycles = table.execute_table(maxCycles, maxInstructions);
+        const registers_t a = jitted.getRegisters();
+        const registers_t b = table.getRegisters();
+        if (devices && devices[0].timeline != devices[1].timeline)
+        {
+            std::printf("seed %d call %d from %04X: devices saw different cycle counts\n", seed, call,
+                        before.PC.value);
+            return false;
+        }
+        if (!fixtures::same(a, b) || jitCycles != tableCycles || jitted.getCycles() != table.getCycles())
+        {
+            std::printf("seed %d call %d from %04X, budget %u cycles %u instructions\n", seed, call,
+                        before.PC.value, maxCycles, maxInstructions);
+            std::printf("jit   A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%u\n",
+                        a.AC, a.X, a.Y, a.sr, a.SP, a.PC.value, jitCycles);
+            std::printf("table A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%u\n",
+                        b.AC, b.X, b.Y, b.sr, b.SP, b.PC.value, tableCycles);
+            return false;
+        }
+    }
+    for (uint32_t address = 0; address < 0x10000; address++)
+    {
+        if ((address >> 8) != 0x40 && jitBus.read(address) != tableBus.read(address))
+        {
+            std::printf("seed %d: memory differs at %04X\n", seed, address);
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+int main()
+{
+    std::vector<uint8_t> image(0x10000);
+    static TestBus flatJit, flatTable;
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        std::mt19937 rng(seed);
+        for (auto &byte : image)
+        {
+            byte = rng();
+        }
+        // Start in the cached range
+        image[0xFFFD] |= 0x80;
+
+        load(flatJit, image);
+        load(flatTable, image);
+        if (!lockstep<TestBus>(flatJit, flatTable, nullptr, seed, rng))
+        {
+            return 1;
+        }
+
+        MMU mmuJit, mmuTable;
+        cartridge cartJit, cartTable;
+        load(mmuJit, cartJit, image);
+        load(mmuTable, cartTable, image);
+        using Core = CPU<MMU, flags::eager>;
+        device<Core> devices[2];
+        mmuJit.map_io(0x4000, 0x100, {&device<Core>::read, &device<Core>::write, &devices[0]});
+        mmuTable.map_io(0x4000, 0x100, {&device<Core>::read, &device<Core>::write, &devices[1]});
+        if (!lockstep(mmuJit, mmuTable, devices, seed, rng))
+        {
+            return 1;
+        }
+    }
+    std::printf("JIT and interpreter agree over %d programs on each bus\n", seeds);
+    return 0;
+}
@@ -0,0 +1,251 @@
+//
+// Runs random programs on the lockstep core, every lane with its own random RAM so branches
+// diverge, and each lane on its own scalar CPU over an MMU, failing on the first lane whose
+// registers, cycle count or RAM differ after a run. Half the programs are random bytes, the
+// other half are built from instructions with branches that rejoin, so lanes split up and
+// come back together.
+//
+
+#include "../system/CPU.h"
+#include "../system/Lockstep.h"
+#include "../system/MMU.h"
+#include "Fixtures.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int lanes = 16;
+const int seeds = 60;
+const int runs = 40;
+
+enum operand
+{
+    none,
+    immediate,
+    zeropage,
+    load_address,
+    store_address,
+};
+
+struct instruction
+{
+    uint8_t opcode;
+    operand kind;
+};
+
+// The vector subset and a few the vector path leaves to the scalar CPU (LAX, DCP, NOP zp)
+const instruction instructions[] = {
+    {0x09, immediate},     {0x29, immediate},     {0x49, immediate},     {0x69, immediate},
+    {0xA9, immediate},     {0xC9, immediate},     {0xE9, immediate},     {0xA2, immediate},
+    {0xA0, immediate},     {0xE0, immediate},     {0xC0, immediate},     {0x05, zeropage},
+    {0x25, zeropage},      {0x45, zeropage},      {0x65, zeropage},      {0x85, zeropage},
+    {0xA5, zeropage},      {0xC5, zeropage},      {0xE5, zeropage},      {0xA6, zeropage},
+    {0xA4, zeropage},      {0x86, zeropage},      {0x84, zeropage},      {0xE4, zeropage},
+    {0xC4, zeropage},      {0x24, zeropage},      {0x06, zeropage},      {0x26, zeropage},
+    {0x46, zeropage},      {0x66, zeropage},      {0xC6, zeropage},      {0xE6, zeropage},
+    {0xA7, zeropage},      {0xC7, zeropage},      {0x04, zeropage},      {0x15, zeropage},
+    {0x35, zeropage},      {0x55, zeropage},      {0x75, zeropage},      {0x95, zeropage},
+    {0xB5, zeropage},      {0xD5, zeropage},      {0xF5, zeropage},      {0xB6, zeropage},
+    {0xB4, zeropage},      {0x96, zeropage},      {0x94, zeropage},      {0x16, zeropage},
+    {0x36, zeropage},      {0x56, zeropage},      {0x76, zeropage},      {0xD6, zeropage},
+    {0xF6, zeropage},      {0x01, zeropage},      {0x21, zeropage},      {0x41, zeropage},
+    {0x61, zeropage},      {0xA1, zeropage},      {0xC1, zeropage},      {0xE1, zeropage},
+    {0x11, zeropage},      {0x31, zeropage},      {0x51, zeropage},      {0x71, zeropage},
+    {0xB1, zeropage},      {0xD1, zeropage},      {0xF1, zeropage},      {0x0D, load_address},
+    {0x2D, load_address},  {0x4D, load_address},  {0x6D, load_address},  {0xAD, load_address},
+    {0xCD, load_address},  {0xED, load_address},  {0xAE, load_address},  {0xAC, load_address},
+    {0xEC, load_address},  {0xCC, load_address},  {0x2C, load_address},  {0x1D, load_address},
+    {0x3D, load_address},  {0x5D, load_address},  {0x7D, load_address},  {0xBD, load_address},
+    {0xDD, load_address},  {0xFD, load_address},  {0x19, load_address},  {0x39, load_address},
+    {0x59, load_address},  {0x79, load_address},  {0xB9, load_address},  {0xD9, load_address},
+    {0xF9, load_address},  {0xBE, load_address},  {0xBC, load_address},  {0x8D, store_address},
+    {0x8E, store_address}, {0x8C, store_address}, {0x0E, store_address}, {0x2E, store_address},
+    {0x4E, store_address}, {0x6E, store_address}, {0xCE, store_address}, {0xEE, store_address},
+    {0x9D, store_address}, {0x99, store_address}, {0x1E, store_address}, {0x3E, store_address},
+    {0x5E, store_address}, {0x7E, store_address}, {0xDE, store_address}, {0xFE, store_address},
+    {0x0A, none},          {0x2A, none},          {0x4A, none},          {0x6A, none},
+    {0xE8, none},          {0xC8, none},          {0xCA, none},          {0x88, none},
+    {0xAA, none},          {0xA8, none},          {0x8A, none},          {0x98, none},
+    {0xBA, none},          {0x18, none},          {0x38, none},          {0x58, none},
+    {0x78, none},          {0xB8, none},          {0xEA, none},          {0xD8, none},
+    {0xF8, none},
+};
+
+/*
+ * A block of random instructions ending in JMP or RTS at start. Branches skip forward over whole
+ * instructions, PHA/PLA and PHP/PLP come in pairs and main calls the subroutines.
+ */
+std::vector<uint8_t> make_block(std::mt19937 &rng, uint16_t start, int count, const uint16_t *subroutines,
+                                int calls)
+{
+    std::vector<uint8_t> code;
+    std::vector<size_t> starts;
+    std::vector<std::pair<size_t, size_t>> branches;
+    for (int i = 0; i < count; i++)
+    {
+        starts.push_back(code.size());
+        const uint32_t pick = rng() % 100;
+        if (pick < 15)
+        {
+            // Bxx over the next one to four instructions
+            code.push_back(((rng() % 8) << 5) | 0x10);
+            code.push_back(0);
+            branches.push_back({code.size() - 2, starts.size() + rng() % 4});
+        }
+        else if (pick < 18 && calls > 0)
+        {
+            const uint16_t target = subroutines[rng() % calls];
+            code.insert(code.end(), {0x20, uint8_t(target), uint8_t(target >> 8)});
+        }
+        else if (pick < 20)
+        {
+            code.insert(code.end(), {0x48, 0xEA, 0x68});
+        }
+        else if (pick < 22)
+        {
+            code.insert(code.end(), {0x08, 0xEA, 0x28});
+        }
+        else
+        {
+            const instruction &next = instructions[rng() % (sizeof(instructions) / sizeof(instructions[0]))];
+            code.push_back(next.opcode);
+            switch (next.kind)
+            {
+            case none:
+                break;
+            case immediate:
+            case zeropage:
+                code.push_back(rng());
+                break;
+            case load_address:
+            {
+                // RAM, its mirrors, the empty I/O range or the ROM
+                const uint16_t address = rng();
+                code.push_back(address);
+                code.push_back(address >> 8);
+                break;
+            }
+            case store_address:
+            {
+                // RAM above the stack
+                const uint16_t address = 0x200 + rng() % 0x600;
+                code.push_back(address);
+                code.push_back(address >> 8);
+                break;
+            }
+            }
+        }
+    }
+    const size_t end = code.size();
+    starts.push_back(end);
+    if (calls > 0)
+    {
+        code.insert(code.end(), {0x4C, uint8_t(start), uint8_t(start >> 8)});
+    }
+    else
+    {
+        code.push_back(0x60);
+    }
+    for (const auto &branch : branches)
+    {
+        const size_t target = starts[std::min(branch.second, starts.size() - 1)];
+        code[branch.first + 1] = uint8_t(target - (branch.first + 2));
+    }
+    return code;
+}
+
+std::vector<uint8_t> make_rom(std::mt19937 &rng, bool structured)
+{
+    std::vector<uint8_t> rom(0x8000);
+    for (auto &byte : rom)
+    {
+        byte = rng();
+    }
+    if (structured)
+    {
+        const uint16_t subroutines[2] = {0xC000, 0xD000};
+        const std::vector<uint8_t> main = make_block(rng, 0x8000, 120, subroutines, 2);
+        std::memcpy(&rom[0], main.data(), main.size());
+        for (uint16_t subroutine : subroutines)
+        {
+            const std::vector<uint8_t> code = make_block(rng, subroutine, 20, nullptr, 0);
+            std::memcpy(&rom[subroutine - 0x8000], code.data(), code.size());
+        }
+    }
+    // Reset and BRK both go to $8000
+    rom[0x7FFC] = rom[0x7FFE] = 0x00;
+    rom[0x7FFD] = rom[0x7FFF] = 0x80;
+    return rom;
+}
+}
+
+int main()
+{
+    uint64_t vector = 0, scalar = 0;
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        std::mt19937 rng(seed);
+        std::vector<uint8_t> rom = make_rom(rng, seed & 1);
+        std::unique_ptr<Lockstep<lanes>> lockstep(new Lockstep<lanes>(rom.data(), rom.size()));
+        std::unique_ptr<MMU> buses[lanes];
+        std::unique_ptr<CPU<MMU>> cpus[lanes];
+        uint64_t cycles[lanes]{};
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            buses[lane].reset(new MMU());
+            buses[lane]->map_memory(0x8000, rom.size(), rom.data(), false);
+            for (uint16_t address = 0; address < 0x800; address++)
+            {
+                nes_byte byte;
+                byte._unsigned = rng();
+                buses[lane]->write(address, byte);
+                lockstep->write(lane, address, byte._unsigned);
+            }
+            cpus[lane].reset(new CPU<MMU>(buses[lane].get()));
+            cpus[lane]->reset();
+        }
+        lockstep->reset();
+        for (int run = 0; run < runs; run++)
+        {
+            const uint32_t budget = 1 + rng() % 3000;
+            uint64_t start = cycles[0];
+            for (int lane = 1; lane < lanes; lane++)
+            {
+                start = std::min(start, cycles[lane]);
+            }
+            lockstep->run_for(budget);
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                while (cycles[lane] < start + budget)
+                {
+                    cycles[lane] += cpus[lane]->step_n(1);
+                }
+                const registers_t a = cpus[lane]->getRegisters();
+                const registers_t b = lockstep->getRegisters(lane);
+                bool ram = true;
+                for (uint16_t address = 0; address < 0x800; address++)
+                {
+                    ram &= buses[lane]->read(address) == lockstep->read(lane, address);
+                }
+                if (!fixtures::same(a, b) || cycles[lane] != lockstep->getCycles(lane) || !ram)
+                {
+                    std::printf("seed %d run %d lane %d%s\n", seed, run, lane, ram ? "" : ", RAM differs");
+                    std::printf("scalar   A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%llu\n", a.AC, a.X,
+                                a.Y, a.sr, a.SP, a.PC.value, (unsigned long long)cycles[lane]);
+                    std::printf("lockstep A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%llu\n", b.AC, b.X,
+                                b.Y, b.sr, b.SP, b.PC.value, (unsigned long long)lockstep->getCycles(lane));
+                    return 1;
+                }
+            }
+        }
+        vector += lockstep->getVectorSteps();
+        scalar += lockstep->getScalarSteps();
+    }
+    std::printf("lockstep core matches the scalar CPU, %llu vector and %llu scalar steps\n",
+                (unsigned long long)vector, (unsigned long long)scalar);
+    return 0;
+}
@@ -0,0 +1,313 @@
+//
+// Plays a movie into a program that reads both controllers in its NMI, moves sprite 0 with the
+// buttons, times the sprite 0 hit in a busy loop and splits the scroll where it lands, with MMC3
+// scanline IRQs counting along. The run is repeated with every frame drawn, with only the last
+// one drawn and with only the last one drawn dot by dot; cycles and RAM must match every frame
+// and the last picture must too. Also checks the movie file round trip, that files holding fewer
+// or more frames than their header claims are refused, that the buttons read are the movie's, and
+// reports how much faster the undrawn run is.
+//
+
+#include "../system/Movie.h"
+#include "../system/NES.h"
+#include "Fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace
+{
+const int frames = 240;
+const char *image_path = "movie_diff.nes";
+const char *movie_path = "movie_diff.nesm";
+
+const uint8_t reset_code[] = {
+    0x78,             // $8000 SEI
+    0xA2, 0xFF,       // $8001 LDX #$FF
+    0x9A,             // $8003 TXS
+    0xA9, 0x40,       // $8004 LDA #$40
+    0x8D, 0x17, 0x40, // $8006 STA $4017
+    0xA9, 0x3F,       // $8009 LDA #$3F
+    0x8D, 0x06, 0x20, // $800B STA $2006
+    0xA9, 0x00,       // $800E LDA #$00
+    0x8D, 0x06, 0x20, // $8010 STA $2006
+    0xA2, 0x00,       // $8013 LDX #$00
+    0x8A,             // $8015 TXA
+    0x8D, 0x07, 0x20, // $8016 STA $2007
+    0xE8,             // $8019 INX
+    0xE0, 0x20,       // $801A CPX #$20
+    0xD0, 0xF7,       // $801C BNE $8015
+    0xA9, 0x20,       // $801E LDA #$20
+    0x8D, 0x06, 0x20, // $8020 STA $2006
+    0xA9, 0x00,       // $8023 LDA #$00
+    0x8D, 0x06, 0x20, // $8025 STA $2006
+    0xA0, 0x04,       // $8028 LDY #$04
+    0x8A,             // $802A TXA
+    0x8D, 0x07, 0x20, // $802B STA $2007
+    0xE8,             // $802E INX
+    0xD0, 0xF9,       // $802F BNE $802A
+    0x88,             // $8031 DEY
+    0xD0, 0xF6,       // $8032 BNE $802A
+    0xA9, 0x30,       // $8034 LDA #$30
+    0x8D, 0x00, 0xC0, // $8036 STA $C000
+    0x8D, 0x01, 0xC0, // $8039 STA $C001
+    0x8D, 0x01, 0xE0, // $803C STA $E001
+    0xA9, 0x88,       // $803F LDA #$88
+    0x8D, 0x00, 0x20, // $8041 STA $2000
+    0xA9, 0x1E,       // $8044 LDA #$1E
+    0x8D, 0x01, 0x20, // $8046 STA $2001
+    0x58,             // $8049 CLI
+    // Wait for the last frame's hit to be cleared, then count until this one's
+    0x2C, 0x02, 0x20, // $804A BIT $2002
+    0x70, 0xFB,       // $804D BVS $804A
+    0xA9, 0x00,       // $804F LDA #$00
+    0x85, 0x30,       // $8051 STA $30
+    0x85, 0x31,       // $8053 STA $31
+    0xE6, 0x30,       // $8055 INC $30
+    0xD0, 0x02,       // $8057 BNE $805B
+    0xE6, 0x31,       // $8059 INC $31
+    0x2C, 0x02, 0x20, // $805B BIT $2002
+    0x30, 0xE9,       // $805E BMI $8049
+    0x50, 0xF3,       // $8060 BVC $8055
+    // Split the scroll at the hit and log how long it took
+    0xA5, 0x30,       // $8062 LDA $30
+    0x8D, 0x05, 0x20, // $8064 STA $2005
+    0x8D, 0x05, 0x20, // $8067 STA $2005
+    0xA6, 0x11,       // $806A LDX $11
+    0x9D, 0x00, 0x03, // $806C STA $0300,X
+    0xA5, 0x31,       // $806F LDA $31
+    0x9D, 0x00, 0x04, // $8071 STA $0400,X
+    0x4C, 0x49, 0x80, // $8074 JMP $8049
+};
+// Reads both ports, puts sprite 0 where they say and DMAs page 2
+const uint8_t nmi_code[] = {
+    0x48,             // $8100 PHA
+    0x8A,             // $8101 TXA
+    0x48,             // $8102 PHA
+    0xE6, 0x11,       // $8103 INC $11
+    0xA9, 0x01,       // $8105 LDA #$01
+    0x8D, 0x16, 0x40, // $8107 STA $4016
+    0xA9, 0x00,       // $810A LDA #$00
+    0x8D, 0x16, 0x40, // $810C STA $4016
+    0xA2, 0x08,       // $810F LDX #$08
+    0xAD, 0x16, 0x40, // $8111 LDA $4016
+    0x4A,             // $8114 LSR A
+    0x66, 0x20,       // $8115 ROR $20
+    0xAD, 0x17, 0x40, // $8117 LDA $4017
+    0x4A,             // $811A LSR A
+    0x66, 0x21,       // $811B ROR $21
+    0xCA,             // $811D DEX
+    0xD0, 0xF1,       // $811E BNE $8111
+    0xA5, 0x21,       // $8120 LDA $21
+    0x4A,             // $8122 LSR A
+    0x8D, 0x00, 0x02, // $8123 STA $0200
+    0xA5, 0x11,       // $8126 LDA $11
+    0x8D, 0x01, 0x02, // $8128 STA $0201
+    0xA5, 0x20,       // $812B LDA $20
+    0x8D, 0x03, 0x02, // $812D STA $0203
+    0xA9, 0x02,       // $8130 LDA #$02
+    0x8D, 0x14, 0x40, // $8132 STA $4014
+    0xA9, 0x00,       // $8135 LDA #$00
+    0x8D, 0x05, 0x20, // $8137 STA $2005
+    0x8D, 0x05, 0x20, // $813A STA $2005
+    0x68,             // $813D PLA
+    0xAA,             // $813E TAX
+    0x68,             // $813F PLA
+    0x40,             // $8140 RTI
+};
+// MMC3 scanline IRQ, counted in $12
+const uint8_t irq_code[] = {
+    0x48,             // $8200 PHA
+    0x8D, 0x00, 0xE0, // $8201 STA $E000
+    0x8D, 0x01, 0xE0, // $8204 STA $E001
+    0xE6, 0x12,       // $8207 INC $12
+    0x68,             // $8209 PLA
+    0x40,             // $820A RTI
+};
+
+struct record
+{
+    uint32_t cycles;
+    uint64_t ram;
+};
+
+bool write_image(uint8_t mapper)
+{
+    fixtures::RomImage image(mapper);
+    image.place(0x8000, reset_code);
+    image.place(0x8100, nmi_code);
+    image.place(0x8200, irq_code);
+    image.set_vectors(0x8100, 0x8000, 0x8200);
+    // Sparse patterns, so whether sprite 0 hits depends on where it is
+    std::mt19937 rng(1);
+    uint8_t *chr = image.getChr();
+    std::generate(chr, chr + fixtures::RomImage::chr_size, [&] { return uint8_t(rng() & rng()); });
+    return image.write(image_path);
+}
+
+// Plays the movie from power on, only the last frame is drawn unless draw_all
+bool play(const Movie &movie, bool draw_all, bool batching, std::vector<record> &records, uint64_t &picture,
+          double &seconds)
+{
+    std::unique_ptr<NES> nes(new NES());
+    if (nes->load(image_path) != NES::loaded)
+    {
+        return false;
+    }
+    nes->getPPU().set_scanline_batching(batching);
+    nes->getPPU().set_frame_output(draw_all);
+    nes->reset();
+    records.clear();
+    double spent = 0;
+    for (uint32_t frame = 0; frame < movie.getFrames(); frame++)
+    {
+        if (frame + 1 == movie.getFrames())
+        {
+            nes->getPPU().set_frame_output(true);
+        }
+        movie.apply(*nes, frame);
+        const auto start = std::chrono::steady_clock::now();
+        record result;
+        result.cycles = nes->run_frame();
+        spent += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint8_t ram[0x800];
+        for (uint16_t address = 0; address < 0x800; address++)
+        {
+            ram[address] = nes->getMMU().read(address);
+        }
+        result.ram = fnv1a(ram, sizeof(ram));
+        records.push_back(result);
+        // The NMI at the start of a frame reads the buttons set for it
+        if (frame > 0 && (ram[0x20] != movie.getButtons(frame, 0) || ram[0x21] != movie.getButtons(frame, 1)))
+        {
+            std::printf("frame %u: read %02X %02X, the movie holds %02X %02X\n", frame, ram[0x20], ram[0x21],
+                        movie.getButtons(frame, 0), movie.getButtons(frame, 1));
+            return false;
+        }
+    }
+    picture = fnv1a(nes->getPPU().getFrame(), PPU::width * PPU::height);
+    seconds = spent;
+    return true;
+}
+
+bool check(const char *board, const Movie &movie)
+{
+    std::vector<record> drawn, skipped, dots;
+    uint64_t drawn_picture, skipped_picture, dots_picture;
+    double drawn_time, skipped_time, dots_time;
+    if (!play(movie, true, true, drawn, drawn_picture, drawn_time) ||
+        !play(movie, false, true, skipped, skipped_picture, skipped_time) ||
+        !play(movie, false, false, dots, dots_picture, dots_time))
+    {
+        std::printf("%s: the movie does not play\n", board);
+        return false;
+    }
+    const char *names[] = {"drawing only the last frame", "drawing only the last frame dot by dot"};
+    const std::vector<record> *runs[] = {&skipped, &dots};
+    const uint64_t pictures[] = {skipped_picture, dots_picture};
+    for (int run = 0; run < 2; run++)
+    {
+        for (size_t frame = 0; frame < drawn.size(); frame++)
+        {
+            const record &got = (*runs[run])[frame];
+            if (got.cycles != drawn[frame].cycles || got.ram != drawn[frame].ram)
+            {
+                std::printf("%s, %s: frame %zu differs%s%s\n", board, names[run], frame,
+                            got.cycles != drawn[frame].cycles ? ", cycles" : "",
+                            got.ram != drawn[frame].ram ? ", RAM" : "");
+                return false;
+            }
+        }
+        if (pictures[run] != drawn_picture)
+        {
+            std::printf("%s, %s: the last picture differs\n", board, names[run]);
+            return false;
+        }
+    }
+    std::printf("%s: %d frames drawn in %.2f ms, undrawn in %.2f ms\n", board, frames, drawn_time * 1000,
+                skipped_time * 1000);
+    return true;
+}
+}
+
+int main()
+{
+    // Sprite 0 moves around the screen, sometimes held still for a while
+    std::mt19937 rng(3);
+    Movie recorded(2);
+    uint8_t held[2] = {};
+    for (int frame = 0; frame < frames; frame++)
+    {
+        if (rng() % 4 == 0)
+        {
+            held[0] = rng();
+            held[1] = rng();
+        }
+        recorded.record(held[0], held[1]);
+    }
+    Movie movie;
+    const bool saved = recorded.save(movie_path);
+    const bool read = movie.load(movie_path);
+    std::remove(movie_path);
+    if (!saved || !read || movie.getPorts() != 2 || movie.getFrames() != uint32_t(frames))
+    {
+        std::printf("the movie does not survive %s\n", movie_path);
+        return 1;
+    }
+    // Files holding fewer or more frames than their header claims, four billion of them included
+    const uint32_t claimed[] = {0xFFFFFFFF, uint32_t(frames), uint32_t(frames)};
+    const size_t sizes[] = {2 * frames, 2 * frames - 1, 2 * frames + 1};
+    for (int i = 0; i < 3; i++)
+    {
+        const Movie::header_t header{Movie::magic, Movie::version, 2, 0, claimed[i], 0};
+        std::vector<uint8_t> bytes(sizeof(header) + sizes[i]);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        FILE *file = std::fopen(movie_path, "wb");
+        const bool written = file && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        if (file)
+        {
+            std::fclose(file);
+        }
+        Movie corrupt;
+        const bool accepted = corrupt.load(movie_path);
+        std::remove(movie_path);
+        if (!written || accepted || corrupt.getFrames() != 0)
+        {
+            std::printf("a movie of %zu bytes claiming %u frames was not refused\n", sizes[i], claimed[i]);
+            return 1;
+        }
+    }
+    for (int frame = 0; frame < frames; frame++)
+    {
+        if (movie.getButtons(frame, 0) != recorded.getButtons(frame, 0) ||
+            movie.getButtons(frame, 1) != recorded.getButtons(frame, 1))
+        {
+            std::printf("frame %d of the movie reads back wrong\n", frame);
+            return 1;
+        }
+    }
+
+    const uint8_t mappers[] = {0, 4};
+    const char *boards[] = {"NROM", "MMC3"};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!write_image(mappers[i]))
+        {
+            std::printf("cannot write %s\n", image_path);
+            return 1;
+        }
+        const bool same = check(boards[i], movie);
+        std::remove(image_path);
+        if (!same)
+        {
+            return 1;
+        }
+    }
+    std::printf("Undrawn frames play the movie the same on NROM and MMC3\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+//
+// Runs the PPU with scanline batching and dot by dot side by side on random VRAM, OAM and
+// register writes landing anywhere in the frame, raster splits included. Fails on the first
+// register read, NMI count or frame that differs.
+//
+
+#include "../system/PPU.h"
+#include "Fixtures.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int seeds = 200;
+const int frames = 3;
+const char *image_path = "ppu_diff.nes";
+
+// NROM with 8KB of random CHR ROM and the given nametable layout
+bool write_image(std::mt19937 &rng, uint8_t flags6)
+{
+    fixtures::RomImage image(0, 1, flags6);
+    // Sparse patterns leave transparent pixels for the sprites to show through
+    uint8_t *chr = image.getChr();
+    for (size_t i = 0; i < fixtures::RomImage::chr_size; i++)
+    {
+        chr[i] = rng() & rng();
+    }
+    return image.write(image_path);
+}
+
+struct console
+{
+    MMU mmu;
+    std::unique_ptr<Mapper> mapper;
+    std::unique_ptr<PPU> ppu;
+    int nmis = 0;
+
+    console(Cartridge &cartridge, bool batching)
+    {
+        mapper = Mapper::create(cartridge, mmu);
+        ppu.reset(new PPU(*mapper));
+        ppu->map(mmu);
+        nmi_line line;
+        line.raise = [](void *context)
+        { static_cast<console *>(context)->nmis++; };
+        line.context = this;
+        ppu->connect_nmi(line);
+        ppu->set_scanline_batching(batching);
+        ppu->reset();
+    }
+    void write(uint16_t address, uint8_t value)
+    {
+        nes_byte byte;
+        byte._unsigned = value;
+        mmu.write(address, byte);
+    }
+};
+
+// Random VRAM, palette and OAM with most sprites on screen and sprite 0 over the background
+void fill(console &a, console &b, std::mt19937 &rng)
+{
+    auto both = [&](uint16_t address, uint8_t value)
+    {
+        a.write(address, value);
+        b.write(address, value);
+    };
+    both(0x2006, 0x20);
+    both(0x2006, 0x00);
+    for (int i = 0; i < 0x1000; i++)
+    {
+        both(0x2007, rng());
+    }
+    both(0x2006, 0x3F);
+    both(0x2006, 0x00);
+    for (int i = 0; i < 32; i++)
+    {
+        both(0x2007, rng());
+    }
+    both(0x2003, 0);
+    for (int i = 0; i < 256; i++)
+    {
+        both(0x2004, (i & 3) == 0 ? rng() % 240 : rng());
+    }
+}
+
+bool compare(int seed, std::mt19937 &rng)
+{
+    const uint8_t layouts[] = {0x00, 0x01, 0x08};
+    if (!write_image(rng, layouts[rng() % 3]))
+    {
+        std::printf("cannot write %s\n", image_path);
+        return false;
+    }
+    Cartridge cartridge;
+    if (!cartridge.load(image_path))
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    console batched(cartridge, true);
+    console dotted(cartridge, false);
+    fill(batched, dotted, rng);
+
+    const uint16_t registers[] = {0x2000, 0x2001, 0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2002};
+    const uint32_t total = PPU::dots_per_line * PPU::lines_per_frame * frames;
+    uint32_t elapsed = 0;
+    while (elapsed < total)
+    {
+        // Mostly short steps, some long enough to cover whole batched lines
+        const uint32_t dots = rng() % 8 ? 1 + rng() % 400 : 1 + rng() % 8000;
+        batched.ppu->run(dots);
+        dotted.ppu->run(dots);
+        elapsed += dots;
+
+        if (rng() % 16 == 0)
+        {
+            // Poll $2002 every dot for a line, like a game waiting for sprite 0
+            for (int i = 0; i < PPU::dots_per_line; i++)
+            {
+                batched.ppu->run(1);
+                dotted.ppu->run(1);
+                const uint8_t a = batched.mmu.read(0x2002);
+                const uint8_t b = dotted.mmu.read(0x2002);
+                if (a != b)
+                {
+                    std::printf("seed %d: $2002 at line %d dot %d, batched %02X dotted %02X\n", seed,
+                                dotted.ppu->getScanline(), dotted.ppu->getDot(), a, b);
+                    return false;
+                }
+            }
+            elapsed += PPU::dots_per_line;
+        }
+
+        const uint16_t address = registers[rng() % 8] + 8 * (rng() % 1024);
+        uint8_t value = rng();
+        if ((address & 7) == 1)
+        {
+            // Keep rendering on most of the time
+            value |= rng() % 4 ? 0x18 : 0;
+        }
+        if (rng() % 3 == 0)
+        {
+            const uint8_t a = batched.mmu.read(address);
+            const uint8_t b = dotted.mmu.read(address);
+            if (a != b)
+            {
+                std::printf("seed %d: read of %04X at line %d dot %d, batched %02X dotted %02X\n", seed, address,
+                            dotted.ppu->getScanline(), dotted.ppu->getDot(), a, b);
+                return false;
+            }
+        }
+        else
+        {
+            batched.write(address, value);
+            dotted.write(address, value);
+        }
+    }
+    // Batched lines are drawn when they start, compare once the last visible one is done
+    while (dotted.ppu->getScanline() != PPU::height)
+    {
+        batched.ppu->run(1);
+        dotted.ppu->run(1);
+    }
+    if (batched.nmis != dotted.nmis || batched.ppu->getFrameCount() != dotted.ppu->getFrameCount())
+    {
+        std::printf("seed %d: batched %d NMIs over %llu frames, dotted %d over %llu\n", seed, batched.nmis,
+                    (unsigned long long)batched.ppu->getFrameCount(), dotted.nmis,
+                    (unsigned long long)dotted.ppu->getFrameCount());
+        return false;
+    }
+    const uint8_t *a = batched.ppu->getFrame();
+    const uint8_t *b = dotted.ppu->getFrame();
+    for (int i = 0; i < PPU::width * PPU::height; i++)
+    {
+        if (a[i] != b[i])
+        {
+            std::printf("seed %d: pixel %d,%d batched %02X dotted %02X\n", seed, i % PPU::width, i / PPU::width, a[i],
+                        b[i]);
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+int main()
+{
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        std::mt19937 rng(seed);
+        if (!compare(seed, rng))
+        {
+            std::remove(image_path);
+            return 1;
+        }
+    }
+    std::remove(image_path);
+    std::printf("Batched and dot by dot rendering agree over %d runs of %d frames\n", seeds, frames);
+    return 0;
+}
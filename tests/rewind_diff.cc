@@ -0,0 +1,159 @@
+//
+// Pushes states into small rewind rings, so keyframe groups get dropped and the coded bytes
+// wrap around, and pops them back against copies kept on the side, stepping back and playing
+// forward again at random. The states are savestates of a console running a program that
+// rewrites a page of RAM every frame, with random runs of other bytes changed on top. Also
+// checks that a minute of plain frames fits in a few MB.
+//
+
+#include "../system/NES.h"
+#include "../system/Rewind.h"
+#include "Fixtures.h"
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+const char *image_path = "rewind_diff.nes";
+const int seeds = 10;
+const int steps = 400;
+// A minute at 60 frames per second and the room it has to fit in
+const int minute = 3600;
+const size_t budget = 4 << 20;
+
+const uint8_t reset_code[] = {
+    0xA9, 0x80,       // $8000 LDA #$80
+    0x8D, 0x00, 0x20, // $8002 STA $2000
+    0xA9, 0x1E,       // $8005 LDA #$1E
+    0x8D, 0x01, 0x20, // $8007 STA $2001
+    0xE6, 0x10,       // $800A INC $10
+    0xA6, 0x10,       // $800C LDX $10
+    0xBD, 0x00, 0x03, // $800E LDA $0300,X
+    0x69, 0x13,       // $8011 ADC #$13
+    0x9D, 0x00, 0x03, // $8013 STA $0300,X
+    0x4C, 0x0A, 0x80, // $8016 JMP $800A
+};
+
+bool write_image()
+{
+    fixtures::RomImage image;
+    image.place(0x8000, reset_code);
+    // NMI returns right away from $8100
+    const uint8_t rti[] = {0x40};
+    image.place(0x8100, rti);
+    image.set_vectors(0x8100, 0x8000, 0x8100);
+    return image.write(image_path);
+}
+
+// The next frame's state, sometimes with a random run of bytes changed as well
+std::vector<uint8_t> next_state(NES &nes, std::mt19937 &rng)
+{
+    nes.run_frame();
+    std::vector<uint8_t> state(nes.getStateSize());
+    nes.save_state(state.data());
+    if (rng() % 4 == 0)
+    {
+        const size_t length = 1 + rng() % 2000;
+        const size_t start = rng() % (state.size() - length);
+        for (size_t i = start; i < start + length; i++)
+        {
+            state[i] = rng();
+        }
+    }
+    return state;
+}
+
+bool check(int seed)
+{
+    std::mt19937 rng(seed);
+    std::unique_ptr<NES> nes(new NES());
+    nes->load(image_path);
+    nes->reset();
+    const size_t size = nes->getStateSize();
+    // Room for a few keyframes at most, and sometimes fewer entries than that holds
+    Rewind rewind(size, size * (2 + rng() % 4), 20 + rng() % 200, 1 + rng() % 30);
+    std::deque<std::vector<uint8_t>> history;
+    std::vector<uint8_t> popped(size);
+    for (int step = 0; step < steps; step++)
+    {
+        if (rng() % 3 == 0)
+        {
+            const bool any = rewind.pop(popped.data());
+            if (any != !history.empty() || (any && popped != history.back()))
+            {
+                std::printf("seed %d step %d: pop gave the wrong state\n", seed, step);
+                return false;
+            }
+            if (any)
+            {
+                history.pop_back();
+            }
+            continue;
+        }
+        history.push_back(next_state(*nes, rng));
+        rewind.push(history.back().data());
+        // Whatever was dropped is the oldest
+        while (history.size() > rewind.getCount())
+        {
+            history.pop_front();
+        }
+        if (history.size() != rewind.getCount())
+        {
+            std::printf("seed %d step %d: %zu states held, %zu expected\n", seed, step, rewind.getCount(),
+                        history.size());
+            return false;
+        }
+    }
+    while (!history.empty())
+    {
+        if (!rewind.pop(popped.data()) || popped != history.back())
+        {
+            std::printf("seed %d: draining gave the wrong state\n", seed);
+            return false;
+        }
+        history.pop_back();
+    }
+    return !rewind.pop(popped.data());
+}
+}
+
+int main()
+{
+    if (!write_image())
+    {
+        std::printf("cannot write %s\n", image_path);
+        return 1;
+    }
+    for (int seed = 0; seed < seeds; seed++)
+    {
+        if (!check(seed))
+        {
+            std::remove(image_path);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<NES> nes(new NES());
+    nes->load(image_path);
+    std::remove(image_path);
+    nes->reset();
+    std::vector<uint8_t> state(nes->getStateSize());
+    Rewind rewind(state.size(), budget, minute);
+    for (int frame = 0; frame < minute; frame++)
+    {
+        nes->run_frame();
+        nes->save_state(state.data());
+        rewind.push(state.data());
+    }
+    std::printf("%zu of %d frames kept in %zu KB, %zu bytes per %zu byte state\n", rewind.getCount(), minute,
+                rewind.getUsed() >> 10, rewind.getUsed() / rewind.getCount(), state.size());
+    if (rewind.getCount() != size_t(minute))
+    {
+        std::printf("a minute of frames does not fit in %zu MB\n", budget >> 20);
+        return 1;
+    }
+    return 0;
+}
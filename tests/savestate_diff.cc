@@ -0,0 +1,337 @@
+//
+// Runs the busy program from Fixtures.h, which keeps the PPU, the APU channels, OAM DMA and the
+// MMC3 and frame counter IRQs busy, saves a state in the middle of a frame and records what the
+// following frames look and sound like. Loading the state into the same console and into a fresh
+// one must replay them exactly, and saving twice or right after a load must give back the same
+// bytes. Also checks that states are refused by another cartridge or build or with fields out of
+// range, that failed loads leave the loaded cartridge running and a later load rewires the
+// console, and reports save/load times.
+//
+
+#include "../system/NES.h"
+#include "Fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+const int warmup = 30;
+const int frames = 30;
+const int saved_line = 100;
+const char *image_path = "savestate_diff.nes";
+const char *unsupported_path = "savestate_diff_mmc5.nes";
+
+// What a frame leaves behind
+struct record
+{
+    uint32_t cycles;
+    uint64_t video;
+    uint64_t audio;
+    uint64_t ram;
+};
+
+// Leaves value all over the stack, where padding saved out of a temporary would come from
+__attribute__((noinline)) void scribble_stack(uint8_t value)
+{
+    volatile uint8_t junk[16384];
+    for (auto &byte : junk)
+    {
+        byte = value;
+    }
+}
+
+// The picture is hashed from first_line down, lines drawn before a state was saved are not in it
+record run_frame(NES &nes, int first_line)
+{
+    record result;
+    result.cycles = nes.run_frame();
+    int16_t samples[4096];
+    const size_t count = nes.getAPU().read_samples(samples, sizeof(samples) / sizeof(samples[0]));
+    result.video = fnv1a(nes.getPPU().getFrame() + first_line * PPU::width, (PPU::height - first_line) * PPU::width);
+    result.audio = fnv1a(samples, count * sizeof(samples[0]));
+    uint8_t ram[0x800];
+    for (uint16_t address = 0; address < 0x800; address++)
+    {
+        ram[address] = nes.getMMU().read(address);
+    }
+    result.ram = fnv1a(ram, sizeof(ram));
+    return result;
+}
+
+bool replay(const char *board, const char *name, NES &nes, const std::vector<record> &expected)
+{
+    for (int frame = 0; frame < frames; frame++)
+    {
+        const record got = run_frame(nes, frame ? 0 : saved_line + 1);
+        const record &want = expected[frame];
+        if (got.cycles != want.cycles || got.video != want.video || got.audio != want.audio ||
+            got.ram != want.ram)
+        {
+            std::printf("%s, %s: frame %d after the load differs%s%s%s%s\n", board, name, frame,
+                        got.cycles != want.cycles ? ", cycles" : "", got.video != want.video ? ", picture" : "",
+                        got.audio != want.audio ? ", audio" : "", got.ram != want.ram ? ", RAM" : "");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check(const char *board)
+{
+    std::unique_ptr<NES> nes(new NES()), fresh(new NES());
+    if (nes->load(image_path) != NES::loaded || fresh->load(image_path) != NES::loaded)
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    nes->reset();
+    // Sprites for the DMA from page 2
+    std::mt19937 rng(2);
+    for (uint16_t address = 0x200; address < 0x300; address++)
+    {
+        nes_byte byte;
+        byte._unsigned = rng();
+        nes->getMMU().write(address, byte);
+    }
+    for (int frame = 0; frame < warmup; frame++)
+    {
+        run_frame(*nes, 0);
+    }
+    // Into the middle of the next frame, with IRQs and audio in flight
+    while (nes->getPPU().getScanline() != saved_line)
+    {
+        nes->getCPU().step_n(1);
+        nes->getPPU().sync(nes->getCPU().getCycles());
+    }
+
+    std::vector<uint8_t> state(nes->getStateSize());
+    scribble_stack(0x00);
+    nes->save_state(state.data());
+    std::vector<uint8_t> twice(state.size());
+    scribble_stack(0xFF);
+    nes->save_state(twice.data());
+    if (twice != state)
+    {
+        const size_t at = std::mismatch(state.begin(), state.end(), twice.begin()).first - state.begin();
+        std::printf("%s: two saves of one state differ at byte %zu\n", board, at);
+        return false;
+    }
+    std::vector<record> expected;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        expected.push_back(run_frame(*nes, frame ? 0 : saved_line + 1));
+    }
+
+    if (nes->load_state(state.data(), state.size()) != NES::state_loaded)
+    {
+        std::printf("%s: the state does not load back\n", board);
+        return false;
+    }
+    if (!replay(board, "same console", *nes, expected))
+    {
+        return false;
+    }
+    // Loads that fail leave the cartridge, and so the state, in place
+    if (nes->load("savestate_diff_missing.nes") != NES::bad_image ||
+        nes->load(unsupported_path) != NES::unsupported_mapper)
+    {
+        std::printf("%s: a bad image loaded\n", board);
+        return false;
+    }
+    if (nes->load_state(state.data(), state.size()) != NES::state_loaded ||
+        !replay(board, "after failed loads", *nes, expected))
+    {
+        return false;
+    }
+    if (fresh->load_state(state.data(), state.size()) != NES::state_loaded)
+    {
+        std::printf("%s: the state does not load into a fresh console\n", board);
+        return false;
+    }
+    std::vector<uint8_t> again(fresh->getStateSize());
+    fresh->save_state(again.data());
+    if (again != state)
+    {
+        std::printf("%s: saving after a load gives other bytes\n", board);
+        return false;
+    }
+    if (!replay(board, "fresh console", *fresh, expected))
+    {
+        return false;
+    }
+
+    // Fields out of range, every byte in turn. The ones that index something are refused and
+    // must leave the console as it was, the scheduler's heap size at the very end among them.
+    std::vector<uint8_t> after(state.size());
+    bool size_refused = false;
+    for (size_t at = sizeof(savestate::header_t); at < state.size(); at++)
+    {
+        again = state;
+        again[at] ^= 0x80;
+        if (fresh->load_state(state.data(), state.size()) != NES::state_loaded)
+        {
+            return false;
+        }
+        const NES::state_result result = fresh->load_state(again.data(), again.size());
+        if (result == NES::state_loaded)
+        {
+            continue;
+        }
+        fresh->save_state(after.data());
+        if (result != NES::state_corrupt || after != state)
+        {
+            std::printf("%s: flipping bit 7 of byte %zu changed the console without loading\n", board, at);
+            return false;
+        }
+        size_refused |= at == state.size() - 1;
+    }
+    if (!size_refused)
+    {
+        std::printf("%s: a negative scheduler heap size was loaded\n", board);
+        return false;
+    }
+
+    // Another build's layout
+    again = state;
+    again[4]++;
+    if (fresh->load_state(again.data(), again.size()) != NES::state_bad_version ||
+        fresh->load_state(state.data(), state.size() - 1) != NES::state_wrong_cartridge)
+    {
+        std::printf("%s: a bad state was not refused\n", board);
+        return false;
+    }
+
+    const int rounds = 10000;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        nes->save_state(state.data());
+    }
+    const auto saved = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        nes->load_state(state.data(), state.size());
+    }
+    const auto loaded = std::chrono::steady_clock::now();
+    std::printf("%s: %zu byte states, save %.2f us, load %.2f us\n", board, state.size(),
+                std::chrono::duration<double, std::micro>(saved - start).count() / rounds,
+                std::chrono::duration<double, std::micro>(loaded - saved).count() / rounds);
+    return true;
+}
+
+/*
+ * A console whose loads failed runs nothing. One that loads a cartridge after a failed load, over
+ * one it ran before, must be wired to the new board only: given a state of a console that only
+ * ever ran that cartridge, it has to run on the same way.
+ */
+bool check_reload()
+{
+    std::unique_ptr<NES> nes(new NES()), fresh(new NES());
+    nes->reset();
+    if (nes->load(unsupported_path) != NES::unsupported_mapper || nes->run_frame() != 0)
+    {
+        std::printf("a console without a cartridge ran\n");
+        return false;
+    }
+    if (!fixtures::busy_image(4).write(image_path) || nes->load(image_path) != NES::loaded)
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    nes->reset();
+    for (int frame = 0; frame < warmup; frame++)
+    {
+        run_frame(*nes, 0);
+    }
+    if (!fixtures::busy_image(0).write(image_path) || nes->load(unsupported_path) != NES::unsupported_mapper ||
+        nes->load(image_path) != NES::loaded || fresh->load(image_path) != NES::loaded)
+    {
+        std::printf("NROM does not load after a failed load over MMC3\n");
+        return false;
+    }
+    nes->reset();
+    fresh->reset();
+    for (int frame = 0; frame < warmup; frame++)
+    {
+        run_frame(*nes, 0);
+        run_frame(*fresh, 0);
+    }
+    std::vector<uint8_t> state(fresh->getStateSize());
+    fresh->save_state(state.data());
+    if (nes->load_state(state.data(), state.size()) != NES::state_loaded)
+    {
+        std::printf("NROM loaded after MMC3 refuses an NROM state\n");
+        return false;
+    }
+    for (int frame = 0; frame < frames; frame++)
+    {
+        const record got = run_frame(*nes, 0);
+        const record want = run_frame(*fresh, 0);
+        if (got.cycles != want.cycles || got.video != want.video || got.audio != want.audio || got.ram != want.ram)
+        {
+            std::printf("NROM loaded after MMC3: frame %d differs from a console that only ran NROM\n", frame);
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+int main()
+{
+    const uint8_t mappers[] = {0, 4};
+    const char *boards[] = {"NROM", "MMC3"};
+    // MMC5, which no board here implements
+    if (!fixtures::busy_image(5).write(unsupported_path))
+    {
+        std::printf("cannot write %s\n", unsupported_path);
+        return 1;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (!fixtures::busy_image(mappers[i]).write(image_path))
+        {
+            std::printf("cannot write %s\n", image_path);
+            return 1;
+        }
+        const bool same = check(boards[i]);
+        std::remove(image_path);
+        if (!same)
+        {
+            std::remove(unsupported_path);
+            return 1;
+        }
+    }
+    const bool reloaded = check_reload();
+    std::remove(image_path);
+    std::remove(unsupported_path);
+    if (!reloaded)
+    {
+        return 1;
+    }
+
+    // An NROM state on MMC3
+    std::vector<uint8_t> state;
+    {
+        fixtures::busy_image(0).write(image_path);
+        std::unique_ptr<NES> nrom(new NES());
+        nrom->load(image_path);
+        state.resize(nrom->getStateSize());
+        nrom->save_state(state.data());
+    }
+    fixtures::busy_image(4).write(image_path);
+    std::unique_ptr<NES> mmc3(new NES());
+    mmc3->load(image_path);
+    std::remove(image_path);
+    if (mmc3->load_state(state.data(), state.size()) != NES::state_wrong_cartridge)
+    {
+        std::printf("an NROM state loaded on MMC3\n");
+        return 1;
+    }
+    std::printf("Savestates replay the same %d frames on NROM and MMC3\n", frames);
+    return 0;
+}
@@ -0,0 +1,163 @@
+//
+// Runs the busy program from Fixtures.h, which polls $2002, splits the scroll mid-frame, plays
+// the APU and updates VRAM and OAM from its NMI handler, twice: through NES::run_frame, which
+// lets the PPU and APU trail the CPU and catches them up on demand, and with both synced after
+// every instruction. Fails on the first frame where the pictures, RAM or the cycle counts differ.
+// Also times OAM DMA started by writes on even and odd cycles.
+//
+
+#include "../system/NES.h"
+#include "Fixtures.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace
+{
+const int frames = 60;
+const char *image_path = "sync_diff.nes";
+const uint32_t dma_budget = 200000;
+
+// DMA from stores of four and of five cycles, which write on different cycles of the instruction
+const uint8_t dma_code[] = {
+    0xA9, 0x02,       // $8000 LDA #$02
+    0xA2, 0x00,       // $8002 LDX #$00
+    0x9D, 0x14, 0x40, // $8004 STA $4014,X
+    0x8D, 0x14, 0x40, // $8007 STA $4014
+    0x24, 0x00,       // $800A BIT $00
+    0x8D, 0x14, 0x40, // $800D STA $4014
+    0x4C, 0x04, 0x80, // $8010 JMP $8004
+};
+
+bool compare(const char *board)
+{
+    NES trailing, stepped;
+    if (trailing.load(image_path) != NES::loaded || stepped.load(image_path) != NES::loaded)
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    trailing.reset();
+    stepped.reset();
+    // Sprites for the DMA from page 2
+    std::mt19937 rng(2);
+    for (uint16_t address = 0x200; address < 0x300; address++)
+    {
+        nes_byte byte;
+        byte._unsigned = rng();
+        trailing.getMMU().write(address, byte);
+        stepped.getMMU().write(address, byte);
+    }
+    for (int frame = 0; frame < frames; frame++)
+    {
+        trailing.run_frame();
+        const uint64_t count = stepped.getPPU().getFrameCount();
+        while (stepped.getPPU().getFrameCount() == count)
+        {
+            stepped.getCPU().step_n(1);
+            stepped.getPPU().sync(stepped.getCPU().getCycles());
+            stepped.getAPU().sync(stepped.getCPU().getCycles());
+        }
+        const uint8_t *a = trailing.getPPU().getFrame();
+        const uint8_t *b = stepped.getPPU().getFrame();
+        bool ram = true;
+        for (uint16_t address = 0; address < 0x800; address++)
+        {
+            ram &= trailing.getMMU().read(address) == stepped.getMMU().read(address);
+        }
+        if (!ram || !std::equal(a, a + PPU::width * PPU::height, b) ||
+            trailing.getCPU().getCycles() != stepped.getCPU().getCycles())
+        {
+            std::printf("%s frame %d differs, cycles %llu trailing and %llu stepped\n", board, frame,
+                        (unsigned long long)trailing.getCPU().getCycles(),
+                        (unsigned long long)stepped.getCPU().getCycles());
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The halt is 513 cycles, 514 when the write to $4014 lands on an odd cycle. Stores write on
+ * their last cycle, so that is the parity to go by, not the one the instruction started on.
+ */
+bool check_dma()
+{
+    fixtures::RomImage image;
+    image.place(0x8000, dma_code);
+    image.set_vectors(0x8000, 0x8000, 0x8000);
+    NES stepped, running;
+    if (!image.write(image_path) || stepped.load(image_path) != NES::loaded ||
+        running.load(image_path) != NES::loaded)
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    stepped.reset();
+    running.reset();
+    int parities[2] = {0, 0};
+    while (stepped.getCPU().getCycles() < dma_budget)
+    {
+        const uint64_t start = stepped.getCPU().getCycles();
+        const uint8_t opcode = stepped.getMMU().read(stepped.getCPU().getRegisters().PC.value);
+        const uint32_t cycles = stepped.getCPU().step_n(1);
+        if (opcode != 0x8D && opcode != 0x9D)
+        {
+            continue;
+        }
+        // The halt is taken before the next instruction
+        const uint32_t halt = stepped.getCPU().step_n(1);
+        const uint64_t written = start + (opcode == 0x8D ? 3 : 4);
+        const int odd = written & 1;
+        parities[odd]++;
+        if (written != start + cycles - 1 || halt != 513u + odd)
+        {
+            std::printf("OAM DMA written on cycle %llu took %u cycles, expected %u\n", (unsigned long long)written,
+                        halt, 513 + odd);
+            return false;
+        }
+    }
+    // The dispatch backends have to agree with stepping, the JIT included
+    while (running.getCPU().getCycles() < stepped.getCPU().getCycles())
+    {
+        running.getCPU().run_for(uint32_t(stepped.getCPU().getCycles() - running.getCPU().getCycles()));
+    }
+    if (!parities[0] || !parities[1] || running.getCPU().getCycles() != stepped.getCPU().getCycles() ||
+        running.getCPU().getRegisters().PC.value != stepped.getCPU().getRegisters().PC.value)
+    {
+        std::printf("OAM DMA: %d even and %d odd starts, cycles %llu running and %llu stepped\n", parities[0],
+                    parities[1], (unsigned long long)running.getCPU().getCycles(),
+                    (unsigned long long)stepped.getCPU().getCycles());
+        return false;
+    }
+    return true;
+}
+}
+
+int main()
+{
+    const uint8_t mappers[] = {0, 4};
+    const char *boards[] = {"NROM", "MMC3"};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!fixtures::busy_image(mappers[i]).write(image_path))
+        {
+            std::printf("cannot write %s\n", image_path);
+            return 1;
+        }
+        const bool same = compare(boards[i]);
+        std::remove(image_path);
+        if (!same)
+        {
+            return 1;
+        }
+    }
+    const bool dma = check_dma();
+    std::remove(image_path);
+    if (!dma)
+    {
+        return 1;
+    }
+    std::printf("Catch-up and per instruction sync agree over %d frames on NROM and MMC3\n", frames);
+    return 0;
+}
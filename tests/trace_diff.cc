@@ -0,0 +1,258 @@
+//
+// Runs a program on one console with a trace ring attached and steps the same program one
+// instruction at a time on another, the trace must hold every instruction with the registers
+// and cycle the stepped console had before it. Also hammers a ring from a recording thread
+// while another copies it out, checks the nestest layout and the dump file round trip, and
+// reports what tracing costs a frame. Built only with NESACOLA_TRACE.
+//
+
+#include "../system/NES.h"
+#include "../system/Trace.h"
+#include "Fixtures.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const char *image_path = "trace_diff.nes";
+const char *dump_path = "trace_diff.bin";
+const uint32_t budget = 20000;
+
+const uint8_t reset_code[] = {
+    0xA2, 0x00,       // $8000 LDX #$00
+    0xBD, 0xF0, 0x80, // $8002 LDA $80F0,X
+    0x69, 0x07,       // $8005 ADC #$07
+    0x9D, 0x00, 0x02, // $8007 STA $0200,X
+    0x2A,             // $800A ROL A
+    0xE8,             // $800B INX
+    0xD0, 0xF4,       // $800C BNE $8002
+    0xE6, 0x10,       // $800E INC $10
+    0xA4, 0x10,       // $8010 LDY $10
+    0xB1, 0x20,       // $8012 LDA ($20),Y
+    0xE1, 0x20,       // $8014 SBC ($20,X)
+    0x04, 0x44,       // $8016 NOP $44
+    0xA7, 0x10,       // $8018 LAX $10
+    0x20, 0x30, 0x80, // $801A JSR $8030
+    0x4C, 0x00, 0x80, // $801D JMP $8000
+};
+const uint8_t subroutine[] = {
+    0x08, // $8030 PHP
+    0x28, // $8031 PLP
+    0x18, // $8032 CLC
+    0x60, // $8033 RTS
+};
+
+trace::entry_t make_entry(uint16_t pc, uint8_t opcode, uint8_t a, uint8_t x, uint8_t y, uint8_t sp, uint8_t p,
+                          uint32_t cycle)
+{
+    return {pc, opcode, a, x, y, sp, p, cycle};
+}
+
+bool write_image()
+{
+    fixtures::RomImage image;
+    image.place(0x8000, reset_code);
+    image.place(0x8030, subroutine);
+    image.set_vectors(0x8000, 0x8000, 0x8000);
+    return image.write(image_path);
+}
+
+bool check_cpu()
+{
+    std::unique_ptr<NES> traced(new NES()), stepped(new NES());
+    if (traced->load(image_path) != NES::loaded || stepped->load(image_path) != NES::loaded)
+    {
+        std::printf("cannot load %s\n", image_path);
+        return false;
+    }
+    traced->reset();
+    stepped->reset();
+    TraceRing ring(budget);
+    traced->getCPU().attach_trace(&ring);
+    traced->getCPU().run_for(budget);
+    traced->getCPU().attach_trace(nullptr);
+    const std::vector<trace::entry_t> entries = ring.snapshot();
+    if (entries.size() != ring.getRecorded() || entries.size() < budget / 8)
+    {
+        std::printf("%zu of %llu instructions traced\n", entries.size(), (unsigned long long)ring.getRecorded());
+        return false;
+    }
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const registers_t registers = stepped->getCPU().getRegisters();
+        const uint8_t opcode = stepped->getMMU().read(registers.PC.value);
+        const trace::entry_t want =
+            make_entry(registers.PC.value, opcode, registers.AC, registers.X, registers.Y, registers.SP,
+                       flags::pack(registers.sr, false).value, uint32_t(stepped->getCPU().getCycles()));
+        const trace::entry_t &got = entries[i];
+        if (std::memcmp(&got, &want, sizeof(want)) != 0)
+        {
+            char line[128], expected[128];
+            const uint8_t bytes[3] = {got.opcode, 0, 0};
+            trace::format(line, sizeof(line), got, bytes, got.cycle);
+            trace::format(expected, sizeof(expected), want, bytes, want.cycle);
+            std::printf("instruction %zu traced as\n  %s\nstepping gives\n  %s\n", i, line, expected);
+            return false;
+        }
+        stepped->getCPU().step_n(1);
+    }
+    return true;
+}
+
+// A recording thread laps the ring while this one copies it, nothing torn may come out
+bool check_concurrent()
+{
+    const uint32_t count = 2000000;
+    TraceRing ring(1000);
+    if (ring.getCapacity() != 1023)
+    {
+        std::printf("a ring of 1000 holds %zu\n", ring.getCapacity());
+        return false;
+    }
+    std::atomic<bool> done{false};
+    std::thread recorder([&] {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            ring.record(make_entry(uint16_t(i * 7), uint8_t(i), uint8_t(i >> 8), uint8_t(i >> 16), uint8_t(i >> 24),
+                                   uint8_t(~i), uint8_t(i * 3), i));
+        }
+        done = true;
+    });
+    bool torn = false;
+    size_t copies = 0;
+    while (!done && !torn)
+    {
+        const std::vector<trace::entry_t> entries = ring.snapshot();
+        copies++;
+        for (size_t i = 0; i < entries.size() && !torn; i++)
+        {
+            const trace::entry_t &entry = entries[i];
+            const uint32_t n = entry.cycle;
+            torn = entry.pc != uint16_t(n * 7) || entry.opcode != uint8_t(n) || entry.a != uint8_t(n >> 8) ||
+                   entry.x != uint8_t(n >> 16) || entry.y != uint8_t(n >> 24) || entry.sp != uint8_t(~n) ||
+                   entry.p != uint8_t(n * 3) || (i && n != entries[i - 1].cycle + 1);
+        }
+    }
+    recorder.join();
+    const std::vector<trace::entry_t> last = ring.snapshot();
+    if (torn || last.size() != ring.getCapacity() || last.back().cycle != count - 1)
+    {
+        std::printf("a copy taken while recording is torn or out of order after %zu copies\n", copies);
+        return false;
+    }
+    return true;
+}
+
+bool check_format()
+{
+    const struct
+    {
+        trace::entry_t entry;
+        uint8_t bytes[3];
+        uint64_t cycle;
+        const char *line;
+    } lines[] = {
+        {make_entry(0xC000, 0x4C, 0x00, 0x00, 0x00, 0xFD, 0x24, 7),
+         {0x4C, 0xF5, 0xC5},
+         7,
+         "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7"},
+        {make_entry(0xC72A, 0x08, 0xFF, 0x00, 0x00, 0xFB, 0x6F, 0),
+         {0x08},
+         100000,
+         "C72A  08        PHP                             A:FF X:00 Y:00 P:6F SP:FB CYC:100000"},
+        {make_entry(0xC6BD, 0x04, 0xAA, 0x97, 0x4E, 0xF5, 0xEF, 0),
+         {0x04, 0xA9},
+         0,
+         "C6BD  04 A9    *NOP $A9                         A:AA X:97 Y:4E P:EF SP:F5 CYC:0"},
+        {make_entry(0xD0F0, 0xD0, 0x00, 0x00, 0x00, 0xFD, 0x24, 0),
+         {0xD0, 0xFE},
+         0,
+         "D0F0  D0 FE     BNE $D0F0                       A:00 X:00 Y:00 P:24 SP:FD CYC:0"},
+        {make_entry(0xE000, 0xB1, 0x00, 0x00, 0x00, 0xFD, 0x24, 0),
+         {0xB1, 0x89},
+         0,
+         "E000  B1 89     LDA ($89),Y                     A:00 X:00 Y:00 P:24 SP:FD CYC:0"},
+        {make_entry(0xE000, 0xEB, 0x00, 0x00, 0x00, 0xFD, 0x24, 0),
+         {0xEB, 0x40},
+         0,
+         "E000  EB 40    *SBC #$40                        A:00 X:00 Y:00 P:24 SP:FD CYC:0"},
+    };
+    for (const auto &line : lines)
+    {
+        char got[128];
+        trace::format(got, sizeof(got), line.entry, line.bytes, line.cycle);
+        if (std::strcmp(got, line.line) != 0)
+        {
+            std::printf("formatted as\n  %s\ninstead of\n  %s\n", got, line.line);
+            return false;
+        }
+    }
+    std::vector<trace::entry_t> written, read;
+    for (const auto &line : lines)
+    {
+        written.push_back(line.entry);
+    }
+    const bool saved = trace::write(dump_path, written);
+    const bool loaded = trace::read(dump_path, read);
+    std::remove(dump_path);
+    if (!saved || !loaded || read.size() != written.size() ||
+        std::memcmp(read.data(), written.data(), written.size() * sizeof(trace::entry_t)) != 0)
+    {
+        std::printf("the dump does not survive %s\n", dump_path);
+        return false;
+    }
+    return true;
+}
+
+// Seconds to run frames with the picture on, traced or not
+double time_frames(bool traced)
+{
+    std::unique_ptr<NES> nes(new NES());
+    nes->load(image_path);
+    nes->reset();
+    nes_byte mask;
+    mask._unsigned = 0x1E;
+    nes->getMMU().write(0x2001, mask);
+    TraceRing ring(1024);
+    if (traced)
+    {
+        nes->getCPU().attach_trace(&ring);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < 300; frame++)
+    {
+        nes->run_frame();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+int main()
+{
+    if (!write_image())
+    {
+        std::printf("cannot write %s\n", image_path);
+        return 1;
+    }
+    const bool same = check_cpu() && check_concurrent() && check_format();
+    if (same)
+    {
+        // Best of five each, the ring only costs a store per instruction
+        double plain = 1e9, traced = 1e9;
+        for (int round = 0; round < 5; round++)
+        {
+            plain = std::min(plain, time_frames(false));
+            traced = std::min(traced, time_frames(true));
+        }
+        std::printf("Traces match stepping, 300 frames in %.1f ms untraced and %.1f ms traced (%+.1f%%)\n",
+                    plain * 1000, traced * 1000, (traced / plain - 1) * 100);
+    }
+    std::remove(image_path);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#ifndef _WORK_STEALING_POOL_
+#define _WORK_STEALING_POOL_
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs a fixed set of independent tasks on worker threads. Each worker starts with its own
+ * contiguous share of the task indices and takes from the back of it; a worker that runs dry
+ * steals from the front of another's, so long tasks do not leave the other cores idle. Tasks
+ * never add tasks, a worker that finds every queue empty is done.
+ */
+class WorkStealingPool
+{
+public:
+    // 0 uses one worker per hardware thread
+    explicit WorkStealingPool(unsigned threads)
+    {
+        if (threads == 0)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        workers = threads ? threads : 1;
+    }
+
+    unsigned getWorkers() const
+    {
+        return workers;
+    }
+
+    /*
+     * Calls task(i) once for every i in [0, count) and returns when all have returned.
+     */
+    template <typename Task>
+    void run(size_t count, const Task &task)
+    {
+        std::vector<queue> queues(workers);
+        for (unsigned worker = 0; worker < workers; worker++)
+        {
+            for (size_t i = count * worker / workers; i < count * (worker + 1) / workers; i++)
+            {
+                queues[worker].tasks.push_back(i);
+            }
+        }
+        std::vector<std::thread> threads;
+        for (unsigned worker = 1; worker < workers; worker++)
+        {
+            threads.emplace_back([&, worker] { work(queues, worker, task); });
+        }
+        work(queues, 0, task);
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+private:
+    unsigned workers;
+
+    // Cache line sized so workers taking from their own queue do not contend
+    struct alignas(64) queue
+    {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    static bool take(queue &from, bool back, size_t &index)
+    {
+        std::lock_guard<std::mutex> guard(from.lock);
+        if (from.tasks.empty())
+        {
+            return false;
+        }
+        if (back)
+        {
+            index = from.tasks.back();
+            from.tasks.pop_back();
+        }
+        else
+        {
+            index = from.tasks.front();
+            from.tasks.pop_front();
+        }
+        return true;
+    }
+
+    template <typename Task>
+    static void work(std::vector<queue> &queues, unsigned self, const Task &task)
+    {
+        const size_t count = queues.size();
+        for (;;)
+        {
+            size_t index;
+            bool found = take(queues[self], true, index);
+            for (size_t offset = 1; !found && offset < count; offset++)
+            {
+                found = take(queues[(self + offset) % count], false, index);
+            }
+            if (!found)
+            {
+                return;
+            }
+            task(index);
+        }
+    }
+};
+#endif
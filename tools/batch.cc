@@ -0,0 +1,166 @@
+//
+// Headless batch runner. Reads jobs from a file, one per line as "rom.nes frames [movie]", and
+// runs each on its own NES instance on a work stealing pool. Instances share nothing but the
+// read only ROM pages. A movie drives the controllers from power on. Prints one line per job,
+// in file order, with the CPU cycles spent and hashes of the last frame and of all the audio,
+// so runs can be compared between builds. Only the last frame is drawn.
+//
+//   nesacola_batch jobs.txt [threads]
+//
+
+#include "WorkStealingPool.h"
+#include "system/Hash.h"
+#include "system/Movie.h"
+#include "system/NES.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct job
+{
+    std::string rom;
+    uint32_t frames = 0;
+    // Empty for no input
+    std::string movie;
+};
+
+struct outcome
+{
+    NES::load_result loaded = NES::bad_image;
+    bool movie = true;
+    uint64_t cycles = 0;
+    uint64_t video = 0;
+    uint64_t audio = 0;
+};
+
+bool read_jobs(const char *path, std::vector<job> &jobs)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line))
+    {
+        number++;
+        std::istringstream fields(line);
+        job next;
+        if (!(fields >> next.rom))
+        {
+            // Blank line
+            continue;
+        }
+        if (next.rom[0] == '#')
+        {
+            continue;
+        }
+        if (!(fields >> next.frames))
+        {
+            std::fprintf(stderr, "%s:%d: expected \"rom.nes frames [movie]\"\n", path, number);
+            return false;
+        }
+        fields >> next.movie;
+        jobs.push_back(next);
+    }
+    return true;
+}
+
+outcome run(const job &work)
+{
+    outcome result;
+    // Heap allocated, an instance is too large for comfort on a worker's stack
+    std::unique_ptr<NES> nes(new NES());
+    result.loaded = nes->load(work.rom.c_str());
+    if (result.loaded != NES::loaded)
+    {
+        return result;
+    }
+    Movie movie;
+    if (!work.movie.empty() && !movie.load(work.movie.c_str()))
+    {
+        result.movie = false;
+        return result;
+    }
+    nes->reset();
+    // Frames before the last one are not looked at
+    nes->getPPU().set_frame_output(false);
+    result.audio = fnv_basis;
+    int16_t samples[4096];
+    for (uint32_t frame = 0; frame < work.frames; frame++)
+    {
+        if (frame + 1 == work.frames)
+        {
+            nes->getPPU().set_frame_output(true);
+        }
+        movie.apply(*nes, frame);
+        result.cycles += nes->run_frame();
+        const size_t count = nes->getAPU().read_samples(samples, sizeof(samples) / sizeof(samples[0]));
+        result.audio = fnv1a(samples, count * sizeof(samples[0]), result.audio);
+    }
+    result.video = fnv1a(nes->getPPU().getFrame(), PPU::width * PPU::height);
+    return result;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s jobs.txt [threads]\n", argv[0]);
+        return 1;
+    }
+    std::vector<job> jobs;
+    if (!read_jobs(argv[1], jobs))
+    {
+        std::fprintf(stderr, "%s: cannot read the job list\n", argv[1]);
+        return 1;
+    }
+    WorkStealingPool pool(argc > 2 ? unsigned(std::atoi(argv[2])) : 0);
+    // Each job only writes its own slot
+    std::vector<outcome> outcomes(jobs.size());
+    const auto start = std::chrono::steady_clock::now();
+    pool.run(jobs.size(), [&](size_t i) { outcomes[i] = run(jobs[i]); });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool failed = false;
+    uint64_t frames = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const outcome &result = outcomes[i];
+        switch (result.loaded)
+        {
+        case NES::bad_image:
+            std::printf("%s: not an iNES or NES 2.0 image\n", jobs[i].rom.c_str());
+            failed = true;
+            continue;
+        case NES::unsupported_mapper:
+            std::printf("%s: mapper not supported\n", jobs[i].rom.c_str());
+            failed = true;
+            continue;
+        case NES::loaded:
+            break;
+        }
+        if (!result.movie)
+        {
+            std::printf("%s: cannot read the movie %s\n", jobs[i].rom.c_str(), jobs[i].movie.c_str());
+            failed = true;
+            continue;
+        }
+        frames += jobs[i].frames;
+        std::printf("%s frames=%u cycles=%llu video=%016llx audio=%016llx\n", jobs[i].rom.c_str(), jobs[i].frames,
+                    (unsigned long long)result.cycles, (unsigned long long)result.video,
+                    (unsigned long long)result.audio);
+    }
+    std::fprintf(stderr, "%zu jobs, %llu frames in %.2f s on %u threads, %.0f frames/s\n", jobs.size(),
+                 (unsigned long long)frames, seconds, pool.getWorkers(), frames / seconds);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+//
+// Prints a trace dumped from a TraceRing in the layout of nestest.log, one instruction per line,
+// so it can be diffed against another emulator's log or another build's trace. The operand bytes
+// come from the ROM with its banks as they are at power on, code run from RAM or from banks
+// switched in later shows what is there instead. CPU cycles are unwrapped from the 32 bits kept.
+//
+//   nesacola_trace trace.bin rom.nes
+//
+
+#include "../system/Cartridge.h"
+#include "../system/Mapper.h"
+#include "../system/MMU.h"
+#include "../system/Trace.h"
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "usage: %s trace.bin rom.nes\n", argv[0]);
+        return 1;
+    }
+    std::vector<trace::entry_t> entries;
+    if (!trace::read(argv[1], entries))
+    {
+        std::fprintf(stderr, "%s: not a trace\n", argv[1]);
+        return 1;
+    }
+    Cartridge cartridge;
+    if (!cartridge.load(argv[2]))
+    {
+        std::fprintf(stderr, "%s: not an iNES or NES 2.0 image\n", argv[2]);
+        return 1;
+    }
+    std::unique_ptr<MMU> mmu(new MMU());
+    std::unique_ptr<Mapper> mapper = Mapper::create(cartridge, *mmu);
+    if (!mapper)
+    {
+        std::fprintf(stderr, "%s: mapper %d is not supported\n", argv[2], cartridge.getHeader().mapper);
+        return 1;
+    }
+    mapper->reset();
+
+    uint64_t cycle = entries.empty() ? 0 : entries[0].cycle;
+    char line[128];
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const trace::entry_t &entry = entries[i];
+        if (i)
+        {
+            cycle += uint32_t(entry.cycle - entries[i - 1].cycle);
+        }
+        uint8_t bytes[3];
+        for (int b = 0; b < 3; b++)
+        {
+            bytes[b] = mmu->read(uint16_t(entry.pc + b));
+        }
+        // The opcode is the one that ran even where the ROM says otherwise
+        bytes[0] = entry.opcode;
+        trace::format(line, sizeof(line), entry, bytes, cycle);
+        std::puts(line);
+    }
+    return 0;
+}